@@ -0,0 +1,84 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Bump allocator. Objects are carved out of large blocks and all of them are released
+// together when the arena is reset or destroyed, so nothing allocated here may need a destructor.
+class Arena {
+private:
+    std::vector<std::unique_ptr<char[]>> blocks;
+    size_t block_size;
+    char* cursor;
+    size_t remaining;
+
+    void grow(size_t min_size) {
+        size_t size = min_size > block_size ? min_size : block_size;
+        blocks.emplace_back(new char[size]);
+        cursor = blocks.back().get();
+        remaining = size;
+    }
+
+public:
+    explicit Arena(size_t block_size = 64 * 1024)
+        : block_size(block_size), cursor(nullptr), remaining(0) {}
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void* allocate(size_t size, size_t align) {
+        size_t pad = (align - (reinterpret_cast<uintptr_t>(cursor) & (align - 1))) & (align - 1);
+        if (cursor == nullptr || pad + size > remaining) {
+            grow(size + align);
+            pad = (align - (reinterpret_cast<uintptr_t>(cursor) & (align - 1))) & (align - 1);
+        }
+        char* p = cursor + pad;
+        cursor = p + size;
+        remaining -= pad + size;
+        return p;
+    }
+
+    template <typename T, typename... Args>
+    T* make(Args&&... args) {
+        static_assert(std::is_trivially_destructible<T>::value, "arena objects are never destroyed");
+        return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+
+    // Copies text into the arena so it outlives the buffer it came from
+    std::string_view copy(std::string_view text) {
+        if (text.empty()) return std::string_view();
+        char* p = static_cast<char*>(allocate(text.size(), 1));
+        std::memcpy(p, text.data(), text.size());
+        return std::string_view(p, text.size());
+    }
+
+    // Frees everything in one shot, the first block is kept for reuse
+    void reset() {
+        if (blocks.empty()) return;
+        blocks.resize(1);
+        cursor = blocks.front().get();
+        remaining = block_size;
+    }
+
+    // Takes over the blocks of other, what was allocated there lives as long as this arena
+    void adopt(Arena& other) {
+        for (std::unique_ptr<char[]>& block : other.blocks) blocks.push_back(std::move(block));
+        other.blocks.clear();
+        other.cursor = nullptr;
+        other.remaining = 0;
+    }
+
+    size_t bytes_reserved() const {
+        return blocks.size() * block_size;
+    }
+};
+
+#endif // ARENA_H
@@ -0,0 +1,233 @@
+#ifndef AST_H
+#define AST_H
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#include "types.h"
+
+// Typed syntax tree. Every node is allocated in the compilation unit's Arena (arena.h),
+// names are string_views into the source or into the arena, so the tree owns no heap memory.
+// Every name also carries its interned id (intern.h), which is what the passes index their state by.
+
+enum class ExprKind : uint8_t { Constant, Variable, Binary, Call };
+// The comparisons yield 1 or 0
+enum class BinaryOp : uint8_t { Add, Sub, Mul, Div, Lt, Le, Gt, Ge, Eq, Ne };
+
+inline const char* binary_op_symbol(BinaryOp op) {
+    switch (op) {
+        case BinaryOp::Add: return "+";
+        case BinaryOp::Sub: return "-";
+        case BinaryOp::Mul: return "*";
+        case BinaryOp::Div: return "/";
+        case BinaryOp::Lt: return "<";
+        case BinaryOp::Le: return "<=";
+        case BinaryOp::Gt: return ">";
+        case BinaryOp::Ge: return ">=";
+        case BinaryOp::Eq: return "==";
+        case BinaryOp::Ne: return "!=";
+    }
+    return "?";
+}
+
+inline bool is_comparison(BinaryOp op) { return op >= BinaryOp::Lt; }
+
+struct Expr {
+    ExprKind kind;
+    uint16_t reg_need;       // Sethi–Ullman label, filled in by label_register_need() (regalloc.h)
+    uint32_t value_number;   // equal numbers compute equal values, filled in by ValueNumbering (valnum.h)
+    uint32_t line;
+    uint32_t column;
+
+    Expr(ExprKind kind, uint32_t line, uint32_t column)
+        : kind(kind), reg_need(1), value_number(0), line(line), column(column) {}
+};
+
+struct ConstantExpr : Expr {
+    int32_t value;
+
+    ConstantExpr(int32_t value, uint32_t line, uint32_t column)
+        : Expr(ExprKind::Constant, line, column), value(value) {}
+};
+
+struct VariableExpr : Expr {
+    std::string_view name;
+    uint32_t symbol;
+
+    VariableExpr(std::string_view name, uint32_t symbol, uint32_t line, uint32_t column)
+        : Expr(ExprKind::Variable, line, column), name(name), symbol(symbol) {}
+};
+
+struct BinaryExpr : Expr {
+    BinaryOp op;
+    Expr* lhs;
+    Expr* rhs;
+
+    BinaryExpr(BinaryOp op, Expr* lhs, Expr* rhs, uint32_t line, uint32_t column)
+        : Expr(ExprKind::Binary, line, column), op(op), lhs(lhs), rhs(rhs) {}
+};
+
+// name ( [ <expr> { , <expr> } ] )
+struct CallExpr : Expr {
+    std::string_view name;
+    uint32_t symbol;
+    Expr** arguments;  // in the arena
+    uint32_t count;
+
+    CallExpr(std::string_view name, uint32_t symbol, Expr** arguments, uint32_t count, uint32_t line, uint32_t column)
+        : Expr(ExprKind::Call, line, column), name(name), symbol(symbol), arguments(arguments), count(count) {}
+};
+
+enum class StmtKind : uint8_t { Declaration, Assignment, Return, Error, If, While, Block, Function };
+
+struct Stmt {
+    StmtKind kind;
+    uint32_t line;
+
+    Stmt(StmtKind kind, uint32_t line) : kind(kind), line(line) {}
+};
+
+// int a;  or  int a = <expr>;  (or another of the types in types.h)
+struct DeclarationStmt : Stmt {
+    std::string_view name;
+    uint32_t symbol;
+    ValueType type;
+    Expr* init;        // nullptr without initializer
+    bool store_init;   // false when the initial value is never read (deadstore.h)
+    bool needs_slot;   // false when the variable is never read at all
+
+    DeclarationStmt(std::string_view name, uint32_t symbol, ValueType type, Expr* init, uint32_t line)
+        : Stmt(StmtKind::Declaration, line), name(name), symbol(symbol), type(type), init(init), store_init(true),
+          needs_slot(true) {}
+};
+
+// a = <expr>;
+struct AssignmentStmt : Stmt {
+    std::string_view name;
+    uint32_t symbol;
+    Expr* value;
+
+    AssignmentStmt(std::string_view name, uint32_t symbol, Expr* value, uint32_t line)
+        : Stmt(StmtKind::Assignment, line), name(name), symbol(symbol), value(value) {}
+};
+
+// return;  or  return <expr>;
+struct ReturnStmt : Stmt {
+    Expr* value;  // nullptr for a bare return
+
+    ReturnStmt(Expr* value, uint32_t line) : Stmt(StmtKind::Return, line), value(value) {}
+};
+
+// A statement the parser could not make sense of, kept in place so the diagnostic
+// shows up at the right position of the output
+struct ErrorStmt : Stmt {
+    std::string_view message;
+
+    ErrorStmt(std::string_view message, uint32_t line) : Stmt(StmtKind::Error, line), message(message) {}
+};
+
+// if ( <expr> ) <statement>  [ else <statement> ]
+struct IfStmt : Stmt {
+    Expr* condition;
+    Stmt* then_branch;
+    Stmt* else_branch;  // nullptr without else
+
+    IfStmt(Expr* condition, Stmt* then_branch, Stmt* else_branch, uint32_t line)
+        : Stmt(StmtKind::If, line), condition(condition), then_branch(then_branch), else_branch(else_branch) {}
+};
+
+// while ( <expr> ) <statement>
+struct WhileStmt : Stmt {
+    Expr* condition;
+    Stmt* body;
+
+    WhileStmt(Expr* condition, Stmt* body, uint32_t line) : Stmt(StmtKind::While, line), condition(condition), body(body) {}
+};
+
+// { <statement>... }  Blocks only group statements, they open no scope of their own.
+struct BlockStmt : Stmt {
+    Stmt** statements;  // in the arena
+    uint32_t count;
+
+    BlockStmt(Stmt** statements, uint32_t count, uint32_t line)
+        : Stmt(StmtKind::Block, line), statements(statements), count(count) {}
+};
+
+// type name ( [ type name { , type name } ] ) { <statement>... }  Only at the top level. The
+// parameters are declarations without initializer, numbered from 0 in $a0-$a3 and the stack.
+struct FunctionStmt : Stmt {
+    std::string_view name;
+    uint32_t symbol;
+    ValueType type;                 // of the result
+    DeclarationStmt** parameters;   // in the arena
+    uint32_t count;
+    BlockStmt* body;
+
+    FunctionStmt(std::string_view name, uint32_t symbol, ValueType type, DeclarationStmt** parameters, uint32_t count,
+                 BlockStmt* body, uint32_t line)
+        : Stmt(StmtKind::Function, line), name(name), symbol(symbol), type(type), parameters(parameters), count(count),
+          body(body) {}
+};
+
+// The statements in source order; the top-level ones outside of functions are the body of main.
+// Control flow, comparisons, functions and calls only compile through the IR (lower.h), the
+// straight-line passes and the statement code generator never see them.
+struct Program {
+    std::vector<Stmt*> statements;
+    uint32_t symbols = 0;       // number of interned names, every symbol id is below it
+    bool control_flow = false;  // an if, while, block, comparison, function or call appears somewhere
+};
+
+// Debug output of a parsed expression, nested operations are parenthesised
+template <typename Out>
+void print_infix(Out& out, const Expr* expr, bool nested = false) {
+    switch (expr->kind) {
+        case ExprKind::Constant:
+            out << static_cast<const ConstantExpr*>(expr)->value;
+            break;
+        case ExprKind::Variable:
+            out << static_cast<const VariableExpr*>(expr)->name;
+            break;
+        case ExprKind::Binary: {
+            auto* bin = static_cast<const BinaryExpr*>(expr);
+            if (nested) out << "( ";
+            print_infix(out, bin->lhs, true);
+            out << " " << binary_op_symbol(bin->op) << " ";
+            print_infix(out, bin->rhs, true);
+            if (nested) out << " )";
+            break;
+        }
+        case ExprKind::Call: {
+            auto* call = static_cast<const CallExpr*>(expr);
+            out << call->name << '(';
+            for (uint32_t i = 0; i < call->count; ++i) {
+                if (i != 0) out << ", ";
+                print_infix(out, call->arguments[i]);
+            }
+            out << ')';
+            break;
+        }
+    }
+}
+
+// Debug output of a parsed expression in postfix order (the order code is generated in)
+template <typename Out>
+void print_postfix(Out& out, const Expr* expr) {
+    if (expr->kind == ExprKind::Binary) {
+        auto* bin = static_cast<const BinaryExpr*>(expr);
+        print_postfix(out, bin->lhs);
+        print_postfix(out, bin->rhs);
+        out << binary_op_symbol(bin->op) << " ";
+    } else if (expr->kind == ExprKind::Call) {
+        // The arguments, then the call
+        auto* call = static_cast<const CallExpr*>(expr);
+        for (uint32_t i = 0; i < call->count; ++i) print_postfix(out, call->arguments[i]);
+        out << call->name << "() ";
+    } else {
+        print_infix(out, expr);
+        out << " ";
+    }
+}
+
+#endif // AST_H
@@ -0,0 +1,439 @@
+#include <iostream>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <initializer_list>
+#include <string>
+#include <vector>
+
+#include <chrono>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Compiler throughput benchmark. Generates a program of the requested shape, compiles it several
+// times with compilerlab1 --time-passes and writes wall time, lines per second, peak RSS and the
+// per-phase times (medians over the runs) as JSON, so numbers can be compared across versions.
+// Every value of the program is a compile-time constant, so it is compiled once more with
+// --no-constant-folding for the code generator to have the whole program to work on.
+
+struct ProgramShape {
+    int declarations = 100;
+    int statements = 10000;
+    int depth = 4;    // operator levels of every expression
+    int nesting = 0;  // redundant parentheses around every right-hand side
+    uint64_t seed = 1;
+};
+
+// Deterministic on every platform, unlike the standard distributions
+class Random {
+private:
+    uint64_t state;
+
+public:
+    explicit Random(uint64_t seed) : state(seed * 0x9E3779B97F4A7C15ull + 1) {}
+
+    uint64_t next() {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
+    }
+
+    int below(int n) { return (int)(next() % (uint64_t)n); }
+};
+
+class ProgramGenerator {
+private:
+    const ProgramShape& shape;
+    Random random;
+    std::string out;
+
+    void variable(int index) {
+        out += 'v';
+        out += std::to_string(index);
+    }
+
+    void leaf(bool divisor) {
+        if (!divisor && random.below(2) == 0) {
+            variable(random.below(shape.declarations));
+        } else {
+            out += std::to_string(1 + random.below(divisor ? 9 : 99));
+        }
+    }
+
+    // The first operand always goes down to depth 0, the others stop early now and then. A divisor
+    // is a nonzero literal or ( e * 0 + k ), k nonzero, whatever e evaluates to.
+    void expression(int depth, bool full, bool divisor) {
+        if (depth == 0 || (!full && random.below(4) == 0)) {
+            leaf(divisor);
+            return;
+        }
+        if (divisor) {
+            out += "( ";
+            expression(depth, full, false);
+            out += " * 0 + ";
+            out += std::to_string(1 + random.below(9));
+            out += " )";
+            return;
+        }
+        static const char ops[] = {'+', '-', '*', '/'};
+        char op = ops[random.below(4)];
+        out += "( ";
+        expression(depth - 1, full, false);
+        out += ' ';
+        out += op;
+        out += ' ';
+        expression(depth - 1, false, op == '/');
+        out += " )";
+    }
+
+    void right_hand_side() {
+        for (int i = 0; i < shape.nesting; ++i) out += "( ";
+        expression(shape.depth, true, false);
+        for (int i = 0; i < shape.nesting; ++i) out += " )";
+    }
+
+public:
+    size_t lines = 0;
+
+    explicit ProgramGenerator(const ProgramShape& shape) : shape(shape), random(shape.seed) {}
+
+    std::string generate() {
+        for (int i = 0; i < shape.declarations; ++i) {
+            out += "int ";
+            variable(i);
+            if (random.below(2) == 0) {
+                out += " = ";
+                out += std::to_string(random.below(100));
+            }
+            out += " ;\n";
+        }
+        for (int i = 0; i < shape.statements; ++i) {
+            variable(random.below(shape.declarations));
+            out += " = ";
+            right_hand_side();
+            out += " ;\n";
+        }
+        out += "return ";
+        right_hand_side();
+        out += " ;\n";
+        lines = (size_t)shape.declarations + (size_t)shape.statements + 1;
+        return std::move(out);
+    }
+};
+
+struct PhaseTime {
+    std::string name;
+    std::vector<double> seconds;  // one per run
+};
+
+struct RunResult {
+    double seconds = 0;
+    long peak_rss_kb = 0;
+};
+
+// Runs the compiler with stdout discarded and stderr captured, false when it cannot be run or fails
+static bool run_compiler(const std::vector<std::string>& args, RunResult& result, std::string& errors) {
+    int pipe_fds[2];
+    if (pipe(pipe_fds) != 0) return false;
+    auto start = std::chrono::steady_clock::now();
+    pid_t pid = fork();
+    if (pid < 0) return false;
+    if (pid == 0) {
+        int null_fd = open("/dev/null", O_WRONLY);
+        dup2(null_fd, STDOUT_FILENO);
+        dup2(pipe_fds[1], STDERR_FILENO);
+        close(pipe_fds[0]);
+        std::vector<char*> argv;
+        for (const std::string& arg : args) argv.push_back(const_cast<char*>(arg.c_str()));
+        argv.push_back(nullptr);
+        execvp(argv[0], argv.data());
+        std::perror(argv[0]);
+        _exit(127);
+    }
+    close(pipe_fds[1]);
+    errors.clear();
+    char chunk[4096];
+    ssize_t n;
+    while ((n = read(pipe_fds[0], chunk, sizeof(chunk))) > 0) errors.append(chunk, (size_t)n);
+    close(pipe_fds[0]);
+
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) != pid) return false;
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    result.peak_rss_kb = usage.ru_maxrss;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+// Picks the "name seconds percent" lines of the --time-passes report out of the compiler's stderr
+static void collect_phases(const std::string& errors, std::vector<PhaseTime>& phases) {
+    size_t at = errors.find("phase ");
+    while (at != std::string::npos && at < errors.size()) {
+        size_t end = errors.find('\n', at);
+        if (end == std::string::npos) end = errors.size();
+        std::string line = errors.substr(at, end - at);
+        at = end + 1;
+        char name[64];
+        double seconds;
+        if (std::sscanf(line.c_str(), "%63s %lf", name, &seconds) != 2) continue;  // the header
+        if (std::strcmp(name, "total") == 0) break;
+        auto it = std::find_if(phases.begin(), phases.end(), [&](const PhaseTime& p) { return p.name == name; });
+        if (it == phases.end()) it = phases.insert(phases.end(), PhaseTime{name, {}});
+        it->seconds.push_back(seconds);
+    }
+}
+
+static double median(std::vector<double> values) {
+    if (values.empty()) return 0;
+    std::sort(values.begin(), values.end());
+    size_t mid = values.size() / 2;
+    return values.size() % 2 ? values[mid] : (values[mid - 1] + values[mid]) / 2;
+}
+
+struct Measurement {
+    std::vector<double> wall;
+    std::vector<PhaseTime> phases;
+    long peak_rss_kb = 0;
+    std::string errors;  // stderr of the last run
+
+    // Median seconds of the named phases together, 0 for phases the runs did not have
+    double phase_seconds(std::initializer_list<const char*> names) const {
+        double sum = 0;
+        for (const PhaseTime& phase : phases) {
+            for (const char* name : names) {
+                if (phase.name == name) sum += median(phase.seconds);
+            }
+        }
+        return sum;
+    }
+};
+
+// The compiler reports errors in the program as "# Error: ..." comments of its output, and succeeds
+static std::string output_errors(const std::string& path) {
+    std::string errors;
+    std::FILE* file = std::fopen(path.c_str(), "rb");
+    if (file == nullptr) return "Cannot read " + path + "\n";
+    char line[4096];
+    while (std::fgets(line, sizeof(line), file) != nullptr) {
+        if (std::strncmp(line, "# Error:", 8) == 0) errors += line;
+    }
+    std::fclose(file);
+    return errors;
+}
+
+// Compiles the program runs times, false when a run fails
+static bool measure(const std::vector<std::string>& args, int runs, Measurement& m) {
+    for (int run = 0; run < runs; ++run) {
+        RunResult result;
+        if (!run_compiler(args, result, m.errors)) return false;
+        m.wall.push_back(result.seconds);
+        m.peak_rss_kb = std::max(m.peak_rss_kb, result.peak_rss_kb);
+        collect_phases(m.errors, m.phases);
+    }
+    return true;
+}
+
+static std::string json_string(const std::string& text) {
+    std::string out = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') out += '\\';
+        if ((unsigned char)c < 0x20) {
+            char escaped[8];
+            std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out += escaped;
+        } else {
+            out += c;
+        }
+    }
+    return out + "\"";
+}
+
+static std::string json_number(double value) {
+    char text[32];
+    std::snprintf(text, sizeof(text), "%.6g", value);
+    return text;
+}
+
+static bool parse_count(const char* text, int& value) {
+    char* end;
+    long n = std::strtol(text, &end, 10);
+    if (*text == '\0' || *end != '\0' || n < 0 || n > 100000000) return false;
+    value = (int)n;
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    const char* usage = " [--compiler <path>] [--declarations N] [--statements N] [--depth N] [--nesting N]"
+                        " [--seed N] [--runs N] [--scaling] [--keep <program.c>] [-o <result.json>] [-- <compiler flags>...]";
+    ProgramShape shape;
+    std::string compiler = "./compilerlab1";
+    std::string keep_path;    // where the generated program is kept
+    std::string json_path;    // stdout when empty
+    int runs = 5;
+    bool scaling = false;     // also time --parse-threads 1/2/4/8
+    std::vector<std::string> compiler_flags;
+
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        bool has_value = i + 1 < argc;
+        int seed;
+        if (std::strcmp(arg, "--") == 0) {
+            for (++i; i < argc; ++i) compiler_flags.push_back(argv[i]);
+        } else if (std::strcmp(arg, "--compiler") == 0 && has_value) {
+            compiler = argv[++i];
+        } else if (std::strcmp(arg, "--declarations") == 0 && has_value && parse_count(argv[i + 1], shape.declarations)) {
+            ++i;
+        } else if (std::strcmp(arg, "--statements") == 0 && has_value && parse_count(argv[i + 1], shape.statements)) {
+            ++i;
+        } else if (std::strcmp(arg, "--depth") == 0 && has_value && parse_count(argv[i + 1], shape.depth)) {
+            ++i;
+        } else if (std::strcmp(arg, "--nesting") == 0 && has_value && parse_count(argv[i + 1], shape.nesting)) {
+            ++i;
+        } else if (std::strcmp(arg, "--seed") == 0 && has_value && parse_count(argv[i + 1], seed)) {
+            shape.seed = (uint64_t)seed;
+            ++i;
+        } else if (std::strcmp(arg, "--runs") == 0 && has_value && parse_count(argv[i + 1], runs) && runs > 0) {
+            ++i;
+        } else if (std::strcmp(arg, "--scaling") == 0) {
+            scaling = true;
+        } else if (std::strcmp(arg, "--keep") == 0 && has_value) {
+            keep_path = argv[++i];
+        } else if (std::strcmp(arg, "-o") == 0 && has_value) {
+            json_path = argv[++i];
+        } else {
+            std::cerr << "Error: Invalid argument '" << arg << "'." << std::endl;
+            std::cerr << "Usage: " << argv[0] << usage << std::endl;
+            return 1;
+        }
+    }
+    if (shape.declarations == 0) {
+        std::cerr << "Error: --declarations must be at least 1.\n";
+        return 1;
+    }
+
+    ProgramGenerator generator(shape);
+    std::string program = generator.generate();
+
+    std::string program_path = keep_path;
+    if (program_path.empty()) {
+        char name[] = "/tmp/compilerlab1-benchXXXXXX.c";
+        int fd = mkstemps(name, 2);
+        if (fd < 0) {
+            std::perror("mkstemps");
+            return 1;
+        }
+        close(fd);
+        program_path = name;
+    }
+    std::FILE* file = std::fopen(program_path.c_str(), "wb");
+    if (file == nullptr || std::fwrite(program.data(), 1, program.size(), file) != program.size() || std::fclose(file) != 0) {
+        std::cerr << "Error: Could not write " << program_path << "\n";
+        return 1;
+    }
+    std::string output_path = program_path + ".s";
+
+    std::vector<std::string> args = {compiler, program_path, "-o", output_path, "--time-passes"};
+    args.insert(args.end(), compiler_flags.begin(), compiler_flags.end());
+
+    Measurement main_run;
+    bool ok = measure(args, runs, main_run);
+    std::string errors = main_run.errors;
+    if (ok) {
+        errors = output_errors(output_path);
+        ok = errors.empty();
+    }
+
+    // The same program without constant folding, unless the flags already turn it off
+    bool unfolded = std::find(compiler_flags.begin(), compiler_flags.end(), "--no-constant-folding") == compiler_flags.end();
+    Measurement unfolded_run;
+    if (unfolded && ok) {
+        std::vector<std::string> unfolded_args = args;
+        unfolded_args.push_back("--no-constant-folding");
+        ok = measure(unfolded_args, runs, unfolded_run);
+        errors = ok ? output_errors(output_path) : unfolded_run.errors;
+        ok = ok && errors.empty();
+    }
+
+    // --scaling: the same program with the front end on 1, 2, 4 and 8 threads
+    const int scaling_threads[] = {1, 2, 4, 8};
+    std::vector<Measurement> scaling_runs;
+    for (int threads : scaling_threads) {
+        if (!scaling || !ok) break;
+        std::vector<std::string> scaled = args;
+        scaled.push_back("--parse-threads");
+        scaled.push_back(std::to_string(threads));
+        scaling_runs.emplace_back();
+        ok = measure(scaled, runs, scaling_runs.back());
+        errors = scaling_runs.back().errors;
+    }
+    if (keep_path.empty()) std::remove(program_path.c_str());
+    std::remove(output_path.c_str());
+    if (!ok) {
+        std::cerr << "Error: " << compiler << " failed:\n" << errors;
+        return 1;
+    }
+    const std::vector<double>& wall = main_run.wall;
+    const std::vector<PhaseTime>& phases = main_run.phases;
+    long peak_rss_kb = main_run.peak_rss_kb;
+
+    double median_wall = median(wall);
+    std::string json = "{\n";
+    json += "  \"compiler\": " + json_string(compiler) + ",\n";
+    json += "  \"flags\": [";
+    for (size_t i = 0; i < compiler_flags.size(); ++i) json += (i ? ", " : "") + json_string(compiler_flags[i]);
+    json += "],\n";
+    json += "  \"program\": {\"declarations\": " + std::to_string(shape.declarations) +
+            ", \"statements\": " + std::to_string(shape.statements) +
+            ", \"depth\": " + std::to_string(shape.depth) +
+            ", \"nesting\": " + std::to_string(shape.nesting) +
+            ", \"seed\": " + std::to_string(shape.seed) +
+            ", \"lines\": " + std::to_string(generator.lines) +
+            ", \"bytes\": " + std::to_string(program.size()) + "},\n";
+    json += "  \"runs\": " + std::to_string(runs) + ",\n";
+    json += "  \"wall_seconds\": {\"min\": " + json_number(*std::min_element(wall.begin(), wall.end())) +
+            ", \"median\": " + json_number(median_wall) +
+            ", \"max\": " + json_number(*std::max_element(wall.begin(), wall.end())) + "},\n";
+    json += "  \"lines_per_second\": " + json_number(median_wall > 0 ? generator.lines / median_wall : 0) + ",\n";
+    json += "  \"peak_rss_kb\": " + std::to_string(peak_rss_kb) + ",\n";
+    json += "  \"phases\": {";
+    for (size_t i = 0; i < phases.size(); ++i) {
+        json += (i ? ", " : "") + json_string(phases[i].name) + ": " + json_number(median(phases[i].seconds));
+    }
+    json += "}";
+    if (unfolded) {
+        double unfolded_wall = median(unfolded_run.wall);
+        json += ",\n  \"unfolded\": {\"wall_median\": " + json_number(unfolded_wall) +
+                ", \"lines_per_second\": " + json_number(unfolded_wall > 0 ? generator.lines / unfolded_wall : 0) +
+                ", \"peak_rss_kb\": " + std::to_string(unfolded_run.peak_rss_kb) + "}";
+    }
+    if (scaling) {
+        // Front end: lex and parse of the serial path, lex+parse of the parallel one
+        double serial_front_end = scaling_runs[0].phase_seconds({"lex", "parse", "lex+parse"});
+        json += ",\n  \"scaling\": [";
+        for (size_t i = 0; i < scaling_runs.size(); ++i) {
+            double front_end = scaling_runs[i].phase_seconds({"lex", "parse", "lex+parse"});
+            json += std::string(i ? ",\n    " : "\n    ") + "{\"threads\": " + std::to_string(scaling_threads[i]) +
+                    ", \"wall_median\": " + json_number(median(scaling_runs[i].wall)) +
+                    ", \"front_end\": " + json_number(front_end) +
+                    ", \"speedup\": " + json_number(front_end > 0 ? serial_front_end / front_end : 0) + "}";
+        }
+        json += "\n  ]";
+    }
+    json += "\n}\n";
+
+    if (json_path.empty()) {
+        std::cout << json;
+        return 0;
+    }
+    file = std::fopen(json_path.c_str(), "wb");
+    if (file == nullptr || std::fwrite(json.data(), 1, json.size(), file) != json.size() || std::fclose(file) != 0) {
+        std::cerr << "Error: Could not write " << json_path << "\n";
+        return 1;
+    }
+    return 0;
+}
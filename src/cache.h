@@ -0,0 +1,171 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "hash.h"
+
+// On-disk cache of generated assembly, keyed by the hash of the source bytes, the compiler
+// version and the options that change the output. Entries are "<key>.s" files in one directory.
+// Several compiler processes can share it: an entry is written to a private temporary file and
+// renamed into place, so readers only ever see complete entries, and eviction (oldest access
+// first, hits refresh the modification time) runs under an flock on "<dir>/lock" by one
+// process at a time. A failing cache operation is never an error, the unit is just compiled.
+class CompilationCache {
+private:
+    std::string directory;
+    uint64_t max_bytes;
+    std::atomic<uint64_t> stored_bytes{0};  // written by this process since the last eviction scan
+    std::atomic<uint64_t> known_bytes{0};   // directory size at the last scan
+    std::atomic<uint64_t> temp_counter{0};
+
+    std::string entry_path(const std::string& key) const { return directory + "/" + key + ".s"; }
+
+    // Copies the file at path to out, false on any read or write error
+    static bool copy_to(const std::string& path, std::FILE* out) {
+        std::FILE* in = std::fopen(path.c_str(), "rb");
+        if (in == nullptr) return false;
+        char chunk[1 << 16];
+        size_t n;
+        bool ok = true;
+        while (ok && (n = std::fread(chunk, 1, sizeof(chunk), in)) > 0) {
+            ok = std::fwrite(chunk, 1, n, out) == n;
+        }
+        ok = ok && !std::ferror(in);
+        std::fclose(in);
+        return ok;
+    }
+
+    static bool copy_to(const std::string& path, const std::string& destination, bool to_stdout) {
+        if (to_stdout) return copy_to(path, stdout) && std::fflush(stdout) == 0;
+        std::FILE* out = std::fopen(destination.c_str(), "wb");
+        if (out == nullptr) return false;
+        bool ok = copy_to(path, out);
+        return std::fclose(out) == 0 && ok;
+    }
+
+    // Deletes the least recently used entries until the directory fits in max_bytes
+    void evict() {
+        std::string lock_path = directory + "/lock";
+        int lock = ::open(lock_path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (lock < 0) return;
+        if (flock(lock, LOCK_EX | LOCK_NB) != 0) {  // another process is already at it
+            ::close(lock);
+            return;
+        }
+        struct Entry {
+            std::string path;
+            int64_t accessed;
+            uint64_t size;
+        };
+        std::vector<Entry> entries;
+        uint64_t total = 0;
+        if (DIR* dir = opendir(directory.c_str())) {
+            while (dirent* item = readdir(dir)) {
+                std::string_view name = item->d_name;
+                bool temporary = name.substr(0, 4) == "tmp.";
+                if (!temporary && (name.size() != 34 || name.substr(32) != ".s")) continue;
+                std::string path = directory + "/" + item->d_name;
+                struct stat st;
+                if (stat(path.c_str(), &st) != 0) continue;
+                if (temporary) {
+                    // Left behind by a process that died while compiling
+                    if (st.st_mtime + 3600 < ::time(nullptr)) ::unlink(path.c_str());
+                    continue;
+                }
+                entries.push_back(Entry{path, (int64_t)st.st_mtime * 1000000000 + st.st_mtim.tv_nsec, (uint64_t)st.st_size});
+                total += (uint64_t)st.st_size;
+            }
+            closedir(dir);
+        }
+        if (total > max_bytes) {
+            std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.accessed < b.accessed; });
+            for (const Entry& entry : entries) {
+                if (total <= max_bytes - max_bytes / 4) break;  // leave some room so not every store scans
+                if (::unlink(entry.path.c_str()) == 0 || errno == ENOENT) {
+                    total -= entry.size;
+                    ++evictions;
+                }
+            }
+        }
+        known_bytes = total;
+        stored_bytes = 0;
+        flock(lock, LOCK_UN);
+        ::close(lock);
+    }
+
+public:
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> misses{0};
+    std::atomic<uint64_t> evictions{0};
+
+    CompilationCache(std::string directory, uint64_t max_bytes)
+        : directory(std::move(directory)), max_bytes(max_bytes), known_bytes(UINT64_MAX) {}
+
+    // Creates the directory if needed, false when it cannot be used
+    bool open() {
+        if (::mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST) return false;
+        return ::access(directory.c_str(), R_OK | W_OK | X_OK) == 0;
+    }
+
+    static std::string key(std::string_view version, std::string_view options, std::string_view source) {
+        Hash128 hash;
+        hash.add(version);
+        hash.add(options);
+        hash.add(source);
+        return hash.hex();
+    }
+
+    // Copies the cached assembly to the destination, false on a miss
+    bool fetch(const std::string& key, const std::string& destination, bool to_stdout) {
+        std::string path = entry_path(key);
+        if (!copy_to(path, destination, to_stdout)) {
+            ++misses;
+            return false;
+        }
+        ::utimensat(AT_FDCWD, path.c_str(), nullptr, 0);  // now, for the LRU order
+        ++hits;
+        return true;
+    }
+
+    // Unique file in the cache directory the compiler writes a missed unit to
+    std::string temporary_path() {
+        return directory + "/tmp." + std::to_string(::getpid()) + "." + std::to_string(temp_counter++);
+    }
+
+    // Delivers the freshly compiled temporary file to the destination and keeps it as the entry for key
+    bool store(const std::string& key, const std::string& temporary, const std::string& destination, bool to_stdout) {
+        bool delivered = copy_to(temporary, destination, to_stdout);
+        struct stat st;
+        uint64_t size = ::stat(temporary.c_str(), &st) == 0 ? (uint64_t)st.st_size : 0;
+        if (!delivered || std::rename(temporary.c_str(), entry_path(key).c_str()) != 0) {
+            ::unlink(temporary.c_str());
+            return delivered;
+        }
+        stored_bytes += size;
+        if (known_bytes == UINT64_MAX || known_bytes + stored_bytes > max_bytes) evict();
+        return true;
+    }
+
+    // The unit failed to compile, nothing is kept
+    void discard(const std::string& temporary) {
+        ::unlink(temporary.c_str());
+    }
+};
+
+#endif // CACHE_H
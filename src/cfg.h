@@ -0,0 +1,200 @@
+#ifndef CFG_H
+#define CFG_H
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "ir.h"
+
+// Basic blocks of an IrFunction (ir.h) with their edges, reverse postorder and dominators. The
+// graph indexes into the code as it was when built, a pass that adds or removes instructions
+// builds it again afterwards.
+
+struct IrBlock {
+    uint32_t begin = 0;                  // instructions [begin, end)
+    uint32_t end = 0;
+    std::vector<uint32_t> predecessors;  // in block order, which is the order of the Phi arguments
+    std::vector<uint32_t> successors;
+    bool exits = false;                  // control falls off the end of the code after it
+    uint32_t idom = ir_none;             // immediate dominator, the entry's is itself; ir_none when unreachable
+};
+
+class ControlFlowGraph {
+private:
+    std::vector<uint32_t> enter;  // dominator tree: preorder number of each block
+    std::vector<uint32_t> leave;  // and the largest number below it
+
+    void build_blocks(const IrFunction& function) {
+        const std::vector<IrInstr>& code = function.code;
+        label_block.assign(function.labels, ir_none);
+        block_of.resize(code.size());
+        for (uint32_t i = 0; i < code.size(); ++i) {
+            bool starts = i == 0 || code[i].op == IrOp::Label || code[i - 1].op == IrOp::Jump ||
+                          code[i - 1].op == IrOp::Branch;
+            if (starts) {
+                if (!blocks.empty()) blocks.back().end = i;
+                blocks.emplace_back();
+                blocks.back().begin = i;
+            }
+            block_of[i] = (uint32_t)blocks.size() - 1;
+            if (code[i].op == IrOp::Label) label_block[code[i].target] = (uint32_t)blocks.size() - 1;
+        }
+        if (blocks.empty()) blocks.emplace_back();  // empty code: one empty block
+        blocks.back().end = (uint32_t)code.size();
+
+        for (uint32_t b = 0; b < blocks.size(); ++b) {
+            IrBlock& block = blocks[b];
+            const IrInstr* last = block.end > block.begin ? &code[block.end - 1] : nullptr;
+            uint32_t next = b + 1 < blocks.size() ? b + 1 : ir_none;
+            if (last != nullptr && last->op == IrOp::Jump) {
+                block.successors.push_back(label_block[last->target]);
+                continue;
+            }
+            if (next == ir_none) {
+                block.exits = true;
+            } else {
+                block.successors.push_back(next);
+            }
+            if (last != nullptr && last->op == IrOp::Branch && label_block[last->target] != next) {
+                block.successors.push_back(label_block[last->target]);
+            }
+        }
+        for (uint32_t b = 0; b < blocks.size(); ++b) {
+            for (uint32_t s : blocks[b].successors) blocks[s].predecessors.push_back(b);
+        }
+    }
+
+    void build_order() {
+        std::vector<uint32_t> postorder;
+        std::vector<bool> visited(blocks.size(), false);
+        std::vector<std::pair<uint32_t, uint32_t>> stack;  // block, next successor to visit
+        stack.push_back({0, 0});
+        visited[0] = true;
+        while (!stack.empty()) {
+            auto& [b, next] = stack.back();
+            if (next < blocks[b].successors.size()) {
+                uint32_t s = blocks[b].successors[next++];
+                if (!visited[s]) {
+                    visited[s] = true;
+                    stack.push_back({s, 0});
+                }
+                continue;
+            }
+            postorder.push_back(b);
+            stack.pop_back();
+        }
+        order.assign(postorder.rbegin(), postorder.rend());
+    }
+
+    // Cooper, Harvey and Kennedy: iterate over the reverse postorder until the immediate
+    // dominators settle, two candidates meet at their common ancestor
+    void build_dominators() {
+        std::vector<uint32_t> number(blocks.size(), ir_none);
+        for (uint32_t i = 0; i < order.size(); ++i) number[order[i]] = i;
+        auto intersect = [&](uint32_t a, uint32_t b) {
+            while (a != b) {
+                while (number[a] > number[b]) a = blocks[a].idom;
+                while (number[b] > number[a]) b = blocks[b].idom;
+            }
+            return a;
+        };
+        blocks[0].idom = 0;
+        for (bool changed = true; changed;) {
+            changed = false;
+            for (uint32_t i = 1; i < order.size(); ++i) {
+                IrBlock& block = blocks[order[i]];
+                uint32_t idom = ir_none;
+                for (uint32_t p : block.predecessors) {
+                    if (blocks[p].idom == ir_none) continue;
+                    idom = idom == ir_none ? p : intersect(p, idom);
+                }
+                if (block.idom != idom) {
+                    block.idom = idom;
+                    changed = true;
+                }
+            }
+        }
+
+        // Number the dominator tree so that dominance is two comparisons
+        child_begin.assign(blocks.size() + 1, 0);
+        for (uint32_t b : order) {
+            if (b != 0) ++child_begin[blocks[b].idom + 1];
+        }
+        for (uint32_t b = 0; b < blocks.size(); ++b) child_begin[b + 1] += child_begin[b];
+        children.resize(order.size());
+        std::vector<uint32_t> fill(child_begin.begin(), child_begin.end() - 1);
+        for (uint32_t b : order) {
+            if (b != 0) children[fill[blocks[b].idom]++] = b;
+        }
+        enter.assign(blocks.size(), ir_none);
+        leave.assign(blocks.size(), 0);
+        uint32_t counter = 0;
+        std::vector<std::pair<uint32_t, uint32_t>> stack;  // block, next child
+        stack.push_back({0, child_begin[0]});
+        enter[0] = counter++;
+        while (!stack.empty()) {
+            auto& [b, next] = stack.back();
+            if (next < child_begin[b + 1]) {
+                uint32_t child = children[next++];
+                enter[child] = counter++;
+                stack.push_back({child, child_begin[child]});
+                continue;
+            }
+            leave[b] = counter - 1;
+            stack.pop_back();
+        }
+    }
+
+public:
+    std::vector<IrBlock> blocks;        // in code order, the entry first
+    std::vector<uint32_t> block_of;     // by instruction
+    std::vector<uint32_t> label_block;  // by label number
+    std::vector<uint32_t> order;        // the reachable blocks in reverse postorder
+    // Dominator tree: the blocks b immediately dominates are children[child_begin[b] .. child_begin[b + 1])
+    std::vector<uint32_t> child_begin;
+    std::vector<uint32_t> children;
+
+    explicit ControlFlowGraph(const IrFunction& function) {
+        build_blocks(function);
+        build_order();
+        build_dominators();
+    }
+
+    bool reachable(uint32_t block) const { return blocks[block].idom != ir_none; }
+
+    // True when every path from the entry to b passes a (every block dominates itself)
+    bool dominates(uint32_t a, uint32_t b) const {
+        return reachable(a) && reachable(b) && enter[a] <= enter[b] && leave[b] <= leave[a];
+    }
+
+    // Position of predecessor among block's predecessors, the index of its Phi arguments
+    uint32_t predecessor_index(uint32_t block, uint32_t predecessor) const {
+        const std::vector<uint32_t>& list = blocks[block].predecessors;
+        for (uint32_t i = 0; i < list.size(); ++i) {
+            if (list[i] == predecessor) return i;
+        }
+        return ir_none;
+    }
+};
+
+// Drops the code no path from the entry reaches, except the notes in it: its diagnostics are still
+// reported. Only before the ssa pass, Phis would keep arguments of the removed predecessors.
+inline size_t remove_unreachable(IrFunction& function) {
+    if (function.straight_line) return 0;
+    ControlFlowGraph cfg(function);
+    size_t removed = 0;
+    for (uint32_t b = 0; b < cfg.blocks.size(); ++b) {
+        if (cfg.reachable(b)) continue;
+        for (uint32_t i = cfg.blocks[b].begin; i < cfg.blocks[b].end; ++i) {
+            IrInstr& in = function.code[i];
+            if (in.op == IrOp::Note || in.op == IrOp::Nop) continue;
+            in.op = IrOp::Nop;
+            ++removed;
+        }
+    }
+    if (removed != 0) function.rebuild();
+    return removed;
+}
+
+#endif // CFG_H
@@ -1,107 +1,139 @@
 #include <iostream>
 #include <fstream>
-#include <regex>
 #include <string>
 #include <vector>
 #include <unordered_map>
 #include <stack>
 
-// Symbol Table to manage variable declarations and offsets
+#include "lexer.h"
+
+// Symbol Table to manage variable declarations and offsets, a flat array indexed by the
+// interned symbol id of the name (intern.h)
 class SymbolTable {
 public:
-    std::unordered_map<std::string, int> table;
+    std::vector<int> offsets;  // -1 while the name is not declared
 
-    bool add_variable(const std::string& var_name, int& stack_offset) {
-        if (table.find(var_name) != table.end()) {
+    bool add_variable(uint32_t symbol, int& stack_offset) {
+        if (get_offset(symbol) != -1) {
             return false;
         }
+        if (symbol >= offsets.size()) offsets.resize(symbol + 1, -1);
         stack_offset -= 4;  // Increment for the next variable
-        table[var_name] = stack_offset;
+        offsets[symbol] = stack_offset;
         return true;
     }
 
-    int get_offset(const std::string& var_name) {
-        return table.count(var_name) ? table[var_name] : -1;
+    // -1 for undeclared names and for pieces that are no name (Interner::none)
+    int get_offset(uint32_t symbol) const {
+        return symbol < offsets.size() ? offsets[symbol] : -1;
     }
 };
 
-std::regex var_decl_regex(R"(int\s+(\w+)\s*(?:=\s*(\d+))?;)");
-std::regex assign_regex(R"((\w+)\s*=\s*(\d+);)");
-std::regex op_regex(R"((\w+)\s*=\s*(.+);)");
-std::regex return_regex(R"(return\s*(\w+)?\s*;)");
 std::stack<std::string> free_temps;
 
-std::string process_expression(const std::string& expr, SymbolTable& symbol_table, 
-                               std::ostream& outFile, int& temp_var_count, 
+// One piece of an expression being rewritten: a lexed token or a temp variable standing in for a group
+struct ExprPiece {
+    TokenKind kind;
+    std::string text;
+    uint32_t symbol;  // interned name, Interner::none for constants and operators
+};
+
+// Joins pieces back into text with single spaces (used for keys and for the returned expression)
+std::string join_pieces(std::vector<ExprPiece>::const_iterator first, std::vector<ExprPiece>::const_iterator last) {
+    std::string text;
+    for (auto it = first; it != last; ++it) {
+        if (!text.empty()) text += ' ';
+        text += it->text;
+    }
+    return text;
+}
+
+std::string process_expression(const Token* first, const Token* last, std::string_view src, Interner& interner,
+                               SymbolTable& symbol_table, std::ostream& outFile, int& temp_var_count, 
                                int& stack_offset, std::stack<std::string>& free_temps) {
-    std::stack<int> paren_stack;
-    std::unordered_map<int, int> matching_paren;
-    std::string processed_expr = expr;
+    std::vector<ExprPiece> pieces;
 
     // Check for mismatched parentheses
-    for (size_t i = 0; i < expr.size(); ++i) {
-        if (expr[i] == '(') {
-            paren_stack.push(i);
-        } else if (expr[i] == ')') {
-            if (!paren_stack.empty()) {
-                matching_paren[paren_stack.top()] = i;
-                paren_stack.pop();
-            } else {
+    int depth = 0;
+    for (const Token* tok = first; tok != last; ++tok) {
+        if (tok->kind == TokenKind::LParen) {
+            ++depth;
+        } else if (tok->kind == TokenKind::RParen) {
+            if (depth == 0) {
                 outFile << "# Error: Mismatched parentheses.\n";
                 return "";
             }
+            --depth;
         }
+        pieces.push_back({tok->kind, std::string(tok->text(src)), tok->symbol});
     }
 
-    if (!paren_stack.empty()) {
+    if (depth != 0) {
         outFile << "# Error: Unmatched opening parenthesis.\n";
         return "";
     }
 
     // Replace sub-expressions (e.g., (a + b)) with temp variables
-    std::regex sub_expr_regex(R"(\(([^()]+)\))");
-    std::smatch match;
-    std::unordered_map<std::string, std::string> subexpr_replacements;
+    struct SubExpr {
+        std::string temp_var;
+        uint32_t temp_symbol;
+        std::vector<ExprPiece> inner;
+    };
+    std::unordered_map<std::string, SubExpr> subexpr_replacements;
     std::vector<std::string> used_temps;
 
-    // Replace sub-expressions with temporary variables
-    while (std::regex_search(processed_expr, match, sub_expr_regex)) {
-        std::string inner_expr = match[1].str();
+    // Replace innermost groups with temporary variables: the first ')' closes an innermost group
+    for (;;) {
+        size_t close = 0;
+        while (close < pieces.size() && pieces[close].kind != TokenKind::RParen) ++close;
+        if (close == pieces.size()) break;
+        size_t open = close;
+        while (pieces[open].kind != TokenKind::LParen) --open;
+        if (close == open + 1) break;  // empty group
+        std::string inner_expr = join_pieces(pieces.begin() + open + 1, pieces.begin() + close);
         std::string temp_var;
+        uint32_t temp_symbol;
 
         // Get a temporary variable to store the result of the sub-expression
         if (!free_temps.empty()) {
             temp_var = free_temps.top();
             free_temps.pop();
+            temp_symbol = interner.intern(temp_var);
         } else {
             temp_var = "temp" + std::to_string(temp_var_count++);
             outFile << "# Saved temp var " << temp_var << " for parenthesis purposes\n";
-            if (!symbol_table.add_variable(temp_var, stack_offset)) {
+            temp_symbol = interner.intern(temp_var);
+            if (!symbol_table.add_variable(temp_symbol, stack_offset)) {
                 outFile << "# Error: Failed to register temporary variable: " << temp_var << "\n";
                 return "";
             }
         }
 
-        subexpr_replacements[inner_expr] = temp_var;
+        SubExpr& sub = subexpr_replacements[inner_expr];
+        sub.temp_var = temp_var;
+        sub.temp_symbol = temp_symbol;
+        sub.inner.assign(pieces.begin() + open + 1, pieces.begin() + close);
         used_temps.push_back(temp_var);
-        processed_expr.replace(match.position(), match.length(), temp_var);
+        pieces.erase(pieces.begin() + open + 1, pieces.begin() + close + 1);
+        pieces[open] = {TokenKind::Identifier, temp_var, temp_symbol};
     }
 
     // Process the subexpressions
-    for (const auto& [subexpr, temp_var] : subexpr_replacements) {
-        std::smatch op_match;
-        std::regex op_extract(R"((\w+)\s*([+\-*/])\s*(\w+))");
+    for (const auto& [subexpr, sub] : subexpr_replacements) {
+        const std::string& temp_var = sub.temp_var;
+        auto is_word = [](TokenKind kind) { return kind == TokenKind::Identifier || kind == TokenKind::Number; };
 
         // Process operations like a + b, a - b, etc.
-        if (std::regex_match(subexpr, op_match, op_extract)) {
-            std::string operand1 = op_match[1];
-            std::string op = op_match[2];
-            std::string operand2 = op_match[3];
+        if (sub.inner.size() == 3 && is_word(sub.inner[0].kind) && is_operator_token(sub.inner[1].kind) &&
+            is_word(sub.inner[2].kind)) {
+            const std::string& operand1 = sub.inner[0].text;
+            const std::string& op = sub.inner[1].text;
+            const std::string& operand2 = sub.inner[2].text;
 
             // Look up the offsets of the operands in the symbol table
-            int offset1 = symbol_table.get_offset(operand1);
-            int offset2 = symbol_table.get_offset(operand2);
-            int temp_offset = symbol_table.get_offset(temp_var);
+            int offset1 = symbol_table.get_offset(sub.inner[0].symbol);
+            int offset2 = symbol_table.get_offset(sub.inner[2].symbol);
+            int temp_offset = symbol_table.get_offset(sub.temp_symbol);
 
             if (offset1 == -1 || offset2 == -1 || temp_offset == -1) {
                 outFile << "# Error: Undefined variable in subexpression.\n";
@@ -133,21 +165,36 @@ std::string process_expression(const std::string& expr, SymbolTable& symbol_tabl
     }
 
     // Return the processed expression with temporary variables replaced
-    return processed_expr;
+    return join_pieces(pieces.begin(), pieces.end());
 }
 
-void process_line(const std::string& line, SymbolTable& symbol_table, 
-                  int& stack_offset, std::ofstream& outFile, 
+// Statements are classified by the shape of their token stream, the same tokens feed process_expression
+void process_line(const std::string& line, uint32_t line_no, std::vector<Token>& tokens, Interner& interner,
+                  SymbolTable& symbol_table, int& stack_offset, std::ofstream& outFile, 
                   int& temp_var_count, std::stack<std::string>& free_temps) {
 	
-	std::smatch matches;
+    Lexer(line, line_no, &interner).tokenize(tokens);
+    const size_t count = tokens.size() - 1;  // without the End token
+    auto kind_at = [&](size_t i) { return i < count ? tokens[i].kind : TokenKind::End; };
+    auto text_at = [&](size_t i) { return tokens[i].text(line); };
+
+    for (size_t i = 0; i < count; ++i) {
+        if (tokens[i].kind == TokenKind::Invalid) {
+            outFile << "# Error: Unexpected character '" << text_at(i) << "' at line " << tokens[i].line
+                    << ", column " << tokens[i].column << ".\n";
+            return;
+        }
+    }
 	
-	if (std::regex_match(line, matches, var_decl_regex)) {
-        std::string var_name = matches[1];
-        int value = matches[2].matched ? std::stoi(matches[2].str()) : 0;
+    if (kind_at(0) == TokenKind::KwInt && kind_at(1) == TokenKind::Identifier &&
+        ((count == 3 && kind_at(2) == TokenKind::Semicolon) ||
+         (count == 5 && kind_at(2) == TokenKind::Assign && kind_at(3) == TokenKind::Number &&
+          kind_at(4) == TokenKind::Semicolon))) {
+        std::string var_name(text_at(1));
+        int value = count == 5 ? std::stoi(std::string(text_at(3))) : 0;
 
         // Add the variable to the symbol table with the current stack offset
-        if (!symbol_table.add_variable(var_name, stack_offset)) {
+        if (!symbol_table.add_variable(tokens[1].symbol, stack_offset)) {
             outFile << "# Error: Variable '" << var_name << "' already declared.\n";
             return;
         }
@@ -163,11 +210,12 @@ void process_line(const std::string& line, SymbolTable& symbol_table,
     }
     
     // Assignment
-    else if (std::regex_match(line, matches, assign_regex)) {
-        std::string var_name = matches[1];
-        int value = std::stoi(matches[2]);
+    else if (count == 4 && kind_at(0) == TokenKind::Identifier && kind_at(1) == TokenKind::Assign &&
+             kind_at(2) == TokenKind::Number && kind_at(3) == TokenKind::Semicolon) {
+        std::string var_name(text_at(0));
+        int value = std::stoi(std::string(text_at(2)));
 
-        int offset = symbol_table.get_offset(var_name);
+        int offset = symbol_table.get_offset(tokens[0].symbol);
         if (offset == -1) {
             outFile << "# Error: Variable '" << var_name << "' not declared.\n";
             return;
@@ -178,10 +226,13 @@ void process_line(const std::string& line, SymbolTable& symbol_table,
     }
     
     // Return statement
-    else if (std::regex_match(line, matches, return_regex)) {
-        if (matches[1].matched) {
-            std::string var_name = matches[1];
-            int offset = symbol_table.get_offset(var_name);
+    else if (kind_at(0) == TokenKind::KwReturn &&
+             ((count == 2 && kind_at(1) == TokenKind::Semicolon) ||
+              (count == 3 && (kind_at(1) == TokenKind::Identifier || kind_at(1) == TokenKind::Number) &&
+               kind_at(2) == TokenKind::Semicolon))) {
+        if (count == 3) {
+            std::string var_name(text_at(1));
+            int offset = symbol_table.get_offset(tokens[1].symbol);
             if (offset == -1) {
                 outFile << "# Error: Variable '" << var_name << "' not declared.\n";
                 return;
@@ -195,22 +246,32 @@ void process_line(const std::string& line, SymbolTable& symbol_table,
     }
     
 	// Arithmetic operations
-	else if (line.find('=') != std::string::npos) {
-		size_t eq_pos = line.find('=');
-		std::string var_name = line.substr(0, eq_pos);
-		var_name.erase(var_name.find_last_not_of(" ")+1); // Trim spaces
-		std::string expr = line.substr(eq_pos + 1);
-		expr.erase(0, expr.find_first_not_of(" ")); // Trim spaces
-		expr.pop_back(); // Remove ending semicolon
+	else {
+		size_t eq_pos = 0;
+		while (eq_pos < count && tokens[eq_pos].kind != TokenKind::Assign) ++eq_pos;
+		if (eq_pos == count) {
+		    return;  // Not a statement we know about
+		}
+		std::string var_name;
+		uint32_t var_symbol = eq_pos == 1 ? tokens[0].symbol : Interner::none;  // a single name
+		if (eq_pos > 0) {
+		    const Token& last = tokens[eq_pos - 1];
+		    var_name = line.substr(tokens[0].offset, last.offset + last.length - tokens[0].offset);
+		}
+		size_t expr_end = count;
+		if (expr_end > eq_pos + 1 && tokens[expr_end - 1].kind == TokenKind::Semicolon) {
+		    --expr_end; // Drop ending semicolon
+		}
 
 		// Process the expression and get the result register
-		std::string processed_expr = process_expression(expr, symbol_table, outFile, temp_var_count, stack_offset, free_temps);
+		std::string processed_expr = process_expression(tokens.data() + eq_pos + 1, tokens.data() + expr_end, line,
+		                                                interner, symbol_table, outFile, temp_var_count, stack_offset, free_temps);
 		if (processed_expr.empty()) {
 		    return;  // If there's an error in processing the expression, return early
 		}
 
 		// Get the offset for the variable where the result will be stored
-		int offset = symbol_table.get_offset(var_name);
+		int offset = symbol_table.get_offset(var_symbol);
 		if (offset == -1) {
 		    outFile << "# Error: Variable '" << var_name << "' not declared.\n";
 		    return;
@@ -244,9 +305,12 @@ int main() {
 
     int stack_offset = 0, temp_var_count = 0;
     SymbolTable symbol_table;
+    Interner interner;  // copies the names, lines are dropped once processed
 
+    std::vector<Token> tokens;  // reused for every line
+    uint32_t line_no = 0;
     for (std::string line; std::getline(input_file, line); ) {
-        process_line(line, symbol_table, stack_offset, outFile, temp_var_count, free_temps);
+        process_line(line, ++line_no, tokens, interner, symbol_table, stack_offset, outFile, temp_var_count, free_temps);
     }
     outFile << "move $a0, $v0 # ֵ$v0Ƶ$a0ΪӡϵͳõĲ\n";
 	outFile << "li $v0, 1 # ϵͳúΪ 1ӡ\n";
@@ -1,133 +1,133 @@
 #include <iostream>
 #include <fstream>
-#include <regex>
+#include <sstream>
 #include <string>
 #include <vector>
-#include <unordered_map>
 #include <stack>
 
+#include "lexer.h"
+
 // Symbol Table to manage variable declarations and offsets, only works with int
 // TODO: Make it work for all variable sizes. Padding needed?
+// Names are interned by the lexer (intern.h), so the table is a flat array indexed by symbol id.
 class SymbolTable {
 private:
     int next_offset;  // Tracks the next available memory offset
+    std::vector<int> offsets;  // by symbol id, -1 while the name is not declared
 
 public:
-    std::unordered_map<std::string, int> table;
-
     SymbolTable() : next_offset(-4) {} // Initialize memory allocation
 
-	// dict addition, assume always int sized (change for future multiple type variations)
-    bool add_variable(const std::string& var_name) {
-        if (table.find(var_name) != table.end()) {
+	// array slot per name, assume always int sized (change for future multiple type variations)
+    bool add_variable(uint32_t symbol) {
+        if (get_offset(symbol) != -1) {
             return false; // Variable already exists
         }
-        table[var_name] = next_offset;
+        if (symbol >= offsets.size()) offsets.resize(symbol + 1, -1);
+        offsets[symbol] = next_offset;
         next_offset -= 4; // Move stack downward (MIPS convention)
         return true;
     }
 
-	// dict hash o(1) speed lookup
-    int get_offset(const std::string& var_name) const {
-        auto it = table.find(var_name);
-        return (it != table.end()) ? it->second : -1;
+	// plain array index, -1 for undeclared names and for tokens that are no name (Interner::none)
+    int get_offset(uint32_t symbol) const {
+        return symbol < offsets.size() ? offsets[symbol] : -1;
     }
 };
 
-std::regex var_decl_regex(R"(int\s+(\w+)\s*(?:=\s*(\d+))?\s*;)");
-std::regex assign_regex(R"((\w+)\s*=\s*(\d+);)");
-std::regex op_regex(R"((\w+)\s*=\s*(.+);)");
-std::regex return_regex(R"(return\s*(\w+)?\s*;)");
 std::stack<int> free_temps;
 
-int precedence(char op) {
-    if (op == '+' || op == '-') return 1;
-    if (op == '*' || op == '/') return 2;
+int precedence(TokenKind op) {
+    if (op == TokenKind::Plus || op == TokenKind::Minus) return 1;
+    if (op == TokenKind::Star || op == TokenKind::Slash) return 2;
     return 0;
 }
 
-bool is_operator(char c) {
-    return (c == '+' || c == '-' || c == '*' || c == '/');
-}
-
 // Djikstra's Yard-shunt Algorithm (Because fuck parenthesis nesting and operator orders
-std::string infix_to_postfix(const std::string& infix_expr) {
-    std::stack<char> operator_stack;
-    std::string postfix_expr;
-    std::string token;
-	
-	std::cout << "Infix: " << infix_expr << std::endl;
-    for (size_t i = 0; i < infix_expr.size(); ++i) {
-        char c = infix_expr[i];
-
-        if (std::isalnum(c)) {  // Operand (variable or constant)
-            token += c;
-            if (i + 1 < infix_expr.size() && std::isalnum(infix_expr[i + 1])) {
-                continue;  // Continue building multi-character tokens
-            }
-            postfix_expr += token + " ";  // Append token with a space
-            token.clear();
+// Works directly on the lexed tokens of the expression, postfix output reuses the same token records
+void infix_to_postfix(const Token* first, const Token* last, std::string_view src,
+                      std::vector<Token>& postfix_expr) {
+    std::stack<Token> operator_stack;
+    postfix_expr.clear();
+
+	std::cout << "Infix: ";
+	if (first != last) {
+		std::cout << src.substr(first->offset, last[-1].offset + last[-1].length - first->offset);
+	}
+	std::cout << std::endl;
+    for (const Token* tok = first; tok != last; ++tok) {
+        if (tok->kind == TokenKind::Identifier || tok->kind == TokenKind::Number) {  // Operand (variable or constant)
+            postfix_expr.push_back(*tok);
         } 
-        else if (c == '(') {
-            operator_stack.push(c);
+        else if (tok->kind == TokenKind::LParen) {
+            operator_stack.push(*tok);
         } 
-        else if (c == ')') {
-            while (!operator_stack.empty() && operator_stack.top() != '(') {
-                postfix_expr += operator_stack.top();
-                postfix_expr += " ";  // Add space for separation
+        else if (tok->kind == TokenKind::RParen) {
+            while (!operator_stack.empty() && operator_stack.top().kind != TokenKind::LParen) {
+                postfix_expr.push_back(operator_stack.top());
                 operator_stack.pop();
             }
-            if (!operator_stack.empty() && operator_stack.top() == '(') {
+            if (!operator_stack.empty() && operator_stack.top().kind == TokenKind::LParen) {
                 operator_stack.pop();  // Discard '('
             } else {
                 // Mismatched parentheses
                 throw std::runtime_error("Mismatched parentheses");
             }
         } 
-        else if (is_operator(c)) {  // Operator
-            while (!operator_stack.empty() && operator_stack.top() != '(' &&
-                   precedence(operator_stack.top()) >= precedence(c)) {
-                postfix_expr += operator_stack.top();
-                postfix_expr += " ";  // Add space for separation
+        else if (is_operator_token(tok->kind)) {  // Operator
+            while (!operator_stack.empty() && operator_stack.top().kind != TokenKind::LParen &&
+                   precedence(operator_stack.top().kind) >= precedence(tok->kind)) {
+                postfix_expr.push_back(operator_stack.top());
                 operator_stack.pop();
             }
-            operator_stack.push(c);
+            operator_stack.push(*tok);
+        }
+        else {
+            throw std::runtime_error(std::string("Unexpected ") + token_kind_name(tok->kind) + " in expression");
         }
     }
 
     // Pop any remaining operators from the stack
     while (!operator_stack.empty()) {
-        if (operator_stack.top() == '(') {
+        if (operator_stack.top().kind == TokenKind::LParen) {
             throw std::runtime_error("Mismatched parentheses");
         }
-        postfix_expr += operator_stack.top();
-        postfix_expr += " ";  // Add space for separation
+        postfix_expr.push_back(operator_stack.top());
         operator_stack.pop();
     }
-	std::cout << "Postfix: " << postfix_expr << std::endl;
-    return postfix_expr;
+	std::cout << "Postfix: ";
+	for (const Token& tok : postfix_expr) {
+		std::cout << tok.text(src) << " ";
+	}
+	std::cout << std::endl;
 }
 
 // using Djikstra's converted postfix, convert in order into MIPS
-std::string convert_postfix_to_mips(const std::string& postfix_expr, SymbolTable& symbol_table, 
-                                    std::ostream& outFile, int& temp_var_count) {
-    std::istringstream expr_stream(postfix_expr);
-    std::string token;
-    std::stack<std::string> operand_stack;  // Stack to hold operands (variables or constants)
-
-    while (expr_stream >> token) {
-        if (isalnum(token[0])) {  // Operand (variable or constant)
-            operand_stack.push(token);  // Push operand onto the stack
+std::string convert_postfix_to_mips(const std::vector<Token>& postfix_expr, std::string_view src,
+                                    SymbolTable& symbol_table, std::ostream& outFile) {
+    // Operands are tokens (variables or constants) or a register holding an earlier result
+    struct Operand {
+        std::string text;
+        uint32_t symbol;
+    };
+    std::stack<Operand> operand_stack;  // Stack to hold operands (variables or constants)
+
+    for (const Token& tok : postfix_expr) {
+        std::string token(tok.text(src));
+        if (tok.kind == TokenKind::Identifier || tok.kind == TokenKind::Number) {  // Operand (variable or constant)
+            operand_stack.push({token, tok.symbol});  // Push operand onto the stack
         } 
-        else if (is_operator(token[0])) {  // Operator
+        else if (is_operator_token(tok.kind)) {  // Operator
             if (operand_stack.size() < 2) {
                 throw std::runtime_error("Invalid postfix expression: Not enough operands for operator " + token);
             }
 
             // Pop the top two operands from the stack
-            std::string operand2 = operand_stack.top();
+            std::string operand2 = operand_stack.top().text;
+            uint32_t symbol2 = operand_stack.top().symbol;
             operand_stack.pop();
-            std::string operand1 = operand_stack.top();
+            std::string operand1 = operand_stack.top().text;
+            uint32_t symbol1 = operand_stack.top().symbol;
             operand_stack.pop();
 
 		// Check if operand1 is a temporary register
@@ -135,8 +135,8 @@ std::string convert_postfix_to_mips(const std::string& postfix_expr, SymbolTable
 			outFile << "# Operand1 is already in register: " << operand1 << "\n";
 			outFile << "move $t0, " << operand1 << "\n";  // Just move it
 		} 
-		else if (symbol_table.get_offset(operand1) != -1) {  // Check if it's a declared variable
-			outFile << "lw $t0, " << symbol_table.get_offset(operand1) << "($fp)\n";
+		else if (symbol_table.get_offset(symbol1) != -1) {  // Check if it's a declared variable
+			outFile << "lw $t0, " << symbol_table.get_offset(symbol1) << "($fp)\n";
 		} 
 		else {  // Assume it's an immediate value
 			outFile << "li $t0, " << operand1 << "\n";  
@@ -147,8 +147,8 @@ std::string convert_postfix_to_mips(const std::string& postfix_expr, SymbolTable
 			outFile << "# Operand2 is already in register: " << operand2 << "\n";
 			outFile << "move $t1, " << operand2 << "\n";  // Just move it
 		} 
-		else if (symbol_table.get_offset(operand2) != -1) {  // Check if it's a declared variable
-			outFile << "lw $t1, " << symbol_table.get_offset(operand2) << "($fp)\n";
+		else if (symbol_table.get_offset(symbol2) != -1) {  // Check if it's a declared variable
+			outFile << "lw $t1, " << symbol_table.get_offset(symbol2) << "($fp)\n";
 		} 
 		else {  // Assume it's an immediate value
 			outFile << "li $t1, " << operand2 << "\n";  
@@ -166,7 +166,7 @@ std::string convert_postfix_to_mips(const std::string& postfix_expr, SymbolTable
             }
 
             // Push the result (in $t2) back onto the stack as a temporary operand
-            operand_stack.push("$t2");
+            operand_stack.push({"$t2", Interner::none});
         }
     }
 
@@ -176,24 +176,39 @@ std::string convert_postfix_to_mips(const std::string& postfix_expr, SymbolTable
     }
 
     // Store the final result in the destination variable (if needed)
-    return operand_stack.top();  // Return the final result (e.g., "$t2")
+    return operand_stack.top().text;  // Return the final result (e.g., "$t2")
 }
 
-void process_line(const std::string& line, SymbolTable& symbol_table, 
-                  std::ofstream& outFile, int& temp_var_count) {
-    std::smatch matches;
+// Statements are classified by the shape of their token stream, the same tokens feed the expression parser
+void process_line(const std::string& line, uint32_t line_no, std::vector<Token>& tokens, Interner& interner,
+                  SymbolTable& symbol_table, std::ofstream& outFile) {
+    Lexer(line, line_no, &interner).tokenize(tokens);
+    const size_t count = tokens.size() - 1;  // without the End token
+    auto kind_at = [&](size_t i) { return i < count ? tokens[i].kind : TokenKind::End; };
+    auto text_at = [&](size_t i) { return tokens[i].text(line); };
+
+    for (size_t i = 0; i < count; ++i) {
+        if (tokens[i].kind == TokenKind::Invalid) {
+            outFile << "# Error: Unexpected character '" << text_at(i) << "' at line " << tokens[i].line
+                    << ", column " << tokens[i].column << ".\n";
+            return;
+        }
+    }
 
     // Variable Declaration (e.g., `int a = 0;` OR int a;)
-    if (std::regex_match(line, matches, var_decl_regex)) {
-        std::string var_name = matches[1];
-        int value = matches[2].matched ? std::stoi(matches[2].str()) : 0;
+    if (kind_at(0) == TokenKind::KwInt && kind_at(1) == TokenKind::Identifier &&
+        ((count == 3 && kind_at(2) == TokenKind::Semicolon) ||
+         (count == 5 && kind_at(2) == TokenKind::Assign && kind_at(3) == TokenKind::Number &&
+          kind_at(4) == TokenKind::Semicolon))) {
+        std::string var_name(text_at(1));
+        int value = count == 5 ? std::stoi(std::string(text_at(3))) : 0;
 
         // Allocate space for the variable in the symbol table
-        if (!symbol_table.add_variable(var_name)) {
+        if (!symbol_table.add_variable(tokens[1].symbol)) {
             outFile << "# Error: Variable '" << var_name << "' already declared.\n";
             return;
         }
-		int offset = symbol_table.get_offset(var_name);
+		int offset = symbol_table.get_offset(tokens[1].symbol);
 		
         // If initialized with a value, store the value
         if (value != 0) {
@@ -206,11 +221,12 @@ void process_line(const std::string& line, SymbolTable& symbol_table,
     }
     
     // Assignment (e.g., `a = 5;`)
-    else if (std::regex_match(line, matches, assign_regex)) {
-        std::string var_name = matches[1];
-        int value = std::stoi(matches[2]);
+    else if (count == 4 && kind_at(0) == TokenKind::Identifier && kind_at(1) == TokenKind::Assign &&
+             kind_at(2) == TokenKind::Number && kind_at(3) == TokenKind::Semicolon) {
+        std::string var_name(text_at(0));
+        int value = std::stoi(std::string(text_at(2)));
 
-        int offset = symbol_table.get_offset(var_name);
+        int offset = symbol_table.get_offset(tokens[0].symbol);
         if (offset == -1) {
             outFile << "# Error: Variable '" << var_name << "' not declared.\n";
             return;
@@ -222,11 +238,14 @@ void process_line(const std::string& line, SymbolTable& symbol_table,
     }
     
     // Return statement (e.g., `return a;`)
-    else if (std::regex_match(line, matches, return_regex)) {
-        std::string var_name = matches[1];
+    else if (kind_at(0) == TokenKind::KwReturn &&
+             ((count == 2 && kind_at(1) == TokenKind::Semicolon) ||
+              (count == 3 && (kind_at(1) == TokenKind::Identifier || kind_at(1) == TokenKind::Number) &&
+               kind_at(2) == TokenKind::Semicolon))) {
+        std::string var_name = count == 3 ? std::string(text_at(1)) : std::string();
 
         if (!var_name.empty()) {
-            int offset = symbol_table.get_offset(var_name);
+            int offset = symbol_table.get_offset(tokens[1].symbol);
             if (offset == -1) {
                 outFile << "# Error: Variable '" << var_name << "' not declared.\n";
                 return;
@@ -240,20 +259,30 @@ void process_line(const std::string& line, SymbolTable& symbol_table,
     }
     
     // Arithmetic Expressions (e.g., `d = a + b * c;`)
-    else if (line.find('=') != std::string::npos) {
-        size_t eq_pos = line.find('=');
-        std::string var_name = line.substr(0, eq_pos);
-        var_name.erase(var_name.find_last_not_of(" ")+1); // Trim spaces
+    else {
+        size_t eq_pos = 0;
+        while (eq_pos < count && tokens[eq_pos].kind != TokenKind::Assign) ++eq_pos;
+        if (eq_pos == count) {
+            return;  // Not a statement we know about
+        }
+        std::string var_name;
+        uint32_t var_symbol = eq_pos == 1 ? tokens[0].symbol : Interner::none;  // a single name
+        if (eq_pos > 0) {
+            const Token& last = tokens[eq_pos - 1];
+            var_name = line.substr(tokens[0].offset, last.offset + last.length - tokens[0].offset);
+        }
 
-        std::string expr = line.substr(eq_pos + 1);
-        expr.erase(0, expr.find_first_not_of(" ")); // Trim spaces
-        expr.pop_back(); // Remove semicolon
+        size_t expr_end = count;
+        if (expr_end > eq_pos + 1 && tokens[expr_end - 1].kind == TokenKind::Semicolon) {
+            --expr_end; // Drop semicolon
+        }
 
         // Convert infix to postfix using Dijkstra’s Algorithm
-        std::string postfix_expr = infix_to_postfix(expr);
+        std::vector<Token> postfix_expr;
+        infix_to_postfix(tokens.data() + eq_pos + 1, tokens.data() + expr_end, line, postfix_expr);
 		
         // Convert postfix to MIPS assembly
-        std::string result_register = convert_postfix_to_mips(postfix_expr, symbol_table, outFile, temp_var_count);
+        std::string result_register = convert_postfix_to_mips(postfix_expr, line, symbol_table, outFile);
         
         if (result_register.empty()) {
             outFile << "# Error: Processed expression is empty\n";
@@ -261,7 +290,7 @@ void process_line(const std::string& line, SymbolTable& symbol_table,
         }
 
         // Get the offset for the target variable
-        int offset = symbol_table.get_offset(var_name);
+        int offset = symbol_table.get_offset(var_symbol);
         if (offset == -1) {
             outFile << "# Error: Variable '" << var_name << "' not declared.\n";
             return;
@@ -302,11 +331,13 @@ int main(int argc, char* argv[]) {
     outFile << "move $fp, $sp\n";
     outFile << "addiu $sp, $sp, -0x100\n";
 
-    int temp_var_count = 0;
     SymbolTable symbol_table;
+    Interner interner;  // copies the names, lines are dropped once processed
 
+    std::vector<Token> tokens;  // reused for every line
+    uint32_t line_no = 0;
     for (std::string line; std::getline(input_file, line); ) {
-        process_line(line, symbol_table, outFile, temp_var_count);
+        process_line(line, ++line_no, tokens, interner, symbol_table, outFile);
     }
     outFile << "# Printing Integer\n";
     outFile << "move $a0, $v0\n";
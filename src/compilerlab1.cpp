@@ -1,402 +1,2776 @@
 #include <iostream>
-#include <fstream>
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
 #include <cstring>
-#include <regex>
+#include <deque>
+#include <iterator>
+#include <new>
+#include <sstream>
 #include <string>
 #include <vector>
+#include <thread>
 #include <unordered_map>
-#include <stack>
 
-// Symbol Table to manage variable declarations and offsets, only works with int
-// TODO: Make it work for all variable sizes. Padding needed?
+#include "arena.h"
+#include "ast.h"
+#include "cache.h"
+#include "constfold.h"
+#include "deadstore.h"
+#include "elf.h"
+#include "encode.h"
+#include "hash.h"
+#include "incremental.h"
+#include "instr.h"
+#include "intern.h"
+#include "io.h"
+#include "ir.h"
+#include "irpasses.h"
+#include "lexer.h"
+#include "lower.h"
+#include "mips.h"
+#include "parser.h"
+#include "peephole.h"
+#include "regalloc.h"
+#include "scheduler.h"
+#include "strength.h"
+#include "timing.h"
+#include "types.h"
+#include "valnum.h"
+#include "workpool.h"
+
+// Every heap allocation of the compiler goes through here so --time-passes can count them per phase
+void* operator new(std::size_t size) {
+    heap_account->allocations.fetch_add(1, std::memory_order_relaxed);
+    heap_account->bytes.fetch_add(size, std::memory_order_relaxed);
+    if (void* p = std::malloc(size != 0 ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+// Not inlined: GCC would otherwise warn about free() on memory that came from new
+__attribute__((noinline)) void operator delete(void* p) noexcept { std::free(p); }
+__attribute__((noinline)) void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+// Symbol Table to manage variable declarations, their types and stack offsets.
+// Names are interned by the lexer (intern.h), so the table is a flat array indexed by symbol id.
+// The slots of all variables are laid out before code generation (layout_frame), a declaration
+// then only makes its variable visible; spill slots are allocated below the variables on demand.
 class SymbolTable {
 private:
-    int next_offset;  // Tracks the next available memory offset
+    int bottom;                     // lowest offset in use, spill slots go below it
+    std::vector<int> free_slots;    // released spill slots
+    std::vector<int> offsets;       // by symbol id, undeclared while the name is not declared
+    std::vector<int> planned;       // by symbol id, the slot layout_frame() assigned
+    std::vector<ValueType> types;   // by symbol id, the type of the first declaration
+    std::vector<uint32_t> owners;   // by byte below the frame pointer (-offset), symbol whose slot starts there
+
+    // Gives the variables their slots below the reserved bytes, see layout_frame()
+    void place_slots(std::vector<uint32_t>& order, int reserved = 0) {
+        std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+            return type_size(types[a]) > type_size(types[b]);
+        });
+        int offset = -reserved;
+        for (uint32_t symbol : order) {
+            offset -= type_size(types[symbol]);
+            planned[symbol] = offset;
+        }
+        bottom = offset & ~3;  // spill slots are words
+        owners.assign(-bottom + 1, Interner::none);
+        for (uint32_t symbol : order) owners[-planned[symbol]] = symbol;
+    }
 
 public:
-    std::unordered_map<std::string, int> table;
+    // Offset of variables that are never read (dead variable elimination), nothing is stored there
+    static constexpr int no_slot = 0;
+    // Offset of names not declared (yet), slots are all below the frame pointer
+    static constexpr int undeclared = 1;
+
+    explicit SymbolTable(uint32_t symbols)
+        : bottom(0), offsets(symbols, undeclared), planned(symbols, no_slot), types(symbols, ValueType::Int) {}
 
-    SymbolTable() : next_offset(-4) {} // Initialize memory allocation
+    // Frame layout pass. Every variable gets a naturally aligned slot below the frame pointer;
+    // placing the slots by decreasing alignment (declaration order among equals) leaves no padding
+    // between them. Only the first declaration of a name counts, the code generator rejects the others.
+    void layout_frame(const Program& program) {
+        std::vector<bool> seen(types.size(), false);
+        std::vector<uint32_t> order;  // variables needing a slot, in declaration order
+        for (const Stmt* stmt : program.statements) {
+            if (stmt->kind != StmtKind::Declaration) continue;
+            auto* decl = static_cast<const DeclarationStmt*>(stmt);
+            if (seen[decl->symbol]) continue;
+            seen[decl->symbol] = true;
+            types[decl->symbol] = decl->type;
+            if (decl->needs_slot) order.push_back(decl->symbol);
+        }
+        place_slots(order);
+    }
+
+    // Frame layout of the IR backend (-O<n>): the variables the optimised code still loads or stores.
+    // A function reserves the words right below the frame pointer for $ra and the caller's $fp.
+    void layout_frame(const IrFunction& function, int reserved = 0) {
+        std::vector<bool> accessed(types.size(), false);
+        for (const IrInstr& in : function.code) {
+            if (in.op == IrOp::Load || in.op == IrOp::Store) accessed[in.symbol] = true;
+        }
+        std::vector<uint32_t> order;
+        for (uint32_t symbol : function.declared) {
+            types[symbol] = function.types[symbol];
+            if (accessed[symbol]) order.push_back(symbol);
+        }
+        place_slots(order, reserved);
+    }
 
-	// dict addition, assume always int sized (change for future multiple type variations)
-    bool add_variable(const std::string& var_name) {
-        if (table.find(var_name) != table.end()) {
+    // Makes the variable visible at the slot the layout gave it, false when already declared
+    bool add_variable(uint32_t symbol, bool needs_slot = true) {
+        if (offsets[symbol] != undeclared) {
             return false; // Variable already exists
         }
-        table[var_name] = next_offset;
-        next_offset -= 4; // Move stack downward (MIPS convention)
+        offsets[symbol] = needs_slot ? planned[symbol] : no_slot;
         return true;
     }
 
-	// dict hash o(1) speed lookup
-    int get_offset(const std::string& var_name) const {
-        auto it = table.find(var_name);
-        return (it != table.end()) ? it->second : -1;
+    // Anonymous 4-byte slot for a spilled or saved register, reused once released
+    int allocate_spill_slot() {
+        if (!free_slots.empty()) {
+            int offset = free_slots.back();
+            free_slots.pop_back();
+            return offset;
+        }
+        bottom -= 4; // Move stack downward (MIPS convention)
+        return bottom;
+    }
+
+    void release_spill_slot(int offset) {
+        free_slots.push_back(offset);
+    }
+
+    // Bytes the prologue reserves for variables and spill slots, a multiple of 8 as the ABI wants $sp
+    int frame_size() const { return (-bottom + 7) & ~7; }
+
+    // Slot allocation state besides the table, saved and restored by incremental recompilation
+    int next_free_offset() const { return bottom; }
+    const std::vector<int>& released_slots() const { return free_slots; }
+
+    void restore_slots(int offset, std::vector<int> released) {
+        bottom = offset;
+        free_slots = std::move(released);
+    }
+
+    // Declares the variable at an offset allocated before (incremental replay)
+    void restore_variable(uint32_t symbol, int offset) { offsets[symbol] = offset; }
+
+	// plain array index, undeclared for undeclared names
+    int get_offset(uint32_t symbol) const { return offsets[symbol]; }
+
+    // Slot the layout planned for the variable, whether declared yet or not
+    int planned_offset(uint32_t symbol) const { return planned[symbol]; }
+
+    ValueType get_type(uint32_t symbol) const { return types[symbol]; }
+
+    // The variable whose slot is at offset, which has to be a variable's slot
+    uint32_t symbol_at(int offset) const { return owners[-offset]; }
+
+    // True when a variable's slot starts at offset (checks the records of an earlier build)
+    bool is_variable_slot(int offset) const {
+        return offset < 0 && (size_t)-offset < owners.size() && owners[-offset] != Interner::none;
+    }
+};
+
+// Register caching state of one variable, or of a reused value (value numbering)
+struct VariableState {
+    std::string_view name;                        // empty for values
+    ValueType type = ValueType::Int;              // how the value is loaded and stored
+    Reg home = Reg::none;                         // register holding the current value, if any
+    bool dirty = false;                           // register value not yet written to the stack slot
+    const std::vector<uint32_t>* uses = nullptr;  // indices of the statements mentioning the variable
+    size_t next_use = 0;                          // cursor into uses
+};
+
+// Code generator state that outlives a single statement
+struct CodegenContext {
+    SymbolTable& symbol_table;
+    InstructionList& code;
+    bool cache_variables;  // keep variables in registers across statements
+    RegisterAllocator regs;
+    std::vector<VariableState> variables;              // by symbol id, see variable()
+    std::vector<std::vector<uint32_t>> use_positions;  // by symbol id
+    bool strength_reduction = true;                    // shifts, immediates and multiply-high for constants
+    ValueNumbering* value_numbering = nullptr;         // reuse of computed values, off when null
+    std::unordered_map<int, VariableState> values;     // by value number
+    std::vector<uint32_t> remaining_uses;              // operations still to come per value number
+    uint32_t statement_index = 0;
+    std::vector<std::pair<Reg, int>> saved_registers;  // callee-saved registers and their save slots
+    uint32_t saved_mask = 0;                            // bit per register number already saved
+    int spills = 0;
+    int reused_values = 0;
+    int eliminated_instructions = 0;
+    int reduced_operations = 0;
+    bool looked_ahead = false;  // an eviction consulted next uses (incremental recompilation)
+
+    CodegenContext(SymbolTable& symbol_table, InstructionList& code, bool cache_variables)
+        : symbol_table(symbol_table), code(code), cache_variables(cache_variables) {}
+
+    // State of the variable with its slot at a stack offset. Register owners and operands name
+    // variables by offset, which unlike symbol ids is the same in every build (--incremental).
+    VariableState& variable(int offset) { return variables[symbol_table.symbol_at(offset)]; }
+
+    VariableState& declare_variable(uint32_t symbol, std::string_view name) {
+        VariableState& state = variables[symbol];
+        state.name = name;
+        state.type = symbol_table.get_type(symbol);
+        state.uses = &use_positions[symbol];
+        return state;
+    }
+};
+
+void collect_uses(const Expr* expr, uint32_t index, CodegenContext& ctx) {
+    if (expr->kind == ExprKind::Variable) {
+        std::vector<uint32_t>& uses = ctx.use_positions[static_cast<const VariableExpr*>(expr)->symbol];
+        if (uses.empty() || uses.back() != index) uses.push_back(index);
+    } else if (expr->kind == ExprKind::Binary) {
+        collect_uses(static_cast<const BinaryExpr*>(expr)->lhs, index, ctx);
+        collect_uses(static_cast<const BinaryExpr*>(expr)->rhs, index, ctx);
+    }
+}
+
+// Linear scan over the statement list recording where every variable is mentioned,
+// eviction then picks the cached variable whose next mention is furthest away
+void collect_use_positions(const Program& program, CodegenContext& ctx) {
+    for (uint32_t i = 0; i < program.statements.size(); ++i) {
+        const Stmt* stmt = program.statements[i];
+        const Expr* expr = nullptr;
+        uint32_t target = Interner::none;
+        if (stmt->kind == StmtKind::Declaration) {
+            target = static_cast<const DeclarationStmt*>(stmt)->symbol;
+            expr = static_cast<const DeclarationStmt*>(stmt)->init;
+        } else if (stmt->kind == StmtKind::Assignment) {
+            target = static_cast<const AssignmentStmt*>(stmt)->symbol;
+            expr = static_cast<const AssignmentStmt*>(stmt)->value;
+        } else if (stmt->kind == StmtKind::Return) {
+            expr = static_cast<const ReturnStmt*>(stmt)->value;
+        }
+        if (expr != nullptr) collect_uses(expr, i, ctx);
+        if (target != Interner::none) {
+            std::vector<uint32_t>& uses = ctx.use_positions[target];
+            if (uses.empty() || uses.back() != i) uses.push_back(i);
+        }
+    }
+}
+
+Opcode load_opcode(ValueType type) {
+    return type == ValueType::Char ? Opcode::Lb : type == ValueType::Short ? Opcode::Lh : Opcode::Lw;
+}
+
+Opcode store_opcode(ValueType type) {
+    return type == ValueType::Char ? Opcode::Sb : type == ValueType::Short ? Opcode::Sh : Opcode::Sw;
+}
+
+// Stores a register into a variable's slot. The high word of a long long (at offset + 4, the
+// stack is little-endian) receives the sign extension of the 32-bit value, computed in $v1, which
+// the register pool never hands out. Not in $at: a store past 16-bit offsets goes through $at.
+void store_variable(InstructionList& code, Reg reg, int offset, ValueType type, std::string_view note = {}) {
+    code.store(store_opcode(type), reg, offset, Reg::fp, note);
+    if (type == ValueType::LongLong) {
+        Reg high = reg;
+        if (reg != Reg::zero) {
+            high = Reg::v1;
+            code.op_imm(Opcode::Sra, high, reg, 31);
+        }
+        code.sw(high, offset + 4, Reg::fp);
+    }
+}
+
+// A register's cache owner is a variable (negative stack offset) or a value number
+VariableState& cache_entry(CodegenContext& ctx, int owner) {
+    return owner < 0 ? ctx.variable(owner) : ctx.values[owner];
+}
+
+// Statements until the variable or value is needed again (the current statement counts as 0)
+uint64_t next_use_distance(CodegenContext& ctx, int var) {
+    VariableState& state = cache_entry(ctx, var);
+    if (state.uses == nullptr) return UINT64_MAX;
+    while (state.next_use < state.uses->size() && (*state.uses)[state.next_use] < ctx.statement_index) {
+        ++state.next_use;
+    }
+    if (state.next_use == state.uses->size()) return UINT64_MAX;
+    return (*state.uses)[state.next_use] - ctx.statement_index;
+}
+
+// Drops a variable from its register, writing it back first when the stack slot is stale
+void evict_variable(CodegenContext& ctx, Reg reg, int var) {
+    VariableState& state = cache_entry(ctx, var);
+    if (state.dirty) {
+        store_variable(ctx.code, reg, var, state.type, ctx.code.note({"spill ", state.name}));
+        ++ctx.spills;
+    }
+    state.home = Reg::none;
+    state.dirty = false;
+    ctx.regs.release(reg);
+}
+
+// Takes a register from the pool, evicting the cached variable needed furthest in the future when
+// nothing is free. The first use of a callee-saved register stores the caller's value.
+Reg acquire_register(CodegenContext& ctx) {
+    Reg reg = ctx.regs.alloc();
+    if (reg == Reg::none) {
+        Reg victim = ctx.regs.pick_victim([&](int var) { return next_use_distance(ctx, var); });
+        ctx.looked_ahead = true;
+        if (victim == Reg::none) {
+            // Cannot happen: emit_expression spills before the pool runs dry
+            throw std::runtime_error("Register pool exhausted");
+        }
+        ctx.regs.for_each_cached([&](Reg cached, int var) {
+            if (cached == victim) evict_variable(ctx, cached, var);
+        });
+        reg = ctx.regs.alloc();
+    }
+    if (is_callee_saved(reg) && !(ctx.saved_mask >> (int)reg & 1)) {
+        int offset = ctx.symbol_table.allocate_spill_slot();
+        ctx.saved_mask |= 1u << (int)reg;
+        ctx.saved_registers.push_back({reg, offset});
+        ctx.code.sw(reg, offset, Reg::fp, ctx.code.note({"save ", reg_name(reg)}));
+    }
+    return reg;
+}
+
+// Writes every modified cached variable back to its stack slot (end of the function)
+void write_back_variables(CodegenContext& ctx) {
+    ctx.regs.for_each_cached([&](Reg reg, int var) {
+        VariableState& state = cache_entry(ctx, var);
+        if (state.dirty) {
+            store_variable(ctx.code, reg, var, state.type, ctx.code.note({"write back ", state.name}));
+            state.dirty = false;
+        }
+    });
+}
+
+// Restores every callee-saved register the body has used, once at the end of the code
+void restore_saved_registers(CodegenContext& ctx) {
+    for (const auto& [reg, offset] : ctx.saved_registers) {
+        ctx.code.lw(reg, offset, Reg::fp, ctx.code.note({"restore ", reg_name(reg)}));
+    }
+}
+
+// Reports the first undeclared variable of the expression, before any of its code is emitted
+bool check_variables(const Expr* expr, const SymbolTable& symbol_table, InstructionList& code) {
+    switch (expr->kind) {
+        case ExprKind::Constant:
+            return true;
+        case ExprKind::Variable: {
+            auto* var = static_cast<const VariableExpr*>(expr);
+            if (symbol_table.get_offset(var->symbol) == SymbolTable::undeclared) {
+                code.comment(code.note({"Error: Variable '", var->name, "' not declared."}));
+                return false;
+            }
+            return true;
+        }
+        case ExprKind::Binary: {
+            auto* bin = static_cast<const BinaryExpr*>(expr);
+            return check_variables(bin->lhs, symbol_table, code) &&
+                   check_variables(bin->rhs, symbol_table, code);
+        }
+        case ExprKind::Call:  // calls only compile through the IR (lower.h)
+            break;
     }
+    return false;
+}
+
+// A value produced while evaluating an expression. Registers borrowed from a cached variable
+// are pinned and must not be overwritten; owned registers are temporaries of the expression.
+struct Value {
+    Reg reg;
+    bool owned;
+    int var;  // owner of a borrowed register: variable stack offset or value number, 0 otherwise
 };
 
-std::regex var_decl_regex(R"(int\s+(\w+)\s*(?:=\s*(\d+))?\s*;)");
-std::regex assign_regex(R"((\w+)\s*=\s*(\d+)\s*;)");
-std::regex op_regex(R"((\w+)\s*=\s*(.+);)");
-std::regex return_regex(R"(return\s*(\w+)?\s*;)");
-std::stack<int> free_temps;
+// Register holding a variable's value: its cached home (loaded on first use) or, without register
+// caching, a fresh temporary loaded from the stack slot
+Value load_variable(int offset, CodegenContext& ctx) {
+    VariableState& state = ctx.variable(offset);
+    if (!ctx.cache_variables) {
+        Reg reg = acquire_register(ctx);
+        ctx.code.load(load_opcode(state.type), reg, offset, Reg::fp, ctx.code.note({"load ", state.name}));
+        return Value{reg, true, 0};
+    }
+    if (state.home == Reg::none) {
+        Reg reg = acquire_register(ctx);
+        ctx.code.load(load_opcode(state.type), reg, offset, Reg::fp, ctx.code.note({"load ", state.name}));
+        ctx.regs.bind(reg, offset);
+        state.home = reg;
+        state.dirty = false;
+    }
+    ctx.regs.pin(state.home);
+    return Value{state.home, false, offset};
+}
+
+// Gives back a consumed value: temporaries return to the pool, borrowed registers are unpinned
+void consume(const Value& value, CodegenContext& ctx) {
+    if (value.owned) {
+        ctx.regs.release(value.reg);
+    } else {
+        ctx.regs.unpin(value.reg);
+    }
+}
+
+// Turns a borrowed operand into a temporary when nothing is left for the result of an operation:
+// the variable gives up its register (written back first if modified). Only possible when no
+// pending value other than the operation's own operands (uses) still reads the register.
+bool take_over(Value& value, int uses, CodegenContext& ctx) {
+    if (value.owned || value.reg == Reg::zero || ctx.regs.pin_count(value.reg) != uses) {
+        return false;
+    }
+    evict_variable(ctx, value.reg, value.var);
+    value.reg = ctx.regs.alloc();  // the only free register
+    value.owned = true;
+    value.var = 0;
+    return true;
+}
 
-int precedence(char op) {
-    if (op == '+' || op == '-') return 1;
-    if (op == '*' || op == '/') return 2;
+// Instructions generating the expression from scratch would take
+int instruction_count(const Expr* expr) {
+    switch (expr->kind) {
+        case ExprKind::Constant:
+            return static_cast<const ConstantExpr*>(expr)->value != 0 ? 1 : 0;
+        case ExprKind::Variable:
+            return 0;
+        case ExprKind::Binary: {
+            auto* bin = static_cast<const BinaryExpr*>(expr);
+            int own = bin->op == BinaryOp::Div ? 2 : 1;
+            return own + instruction_count(bin->lhs) + instruction_count(bin->rhs);
+        }
+        case ExprKind::Call:  // calls only compile through the IR (lower.h)
+            break;
+    }
     return 0;
 }
 
-bool is_operator(char c) {
-    return (c == '+' || c == '-' || c == '*' || c == '/');
-}
-
-// Djikstra's Yard-shunt Algorithm (Because fuck parenthesis nesting and operator orders
-std::string infix_to_postfix(const std::string& infix_expr) {
-    std::stack<char> operator_stack;
-    std::string postfix_expr;
-    std::string token;
-	
-	std::cout << "Infix: " << infix_expr << std::endl;
-    for (size_t i = 0; i < infix_expr.size(); ++i) {
-        char c = infix_expr[i];
-
-        if (std::isalnum(c)) {  // Operand (variable or constant)
-            token += c;
-            if (i + 1 < infix_expr.size() && std::isalnum(infix_expr[i + 1])) {
-                continue;  // Continue building multi-character tokens
-            }
-            postfix_expr += token + " ";  // Append token with a space
-            token.clear();
-        } 
-        else if (c == '(') {
-            operator_stack.push(c);
-        } 
-        else if (c == ')') {
-            while (!operator_stack.empty() && operator_stack.top() != '(') {
-                postfix_expr += operator_stack.top();
-                postfix_expr += " ";  // Add space for separation
-                operator_stack.pop();
-            }
-            if (!operator_stack.empty() && operator_stack.top() == '(') {
-                operator_stack.pop();  // Discard '('
+// Value number under which the result of an operation is kept for later reuse, 0 when it is not
+int kept_number(const Expr* expr, const CodegenContext& ctx) {
+    return ctx.value_numbering != nullptr && ctx.value_numbering->reused(expr->value_number)
+               ? (int)expr->value_number : 0;
+}
+
+// Hands out a value computed earlier. Its last use takes the register over as a temporary.
+Value reuse_value(int number, CodegenContext& ctx) {
+    VariableState& state = ctx.values[number];
+    Reg reg = state.home;
+    if (--ctx.remaining_uses[number] == 0 && ctx.regs.pin_count(reg) == 0) {
+        ctx.regs.unbind(reg);
+        state.home = Reg::none;
+        return Value{reg, true, 0};
+    }
+    ctx.regs.pin(reg);
+    return Value{reg, false, number};
+}
+
+// Keeps a freshly computed value in its register when later operations compute it again
+Value keep_value(int number, Reg reg, CodegenContext& ctx) {
+    if (--ctx.remaining_uses[number] == 0) {
+        return Value{reg, true, 0};
+    }
+    VariableState& state = ctx.values[number];
+    if (state.uses == nullptr) state.uses = &ctx.value_numbering->positions[number];
+    ctx.regs.bind(reg, number);
+    ctx.regs.pin(reg);
+    state.home = reg;
+    return Value{reg, false, number};
+}
+
+// The constant operand of an operation strength reduction may apply to: a constant divisor,
+// subtrahend or factor/addend on either side. nullptr for anything else.
+const ConstantExpr* reducible_constant(const BinaryExpr* bin, const CodegenContext& ctx) {
+    if (!ctx.strength_reduction) return nullptr;
+    bool lhs_constant = bin->lhs->kind == ExprKind::Constant;
+    bool rhs_constant = bin->rhs->kind == ExprKind::Constant;
+    if (rhs_constant && !lhs_constant) return static_cast<const ConstantExpr*>(bin->rhs);
+    if (lhs_constant && !rhs_constant && (bin->op == BinaryOp::Add || bin->op == BinaryOp::Mul)) {
+        return static_cast<const ConstantExpr*>(bin->lhs);
+    }
+    return nullptr;
+}
+
+// x op c as immediates, shifts or a multiply-high instead of li plus add/mul/div. Returns the result
+// register, or Reg::none with nothing emitted when the constant has no cheaper form or the pool
+// cannot provide the registers the sequence needs (the caller then falls back to the plain form).
+Reg emit_reduced(BinaryOp op, const Value& x, int32_t c, CodegenContext& ctx) {
+    InstructionList& code = ctx.code;
+    Reg xs = x.reg;
+    int fresh = x.owned ? 0 : 1;  // a result register unless x's temporary can be reused
+    int available = ctx.regs.available_count();
+    Reg d;
+    switch (op) {
+        case BinaryOp::Add:
+        case BinaryOp::Sub: {
+            int64_t imm = op == BinaryOp::Add ? (int64_t)c : -(int64_t)c;
+            if (!fits_immediate(imm) || available < fresh) return Reg::none;
+            d = x.owned ? x.reg : acquire_register(ctx);
+            code.op_imm(Opcode::Addiu, d, xs, (int32_t)imm);
+            break;
+        }
+        case BinaryOp::Mul: {
+            ShiftPlan plan;
+            if (!plan_multiply(c, plan)) return Reg::none;
+            if (plan.low < 0) {
+                if (available < fresh) return Reg::none;
+                d = x.owned ? x.reg : acquire_register(ctx);
+                code.op_imm(Opcode::Sll, d, xs, plan.high);
+            } else if (plan.low == 0) {
+                if (available < 1) return Reg::none;
+                d = acquire_register(ctx);
+                code.op_imm(Opcode::Sll, d, xs, plan.high);
+                code.op3(plan.subtract ? Opcode::Subu : Opcode::Addu, d, d, xs);
             } else {
-                // Mismatched parentheses
-                throw std::runtime_error("Mismatched parentheses");
-            }
-        } 
-        else if (is_operator(c)) {  // Operator
-            while (!operator_stack.empty() && operator_stack.top() != '(' &&
-                   precedence(operator_stack.top()) >= precedence(c)) {
-                postfix_expr += operator_stack.top();
-                postfix_expr += " ";  // Add space for separation
-                operator_stack.pop();
-            }
-            operator_stack.push(c);
-        }
-    }
-
-    // Pop any remaining operators from the stack
-    while (!operator_stack.empty()) {
-        if (operator_stack.top() == '(') {
-            throw std::runtime_error("Mismatched parentheses");
-        }
-        postfix_expr += operator_stack.top();
-        postfix_expr += " ";  // Add space for separation
-        operator_stack.pop();
-    }
-	std::cout << "Postfix: " << postfix_expr << std::endl;
-    return postfix_expr;
-}
-
-// using Djikstra's converted postfix, convert in order into MIPS
-std::string convert_postfix_to_mips(const std::string& postfix_expr, SymbolTable& symbol_table, 
-                                    std::ostream& outFile, int& temp_var_count) {
-    std::istringstream expr_stream(postfix_expr);
-    std::string token;
-    std::stack<std::string> operand_stack;  // Stack to hold operands (variables or constants)
-    
-    // Register management
-    std::stack<int> free_temps;                      // stack of available temporary register numbers (2..9)
-    int next_temp = 2;                                // next unused register number (start from $t2)
-	
-	// Helper to allocate a new temporary register
-    auto alloc_temp = [&]() -> std::string {
-        int reg_num;
-        if (!free_temps.empty()) {
-            reg_num = free_temps.top();
-            free_temps.pop();
-        } else {
-            if (next_temp > 9) {
-                // Out of registers C for a real compiler you would spill to stack
-                throw std::runtime_error("Out of temporary registers C expression too complex");
+                // Three instructions already, a negation would make it as slow as mul
+                if (plan.negate || available < 1 + fresh) return Reg::none;
+                Reg t = acquire_register(ctx);
+                d = x.owned ? x.reg : acquire_register(ctx);
+                code.op_imm(Opcode::Sll, t, xs, plan.high);
+                code.op_imm(Opcode::Sll, d, xs, plan.low);
+                code.op3(plan.subtract ? Opcode::Subu : Opcode::Addu, d, t, d);
+                ctx.regs.release(t);
             }
-            reg_num = next_temp++;
+            if (plan.negate) code.op3(Opcode::Subu, d, Reg::zero, d);
+            break;
         }
-        return "$t" + std::to_string(reg_num);
-    };
+        case BinaryOp::Div: {
+            uint32_t m = c < 0 ? 0u - (uint32_t)c : (uint32_t)c;
+            if (c == -1) {
+                if (available < fresh) return Reg::none;
+                d = x.owned ? x.reg : acquire_register(ctx);
+                code.op3(Opcode::Subu, d, Reg::zero, xs);
+            } else if (m < 2 || c == INT32_MIN) {
+                return Reg::none;
+            } else if (is_power_of_two(m)) {
+                // Shifting alone rounds toward minus infinity, negative dividends get 2^k - 1 added first
+                if (available < 1) return Reg::none;
+                int k = log2_exact(m);
+                d = acquire_register(ctx);
+                if (k == 1) {
+                    code.op_imm(Opcode::Srl, d, xs, 31);
+                } else {
+                    code.op_imm(Opcode::Sra, d, xs, 31);
+                    code.op_imm(Opcode::Srl, d, d, 32 - k);
+                }
+                code.op3(Opcode::Addu, d, xs, d);
+                code.op_imm(Opcode::Sra, d, d, k);
+                if (c < 0) code.op3(Opcode::Subu, d, Reg::zero, d);
+            } else {
+                if (available < 1 + fresh) return Reg::none;
+                DivisionMagic magic = signed_division_magic(c);
+                d = acquire_register(ctx);
+                code.li(d, magic.magic);
+                code.hilo(Opcode::Mult, xs, d);
+                code.from_hilo(Opcode::Mfhi, d);
+                if (c > 0 && magic.magic < 0) code.op3(Opcode::Addu, d, d, xs);
+                if (c < 0 && magic.magic > 0) code.op3(Opcode::Subu, d, d, xs);
+                if (magic.shift > 0) code.op_imm(Opcode::Sra, d, d, magic.shift);
+                // Round toward zero: add one when the quotient is negative
+                Reg sign = x.owned ? x.reg : acquire_register(ctx);
+                code.op_imm(Opcode::Srl, sign, d, 31);
+                code.op3(Opcode::Addu, d, d, sign);
+                if (sign != x.reg) ctx.regs.release(sign);
+            }
+            break;
+        }
+        default:
+            return Reg::none;
+    }
+    ++ctx.reduced_operations;
+    return d;
+}
 
-    // Helper to free a temporary register (if the string is a temporary name)
-	auto free_if_temp = [&](const std::string& reg_name) {
-		if (reg_name.size() > 2 && reg_name[0] == '$' && reg_name[1] == 't') {
-		    int num = std::stoi(reg_name.substr(2));
-		    if (num >= 2) {          // only free temporaries from our pool ($t2..$t9)
-		        free_temps.push(num);
-		    }
-		}
-	};
-	
-    while (expr_stream >> token) {
-        if (isalnum(token[0])) {  // Operand (variable or constant)
-            operand_stack.push(token);  // Push operand onto the stack
-        } 
-        else if (is_operator(token[0])) {  // Operator
-            if (operand_stack.size() < 2) {
-                throw std::runtime_error("Invalid postfix expression: Not enough operands for operator " + token);
-            }
-
-            // Pop the top two operands from the stack
-            std::string operand2 = operand_stack.top();
-            operand_stack.pop();
-            std::string operand1 = operand_stack.top();
-            operand_stack.pop();
-
-		// Check if operand1 is a temporary register
-		std::string src1;
-		// Load/obtain first source register
-        if (operand1[0] == '$') {          // already a temporary
-        	outFile << "# Operand1 is already in register: " << operand1 << "\n";
-            src1 = operand1;
-        } else if (symbol_table.get_offset(operand1) != -1) { // declared variable
-            outFile << "lw $t0, " << symbol_table.get_offset(operand1) << "($fp)  # load " << operand1 << "\n";
-            src1 = "$t0";
-        } else {                            // constant
-            outFile << "li $t0, " << operand1 << "\n";
-            src1 = "$t0";
-        }
-        
-        
-        // Load/obtain second source register
-        std::string src2;
-        if (operand2[0] == '$') {
-			outFile << "# Operand2 is already in register: " << operand2 << "\n";
-            src2 = operand2;
-        } else if (symbol_table.get_offset(operand2) != -1) {
-            outFile << "lw $t1, " << symbol_table.get_offset(operand2) << "($fp)  # load " << operand2 << "\n";
-            src2 = "$t1";
-        } else {
-            outFile << "li $t1, " << operand2 << "\n";
-            src2 = "$t1";
-        }
-       
-        // Allocate a new temporary for the result
-        int reg_num;
-        std::string result_reg = alloc_temp();
-
-        // Emit the operation
-        outFile << "# " << result_reg << " = " << operand1 << " " << token << " " << operand2 << "\n";
-        if (token == "+") outFile << "add " << result_reg << ", " << src1 << ", " << src2 << "\n";
-        else if (token == "-") outFile << "sub " << result_reg << ", " << src1 << ", " << src2 << "\n";
-        else if (token == "*") outFile << "mul " << result_reg << ", " << src1 << ", " << src2 << "\n";
-        else if (token == "/") {
-            outFile << "div " << src1 << ", " << src2 << "\n";
-            outFile << "mflo " << result_reg << "\n";
-        }
-        
-		// Free the source registers if they were temporaries (they are now consumed)
-		free_if_temp(src1);
-		free_if_temp(src2);
-
-        // Push the result register onto the operand stack
-        operand_stack.push(result_reg);
-        }
-    }
-
-    // The final result is in $t2
-    if (operand_stack.size() != 1) {
-        throw std::runtime_error("Invalid postfix expression: Too many operands remaining");
-    }
-    std::string result = operand_stack.top();
-    
-    // If the final result is not already a register (e.g., a constant or variable), load it into a temporary
-    if (result[0] != '$') {
-        bool is_constant = !result.empty() &&
-                           (isdigit(result[0]) || (result[0] == '-' && result.size() > 1 && isdigit(result[1])));
-        std::string temp_reg = alloc_temp();  // get a temporary register
-        if (is_constant) {
-            outFile << "li " << temp_reg << ", " << result << "\n";
+// Sethi–Ullman code generation: the operand needing more registers is evaluated first, the result
+// reuses a temporary operand register. When the pool cannot hold the second operand, the first one
+// is spilled to a stack slot (or, if it is a cached variable, simply unpinned) and fetched again
+// right before the operation.
+// A constant in a fresh register, 0 is read from $zero
+Value emit_constant(int32_t value, CodegenContext& ctx) {
+    if (value == 0) {
+        return Value{Reg::zero, false, 0};
+    }
+    Reg reg = acquire_register(ctx);
+    ctx.code.li(reg, value);
+    return Value{reg, true, 0};
+}
+
+Value emit_expression(const Expr* expr, CodegenContext& ctx) {
+    if (expr->kind == ExprKind::Constant) {
+        return emit_constant(static_cast<const ConstantExpr*>(expr)->value, ctx);
+    }
+    if (expr->kind == ExprKind::Variable) {
+        return load_variable(ctx.symbol_table.get_offset(static_cast<const VariableExpr*>(expr)->symbol), ctx);
+    }
+    auto* bin = static_cast<const BinaryExpr*>(expr);
+    int number = kept_number(expr, ctx);
+    if (number != 0 && ctx.values[number].home != Reg::none) {
+        ++ctx.reused_values;
+        ctx.eliminated_instructions += instruction_count(expr);
+        return reuse_value(number, ctx);
+    }
+    // With a constant operand the other one goes first, the constant may then never need a register
+    const ConstantExpr* constant = reducible_constant(bin, ctx);
+    bool lhs_first = constant != nullptr ? constant == bin->rhs : bin->lhs->reg_need >= bin->rhs->reg_need;
+    const Expr* first = lhs_first ? bin->lhs : bin->rhs;
+    const Expr* second = lhs_first ? bin->rhs : bin->lhs;
+
+    Value first_val = emit_expression(first, ctx);
+    if (constant != nullptr) {
+        Reg dst = emit_reduced(bin->op, first_val, constant->value, ctx);
+        if (dst != Reg::none) {
+            if (!(first_val.owned && first_val.reg == dst)) consume(first_val, ctx);
+            return number != 0 ? keep_value(number, dst, ctx) : Value{dst, true, 0};
+        }
+    }
+    int spill_offset = 0;
+    bool parked = false;
+    if (first_val.reg != Reg::zero && ctx.regs.available_count() < second->reg_need) {
+        if (!first_val.owned && first_val.var > 0 && ctx.regs.pin_count(first_val.reg) == 1) {
+            // A reused value cannot be fetched again, it is spilled like a temporary
+            ctx.regs.unbind(first_val.reg);
+            ctx.values[first_val.var].home = Reg::none;
+            first_val = Value{first_val.reg, true, 0};
+        }
+        parked = first_val.owned || first_val.var < 0;
+    }
+    if (parked) {
+        if (first_val.owned) {
+            spill_offset = ctx.symbol_table.allocate_spill_slot();
+            ctx.code.sw(first_val.reg, spill_offset, Reg::fp, "spill");
+            ++ctx.spills;
+        }
+        consume(first_val, ctx);
+    }
+    Value second_val = emit_expression(second, ctx);
+    if (parked) {
+        if (first_val.owned) {
+            first_val.reg = acquire_register(ctx);
+            ctx.code.lw(first_val.reg, spill_offset, Reg::fp, "reload");
+            ctx.symbol_table.release_spill_slot(spill_offset);
         } else {
-            int offset = symbol_table.get_offset(result);
-            if (offset == -1) {
-                throw std::runtime_error("Undefined variable: " + result);
-            }
-            outFile << "lw " << temp_reg << ", " << offset << "($fp)  # load " << result << "\n";
+            first_val = load_variable(first_val.var, ctx);
+        }
+    }
+
+    Value& lhs = lhs_first ? first_val : second_val;
+    Value& rhs = lhs_first ? second_val : first_val;
+    if (!lhs.owned && !rhs.owned && ctx.regs.available_count() == 0) {
+        // Both operands are cached variables and every other register is pinned
+        int shared = lhs.reg == rhs.reg ? 2 : 1;
+        if (!take_over(lhs, shared, ctx) && !take_over(rhs, shared, ctx)) {
+            throw std::runtime_error("Register pool exhausted");
+        }
+        if (shared == 2) rhs = lhs;
+    }
+    Reg dst = lhs.owned ? lhs.reg : rhs.owned ? rhs.reg : acquire_register(ctx);
+    switch (bin->op) {
+        case BinaryOp::Add: ctx.code.op3(Opcode::Add, dst, lhs.reg, rhs.reg); break;
+        case BinaryOp::Sub: ctx.code.op3(Opcode::Sub, dst, lhs.reg, rhs.reg); break;
+        case BinaryOp::Mul: ctx.code.op3(Opcode::Mul, dst, lhs.reg, rhs.reg); break;
+        case BinaryOp::Div:
+            ctx.code.hilo(Opcode::Div, lhs.reg, rhs.reg);
+            ctx.code.from_hilo(Opcode::Mflo, dst);
+            break;
+        default:
+            break;  // comparisons only compile through the IR (lower.h)
+    }
+
+    // The operands are consumed, the result lives on in dst
+    if (!(lhs.owned && lhs.reg == dst)) consume(lhs, ctx);
+    if (!(rhs.owned && rhs.reg == dst)) consume(rhs, ctx);
+    return number != 0 ? keep_value(number, dst, ctx) : Value{dst, true, 0};
+}
+
+// Evaluates the value assigned to a variable of the type. A register that becomes a char or short
+// variable's home has to hold the narrowed value (sll/sra), a store to the stack slot narrows by
+// itself; constants are narrowed at compile time and narrower variables need nothing.
+Value emit_assigned(const Expr* expr, ValueType type, CodegenContext& ctx) {
+    if (expr->kind == ExprKind::Constant) {
+        return emit_constant(narrow(static_cast<const ConstantExpr*>(expr)->value, type), ctx);
+    }
+    Value value = emit_expression(expr, ctx);
+    if (!ctx.cache_variables || fits_type(ValueType::Int, type) || value.reg == Reg::zero ||
+        (value.var < 0 && fits_type(ctx.variable(value.var).type, type))) {
+        return value;
+    }
+    int shift = 32 - 8 * type_size(type);
+    Reg reg = value.owned ? value.reg : acquire_register(ctx);
+    ctx.code.op_imm(Opcode::Sll, reg, value.reg, shift);
+    ctx.code.op_imm(Opcode::Sra, reg, reg, shift);
+    if (!value.owned) consume(value, ctx);
+    return Value{reg, true, 0};
+}
+
+// Stores an evaluated value into a variable: with register caching the value's register becomes the
+// variable's new home (written back later), otherwise it goes straight to the stack slot
+void assign_variable(int offset, const Value& value, CodegenContext& ctx) {
+    VariableState& state = ctx.variable(offset);
+    if (!ctx.cache_variables) {
+        store_variable(ctx.code, value.reg, offset, state.type);
+        consume(value, ctx);
+        return;
+    }
+    if (value.owned) {
+        if (state.home != Reg::none) {
+            ctx.regs.release(state.home);  // the old value is dead
+        }
+        ctx.regs.bind(value.reg, offset);
+        state.home = value.reg;
+    } else {
+        if (state.home == Reg::none) {
+            state.home = acquire_register(ctx);
+            ctx.regs.bind(state.home, offset);
+        }
+        if (state.home != value.reg) {
+            ctx.code.move(state.home, value.reg);
         }
-        result = temp_reg;
-        // Note: do NOT free this temporary because it is the final value.
+        consume(value, ctx);
     }
-    
-    // Return the register name holding the final result (e.g., "$t3")
-    return result;
+    state.dirty = true;
 }
 
-void process_line(const std::string& line, SymbolTable& symbol_table, 
-                  std::ofstream& outFile, int& temp_var_count) {
-    std::smatch matches;
+// trace receives the Infix/Postfix debug lines of --trace, nullptr when they are off
+void generate_statement(const Stmt* stmt, CodegenContext& ctx, std::ostream* trace) {
+    SymbolTable& symbol_table = ctx.symbol_table;
+    InstructionList& code = ctx.code;
+    switch (stmt->kind) {
 
     // Variable Declaration (e.g., `int a = 0;` OR int a;)
-    if (std::regex_match(line, matches, var_decl_regex)) {
-        std::string var_name = matches[1];
-        int value = matches[2].matched ? std::stoi(matches[2].str()) : 0;
+    case StmtKind::Declaration: {
+        auto* decl = static_cast<const DeclarationStmt*>(stmt);
+        std::string_view var_name = decl->name;
 
         // Allocate space for the variable in the symbol table
-        if (!symbol_table.add_variable(var_name)) {
-            outFile << "# Error: Variable '" << var_name << "' already declared.\n";
+        if (!symbol_table.add_variable(decl->symbol, decl->needs_slot)) {
+            code.comment(code.note({"Error: Variable '", var_name, "' already declared."}));
             return;
         }
-		int offset = symbol_table.get_offset(var_name);
-		
-        // If initialized with a value, store the value
-        if (value != 0) {
-            outFile << "li $t0, " << value << "\n";
-            outFile << "sw $t0, " << offset << "($fp)  # Store " << var_name << " with value\n";
-        } else {
+        int offset = symbol_table.get_offset(decl->symbol);
+        VariableState& state = ctx.declare_variable(decl->symbol, var_name);
+        const Expr* init = decl->init;
+
+        if (!decl->store_init) {
+            // The initial value is never read, nothing to store
+        } else if (init == nullptr || (init->kind == ExprKind::Constant && static_cast<const ConstantExpr*>(init)->value == 0)) {
             // Zero initialize the variable
-        	outFile << "sw $zero, " << offset << "($fp)  # " << var_name << " (int)\n";
-		}
-    }
-    
-    // Assignment (e.g., `a = 5 ;`)
-    else if (std::regex_match(line, matches, assign_regex)) {
-        std::string var_name = matches[1];
-        int value = std::stoi(matches[2]);
-
-        int offset = symbol_table.get_offset(var_name);
-        if (offset == -1) {
-            outFile << "# Error: Variable '" << var_name << "' not declared.\n";
+            store_variable(ctx.code, Reg::zero, offset, state.type, code.note({var_name, " (", type_name(state.type), ")"}));
+        } else {
+            // If initialized with a value, store the value
+            if (!check_variables(init, symbol_table, code)) {
+                return;
+            }
+            code.comment(code.note({"Initialize ", var_name}));
+            assign_variable(offset, emit_assigned(init, state.type, ctx), ctx);
+        }
+        break;
+    }
+
+    // Assignment (e.g., `a = 5;` or `d = a + b * c;`)
+    case StmtKind::Assignment: {
+        auto* assign = static_cast<const AssignmentStmt*>(stmt);
+        int offset = symbol_table.get_offset(assign->symbol);
+        if (offset == SymbolTable::undeclared) {
+            code.comment(code.note({"Error: Variable '", assign->name, "' not declared."}));
+            return;
+        }
+
+        if (assign->value->kind == ExprKind::Constant) {
+            std::string value = std::to_string(static_cast<const ConstantExpr*>(assign->value)->value);
+            code.comment(code.note({"Assignment: ", assign->name, " = ", value}));
+            assign_variable(offset, emit_assigned(assign->value, symbol_table.get_type(assign->symbol), ctx), ctx);
+            return;
+        }
+
+        if (trace != nullptr) {
+            *trace << "Infix: ";
+            print_infix(*trace, assign->value);
+            *trace << '\n';
+            *trace << "Postfix: ";
+            print_postfix(*trace, assign->value);
+            *trace << '\n';
+        }
+
+        if (!check_variables(assign->value, symbol_table, code)) {
             return;
         }
+        Value result = emit_assigned(assign->value, symbol_table.get_type(assign->symbol), ctx);
 
-        outFile << "# Assignment: " << var_name << " = " << value << "\n";
-        outFile << "li $t0, " << value << "\n";
-        outFile << "sw $t0, " << offset << "($fp)\n";
+        // Store the result of the expression in the variable
+        if (!ctx.cache_variables) {
+            code.comment(code.note({"Store result in ", assign->name}));
+        }
+        assign_variable(offset, result, ctx);
+        break;
     }
-    
-    // Return statement (e.g., `return a ;`)
-    else if (std::regex_match(line, matches, return_regex)) {
-        std::string var_name = matches[1];
 
-        if (!var_name.empty()) {
-            int offset = symbol_table.get_offset(var_name);
-            if (offset == -1) {
-                outFile << "# Error: Variable '" << var_name << "' not declared.\n";
+    // Return statement (e.g., `return a;`)
+    case StmtKind::Return: {
+        const Expr* value = static_cast<const ReturnStmt*>(stmt)->value;
+        if (value == nullptr) {
+            code.comment("Return: void");
+            code.move(Reg::v0, Reg::zero);
+        } else if (value->kind == ExprKind::Variable) {
+            std::string_view var_name = static_cast<const VariableExpr*>(value)->name;
+            int offset = symbol_table.get_offset(static_cast<const VariableExpr*>(value)->symbol);
+            if (offset == SymbolTable::undeclared) {
+                code.comment(code.note({"Error: Variable '", var_name, "' not declared."}));
                 return;
             }
-            outFile << "# Return: " << var_name << "\n";
-            outFile << "lw $v0, " << offset << "($fp)\n";
+            code.comment(code.note({"Return: ", var_name}));
+            const VariableState& state = ctx.variable(offset);
+            Reg home = ctx.cache_variables ? state.home : Reg::none;
+            if (home != Reg::none) {
+                code.move(Reg::v0, home);
+            } else {
+                code.load(load_opcode(state.type), Reg::v0, offset, Reg::fp);
+            }
+        } else if (value->kind == ExprKind::Constant) {
+            int32_t constant = static_cast<const ConstantExpr*>(value)->value;
+            code.comment(code.note({"Return: ", std::to_string(constant)}));
+            code.li(Reg::v0, constant);
         } else {
-            outFile << "# Return: void\n";
-            outFile << "move $v0, $zero\n";
-        }
-    }
-    
-    // Arithmetic Expressions (e.g., `d = a + b * c;`)
-    else if (line.find('=') != std::string::npos) {
-        size_t eq_pos = line.find('=');
-        std::string var_name = line.substr(0, eq_pos);
-        var_name.erase(var_name.find_last_not_of(" ")+1); // Trim spaces
-
-        std::string expr = line.substr(eq_pos + 1);
-        expr.erase(0, expr.find_first_not_of(" ")); // Trim spaces
-        expr.pop_back(); // Remove semicolon
-
-        // Convert infix to postfix using Dijkstra’s Algorithm
-        std::string postfix_expr = infix_to_postfix(expr);
-		
-        // Convert postfix to MIPS assembly
-        std::string result_register = convert_postfix_to_mips(postfix_expr, symbol_table, outFile, temp_var_count);
-        
-        if (result_register.empty()) {
-            outFile << "# Error: Processed expression is empty\n";
-            return;
+            if (!check_variables(value, symbol_table, code)) {
+                return;
+            }
+            Value result = emit_expression(value, ctx);
+            code.comment("Return: expression");
+            code.move(Reg::v0, result.reg);
+            consume(result, ctx);
         }
+        break;
+    }
 
-        // Get the offset for the target variable
-        int offset = symbol_table.get_offset(var_name);
-        if (offset == -1) {
-            outFile << "# Error: Variable '" << var_name << "' not declared.\n";
-            return;
-        }
-		
-        // Store the result of the expression in the variable
-        outFile << "# Store result in " << var_name << "\n" << "sw " << result_register << ", " << offset << "($fp)\n";
+    case StmtKind::If:
+    case StmtKind::While:
+    case StmtKind::Function:
+    case StmtKind::Block:
+        break;  // control flow only compiles through the IR (lower.h)
+    case StmtKind::Error:
+        code.comment(code.note({"Error: ", static_cast<const ErrorStmt*>(stmt)->message}));
+        break;
     }
 }
 
+// Incremental recompilation (--incremental, incremental.h). The code of a statement depends on the
+// statement itself, on the state the statements before it left behind (register pool, cached
+// variables and values, symbol table, saved registers) and, once the pool runs dry, on how soon the
+// cached variables and values are needed again. Statements are replayed in segments so the
+// bookkeeping is not paid per statement: the entry hash chain covers the state, the fingerprint the
+// statements and the look-ahead hash the next uses after the segment; the effect records how
+// generating the segment changed the state, so replaying it leaves the same state behind.
 
-int main(int argc, char* argv[]) {
-    // Check argument count: must be 2 (input file) or 3 (input file + debug flag)
-    if (argc < 2 || argc > 3) {
-        std::cerr << "Usage: " << argv[0] << " <input_file.c> [--debug|-d]" << std::endl;
-        return 1;
+// Statements from index to the next mention in a sorted list of statement indices
+uint64_t distance_from(const std::vector<uint32_t>* uses, uint32_t index) {
+    if (uses == nullptr) return UINT64_MAX;
+    auto it = std::lower_bound(uses->begin(), uses->end(), index);
+    return it == uses->end() ? UINT64_MAX : *it - index;
+}
+
+// How generating a segment changed the code generator state
+struct SegmentEffect {
+    struct Cached {
+        int owner;
+        Reg home;
+        bool dirty;
+    };
+
+    RegisterAllocator::Snapshot regs{};
+    int next_offset = 0;
+    std::vector<int> released_slots;
+    std::vector<std::pair<std::string_view, int>> declared;  // variables added, with their offsets
+    std::vector<Cached> owners;            // variables and values whose caching state may have changed
+    std::vector<uint32_t> remaining_uses;  // per value number the segment computes
+    uint32_t saved_mask = 0;
+    std::vector<std::pair<Reg, int>> saved_registers;  // saved in the segment
+
+    // The register pool is stored as the change from entry, the pool state the segment started with
+    void write(ByteWriter& out, const RegisterAllocator::Snapshot& entry) const {
+        out.u32(regs.free_mask);
+        out.u32(regs.used_mask);
+        out.u32(regs.cached_mask);
+        uint32_t rebound = 0;  // cached registers with another owner than at entry
+        uint32_t pinned = 0;
+        for (int i = 0; i < RegisterAllocator::size(); ++i) {
+            if (regs.cached_mask >> i & 1 && !(entry.cached_mask >> i & 1 && entry.owner[i] == regs.owner[i])) {
+                rebound |= 1u << i;
+            }
+            if (regs.pins[i] != 0) pinned |= 1u << i;
+        }
+        out.u32(rebound);
+        for (int i = 0; i < RegisterAllocator::size(); ++i) {
+            if (rebound >> i & 1) out.i32(regs.owner[i]);
+        }
+        out.u32(pinned);
+        for (int i = 0; i < RegisterAllocator::size(); ++i) {
+            if (pinned >> i & 1) out.u32(regs.pins[i]);
+        }
+        out.i32(next_offset);
+        out.u32((uint32_t)released_slots.size());
+        for (int offset : released_slots) out.i32(offset);
+        out.u32((uint32_t)declared.size());
+        for (const auto& [name, offset] : declared) {
+            out.string(name);
+            out.i32(offset);
+        }
+        out.u32((uint32_t)owners.size());
+        for (const Cached& cached : owners) {
+            out.i32(cached.owner);
+            out.u8((uint32_t)cached.home);
+            out.u8(cached.dirty);
+        }
+        out.u32((uint32_t)remaining_uses.size());
+        for (uint32_t uses : remaining_uses) out.u32(uses);
+        out.u32(saved_mask);
+        out.u32((uint32_t)saved_registers.size());
+        for (const auto& [reg, offset] : saved_registers) {
+            out.u8((uint32_t)reg);
+            out.i32(offset);
+        }
     }
 
-    // Determine whether to write the default MIPS setup
-    bool write_setup = false;
-    if (argc == 3) {
-        // If a third argument is present, it must be the debug flag
-        if (std::strcmp(argv[2], "--debug") == 0 || std::strcmp(argv[2], "-d") == 0) {
-            write_setup = true;
-        } else {
-            std::cerr << "Error: Invalid optional argument. Use --debug or -d for local debugging." << std::endl;
-            return 1;
+    bool read(ByteReader& in, const RegisterAllocator::Snapshot& entry) {
+        regs = RegisterAllocator::Snapshot{};
+        regs.free_mask = in.u32();
+        regs.used_mask = in.u32();
+        regs.cached_mask = in.u32();
+        uint32_t rebound = in.u32();
+        for (int i = 0; i < RegisterAllocator::size(); ++i) {
+            if (rebound >> i & 1) {
+                regs.owner[i] = in.i32();
+            } else if (regs.cached_mask >> i & 1) {
+                regs.owner[i] = entry.owner[i];
+            }
+        }
+        uint32_t pinned = in.u32();
+        for (int i = 0; i < RegisterAllocator::size(); ++i) {
+            if (pinned >> i & 1) regs.pins[i] = (uint16_t)in.u32();
+        }
+        next_offset = in.i32();
+        released_slots.clear();
+        for (uint32_t n = in.u32(); n > 0 && in.ok; --n) released_slots.push_back(in.i32());
+        declared.clear();
+        for (uint32_t n = in.u32(); n > 0 && in.ok; --n) {
+            std::string_view name = in.string();
+            declared.push_back({name, in.i32()});
+        }
+        owners.clear();
+        for (uint32_t n = in.u32(); n > 0 && in.ok; --n) {
+            int owner = in.i32();
+            uint8_t home = (uint8_t)in.u8();
+            bool dirty = in.u8() != 0;
+            if (!valid_register(home)) return false;
+            owners.push_back(Cached{owner, (Reg)home, dirty});
+        }
+        remaining_uses.clear();
+        for (uint32_t n = in.u32(); n > 0 && in.ok; --n) remaining_uses.push_back(in.u32());
+        saved_mask = in.u32();
+        saved_registers.clear();
+        for (uint32_t n = in.u32(); n > 0 && in.ok; --n) {
+            uint8_t reg = (uint8_t)in.u8();
+            if (!is_callee_saved((Reg)reg)) return false;
+            saved_registers.push_back({(Reg)reg, in.i32()});
+        }
+        // Registers outside the pool and slots above the frame pointer cannot come from a build
+        uint32_t pool = RegisterAllocator::size() < 32 ? (1u << RegisterAllocator::size()) - 1 : ~0u;
+        if (((regs.free_mask | regs.used_mask | regs.cached_mask) & ~pool) != 0 || next_offset > 0 || next_offset % 4 != 0) {
+            return false;
+        }
+        for (int offset : released_slots) {
+            if (offset < next_offset || offset >= 0 || offset % 4 != 0) return false;
+        }
+        return in.ok && in.done();
+    }
+};
+
+// Generates the statements of a unit segment by segment, replaying the segments the previous build
+// generated from the same state. Segment boundaries depend on the statements only, so they line up
+// again after an inserted or deleted statement.
+class IncrementalCodegen {
+private:
+    static constexpr size_t min_segment = 4;
+    static constexpr size_t max_segment = 64;
+    static constexpr uint32_t never = UINT32_MAX;
+
+    CodegenContext& ctx;
+    IncrementalState& incremental;
+    const Interner& interner;  // symbol ids differ between builds, the records hold names
+    Hash128 state;             // entry hash chain
+
+    // Every statement's key hash and the variables (symbol ids) and kept values it mentions, in
+    // program order. next_name and next_number hold the statement of the following mention, never
+    // for the last one.
+    std::vector<Hash128> keys;
+    std::vector<uint32_t> names;
+    std::vector<int> numbers;
+    std::vector<uint32_t> name_begin;
+    std::vector<uint32_t> number_begin;
+    std::vector<uint32_t> next_name;
+    std::vector<uint32_t> next_number;
+
+    // Buffers for the current segment, kept from segment to segment
+    std::vector<int> owners;
+    RegisterAllocator::Snapshot entry_regs;
+    SegmentEffect effect;
+    ByteWriter key;
+    ByteWriter segment_key;
+    ByteWriter effect_bytes;
+    ByteWriter stats;
+    ByteWriter block;
+
+    void write_key(const Expr* expr) {
+        key.u8((uint32_t)expr->kind);
+        switch (expr->kind) {
+            case ExprKind::Constant:
+                key.i32(static_cast<const ConstantExpr*>(expr)->value);
+                break;
+            case ExprKind::Variable:
+                key.string(static_cast<const VariableExpr*>(expr)->name);
+                names.push_back(static_cast<const VariableExpr*>(expr)->symbol);
+                break;
+            case ExprKind::Binary: {
+                auto* bin = static_cast<const BinaryExpr*>(expr);
+                int number = kept_number(expr, ctx);
+                key.u8((uint32_t)bin->op);
+                key.i32(number);
+                if (number != 0) numbers.push_back(number);
+                write_key(bin->lhs);
+                write_key(bin->rhs);
+                break;
+            }
+            case ExprKind::Call:  // calls only compile through the IR (lower.h)
+                break;
         }
     }
 
-    // Get the input filename from the command-line arguments
-    std::string input_filename = argv[1];
+    // Hash of everything code generation reads from the statement
+    Hash128 statement_key(const Stmt* stmt) {
+        key.bytes.clear();
+        key.u8((uint32_t)stmt->kind);
+        const Expr* expr = nullptr;
+        switch (stmt->kind) {
+            case StmtKind::Declaration: {
+                auto* decl = static_cast<const DeclarationStmt*>(stmt);
+                key.string(decl->name);
+                key.u8((uint32_t)decl->type);
+                key.i32(ctx.symbol_table.planned_offset(decl->symbol));
+                key.u8(decl->store_init);
+                key.u8(decl->needs_slot);
+                names.push_back(decl->symbol);
+                expr = decl->init;
+                break;
+            }
+            case StmtKind::Assignment: {
+                auto* assign = static_cast<const AssignmentStmt*>(stmt);
+                key.string(assign->name);
+                names.push_back(assign->symbol);
+                expr = assign->value;
+                break;
+            }
+            case StmtKind::Return:
+                expr = static_cast<const ReturnStmt*>(stmt)->value;
+                break;
+            case StmtKind::If:
+            case StmtKind::While:
+            case StmtKind::Function:
+            case StmtKind::Block:
+                break;  // control flow only compiles through the IR (lower.h)
+            case StmtKind::Error:
+                key.string(static_cast<const ErrorStmt*>(stmt)->message);
+                break;
+        }
+        key.u8(expr != nullptr);
+        if (expr != nullptr) write_key(expr);
+        Hash128 hash;
+        hash.add(key.bytes);
+        return hash;
+    }
 
-    std::ifstream input_file(input_filename);
-    if (!input_file.is_open()) {
-        std::cerr << "Error: Could not open file.\n";
-        return 1;
+    // Keys and mentions of all statements, linked backwards from the end of the program
+    void scan(const std::vector<Stmt*>& statements) {
+        size_t count = statements.size();
+        keys.resize(count);
+        name_begin.resize(count + 1);
+        number_begin.resize(count + 1);
+        for (size_t i = 0; i < count; ++i) {
+            name_begin[i] = (uint32_t)names.size();
+            number_begin[i] = (uint32_t)numbers.size();
+            keys[i] = statement_key(statements[i]);
+        }
+        name_begin[count] = (uint32_t)names.size();
+        number_begin[count] = (uint32_t)numbers.size();
+
+        next_name.assign(names.size(), never);
+        next_number.assign(numbers.size(), never);
+        std::vector<uint32_t> following_name(ctx.use_positions.size(), never);
+        std::vector<uint32_t> following_number(ctx.remaining_uses.size(), never);
+        for (size_t i = count; i-- > 0;) {
+            for (uint32_t m = name_begin[i]; m < name_begin[i + 1]; ++m) next_name[m] = following_name[names[m]];
+            for (uint32_t m = name_begin[i]; m < name_begin[i + 1]; ++m) following_name[names[m]] = (uint32_t)i;
+            for (uint32_t m = number_begin[i]; m < number_begin[i + 1]; ++m) next_number[m] = following_number[numbers[m]];
+            for (uint32_t m = number_begin[i]; m < number_begin[i + 1]; ++m) following_number[numbers[m]] = (uint32_t)i;
+        }
     }
 
-    std::ofstream outFile("output.s");
-    if (!outFile) {
-        std::cerr << "Error opening file for writing!\n";
-        return 1;
+    // Next uses from the end of the segment on of everything it mentions or found cached, which
+    // together with the uses inside the segment is what choosing an eviction victim looks at. Only
+    // the last mention of a name in the segment has its next one at or after the end.
+    Hash128 lookahead(uint32_t begin, uint32_t end) {
+        key.bytes.clear();
+        for (uint32_t m = name_begin[begin]; m < name_begin[end]; ++m) {
+            if (next_name[m] >= end) key.u64(next_name[m] == never ? UINT64_MAX : next_name[m] - end);
+        }
+        for (uint32_t m = number_begin[begin]; m < number_begin[end]; ++m) {
+            if (next_number[m] >= end) key.u64(next_number[m] == never ? UINT64_MAX : next_number[m] - end);
+        }
+        for (int i = 0; i < RegisterAllocator::size(); ++i) {
+            if (!(entry_regs.cached_mask >> i & 1)) continue;
+            key.i32(entry_regs.owner[i]);
+            key.u64(distance_from(cache_entry(ctx, entry_regs.owner[i]).uses, end));
+        }
+        Hash128 hash;
+        hash.add(key.bytes);
+        return hash;
     }
 
-    // Write the default MIPS setup only if the debug flag is provided (local mode)
-    if (write_setup) {
-        outFile << ".text\n";
-        outFile << ".globl main\n";
-        outFile << "main:\n";
-        outFile << "move $fp, $sp\n";
-        outFile << "addiu $sp, $sp, -0x100\n";
-    }
-
-    int temp_var_count = 0;
-    SymbolTable symbol_table;
-
-    for (std::string line; std::getline(input_file, line); ) {
-        process_line(line, symbol_table, outFile, temp_var_count);
-    }
-
-	if (write_setup) {
-		// (rest of the code: printing integer and exiting)
-		outFile << "# Printing Integer\n";
-		outFile << "move $a0, $v0\n";
-		outFile << "li $v0, 1\n";
-		outFile << "syscall\n";
-		
-		outFile << "# exiting gracefully\n";
-		outFile << "li $v0, 10\n";
-		outFile << "syscall\n";
-    }
-    
-    input_file.close();
-    outFile.close();
+    // A cached variable or value only changes when the segment mentions it or its register changes
+    // hands, everything else keeps its state
+    void capture(uint32_t begin, uint32_t end, size_t entry_saved_registers) {
+        SymbolTable& symbol_table = ctx.symbol_table;
+        effect.regs = ctx.regs.snapshot();
+        effect.next_offset = symbol_table.next_free_offset();
+        effect.released_slots = symbol_table.released_slots();
+
+        owners.assign(numbers.begin() + number_begin[begin], numbers.begin() + number_begin[end]);
+        for (uint32_t m = name_begin[begin]; m < name_begin[end]; ++m) {
+            if (next_name[m] < end) continue;  // mentioned again in the segment
+            int offset = symbol_table.get_offset(names[m]);
+            if (offset != SymbolTable::undeclared && offset != SymbolTable::no_slot) owners.push_back(offset);
+        }
+        for (int i = 0; i < RegisterAllocator::size(); ++i) {
+            bool was_cached = entry_regs.cached_mask >> i & 1;
+            bool is_cached = effect.regs.cached_mask >> i & 1;
+            if (was_cached && is_cached && entry_regs.owner[i] == effect.regs.owner[i]) continue;
+            if (was_cached) owners.push_back(entry_regs.owner[i]);
+            if (is_cached) owners.push_back(effect.regs.owner[i]);
+        }
+        std::sort(owners.begin(), owners.end());
+        owners.erase(std::unique(owners.begin(), owners.end()), owners.end());
+        effect.owners.clear();
+        for (int owner : owners) {
+            const VariableState& state = cache_entry(ctx, owner);
+            effect.owners.push_back(SegmentEffect::Cached{owner, state.home, state.dirty});
+        }
+        effect.remaining_uses.clear();
+        for (uint32_t m = number_begin[begin]; m < number_begin[end]; ++m) {
+            effect.remaining_uses.push_back(ctx.remaining_uses[numbers[m]]);
+        }
+        effect.saved_mask = ctx.saved_mask;
+        effect.saved_registers.assign(ctx.saved_registers.begin() + entry_saved_registers, ctx.saved_registers.end());
+    }
+
+    // Puts the state after the segment in place, as generating it would have left it
+    void apply(uint32_t begin) {
+        ctx.regs.restore(effect.regs);
+        ctx.symbol_table.restore_slots(effect.next_offset, effect.released_slots);
+        for (const auto& [name, offset] : effect.declared) {
+            uint32_t symbol = interner.find(name);  // mentioned by the segment, so interned
+            ctx.symbol_table.restore_variable(symbol, offset);
+            ctx.declare_variable(symbol, interner.name(symbol));
+        }
+        for (const SegmentEffect::Cached& cached : effect.owners) {
+            VariableState& state = cache_entry(ctx, cached.owner);
+            state.home = cached.home;
+            state.dirty = cached.dirty;
+            if (cached.owner > 0 && state.home != Reg::none && state.uses == nullptr) {
+                state.uses = &ctx.value_numbering->positions[cached.owner];
+            }
+        }
+        for (size_t i = 0; i < effect.remaining_uses.size(); ++i) {
+            ctx.remaining_uses[numbers[number_begin[begin] + i]] = effect.remaining_uses[i];
+        }
+        ctx.saved_mask = effect.saved_mask;
+        ctx.saved_registers.insert(ctx.saved_registers.end(), effect.saved_registers.begin(), effect.saved_registers.end());
+    }
+
+    // A variable slot or value number of this build
+    bool valid_owner(int owner) const {
+        return owner < 0 ? ctx.symbol_table.is_variable_slot(owner) : owner > 0 && (size_t)owner < ctx.remaining_uses.size();
+    }
+
+    // The effect only names variables and values this build has
+    bool fits_build() const {
+        for (int i = 0; i < RegisterAllocator::size(); ++i) {
+            if (effect.regs.cached_mask >> i & 1 && !valid_owner(effect.regs.owner[i])) return false;
+        }
+        for (const SegmentEffect::Cached& cached : effect.owners) {
+            if (!valid_owner(cached.owner)) return false;
+        }
+        for (const auto& [name, offset] : effect.declared) {
+            uint32_t symbol = interner.find(name);
+            if (symbol == Interner::none) return false;
+            if (offset != SymbolTable::no_slot &&
+                (!ctx.symbol_table.is_variable_slot(offset) || ctx.symbol_table.symbol_at(offset) != symbol)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool replay(const Hash128& entry, const Hash128& fingerprint, uint32_t begin, uint32_t end) {
+        IncrementalState::Replay replay;
+        if (!incremental.find(entry, fingerprint, replay)) return false;
+        if (replay.looked_ahead && replay.lookahead != lookahead(begin, end)) return false;
+        ByteReader effect_in(replay.effect);
+        ByteReader stats_in(replay.stats);
+        ByteReader code_in(replay.code);
+        if (!effect.read(effect_in, entry_regs) || effect.remaining_uses.size() != number_begin[end] - number_begin[begin] ||
+            !fits_build()) {
+            return false;
+        }
+        int spills = stats_in.i32();
+        int reused_values = stats_in.i32();
+        int eliminated_instructions = stats_in.i32();
+        int reduced_operations = stats_in.i32();
+        if (!stats_in.ok || !stats_in.done()) return false;
+        std::vector<Instr>& code = ctx.code.instructions();
+        size_t first = code.size();
+        if (!read_instructions(code_in, ctx.code) || !code_in.done()) {
+            code.resize(first);  // damaged record, generate the segment after all
+            return false;
+        }
+        apply(begin);
+        ctx.spills += spills;
+        ctx.reused_values += reused_values;
+        ctx.eliminated_instructions += eliminated_instructions;
+        ctx.reduced_operations += reduced_operations;
+        state.add(replay.effect);
+        incremental.add(entry, fingerprint, replay);
+        return true;
+    }
+
+    void generate(const Hash128& entry, const Hash128& fingerprint, const std::vector<Stmt*>& statements,
+                  uint32_t begin, uint32_t end) {
+        std::vector<Instr>& code = ctx.code.instructions();
+        size_t first = code.size();
+        size_t entry_saved_registers = ctx.saved_registers.size();
+        int spills = ctx.spills;
+        int reused_values = ctx.reused_values;
+        int eliminated_instructions = ctx.eliminated_instructions;
+        int reduced_operations = ctx.reduced_operations;
+        effect.declared.clear();
+        ctx.looked_ahead = false;
+        for (uint32_t i = begin; i < end; ++i) {
+            const Stmt* stmt = statements[i];
+            auto* decl = stmt->kind == StmtKind::Declaration ? static_cast<const DeclarationStmt*>(stmt) : nullptr;
+            bool new_name = decl != nullptr && ctx.symbol_table.get_offset(decl->symbol) == SymbolTable::undeclared;
+            generate_statement(stmt, ctx, nullptr);
+            if (new_name) {
+                effect.declared.push_back({decl->name, ctx.symbol_table.get_offset(decl->symbol)});
+            }
+            ++ctx.statement_index;
+        }
+        capture(begin, end, entry_saved_registers);
+
+        effect_bytes.bytes.clear();
+        effect.write(effect_bytes, entry_regs);
+        stats.bytes.clear();
+        stats.i32(ctx.spills - spills);
+        stats.i32(ctx.reused_values - reused_values);
+        stats.i32(ctx.eliminated_instructions - eliminated_instructions);
+        stats.i32(ctx.reduced_operations - reduced_operations);
+        block.bytes.clear();
+        write_instructions(block, code.data() + first, code.data() + code.size());
+        IncrementalState::Replay replay{ctx.looked_ahead, ctx.looked_ahead ? lookahead(begin, end) : Hash128(),
+                                        effect_bytes.bytes, stats.bytes, block.bytes};
+        state.add(effect_bytes.bytes);
+        incremental.add(entry, fingerprint, replay);
+    }
+
+public:
+    IncrementalCodegen(CodegenContext& ctx, IncrementalState& incremental, const Interner& interner)
+        : ctx(ctx), incremental(incremental), interner(interner) {}
+
+    void run(const Program& program) {
+        const std::vector<Stmt*>& statements = program.statements;
+        scan(statements);
+        // A record that does not decode means a damaged file: nothing is replayed then
+        RegisterAllocator::Snapshot start = ctx.regs.snapshot();
+        InstructionList scratch;
+        incremental.validate([&](const IncrementalState::Replay& replay) {
+            ByteReader effect_in(replay.effect);
+            ByteReader stats_in(replay.stats);
+            ByteReader code_in(replay.code);
+            scratch.instructions().clear();
+            stats_in.take(16);
+            return effect.read(effect_in, start) && stats_in.ok && stats_in.done() &&
+                   read_instructions(code_in, scratch) && code_in.done();
+        });
+        // Spill slots start below all variables, which depends on declarations anywhere in the program
+        key.bytes.clear();
+        key.i32(ctx.symbol_table.next_free_offset());
+        state.add(key.bytes);
+        uint32_t begin = 0;
+        while (begin < statements.size()) {
+            // A segment ends after a statement whose key has its low four bits clear
+            uint32_t end = begin;
+            segment_key.bytes.clear();
+            while (end < statements.size()) {
+                const Hash128& statement = keys[end++];
+                segment_key.u64(statement.low);
+                segment_key.u64(statement.high);
+                size_t length = end - begin;
+                if (length >= max_segment || (length >= min_segment && (statement.low & 15) == 0)) break;
+            }
+            for (uint32_t m = number_begin[begin]; m < number_begin[end]; ++m) {
+                segment_key.u32(ctx.remaining_uses[numbers[m]]);
+            }
+            Hash128 fingerprint;
+            fingerprint.add(segment_key.bytes);
+
+            Hash128 entry = state;
+            entry_regs = ctx.regs.snapshot();
+            if (replay(entry, fingerprint, begin, end)) {
+                ctx.statement_index = end;
+                incremental.reused += end - begin;
+            } else {
+                generate(entry, fingerprint, statements, begin, end);
+                incremental.generated += end - begin;
+            }
+            begin = end;
+        }
+    }
+};
+
+// Code generation from the IR (-O0/-O1/-O2). Instructions are selected one at a time in program
+// order, values take registers from the same pool as the statement code generator: a value gets one
+// at its definition and keeps it until its last use. When the pool runs dry, the value needed
+// furthest in the future is evicted (Belady); values are never redefined, so each is spilled at most
+// once and every later eviction just drops it. Constants are not spilled but loaded again with li,
+// and 0 is read from $zero.
+//
+// With control flow the registers only cache values within a block. Values read in other blocks
+// than their own, phis and phi arguments ("global" values) keep one location for their whole
+// lifetime instead: a linear scan over the hulls of their live ranges in code order gives them
+// registers taken out of the pool ($s0 up, at most 8, the rest stays for the blocks), the others a
+// stack slot written right after the definition. A phi becomes a parallel copy at the end of each
+// predecessor, comparisons feeding a branch become beq/bne/bltz/.. directly.
+class IrCodegen {
+private:
+    // Where a global value lives at the edges, or a constant source of an edge copy
+    struct Location {
+        Reg reg = Reg::none;  // Reg::none for a stack slot
+        int slot = 0;
+        bool constant = false;
+        int32_t imm = 0;
+
+        bool operator==(const Location& other) const {
+            return reg == other.reg && constant == other.constant && (reg != Reg::none || slot == other.slot) &&
+                   (!constant || imm == other.imm);
+        }
+    };
+
+    struct Move {
+        Location dst;
+        Location src;
+    };
+
+    const IrFunction& function;
+    SymbolTable& symbol_table;
+    InstructionList& code;
+    bool immediates;  // add/sub of a 16-bit constant as addiu
+    RegisterAllocator regs;
+    std::vector<Reg> homes;         // by value, the register holding it or Reg::none
+    std::vector<int> spill_slots;   // by value, 0 until spilled
+    // Instruction indices reading each value: use_positions[use_begin[v] .. use_begin[v + 1]),
+    // next_use[v] is the cursor of the eviction's look-ahead
+    std::vector<uint32_t> use_begin;
+    std::vector<uint32_t> use_positions;
+    std::vector<uint32_t> next_use;
+    uint32_t position = 0;          // index of the instruction being selected
+    std::vector<std::pair<Reg, int>> saved_registers;
+    uint32_t saved_mask = 0;
+    bool leaf = false;              // a function calling nothing
+    std::string_view label_prefix;  // ".L" in main, ".L<function>_" in a function
+
+    // Control flow only, cfg is nullptr for straight-line code
+    const ControlFlowGraph* cfg = nullptr;
+    std::vector<bool> global;               // by value, read outside its block or a phi (argument)
+    std::vector<Reg> global_registers;      // by value, the register of a global value, Reg::none for a slot
+    std::vector<std::string_view> label_names;  // by label number, codegen labels after the IR's
+    std::vector<size_t> label_positions;    // by label number, index of the emitted label
+    std::vector<bool> referenced;           // by label number, some branch goes there
+    uint32_t labels = 0;
+
+    void collect_uses() {
+        use_begin.assign(function.values + 1, 0);
+        for (const IrInstr& in : function.code) {
+            if (in.a != ir_none) ++use_begin[in.a + 1];
+            if (in.b != ir_none) ++use_begin[in.b + 1];
+        }
+        for (uint32_t v = 0; v < function.values; ++v) use_begin[v + 1] += use_begin[v];
+        use_positions.resize(use_begin[function.values]);
+        next_use.assign(use_begin.begin(), use_begin.end() - 1);
+        for (uint32_t i = 0; i < function.code.size(); ++i) {
+            const IrInstr& in = function.code[i];
+            if (in.a != ir_none) use_positions[next_use[in.a]++] = i;
+            if (in.b != ir_none) use_positions[next_use[in.b]++] = i;
+        }
+        next_use.assign(use_begin.begin(), use_begin.end() - 1);
+    }
+
+    // Instructions until the value is read again
+    uint64_t distance(uint32_t value) {
+        uint32_t& k = next_use[value];
+        while (k < use_begin[value + 1] && use_positions[k] < position) ++k;
+        return k == use_begin[value + 1] ? UINT64_MAX : use_positions[k] - position;
+    }
+
+    // True when the current instruction is the value's last use
+    bool dies(uint32_t value) const {
+        uint32_t end = use_begin[value + 1];
+        return end == use_begin[value] || use_positions[end - 1] <= position;
+    }
+
+    // True for a global value living in a register of its own
+    bool fixed(uint32_t value) const {
+        return cfg != nullptr && global_registers[value] != Reg::none;
+    }
+
+    bool is_constant(uint32_t value) const { return function.def(value).op == IrOp::Const; }
+
+    bool is_zero(uint32_t value) const { return is_constant(value) && function.def(value).imm == 0; }
+
+    void evict(Reg reg, uint32_t value) {
+        if (function.def(value).op != IrOp::Const && spill_slots[value] == 0) {
+            spill_slots[value] = symbol_table.allocate_spill_slot();
+            code.sw(reg, spill_slots[value], Reg::fp, "spill");
+            ++spills;
+        }
+        homes[value] = Reg::none;
+        regs.release(reg);
+    }
+
+    // The first use of a callee-saved register stores the caller's value. With control flow the
+    // first use may be in a loop or on one path only, the stores go to the top of the code then.
+    void save(Reg reg) {
+        if (!is_callee_saved(reg) || (saved_mask >> (int)reg & 1)) return;
+        int offset = symbol_table.allocate_spill_slot();
+        saved_mask |= 1u << (int)reg;
+        saved_registers.push_back({reg, offset});
+        if (cfg == nullptr) code.sw(reg, offset, Reg::fp, code.note({"save ", reg_name(reg)}));
+    }
+
+    // A free register, evicting a value when there is none
+    Reg acquire() {
+        Reg reg = regs.alloc();
+        if (reg == Reg::none) {
+            Reg victim = regs.pick_victim([&](int value) { return distance((uint32_t)value); });
+            if (victim == Reg::none) {
+                // Cannot happen: at most two operands are pinned at a time
+                throw std::runtime_error("Register pool exhausted");
+            }
+            regs.for_each_cached([&](Reg cached, int value) {
+                if (cached == victim) evict(cached, (uint32_t)value);
+            });
+            reg = regs.alloc();
+        }
+        save(reg);
+        return reg;
+    }
+
+    // Register holding an operand, pinned until release_operands(). Spilled values are reloaded,
+    // constants loaded again.
+    Reg use(uint32_t value) {
+        const IrInstr& def = function.def(value);
+        if (def.op == IrOp::Const && def.imm == 0) return Reg::zero;
+        if (homes[value] == Reg::none) {
+            Reg reg = acquire();
+            if (def.op == IrOp::Const) {
+                code.li(reg, def.imm);
+            } else {
+                code.lw(reg, spill_slots[value], Reg::fp, "reload");
+            }
+            regs.bind(reg, (int)value);
+            homes[value] = reg;
+        }
+        regs.pin(homes[value]);
+        return homes[value];
+    }
+
+    // Unpins the operands and frees the registers of those read for the last time. The instruction
+    // still reads them, the result may go to the same register.
+    void release_operands(const IrInstr& in) {
+        for (uint32_t value : {in.a, in.b}) {
+            if (value != ir_none && homes[value] != Reg::none) regs.unpin(homes[value]);
+        }
+        for (uint32_t value : {in.a, in.b}) {
+            if (value == ir_none || homes[value] == Reg::none || fixed(value) || !dies(value)) continue;
+            regs.release(homes[value]);
+            homes[value] = Reg::none;
+        }
+    }
+
+    Reg define(uint32_t value) {
+        if (fixed(value)) return homes[value];
+        Reg reg = acquire();
+        regs.bind(reg, (int)value);
+        homes[value] = reg;
+        return reg;
+    }
+
+    // A 16-bit constant operand of an add or sub as the immediate of addiu, false when there is none
+    bool immediate_operand(const IrInstr& in, uint32_t& other, int32_t& imm) const {
+        if (!immediates || (in.op != IrOp::Add && in.op != IrOp::Sub)) return false;
+        const IrInstr& b = function.def(in.b);
+        const IrInstr& a = function.def(in.a);
+        if (b.op == IrOp::Const && b.imm != 0) {
+            int64_t value = in.op == IrOp::Add ? (int64_t)b.imm : -(int64_t)b.imm;
+            if (!fits_immediate(value)) return false;
+            other = in.a;
+            imm = (int32_t)value;
+            return true;
+        }
+        if (in.op == IrOp::Add && a.op == IrOp::Const && a.imm != 0 && fits_immediate(a.imm)) {
+            other = in.b;
+            imm = a.imm;
+            return true;
+        }
+        return false;
+    }
+
+    // dst = a relation b as 0/1: slt/slti for the orderings, xori 1 for the negated ones, xor and
+    // sltiu/sltu for equality
+    void select_compare(const IrInstr& in) {
+        Relation relation = (Relation)in.imm;
+        uint32_t a = in.a;
+        uint32_t b = in.b;
+        if (is_constant(a) && !is_constant(b)) {
+            std::swap(a, b);
+            relation = swap_operands(relation);
+        }
+        int32_t c = is_constant(b) ? function.def(b).imm : 0;
+        if (relation == Relation::Eq || relation == Relation::Ne) {
+            Reg rs = use(a);
+            Reg difference = rs;
+            Reg rd;
+            if (is_constant(b) && c >= 0 && c <= 0xFFFF) {
+                release_operands(in);
+                rd = define(in.dst);
+                if (c != 0) {
+                    code.op_imm(Opcode::Xori, rd, rs, c);
+                    difference = rd;
+                }
+            } else {
+                Reg rt = use(b);
+                release_operands(in);
+                rd = define(in.dst);
+                code.op3(Opcode::Xor, rd, rs, rt);
+                difference = rd;
+            }
+            if (relation == Relation::Eq) {
+                code.op_imm(Opcode::Sltiu, rd, difference, 1);
+            } else {
+                code.op3(Opcode::Sltu, rd, Reg::zero, difference);
+            }
+            return;
+        }
+        // a <= c is a < c + 1, a > c and a >= c the negations of a < c + 1 and a < c
+        bool less = relation == Relation::Lt || relation == Relation::Le;
+        int64_t bound = relation == Relation::Lt || relation == Relation::Ge ? (int64_t)c : (int64_t)c + 1;
+        if (is_constant(b) && fits_immediate(bound)) {
+            Reg rs = use(a);
+            release_operands(in);
+            Reg rd = define(in.dst);
+            code.op_imm(Opcode::Slti, rd, rs, (int32_t)bound);
+            if (!less) code.op_imm(Opcode::Xori, rd, rd, 1);
+            return;
+        }
+        // a > b is b < a, a >= b and a <= b the negations of a < b and b < a
+        bool swapped = relation == Relation::Gt || relation == Relation::Le;
+        Reg rs = use(a);
+        Reg rt = use(b);
+        release_operands(in);
+        Reg rd = define(in.dst);
+        code.op3(Opcode::Slt, rd, swapped ? rt : rs, swapped ? rs : rt);
+        if (relation == Relation::Ge || relation == Relation::Le) code.op_imm(Opcode::Xori, rd, rd, 1);
+    }
+
+    void select(const IrInstr& in) {
+        switch (in.op) {
+            case IrOp::Const:
+            case IrOp::Nop:
+                return;  // constants are loaded where they are used
+            case IrOp::Phi:
+            case IrOp::Label:
+            case IrOp::Jump:
+            case IrOp::Branch:
+                return;  // control flow is run()'s, phis become copies on the edges
+            case IrOp::Note:
+                code.comment(in.text);
+                return;
+            case IrOp::Load: {
+                Reg rd = define(in.dst);
+                code.load(load_opcode(in.type), rd, symbol_table.planned_offset(in.symbol), Reg::fp,
+                          code.note({"load ", function.names[in.symbol]}));
+                break;
+            }
+            case IrOp::Store: {
+                Reg rs = use(in.a);
+                release_operands(in);
+                store_variable(code, rs, symbol_table.planned_offset(in.symbol), in.type,
+                               code.note({function.names[in.symbol], " (", type_name(in.type), ")"}));
+                return;
+            }
+            case IrOp::Return: {
+                code.comment("Return");
+                const IrInstr& def = function.def(in.a);
+                if (def.op == IrOp::Const && homes[in.a] == Reg::none) {
+                    code.li(Reg::v0, def.imm);
+                } else {
+                    code.move(Reg::v0, use(in.a));
+                    release_operands(in);
+                }
+                return;
+            }
+            case IrOp::Add:
+            case IrOp::Sub: {
+                uint32_t other;
+                int32_t imm;
+                if (immediate_operand(in, other, imm)) {
+                    Reg rs = use(other);
+                    release_operands(in);
+                    code.op_imm(Opcode::Addiu, define(in.dst), rs, imm);
+                    break;
+                }
+                Reg rs = use(in.a);
+                Reg rt = use(in.b);
+                release_operands(in);
+                Opcode opcode = in.op == IrOp::Add ? (in.wraps ? Opcode::Addu : Opcode::Add)
+                                                   : (in.wraps ? Opcode::Subu : Opcode::Sub);
+                code.op3(opcode, define(in.dst), rs, rt);
+                break;
+            }
+            case IrOp::Mul: {
+                Reg rs = use(in.a);
+                Reg rt = use(in.b);
+                release_operands(in);
+                code.op3(Opcode::Mul, define(in.dst), rs, rt);
+                break;
+            }
+            case IrOp::Div:
+            case IrOp::MulHi: {
+                Reg rs = use(in.a);
+                Reg rt = use(in.b);
+                release_operands(in);
+                code.hilo(in.op == IrOp::Div ? Opcode::Div : Opcode::Mult, rs, rt);
+                code.from_hilo(in.op == IrOp::Div ? Opcode::Mflo : Opcode::Mfhi, define(in.dst));
+                break;
+            }
+            case IrOp::Shl:
+            case IrOp::Sra:
+            case IrOp::Srl: {
+                Reg rs = use(in.a);
+                release_operands(in);
+                Opcode op = in.op == IrOp::Shl ? Opcode::Sll : in.op == IrOp::Sra ? Opcode::Sra : Opcode::Srl;
+                code.op_imm(op, define(in.dst), rs, in.imm);
+                break;
+            }
+            case IrOp::Cmp:
+                select_compare(in);
+                break;
+            case IrOp::Narrow: {
+                int shift = 32 - 8 * type_size(in.type);
+                Reg rs = use(in.a);
+                release_operands(in);
+                Reg rd = define(in.dst);
+                code.op_imm(Opcode::Sll, rd, rs, shift);
+                code.op_imm(Opcode::Sra, rd, rd, shift);
+                break;
+            }
+            case IrOp::Copy: {
+                Reg rs = use(in.a);
+                release_operands(in);
+                code.move(define(in.dst), rs);
+                break;
+            }
+            case IrOp::Param: {
+                // The first four arrive in $a0-$a3, the others in the caller's frame right above ours
+                Reg rd = define(in.dst);
+                if (in.imm < 4) {
+                    code.move(rd, (Reg)((int)Reg::a0 + in.imm));
+                } else {
+                    code.lw(rd, 4 * in.imm, Reg::fp, "stack argument");
+                }
+                break;
+            }
+            case IrOp::Arg: {
+                // The stack ones go above the four words the callee may store $a0-$a3 in
+                if (in.imm >= 4) {
+                    Reg rs = use(in.a);
+                    release_operands(in);
+                    code.sw(rs, 4 * in.imm, Reg::sp, "argument");
+                    return;
+                }
+                Reg rd = (Reg)((int)Reg::a0 + in.imm);
+                const IrInstr& def = function.def(in.a);
+                if (def.op == IrOp::Const && homes[in.a] == Reg::none) {
+                    code.li(rd, def.imm);
+                } else {
+                    code.move(rd, use(in.a));
+                    release_operands(in);
+                }
+                return;
+            }
+            case IrOp::Call: {
+                // Whatever the caller-saved registers hold goes to the stack first
+                regs.for_each_cached([&](Reg reg, int value) {
+                    if (!is_callee_saved(reg) && !fixed((uint32_t)value)) evict(reg, (uint32_t)value);
+                });
+                code.call(in.text);
+                code.move(define(in.dst), Reg::v0);
+                break;
+            }
+        }
+        if (fixed(in.dst)) return;
+        if (cfg != nullptr && global[in.dst]) {
+            // Read in other blocks, which find it in its slot
+            code.sw(homes[in.dst], spill_slots[in.dst], Reg::fp, "spill");
+        }
+        if (dies(in.dst)) {
+            // Never read, the register is free again right away
+            regs.release(homes[in.dst]);
+            homes[in.dst] = Reg::none;
+        }
+    }
+
+    // Finds the global values and gives them their locations. A value's hull runs from the first
+    // to the last point in code order where it is defined, read or live across a block boundary
+    // (points are 2 * instruction, 2 * end of a block - 1 for the edge copies after its last
+    // instruction); values whose hulls do not overlap can share a register.
+    void allocate_globals() {
+        const ControlFlowGraph& graph = *cfg;
+        uint32_t values = function.values;
+        global.assign(values, false);
+        global_registers.assign(values, Reg::none);
+        auto block_of = [&](uint32_t value) { return graph.block_of[function.defs[value]]; };
+        for (uint32_t i = 0; i < function.code.size(); ++i) {
+            const IrInstr& in = function.code[i];
+            if (in.op == IrOp::Phi) {
+                global[in.dst] = true;
+                for (const uint32_t* arg = function.phi_begin(in); arg != function.phi_end(in); ++arg) {
+                    if (!is_constant(*arg)) global[*arg] = true;
+                }
+                continue;
+            }
+            for (uint32_t value : {in.a, in.b}) {
+                if (value != ir_none && !is_constant(value) && block_of(value) != graph.block_of[i]) global[value] = true;
+            }
+        }
+
+        std::vector<uint32_t> lo(values, UINT32_MAX);
+        std::vector<uint32_t> hi(values, 0);
+        auto extend = [&](uint32_t value, uint32_t point) {
+            lo[value] = std::min(lo[value], point);
+            hi[value] = std::max(hi[value], point);
+        };
+        auto edge = [&](uint32_t block) { return 2 * graph.blocks[block].end - 1; };
+        // Live at the top of block: so is it on every path back to its definition
+        std::vector<uint32_t> visited(graph.blocks.size(), ir_none);
+        std::vector<uint32_t> work;
+        auto live_in = [&](uint32_t value, uint32_t block) {
+            uint32_t home = block_of(value);
+            if (block == home || visited[block] == value) return;
+            visited[block] = value;
+            work.push_back(block);
+            while (!work.empty()) {
+                uint32_t b = work.back();
+                work.pop_back();
+                extend(value, 2 * graph.blocks[b].begin);
+                for (uint32_t p : graph.blocks[b].predecessors) {
+                    if (!graph.reachable(p)) continue;
+                    extend(value, edge(p));
+                    if (p == home || visited[p] == value) continue;
+                    visited[p] = value;
+                    work.push_back(p);
+                }
+            }
+        };
+        for (uint32_t i = 0; i < function.code.size(); ++i) {
+            const IrInstr& in = function.code[i];
+            uint32_t b = graph.block_of[i];
+            if (!graph.reachable(b)) continue;
+            if (in.dst != ir_none && global[in.dst]) extend(in.dst, 2 * i);
+            if (in.op == IrOp::Phi) {
+                const std::vector<uint32_t>& predecessors = graph.blocks[b].predecessors;
+                for (uint32_t k = 0; k < predecessors.size(); ++k) {
+                    uint32_t p = predecessors[k];
+                    if (!graph.reachable(p)) continue;
+                    extend(in.dst, edge(p));
+                    uint32_t arg = function.phi_args[in.target + k];
+                    if (!global[arg]) continue;
+                    extend(arg, edge(p));
+                    live_in(arg, p);
+                }
+                continue;
+            }
+            for (uint32_t value : {in.a, in.b}) {
+                if (value == ir_none || !global[value]) continue;
+                extend(value, 2 * i);
+                live_in(value, b);
+            }
+        }
+
+        // Linear scan: an interval that finds no register free takes the one of the interval
+        // reaching furthest, itself included, which goes to a slot
+        std::vector<uint32_t> intervals;
+        for (uint32_t v = 0; v < values; ++v) {
+            if (global[v]) intervals.push_back(v);
+        }
+        std::sort(intervals.begin(), intervals.end(), [&](uint32_t a, uint32_t b) {
+            return lo[a] != lo[b] ? lo[a] < lo[b] : a < b;
+        });
+        // A leaf function takes caller-saved registers, which it need not save ($t9 down, $t0-$t3
+        // stay for the blocks); anything else callee-saved ones, which survive its calls
+        std::vector<Reg> free;
+        if (leaf) {
+            static constexpr Reg caller_saved[] = {Reg::t9, Reg::t8, Reg::t7, Reg::t6, Reg::t5, Reg::t4};
+            free.assign(std::begin(caller_saved), std::end(caller_saved));
+        } else {
+            int count = std::min(8, RegisterAllocator::size() - 3);
+            for (int i = 0; i < count; ++i) free.push_back(RegisterAllocator::pool_register(RegisterAllocator::size() - 1 - i));
+        }
+        std::vector<uint32_t> active;
+        for (uint32_t v : intervals) {
+            if (lo[v] == UINT32_MAX) continue;  // only in unreachable code
+            for (size_t j = 0; j < active.size();) {
+                if (hi[active[j]] < lo[v]) {
+                    free.push_back(global_registers[active[j]]);
+                    active[j] = active.back();
+                    active.pop_back();
+                } else {
+                    ++j;
+                }
+            }
+            if (!free.empty()) {
+                global_registers[v] = free.back();
+                free.pop_back();
+                active.push_back(v);
+                continue;
+            }
+            size_t furthest = active.size();
+            for (size_t j = 0; j < active.size(); ++j) {
+                if (hi[active[j]] > hi[v] && (furthest == active.size() || hi[active[j]] > hi[active[furthest]])) furthest = j;
+            }
+            if (furthest == active.size()) continue;
+            std::swap(global_registers[v], global_registers[active[furthest]]);
+            active[furthest] = v;
+        }
+
+        for (uint32_t v : intervals) {
+            Reg reg = global_registers[v];
+            if (reg == Reg::none) {
+                spill_slots[v] = symbol_table.allocate_spill_slot();
+                ++spills;
+                continue;
+            }
+            regs.reserve(reg);
+            save(reg);
+            homes[v] = reg;
+        }
+    }
+
+    std::string_view label_name(uint32_t label) {
+        if (label_names[label].empty()) label_names[label] = code.note({label_prefix, std::to_string(label)});
+        return label_names[label];
+    }
+
+    // Name of the label a branch goes to, the label itself is only printed when one does
+    std::string_view target(uint32_t label) {
+        referenced[label] = true;
+        return label_name(label);
+    }
+
+    uint32_t new_label() {
+        label_names.emplace_back();
+        label_positions.push_back(SIZE_MAX);
+        referenced.push_back(false);
+        return labels++;
+    }
+
+    Location location(uint32_t value) const {
+        Location at;
+        if (is_constant(value)) {
+            at.constant = true;
+            at.imm = function.def(value).imm;
+        } else if (global_registers[value] != Reg::none) {
+            at.reg = global_registers[value];
+        } else {
+            at.slot = spill_slots[value];
+        }
+        return at;
+    }
+
+    // The copies of the edge from block to successor: every phi of successor gets its argument
+    std::vector<Move> edge_moves(uint32_t block, uint32_t successor) const {
+        std::vector<Move> moves;
+        const IrBlock& to = cfg->blocks[successor];
+        uint32_t k = cfg->predecessor_index(successor, block);
+        for (uint32_t i = to.begin; i < to.end; ++i) {
+            const IrInstr& in = function.code[i];
+            if (in.op == IrOp::Label) continue;
+            if (in.op != IrOp::Phi) break;
+            Move move{location(in.dst), location(function.phi_args[in.target + k])};
+            if (!(move.dst == move.src)) moves.push_back(move);
+        }
+        return moves;
+    }
+
+    // One move, $at carries values from memory to memory and constants to memory. A slot past 16-bit
+    // offsets is stored through $at, then $v0 carries instead: it is free between the blocks.
+    void move(const Location& dst, const Location& src) {
+        Reg reg = dst.reg != Reg::none ? dst.reg : fits_immediate(dst.slot) ? Reg::at : Reg::v0;
+        if (src.constant) {
+            if (dst.reg == Reg::none && src.imm == 0) {
+                reg = Reg::zero;
+            } else {
+                code.li(reg, src.imm);
+            }
+        } else if (src.reg == Reg::none) {
+            code.lw(reg, src.slot, Reg::fp, "reload");
+        } else if (dst.reg != Reg::none) {
+            code.move(reg, src.reg);
+        } else {
+            reg = src.reg;
+        }
+        if (dst.reg == Reg::none) code.sw(reg, dst.slot, Reg::fp, "spill");
+    }
+
+    // Emits the moves as if they all happened at once: a move goes first when no other still reads
+    // its destination, a cycle is broken by parking one destination's value in $v1
+    void parallel_copy(std::vector<Move> moves) {
+        while (!moves.empty()) {
+            size_t ready = moves.size();
+            for (size_t i = 0; i < moves.size() && ready == moves.size(); ++i) {
+                bool read = false;
+                for (const Move& other : moves) read |= !other.src.constant && other.src == moves[i].dst;
+                if (!read) ready = i;
+            }
+            if (ready == moves.size()) {
+                Location parked;
+                parked.reg = Reg::v1;
+                move(parked, moves[0].dst);
+                for (Move& other : moves) {
+                    if (!other.src.constant && other.src == moves[0].dst) other.src = parked;
+                }
+                ready = 0;
+            }
+            move(moves[ready].dst, moves[ready].src);
+            moves.erase(moves.begin() + ready);
+        }
+    }
+
+    // Branches to label when a relation b holds: against zero with bltz/bgez/bgtz/blez/beq/bne,
+    // equality with beq/bne, the orderings through slt/slti into $at
+    void branch_if(const IrInstr& in, Relation relation, std::string_view label) {
+        uint32_t a = in.a;
+        uint32_t b = in.b;
+        if ((is_zero(a) && !is_zero(b)) || (is_constant(a) && !is_constant(b))) {
+            std::swap(a, b);
+            relation = swap_operands(relation);
+        }
+        if (is_zero(b)) {
+            static constexpr Opcode against_zero[] = {Opcode::Beq, Opcode::Bne, Opcode::Bltz,
+                                                      Opcode::Bgez, Opcode::Bgtz, Opcode::Blez};
+            Reg rs = use(a);
+            release_operands(in);
+            code.branch(against_zero[(int)relation], rs, Reg::zero, label);
+            return;
+        }
+        if (relation == Relation::Eq || relation == Relation::Ne) {
+            Reg rs = use(a);
+            Reg rt = use(b);
+            release_operands(in);
+            code.branch(relation == Relation::Eq ? Opcode::Beq : Opcode::Bne, rs, rt, label);
+            return;
+        }
+        // slt gives 1 for a < b and a < c, b < a and a < c + 1 for a > b and a <= c
+        bool less = relation == Relation::Lt || relation == Relation::Le;
+        if (is_constant(b)) {
+            int32_t c = function.def(b).imm;
+            int64_t bound = relation == Relation::Lt || relation == Relation::Ge ? (int64_t)c : (int64_t)c + 1;
+            if (fits_immediate(bound)) {
+                Reg rs = use(a);
+                release_operands(in);
+                code.op_imm(Opcode::Slti, Reg::at, rs, (int32_t)bound);
+                code.branch(less ? Opcode::Bne : Opcode::Beq, Reg::at, Reg::zero, label);
+                return;
+            }
+        }
+        bool swapped = relation == Relation::Gt || relation == Relation::Le;
+        Reg rs = use(a);
+        Reg rt = use(b);
+        release_operands(in);
+        code.op3(Opcode::Slt, Reg::at, swapped ? rt : rs, swapped ? rs : rt);
+        code.branch(relation == Relation::Lt || relation == Relation::Gt ? Opcode::Bne : Opcode::Beq, Reg::at, Reg::zero, label);
+    }
+
+    // The terminator of block. The taken edge's copies need a block of their own: the branch is
+    // inverted to skip them and a jump follows.
+    void terminator(uint32_t block, const IrInstr& in) {
+        uint32_t taken = cfg->label_block[in.target];
+        uint32_t next = block + 1;
+        if (in.op == IrOp::Jump) {
+            parallel_copy(edge_moves(block, taken));
+            if (taken != next) code.jump(target(in.target));
+            return;
+        }
+        if (taken == next) return;  // either way the same block
+        std::vector<Move> moves = edge_moves(block, taken);
+        Relation relation = (Relation)in.imm;
+        if (moves.empty()) {
+            branch_if(in, relation, target(in.target));
+            return;
+        }
+        uint32_t skip = new_label();
+        branch_if(in, negate(relation), target(skip));
+        parallel_copy(std::move(moves));
+        code.jump(target(in.target));
+        code.label(label_name(skip));
+    }
+
+    // Frees the registers caching values of the previous block, only global values cross blocks
+    void start_block() {
+        regs.for_each_cached([&](Reg reg, int value) {
+            regs.release(reg);
+            homes[(uint32_t)value] = Reg::none;
+        });
+    }
+
+    void run_blocks() {
+        ControlFlowGraph graph(function);
+        cfg = &graph;
+        size_t top = code.instructions().size();
+        labels = function.labels;
+        label_names.assign(labels, std::string_view());
+        label_positions.assign(labels, SIZE_MAX);
+        referenced.assign(labels, false);
+        allocate_globals();
+
+        for (uint32_t b = 0; b < graph.blocks.size(); ++b) {
+            const IrBlock& block = graph.blocks[b];
+            if (!graph.reachable(b)) {
+                for (uint32_t i = block.begin; i < block.end; ++i) {
+                    if (function.code[i].op == IrOp::Note) code.comment(function.code[i].text);
+                }
+                continue;
+            }
+            if (b != 0) start_block();
+            for (position = block.begin; position < block.end; ++position) {
+                const IrInstr& in = function.code[position];
+                if (in.op == IrOp::Label) {
+                    label_positions[in.target] = code.instructions().size();
+                    code.label(label_name(in.target));
+                } else if (in.op == IrOp::Jump || in.op == IrOp::Branch) {
+                    terminator(b, in);
+                } else {
+                    select(in);
+                }
+            }
+            if (function.code[block.end - 1].op != IrOp::Jump && !block.exits) {
+                parallel_copy(edge_moves(b, b + 1));
+            }
+        }
+
+        std::vector<Instr>& list = code.instructions();
+        for (uint32_t label = 0; label < function.labels; ++label) {
+            if (label_positions[label] != SIZE_MAX && !referenced[label]) list[label_positions[label]].op = Opcode::Deleted;
+        }
+        std::vector<Instr> saves;
+        for (const auto& [reg, offset] : saved_registers) {
+            saves.push_back(Instr{Opcode::Sw, Reg::none, Reg::fp, reg, offset, code.note({"save ", reg_name(reg)})});
+        }
+        list.insert(list.begin() + top, saves.begin(), saves.end());
+        cfg = nullptr;
+    }
+
+public:
+    int spills = 0;
+
+    IrCodegen(const IrFunction& function, SymbolTable& symbol_table, InstructionList& code, bool immediates)
+        : function(function), symbol_table(symbol_table), code(code), immediates(immediates) {}
+
+    void run() {
+        leaf = !function.name.empty() && function.call_arguments() < 0;
+        label_prefix = function.name.empty() ? std::string_view(".L") : code.note({".L", function.name, "_"});
+        homes.assign(function.values, Reg::none);
+        spill_slots.assign(function.values, 0);
+        collect_uses();
+        if (function.straight_line) {
+            for (position = 0; position < function.code.size(); ++position) {
+                select(function.code[position]);
+            }
+        } else {
+            run_blocks();
+        }
+        for (const auto& [reg, offset] : saved_registers) {
+            code.lw(reg, offset, Reg::fp, code.note({"restore ", reg_name(reg)}));
+        }
+    }
+
+    int registers_used() const { return regs.used_count(); }
+};
+
+// Bytes below a function's frame pointer for its $ra and its caller's $fp
+constexpr int function_reserved = 8;
+
+// Bytes at the bottom of the frame for the arguments of the calls. O32 has the caller reserve four
+// words for $a0-$a3 below the stack arguments, but no callee compiled here stores them there: the
+// area is only there when some call passes more than four, none for code calling nothing.
+int outgoing_area(int arguments) {
+    return arguments <= 4 ? 0 : (arguments * 4 + 7) & ~7;
+}
+
+// Prologue and epilogue of a function compiled to the code from start on. A leaf function without
+// slots (variables, spills, saved registers) needs no frame and runs on its caller's: only the
+// loads of its stack arguments change from $fp to $sp. Any other one gets a frame of the slots and
+// the outgoing arguments, $fp at its top and the words right below it for $ra (when it calls
+// anything) and the caller's $fp. Returns the size of the frame, 0 for a frameless function.
+int wrap_function(InstructionList& code, size_t start, const SymbolTable& frame, int arguments) {
+    std::vector<Instr>& list = code.instructions();
+    int slots = frame.frame_size();
+    if (arguments < 0 && slots == function_reserved) {
+        for (size_t i = start; i < list.size(); ++i) {
+            if (is_load(list[i].op) && list[i].rs == Reg::fp) list[i].rs = Reg::sp;
+        }
+        code.jr(Reg::ra);
+        return 0;
+    }
+    int size = slots + outgoing_area(arguments);
+    bool calls = arguments >= 0;
+    std::vector<Instr> prologue;
+    if (fits_immediate(-(int64_t)size)) {
+        prologue.push_back(Instr{Opcode::Addiu, Reg::sp, Reg::sp, Reg::none, -size, {}});
+        if (calls) prologue.push_back(Instr{Opcode::Sw, Reg::none, Reg::sp, Reg::ra, size - 4, "save $ra"});
+        prologue.push_back(Instr{Opcode::Sw, Reg::none, Reg::sp, Reg::fp, size - 8, "save $fp"});
+        prologue.push_back(Instr{Opcode::Addiu, Reg::fp, Reg::sp, Reg::none, size, {}});
+    } else {
+        // $at = -size, then the old $sp back into $at
+        prologue.push_back(Instr{Opcode::Li, Reg::at, Reg::none, Reg::none, -size, {}});
+        prologue.push_back(Instr{Opcode::Addu, Reg::sp, Reg::sp, Reg::at, 0, {}});
+        prologue.push_back(Instr{Opcode::Subu, Reg::at, Reg::sp, Reg::at, 0, {}});
+        if (calls) prologue.push_back(Instr{Opcode::Sw, Reg::none, Reg::at, Reg::ra, -4, "save $ra"});
+        prologue.push_back(Instr{Opcode::Sw, Reg::none, Reg::at, Reg::fp, -8, "save $fp"});
+        prologue.push_back(Instr{Opcode::Move, Reg::fp, Reg::at, Reg::none, 0, {}});
+    }
+    list.insert(list.begin() + start, prologue.begin(), prologue.end());
+    // $ra and $fp come back while the frame still holds them, only then is it released
+    if (fits_immediate(size)) {
+        if (calls) code.lw(Reg::ra, size - 4, Reg::sp, "restore $ra");
+        code.lw(Reg::fp, size - 8, Reg::sp, "restore $fp");
+        code.op_imm(Opcode::Addiu, Reg::sp, Reg::sp, size);
+    } else {
+        if (calls) code.lw(Reg::ra, -4, Reg::fp, "restore $ra");
+        code.move(Reg::at, Reg::fp);
+        code.lw(Reg::fp, -8, Reg::at, "restore $fp");
+        code.move(Reg::sp, Reg::at);
+    }
+    code.jr(Reg::ra);
+    return size;
+}
+
+// Settings shared by every compilation unit of a run
+struct CompileOptions {
+    bool write_setup = false;        // write the default MIPS setup (local debugging)
+    bool cache_variables = true;     // keep variables in registers across statements
+    bool fold_constants = true;      // evaluate compile-time constant expressions
+    bool reuse_values = true;        // common subexpression elimination (value numbering)
+    bool remove_dead_stores = true;  // dead store and dead variable elimination
+    bool strength_reduction = true;  // cheaper sequences for operations with a constant operand
+    uint32_t peephole_rules = ~0u;   // peephole rules left enabled
+    bool schedule = true;            // reorder instructions to hide load and multiply/divide latencies
+    bool print_stats = false;        // optimisation counters
+    bool time_passes = false;        // wall time per phase
+    bool incremental = false;        // replay unchanged statements from <output>.inc
+    int optimization_level = -1;     // -O<n>: compile through the IR (ir.h), -1 for the statement code generator
+    bool copy_propagation = true;    // IR pass of -O1 and up
+    bool licm = true;                // IR pass of -O1 and up, loop-invariant code motion
+    bool print_ir = false;           // the IR after the passes, to the diagnostics
+    bool pipeline = false;           // lexer and writer on threads of their own, same output
+    unsigned parse_threads = 1;      // lex and parse chunks of the source in parallel, same output
+    bool object = false;             // write an ELF relocatable object (elf.h) instead of assembly text
+    bool big_endian = true;          // byte order of the object
+
+    // Everything above that changes the generated assembly, part of the cache key
+    std::string signature() const {
+        return std::string("d") + (write_setup ? '1' : '0') + " r" + (cache_variables ? '1' : '0') +
+               " f" + (fold_constants ? '1' : '0') + " c" + (reuse_values ? '1' : '0') +
+               " s" + (remove_dead_stores ? '1' : '0') + " x" + (strength_reduction ? '1' : '0') +
+               " p" + std::to_string(peephole_rules) + " O" + std::to_string(optimization_level) +
+               " y" + (copy_propagation ? '1' : '0') + " l" + (schedule ? '1' : '0') +
+               " m" + (licm ? '1' : '0') + " e" + (object ? (big_endian ? 'b' : 'l') : '0');
+    }
+};
+
+// Cached assembly is only valid for the compiler that generated it
+const char* const compiler_version = "compilerlab1 " __DATE__ " " __TIME__;
+
+// Compiles one source file. A unit owns all of its state, so units can run on different threads.
+// Errors, --stats and --time-passes go to diagnostics, the --trace lines to trace (nullptr when off).
+// With a cache, a unit compiled before with the same options is copied from there instead.
+bool compile_unit(const std::string& input_filename, const std::string& output_filename, bool to_stdout,
+                  const CompileOptions& options, std::ostream& diagnostics, std::ostream* trace,
+                  CompilationCache* cache) {
+    PhaseTimer timer;
+
+    // The source is mapped, tokens and AST names point straight into it
+    MappedFile input_file;
+    if (!input_file.open(input_filename)) {
+        diagnostics << "Error: Could not open file.\n";
+        return false;
+    }
+    std::string_view source = input_file.contents();
+
+    std::string cache_key, cache_file;
+    if (trace != nullptr || options.print_ir) {
+        cache = nullptr;  // the trace and the IR are printed while compiling
+    }
+    if (cache != nullptr) {
+        cache_key = CompilationCache::key(compiler_version, options.signature(), source);
+        if (cache->fetch(cache_key, output_filename, to_stdout)) {
+            timer.lap("cache", source.size());
+            if (options.print_stats) {
+                diagnostics << "cache: hit, nothing compiled\n";
+            }
+            if (options.time_passes) {
+                timer.report(diagnostics);
+            }
+            return true;
+        }
+        cache_file = cache->temporary_path();
+    }
+
+    // With a cache the unit is compiled into the cache directory, then copied to the real destination
+    OutputBuffer outFile;
+    if (cache != nullptr && !outFile.open(cache_file)) {
+        cache = nullptr;  // unusable cache, compile straight to the destination
+    }
+    if (cache == nullptr) {
+        if (to_stdout) {
+            outFile.attach_stdout();
+        } else if (!outFile.open(output_filename)) {
+            diagnostics << "Error opening file for writing!\n";
+            return false;
+        }
+    }
+    if (options.pipeline) outFile.start_writer();
+    timer.lap("open");
+
+    // The backend emits into the instruction list, which is printed after the peephole pass and the scheduler
+    InstructionList code;
+
+    // Write the default MIPS setup only if the debug flag is provided (local mode)
+    // The frame size is only known after code generation (spill slots), the two instructions
+    // allocating it are filled in then
+    size_t frame_allocation = 0;
+    if (options.write_setup) {
+        code.directive(".text");
+        code.directive(".globl main");
+        code.label("main");
+        code.move(Reg::fp, Reg::sp);
+        frame_allocation = code.instructions().size();
+        code.emit(Instr{Opcode::Deleted});
+        code.emit(Instr{Opcode::Deleted});
+    }
+
+    // All AST nodes of the compilation unit live in the arena and are freed together at the end.
+    // Identifiers are interned while lexing, later phases index their tables by the ids.
+    Arena arena;
+    Program program;
+    Interner interner;
+    if (options.parse_threads > 1) {
+        size_t tokens = parse_parallel(source, options.parse_threads, interner, arena, program);
+        program.symbols = interner.size();
+        timer.lap("lex+parse", tokens);
+    } else if (options.pipeline) {
+        size_t tokens = parse_pipelined(source, interner, arena, program);
+        program.symbols = interner.size();
+        timer.lap("lex+parse", tokens);
+    } else {
+        std::vector<Token> tokens;
+        tokens.reserve(source.size() / 4 + 1);
+        Lexer(source, 1, &interner).tokenize(tokens);
+        program.symbols = interner.size();
+        timer.lap("lex", tokens.size());
+        Parser(tokens.data(), source, arena).parse_program(program);
+        timer.lap("parse", program.statements.size());
+    }
+
+    // -O<n> compiles through the IR (ir.h): lowering, the passes of the level, code generation from
+    // the IR. Otherwise the syntax tree passes run and the statement code generator emits the code;
+    // it only knows straight-line code, programs with if/while take the IR at -O1.
+    bool use_ir = options.optimization_level >= 0 || program.control_flow;
+    ConstantFolder folder(arena);
+    if (options.fold_constants && !use_ir) {
+        folder.run(program);
+        timer.lap("constant-folding", program.statements.size());
+    }
+    DeadStoreElimination dead_stores;
+    if (options.remove_dead_stores && !use_ir) {
+        size_t statements = program.statements.size();
+        dead_stores.run(program);
+        timer.lap("dead-stores", statements);
+    }
+
+    SymbolTable symbol_table(program.symbols + 1);  // main's result variable with functions (lower.h)
+    CodegenContext ctx(symbol_table, code, options.cache_variables);
+    ValueNumbering value_numbering;
+    IncrementalState incremental;
+    std::string incremental_path = output_filename + ".inc";
+    bool incremental_build = options.incremental && trace == nullptr && !use_ir;
+    IrFunction function(program.symbols);
+    PassManager passes;
+    std::vector<const FunctionStmt*> functions;  // by symbol id, the definitions the calls go to
+    size_t lowered = 0;
+    size_t optimized = 0;
+    int registers_used = 0;
+    int spills = 0;
+    int main_arguments = -1;    // the most any call of main passes, -1 when it calls nothing
+    int level = options.optimization_level >= 0 ? options.optimization_level : 1;
+    if (use_ir) {
+        functions = function_definitions(program);
+        IrLowering(function, trace, functions).run(program);
+        lowered = function.code.size();
+        timer.lap("lower", program.statements.size());
+
+        // Keeping variables in registers is what the ssa pass does, without it they stay in memory
+        if (level >= 1 && options.fold_constants) passes.add("fold", fold_pass);
+        if (level >= 1 && options.cache_variables) passes.add("ssa", ssa_pass);
+        if (level >= 2 && options.reuse_values) passes.add("cse", cse_pass);
+        if (level >= 1 && options.copy_propagation) passes.add("copy-propagation", copy_propagation_pass);
+        if (level >= 1 && options.fold_constants && options.cache_variables) passes.add("fold", fold_pass);
+        if (level >= 2 && options.strength_reduction) passes.add("strength-reduce", strength_reduction_pass);
+        if (level >= 1 && options.licm) passes.add("licm", licm_pass);
+        if (level >= 1 && options.remove_dead_stores) passes.add("dce", dce_pass);
+        passes.run(function, timer);
+        optimized = function.code.size();
+        if (options.print_ir) {
+            if (function.types.size() > program.symbols) diagnostics << "main:\n";  // functions follow
+            print_ir(diagnostics, function);
+        }
+
+        symbol_table.layout_frame(function);
+        IrCodegen codegen(function, symbol_table, code, level >= 2 && options.strength_reduction);
+        codegen.run();
+        registers_used = codegen.registers_used();
+        spills = codegen.spills;
+        main_arguments = function.call_arguments();
+    } else {
+        label_register_need(program);
+        symbol_table.layout_frame(program);
+        ctx.strength_reduction = options.strength_reduction;
+        ctx.variables.resize(program.symbols);
+        ctx.use_positions.resize(program.symbols);
+        collect_use_positions(program, ctx);
+
+        // Reused values live in registers, so this needs register caching
+        if (options.reuse_values && options.cache_variables) {
+            value_numbering.run(program);
+            ctx.value_numbering = &value_numbering;
+            ctx.remaining_uses = value_numbering.occurrences;
+            timer.lap("value-numbering", program.statements.size());
+        }
+        // The previous build's statement code is kept next to the output. Traced builds generate everything.
+        if (incremental_build) {
+            incremental.load(incremental_path, std::string(compiler_version) + "\n" + options.signature());
+        }
+        if (incremental_build) {
+            IncrementalCodegen(ctx, incremental, interner).run(program);
+        } else {
+            for (const Stmt* stmt : program.statements) {
+                generate_statement(stmt, ctx, trace);
+                ++ctx.statement_index;
+            }
+        }
+        if (!options.remove_dead_stores) {
+            // Only the return value outlives the frame, the final write-back is a dead store
+            write_back_variables(ctx);
+        }
+        restore_saved_registers(ctx);
+        registers_used = ctx.regs.used_count();
+        spills = ctx.spills;
+    }
+
+    // A main calling functions keeps its frame: $sp goes below the slots and the outgoing arguments
+    int frame = symbol_table.frame_size() + outgoing_area(main_arguments);
+    if (!options.write_setup && main_arguments >= 0) {
+        std::vector<Instr>& list = code.instructions();
+        if (frame == 0) {
+            list.insert(list.begin(), Instr{Opcode::Move, Reg::sp, Reg::fp, Reg::none, 0, {}});
+        } else if (fits_immediate(-(int64_t)frame)) {
+            list.insert(list.begin(), Instr{Opcode::Addiu, Reg::sp, Reg::fp, Reg::none, -frame, {}});
+        } else {
+            list.insert(list.begin(), {Instr{Opcode::Li, Reg::at, Reg::none, Reg::none, -frame, {}},
+                                       Instr{Opcode::Addu, Reg::sp, Reg::fp, Reg::at, 0, {}}});
+        }
+    }
+    if (options.write_setup) {
+        // Exactly the frame the variables and spill slots need, li + addu when it exceeds an immediate
+        Instr* allocation = code.instructions().data() + frame_allocation;
+        if (fits_immediate(-(int64_t)frame)) {
+            if (frame != 0) allocation[1] = Instr{Opcode::Addiu, Reg::sp, Reg::sp, Reg::none, -frame, {}};
+        } else {
+            allocation[0] = Instr{Opcode::Li, Reg::at, Reg::none, Reg::none, -frame, {}};
+            allocation[1] = Instr{Opcode::Addu, Reg::sp, Reg::sp, Reg::at, 0, {}};
+        }
+
+        // (rest of the code: printing integer and exiting)
+        code.comment("Printing Integer");
+        code.move(Reg::a0, Reg::v0);
+        code.li(Reg::v0, 1);
+        code.syscall();
+
+        code.comment("exiting gracefully");
+        code.li(Reg::v0, 10);
+        code.syscall();
+    }
+
+    // The functions follow main, which jumps over them when the setup does not exit before. Each
+    // one is lowered, optimised and compiled on its own with a frame of its own.
+    std::deque<IrFunction> callees;  // the notes of their code point into them
+    int compiled_functions = 0;
+    int frameless_functions = 0;
+    int largest_function_frame = 0;
+    bool any_function = false;
+    for (const FunctionStmt* defined : functions) any_function |= defined != nullptr;
+    if (any_function && !options.write_setup) code.jump(".Lend");
+    for (const Stmt* stmt : program.statements) {
+        if (stmt->kind != StmtKind::Function || functions[static_cast<const FunctionStmt*>(stmt)->symbol] != stmt) continue;
+        auto* defined = static_cast<const FunctionStmt*>(stmt);
+        IrFunction& callee = callees.emplace_back(program.symbols);
+        IrLowering(callee, trace, functions).run(program, *defined);
+        lowered += callee.code.size();
+        passes.run(callee, timer);
+        optimized += callee.code.size();
+        if (options.print_ir) {
+            diagnostics << defined->name << ":\n";
+            print_ir(diagnostics, callee);
+        }
+
+        SymbolTable frame_table(program.symbols);
+        frame_table.layout_frame(callee, function_reserved);
+        code.label(defined->name);
+        size_t start = code.instructions().size();
+        IrCodegen codegen(callee, frame_table, code, level >= 2 && options.strength_reduction);
+        codegen.run();
+        registers_used = std::max(registers_used, codegen.registers_used());
+        spills += codegen.spills;
+        ++compiled_functions;
+        int function_frame = wrap_function(code, start, frame_table, callee.call_arguments());
+        if (function_frame == 0) ++frameless_functions;
+        largest_function_frame = std::max(largest_function_frame, function_frame);
+    }
+    if (any_function && !options.write_setup) code.label(".Lend");
+    timer.lap("codegen", program.statements.size());
+
+    // Only the return value in $v0 is read after the generated code. -O0 leaves the code as selected.
+    uint32_t peephole_rules = options.optimization_level == 0 ? 0 : options.peephole_rules;
+    PeepholeOptimizer peephole(peephole_rules, Reg::v0);
+    if (peephole_rules != 0) {
+        size_t instructions = code.instructions().size();
+        peephole.run(code.instructions());
+        timer.lap("peephole", instructions);
+    }
+    InstructionScheduler scheduler;
+    if (options.schedule && options.optimization_level != 0) {
+        size_t instructions = code.instructions().size();
+        scheduler.run(code.instructions());
+        timer.lap("schedule", instructions);
+    }
+    // The object gets the machine code of exactly the instructions the text would list
+    MachineCode machine_code;
+    if (options.object) {
+        if (!encode_instructions(code.instructions(), machine_code)) {
+            diagnostics << "Error: Cannot encode the code: " << machine_code.error << ".\n";
+            outFile.close();
+            if (cache != nullptr) cache->discard(cache_file);
+            return false;
+        }
+        timer.lap("encode", code.instructions().size());
+        outFile << elf_object(machine_code, options.big_endian);
+    } else {
+        print_instructions(code.instructions(), outFile);
+    }
+
+    if (!outFile.close()) {
+        diagnostics << "Error writing output!\n";
+        if (cache != nullptr) cache->discard(cache_file);
+        return false;
+    }
+    timer.lap("emit", code.instructions().size());
+
+    if (cache != nullptr) {
+        if (!cache->store(cache_key, cache_file, output_filename, to_stdout)) {
+            diagnostics << "Error writing output!\n";
+            return false;
+        }
+        timer.lap("cache", source.size());
+    }
+    if (incremental_build) {
+        if (!incremental.save(incremental_path)) {
+            diagnostics << "Warning: Could not write incremental state '" << incremental_path << "'.\n";
+        }
+        timer.lap("incremental", program.statements.size());
+    }
+
+    if (options.print_stats) {
+        if (use_ir) {
+            diagnostics << "ir: " << lowered << " instructions lowered, " << optimized
+                        << " after the passes\n";
+            passes.report(diagnostics);
+            if (compiled_functions != 0) {
+                diagnostics << "functions: " << compiled_functions << " compiled, " << frameless_functions
+                            << " without a stack frame, largest frame " << largest_function_frame << " bytes\n";
+            }
+        } else {
+            diagnostics << "constant folding: " << folder.folded << " operations folded, "
+                      << folder.propagated << " variable reads propagated\n";
+            diagnostics << "value numbering: " << ctx.reused_values << " values reused, "
+                      << ctx.eliminated_instructions << " instructions eliminated\n";
+            diagnostics << "dead stores: " << dead_stores.removed_stores << " removed, "
+                      << dead_stores.removed_slots << " stack slots dropped\n";
+            diagnostics << "strength reduction: " << ctx.reduced_operations << " operations\n";
+        }
+        diagnostics << "peephole: " << peephole.removed << " instructions removed";
+        for (int rule = 0; rule < peephole_rule_count; ++rule) {
+            diagnostics << (rule == 0 ? " (" : ", ") << peephole_rule_name((PeepholeRule)rule) << ' ' << peephole.hits[rule];
+        }
+        diagnostics << ")\n";
+        if (options.schedule && options.optimization_level != 0) {
+            diagnostics << "schedule: " << scheduler.moved << " instructions moved, stall cycles "
+                        << scheduler.stalls_before << " -> " << scheduler.stalls_after << " (estimated)\n";
+        }
+        diagnostics << "registers: " << registers_used << " used, " << spills << " spills\n";
+        diagnostics << "stack frame: " << frame << " bytes\n";
+        if (options.object) {
+            diagnostics << "object: " << machine_code.size() << " bytes of code, " << machine_code.symbols.size()
+                        << " symbols, " << machine_code.relocations.size() << " relocations\n";
+        }
+        if (incremental_build) {
+            diagnostics << "incremental: " << incremental.reused << " statements reused, "
+                        << incremental.generated << " generated\n";
+        }
+
+        size_t by_opcode[(int)Opcode::Comment] = {};
+        size_t emitted = 0;
+        for (const Instr& in : code.instructions()) {
+            if (is_pseudo(in.op)) continue;
+            ++by_opcode[(int)in.op];
+            ++emitted;
+        }
+        diagnostics << "instructions: " << emitted;
+        const char* separator = " (";
+        for (int op = 0; op < (int)Opcode::Comment; ++op) {
+            if (by_opcode[op] == 0) continue;
+            diagnostics << separator << opcode_name((Opcode)op) << ' ' << by_opcode[op];
+            separator = ", ";
+        }
+        diagnostics << (emitted != 0 ? ")\n" : "\n");
+    }
+    if (options.time_passes) {
+        timer.report(diagnostics);
+    }
+    return true;
+}
+
+// Output name of a batch unit: the input with .c replaced by extension (.s or .o), next to it
+std::string batch_output_name(const std::string& input, const char* extension) {
+    size_t slash = input.find_last_of('/');
+    size_t dot = input.find_last_of('.');
+    if (dot != std::string::npos && (slash == std::string::npos || dot > slash)) {
+        return input.substr(0, dot) + extension;
+    }
+    return input + extension;
+}
+
+// Appends the file names listed in a response file, one per line; blank lines and # comments are skipped
+bool read_response_file(const std::string& path, std::vector<std::string>& inputs) {
+    MappedFile file;
+    if (!file.open(path)) return false;
+    std::string_view text = file.contents();
+    while (!text.empty()) {
+        size_t end = text.find('\n');
+        std::string_view line = text.substr(0, end);
+        text = end == std::string_view::npos ? std::string_view() : text.substr(end + 1);
+        while (!line.empty() && std::isspace((unsigned char)line.front())) line.remove_prefix(1);
+        while (!line.empty() && std::isspace((unsigned char)line.back())) line.remove_suffix(1);
+        if (!line.empty() && line[0] != '#') inputs.emplace_back(line);
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    const char* usage = " <input_file.c|-|@list>... [--debug|-d] [-o <output.s>] [--stdout] [-j <threads>] [--no-register-cache] [--no-constant-folding] [--no-cse] [--no-dse] [--no-strength-reduction] [--no-peephole[=<rules>]] [--no-schedule] [-O0|-O1|-O2] [--no-copy-propagation] [--no-licm] [--print-ir] [--pipeline] [--parse-threads <n>] [--cache-dir <dir>] [--cache-size <MiB>] [--incremental] [--stats] [--time-passes] [--trace] [-c [-EB|-EL]]";
+    std::vector<std::string> inputs;
+    std::string output_filename = "output.s";
+    bool output_given = false;
+    bool batch = false;         // several inputs or a response file: every input gets its own .s
+    bool to_stdout = false;     // streaming mode: assembly goes to stdout
+    unsigned threads = std::thread::hardware_concurrency();
+    bool trace_expressions = false;  // Infix/Postfix form of every expression
+    std::string cache_directory;     // compilation cache, off when empty
+    uint64_t cache_size = 256;       // MiB
+    CompileOptions options;
+
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--debug") == 0 || std::strcmp(argv[i], "-d") == 0) {
+            options.write_setup = true;
+        } else if (std::strcmp(argv[i], "--stdout") == 0) {
+            to_stdout = true;
+        } else if (std::strcmp(argv[i], "--no-register-cache") == 0) {
+            options.cache_variables = false;
+        } else if (std::strcmp(argv[i], "--no-constant-folding") == 0) {
+            options.fold_constants = false;
+        } else if (std::strcmp(argv[i], "--no-cse") == 0) {
+            options.reuse_values = false;
+        } else if (std::strcmp(argv[i], "--no-dse") == 0) {
+            options.remove_dead_stores = false;
+        } else if (std::strcmp(argv[i], "--no-strength-reduction") == 0) {
+            options.strength_reduction = false;
+        } else if (std::strcmp(argv[i], "--no-peephole") == 0) {
+            options.peephole_rules = 0;
+        } else if (std::strncmp(argv[i], "--no-peephole=", 14) == 0) {
+            int64_t disabled = PeepholeOptimizer::parse_rules(argv[i] + 14);
+            if (disabled < 0) {
+                std::cerr << "Error: Unknown peephole rule in '" << argv[i] << "'." << std::endl;
+                return 1;
+            }
+            options.peephole_rules &= ~(uint32_t)disabled;
+        } else if (argv[i][0] == '-' && argv[i][1] == 'O' && argv[i][2] >= '0' && argv[i][2] <= '2' && argv[i][3] == '\0') {
+            options.optimization_level = argv[i][2] - '0';
+        } else if (std::strcmp(argv[i], "--no-schedule") == 0) {
+            options.schedule = false;
+        } else if (std::strcmp(argv[i], "--no-copy-propagation") == 0) {
+            options.copy_propagation = false;
+        } else if (std::strcmp(argv[i], "--no-licm") == 0) {
+            options.licm = false;
+        } else if (std::strcmp(argv[i], "--print-ir") == 0) {
+            options.print_ir = true;
+        } else if (std::strcmp(argv[i], "--incremental") == 0) {
+            options.incremental = true;
+        } else if (std::strcmp(argv[i], "--pipeline") == 0) {
+            options.pipeline = true;
+        } else if (std::strcmp(argv[i], "--stats") == 0) {
+            options.print_stats = true;
+        } else if (std::strcmp(argv[i], "--time-passes") == 0) {
+            options.time_passes = true;
+        } else if (std::strcmp(argv[i], "--trace") == 0) {
+            trace_expressions = true;
+        } else if (std::strcmp(argv[i], "-c") == 0) {
+            options.object = true;
+        } else if (std::strcmp(argv[i], "-EB") == 0 || std::strcmp(argv[i], "-EL") == 0) {
+            options.big_endian = argv[i][2] == 'B';
+        } else if (std::strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            output_filename = argv[++i];
+            output_given = true;
+        } else if (std::strcmp(argv[i], "--cache-dir") == 0 && i + 1 < argc) {
+            cache_directory = argv[++i];
+        } else if (std::strcmp(argv[i], "--cache-size") == 0 && i + 1 < argc) {
+            cache_size = std::strtoull(argv[++i], nullptr, 10);
+        } else if (std::strcmp(argv[i], "--parse-threads") == 0 && i + 1 < argc) {
+            options.parse_threads = (unsigned)std::strtoul(argv[++i], nullptr, 10);
+        } else if (std::strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            threads = (unsigned)std::strtoul(argv[++i], nullptr, 10);
+        } else if (argv[i][0] == '@' && argv[i][1] != '\0') {
+            if (!read_response_file(argv[i] + 1, inputs)) {
+                std::cerr << "Error: Could not open response file '" << argv[i] + 1 << "'." << std::endl;
+                return 1;
+            }
+            batch = true;
+        } else if (argv[i][0] == '-' && argv[i][1] != '\0') {
+            std::cerr << "Error: Invalid optional argument '" << argv[i] << "'." << std::endl;
+            std::cerr << "Usage: " << argv[0] << usage << std::endl;
+            return 1;
+        } else {
+            inputs.push_back(argv[i]);
+        }
+    }
+    batch = batch || inputs.size() > 1;
+    if (options.object && !output_given) output_filename = "output.o";
+    if (inputs.empty() && !batch) {
+        std::cerr << "Usage: " << argv[0] << usage << std::endl;
+        return 1;
+    }
+
+    if (options.incremental && options.optimization_level >= 0) {
+        std::cerr << "Error: --incremental replays the statement code generator, it cannot be used with -O<n>." << std::endl;
+        return 1;
+    }
+    if (options.pipeline && options.parse_threads > 1) {
+        std::cerr << "Error: --pipeline and --parse-threads split the front end differently, use one of them." << std::endl;
+        return 1;
+    }
+    if (options.incremental && to_stdout) {
+        std::cerr << "Error: --incremental keeps its state next to the output file, it cannot be used with --stdout." << std::endl;
+        return 1;
+    }
+
+    CompilationCache cache(cache_directory, cache_size << 20);
+    if (!cache_directory.empty() && !cache.open()) {
+        std::cerr << "Warning: Cannot use cache directory '" << cache_directory << "', compiling without it." << std::endl;
+        cache_directory.clear();
+    }
+    CompilationCache* use_cache = cache_directory.empty() ? nullptr : &cache;
+
+    if (!batch) {
+        // The expression trace goes to stderr when the assembly itself goes to stdout
+        std::ostream* trace = nullptr;
+        if (trace_expressions) {
+            trace = to_stdout ? &std::cerr : &std::cout;
+        }
+        bool ok = compile_unit(inputs[0], output_filename, to_stdout, options, std::cerr, trace, use_cache);
+        if (options.print_stats && use_cache != nullptr) {
+            std::cerr << "cache: " << cache.hits << " hits, " << cache.misses << " misses, " << cache.evictions << " evicted\n";
+        }
+        return ok ? 0 : 1;
+    }
+
+    if (output_given || to_stdout) {
+        std::cerr << "Error: -o and --stdout take a single input, batch mode writes <name>.s (<name>.o with -c) next to every input." << std::endl;
+        return 1;
+    }
+    for (const std::string& input : inputs) {
+        if (input == "-") {
+            std::cerr << "Error: Standard input cannot be part of a batch." << std::endl;
+            return 1;
+        }
+    }
+
+    // Units compile concurrently; what they report is buffered and printed in input order
+    struct UnitResult {
+        bool ok = false;
+        std::ostringstream diagnostics;
+        std::ostringstream trace;
+    };
+    std::vector<UnitResult> results(inputs.size());
+    WorkStealingPool pool;
+    pool.run(inputs.size(), threads, [&](size_t i) {
+        UnitResult& result = results[i];
+        result.ok = compile_unit(inputs[i], batch_output_name(inputs[i], options.object ? ".o" : ".s"), false, options, result.diagnostics,
+                                 trace_expressions ? &result.trace : nullptr, use_cache);
+    });
+
+    int failed = 0;
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        std::string diagnostics = results[i].diagnostics.str();
+        std::cout << results[i].trace.str();
+        if (!diagnostics.empty()) std::cerr << inputs[i] << ":\n" << diagnostics;
+        if (!results[i].ok) ++failed;
+    }
+    if (options.print_stats && use_cache != nullptr) {
+        std::cerr << "cache: " << cache.hits << " hits, " << cache.misses << " misses, " << cache.evictions << " evicted\n";
+    }
+    if (failed != 0) {
+        std::cerr << failed << " of " << inputs.size() << " files failed to compile." << std::endl;
+        return 1;
+    }
     return 0;
 }
@@ -0,0 +1,210 @@
+#ifndef CONSTFOLD_H
+#define CONSTFOLD_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "arena.h"
+#include "ast.h"
+#include "types.h"
+
+// Evaluates op on two constants with MIPS semantics: add/sub/mul wrap around at 32 bits, div
+// truncates toward zero and INT32_MIN / -1 wraps to INT32_MIN, comparisons give 1 or 0. Returns false
+// for a division by zero.
+inline bool fold_binary(BinaryOp op, int32_t a, int32_t b, int32_t& out) {
+    uint32_t ua = (uint32_t)a;
+    uint32_t ub = (uint32_t)b;
+    switch (op) {
+        case BinaryOp::Add: out = (int32_t)(ua + ub); return true;
+        case BinaryOp::Sub: out = (int32_t)(ua - ub); return true;
+        case BinaryOp::Mul: out = (int32_t)(ua * ub); return true;
+        case BinaryOp::Div:
+            if (b == 0) return false;
+            out = b == -1 ? (int32_t)(0u - ua) : a / b;
+            return true;
+        case BinaryOp::Lt: out = a < b; return true;
+        case BinaryOp::Le: out = a <= b; return true;
+        case BinaryOp::Gt: out = a > b; return true;
+        case BinaryOp::Ge: out = a >= b; return true;
+        case BinaryOp::Eq: out = a == b; return true;
+        case BinaryOp::Ne: out = a != b; return true;
+    }
+    return false;
+}
+
+// Constant folding and forward constant propagation over the straight-line statement list.
+// Variables holding a value known at compile time are replaced by that value and every operation
+// on constants is evaluated, so `a = 1; b = a * 2 + 3;` generates a single li for b.
+// The pass mirrors the code generator's view of declarations: statements it would reject
+// (redeclarations, undeclared variables) are left untouched for it to report.
+class ConstantFolder {
+private:
+    // What the pass knows about a variable, indexed by symbol id
+    struct Variable {
+        bool declared = false;
+        bool known = false;  // holds a compile-time value
+        ValueType type = ValueType::Int;
+        int32_t value = 0;   // narrowed to the type
+    };
+
+    Arena& arena;
+    std::vector<Variable> variables;
+    const BinaryExpr* division_by_zero;  // first constant division by zero seen
+
+    static bool is_constant(const Expr* expr, int32_t value) {
+        return expr->kind == ExprKind::Constant && static_cast<const ConstantExpr*>(expr)->value == value;
+    }
+
+    bool all_declared(const Expr* expr) const {
+        switch (expr->kind) {
+            case ExprKind::Constant:
+                return true;
+            case ExprKind::Variable:
+                return variables[static_cast<const VariableExpr*>(expr)->symbol].declared;
+            case ExprKind::Binary:
+                return all_declared(static_cast<const BinaryExpr*>(expr)->lhs) &&
+                       all_declared(static_cast<const BinaryExpr*>(expr)->rhs);
+            case ExprKind::Call:  // calls only compile through the IR (lower.h)
+                break;
+        }
+        return false;
+    }
+
+    Expr* simplified(Expr* expr) {
+        ++folded;
+        return expr;
+    }
+
+    Expr* fold(Expr* expr) {
+        if (expr->kind == ExprKind::Variable) {
+            const Variable& variable = variables[static_cast<VariableExpr*>(expr)->symbol];
+            if (!variable.known) return expr;
+            ++propagated;
+            return arena.make<ConstantExpr>(variable.value, expr->line, expr->column);
+        }
+        if (expr->kind != ExprKind::Binary) return expr;
+
+        auto* bin = static_cast<BinaryExpr*>(expr);
+        bin->lhs = fold(bin->lhs);
+        bin->rhs = fold(bin->rhs);
+        if (bin->lhs->kind == ExprKind::Constant && bin->rhs->kind == ExprKind::Constant) {
+            int32_t value;
+            if (!fold_binary(bin->op, static_cast<ConstantExpr*>(bin->lhs)->value,
+                             static_cast<ConstantExpr*>(bin->rhs)->value, value)) {
+                if (division_by_zero == nullptr) division_by_zero = bin;
+                return bin;
+            }
+            ++folded;
+            return arena.make<ConstantExpr>(value, bin->line, bin->column);
+        }
+
+        // Identities with one constant operand, none of them changes the result
+        switch (bin->op) {
+            case BinaryOp::Add:
+                if (is_constant(bin->lhs, 0)) return simplified(bin->rhs);
+                if (is_constant(bin->rhs, 0)) return simplified(bin->lhs);
+                break;
+            case BinaryOp::Sub:
+                if (is_constant(bin->rhs, 0)) return simplified(bin->lhs);
+                break;
+            case BinaryOp::Mul:
+                if (is_constant(bin->lhs, 1)) return simplified(bin->rhs);
+                if (is_constant(bin->rhs, 1)) return simplified(bin->lhs);
+                if (is_constant(bin->lhs, 0)) return simplified(bin->lhs);
+                if (is_constant(bin->rhs, 0)) return simplified(bin->rhs);
+                break;
+            case BinaryOp::Div:
+                if (is_constant(bin->rhs, 0)) {
+                    if (division_by_zero == nullptr) division_by_zero = bin;
+                } else if (is_constant(bin->rhs, 1)) {
+                    return simplified(bin->lhs);
+                }
+                break;
+            default:
+                break;
+        }
+        return bin;
+    }
+
+    // Folds the value assigned to the variable. Returns false after a constant division by zero.
+    bool fold_assigned(uint32_t symbol, Expr*& value) {
+        Variable& variable = variables[symbol];
+        if (!all_declared(value)) {
+            // The code generator rejects the statement, nothing is known about the variable any more
+            variable.known = false;
+            return true;
+        }
+        value = fold(value);
+        if (division_by_zero != nullptr) return false;
+        variable.known = value->kind == ExprKind::Constant;
+        if (variable.known) variable.value = narrow(static_cast<ConstantExpr*>(value)->value, variable.type);
+        return true;
+    }
+
+    Stmt* division_error(const Stmt* stmt) {
+        std::string message = "Division by zero at line " + std::to_string(division_by_zero->line) +
+                              ", column " + std::to_string(division_by_zero->column);
+        division_by_zero = nullptr;
+        ++errors;
+        return arena.make<ErrorStmt>(arena.copy(message), stmt->line);
+    }
+
+public:
+    size_t folded = 0;      // operations evaluated or simplified at compile time
+    size_t propagated = 0;  // variable reads replaced by their constant value
+    size_t errors = 0;      // statements rejected for a constant division by zero
+
+    explicit ConstantFolder(Arena& arena) : arena(arena), division_by_zero(nullptr) {}
+
+    // Rewrites one statement, a constant division by zero turns it into an ErrorStmt. Symbols
+    // have to be below the count run(Program&) was given.
+    Stmt* run(Stmt* stmt) {
+        switch (stmt->kind) {
+            case StmtKind::Declaration: {
+                auto* decl = static_cast<DeclarationStmt*>(stmt);
+                Variable& variable = variables[decl->symbol];
+                if (variable.declared) break;  // redeclaration, reported later
+                variable.declared = true;
+                variable.type = decl->type;
+                if (decl->init == nullptr) {
+                    variable.known = true;  // declarations are zero initialised
+                    variable.value = 0;
+                } else if (!fold_assigned(decl->symbol, decl->init)) {
+                    variable = Variable();  // the rejected declaration never happens
+                    return division_error(stmt);
+                }
+                break;
+            }
+            case StmtKind::Assignment: {
+                auto* assign = static_cast<AssignmentStmt*>(stmt);
+                if (!variables[assign->symbol].declared) break;
+                if (!fold_assigned(assign->symbol, assign->value)) return division_error(stmt);
+                break;
+            }
+            case StmtKind::Return: {
+                auto* ret = static_cast<ReturnStmt*>(stmt);
+                if (ret->value == nullptr || !all_declared(ret->value)) break;
+                ret->value = fold(ret->value);
+                if (division_by_zero != nullptr) return division_error(stmt);
+                break;
+            }
+            case StmtKind::If:
+            case StmtKind::While:
+            case StmtKind::Function:
+            case StmtKind::Block:  // control flow only compiles through the IR (lower.h)
+            case StmtKind::Error:
+                break;
+        }
+        return stmt;
+    }
+
+    void run(Program& program) {
+        if (variables.size() < program.symbols) variables.resize(program.symbols);
+        for (Stmt*& stmt : program.statements) {
+            stmt = run(stmt);
+        }
+    }
+};
+
+#endif // CONSTFOLD_H
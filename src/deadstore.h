@@ -0,0 +1,170 @@
+#ifndef DEADSTORE_H
+#define DEADSTORE_H
+
+#include <cstdint>
+#include <vector>
+
+#include "ast.h"
+
+// Dead store and dead variable elimination. A backward liveness scan over the straight-line
+// program removes assignments whose value is overwritten or never read before the end, skips the
+// initial store of declarations in the same situation and marks variables that are never live
+// at all, which then get no stack slot. Only return values are observable.
+// Statements the code generator rejects (undeclared or redeclared variables) keep their
+// diagnostic and have no effect on liveness.
+class DeadStoreElimination {
+private:
+    // By symbol id
+    std::vector<bool> live;
+    std::vector<bool> ever_live;
+
+    // Clears the variable's liveness, true when it was live
+    bool kill(uint32_t symbol) {
+        bool was_live = live[symbol];
+        live[symbol] = false;
+        return was_live;
+    }
+
+    void mark_live(const Expr* expr) {
+        if (expr->kind == ExprKind::Variable) {
+            uint32_t symbol = static_cast<const VariableExpr*>(expr)->symbol;
+            live[symbol] = true;
+            ever_live[symbol] = true;
+        } else if (expr->kind == ExprKind::Binary) {
+            mark_live(static_cast<const BinaryExpr*>(expr)->lhs);
+            mark_live(static_cast<const BinaryExpr*>(expr)->rhs);
+        }
+    }
+
+    static bool all_declared(const Expr* expr, const std::vector<bool>& declared) {
+        switch (expr->kind) {
+            case ExprKind::Constant:
+                return true;
+            case ExprKind::Variable:
+                return declared[static_cast<const VariableExpr*>(expr)->symbol];
+            case ExprKind::Binary:
+                return all_declared(static_cast<const BinaryExpr*>(expr)->lhs, declared) &&
+                       all_declared(static_cast<const BinaryExpr*>(expr)->rhs, declared);
+            case ExprKind::Call:  // calls only compile through the IR (lower.h)
+                break;
+        }
+        return false;
+    }
+
+    enum Verdict : uint8_t { Accepted, Rejected, Uninitialised };  // the latter still declares
+
+    // Forward scan mirroring the code generator's declaration checks
+    static std::vector<Verdict> find_rejected(const Program& program) {
+        std::vector<Verdict> rejected(program.statements.size(), Accepted);
+        std::vector<bool> declared(program.symbols, false);
+        for (size_t i = 0; i < program.statements.size(); ++i) {
+            const Stmt* stmt = program.statements[i];
+            switch (stmt->kind) {
+                case StmtKind::Declaration: {
+                    auto* decl = static_cast<const DeclarationStmt*>(stmt);
+                    if (declared[decl->symbol]) {
+                        rejected[i] = Rejected;
+                        break;
+                    }
+                    declared[decl->symbol] = true;
+                    if (decl->init != nullptr && !all_declared(decl->init, declared)) {
+                        rejected[i] = Uninitialised;
+                    }
+                    break;
+                }
+                case StmtKind::Assignment: {
+                    auto* assign = static_cast<const AssignmentStmt*>(stmt);
+                    if (!declared[assign->symbol] || !all_declared(assign->value, declared)) {
+                        rejected[i] = Rejected;
+                    }
+                    break;
+                }
+                case StmtKind::Return: {
+                    const Expr* value = static_cast<const ReturnStmt*>(stmt)->value;
+                    if (value != nullptr && !all_declared(value, declared)) rejected[i] = Rejected;
+                    break;
+                }
+                case StmtKind::If:
+                case StmtKind::While:
+                case StmtKind::Function:
+                case StmtKind::Block:
+                    break;  // control flow only compiles through the IR (lower.h)
+                case StmtKind::Error:
+                    rejected[i] = Rejected;
+                    break;
+            }
+        }
+        return rejected;
+    }
+
+public:
+    size_t removed_stores = 0;  // assignments removed and initial stores skipped
+    size_t removed_slots = 0;   // variables left without a stack slot
+
+    void run(Program& program) {
+        live.assign(program.symbols, false);
+        ever_live.assign(program.symbols, false);
+        std::vector<Verdict> verdicts = find_rejected(program);
+        std::vector<bool> removed(program.statements.size(), false);
+
+        for (size_t i = program.statements.size(); i-- > 0;) {
+            Stmt* stmt = program.statements[i];
+            if (verdicts[i] == Uninitialised) {
+                kill(static_cast<DeclarationStmt*>(stmt)->symbol);
+                continue;
+            }
+            if (verdicts[i] == Rejected) continue;
+            switch (stmt->kind) {
+                case StmtKind::Declaration: {
+                    auto* decl = static_cast<DeclarationStmt*>(stmt);
+                    if (kill(decl->symbol)) {
+                        if (decl->init != nullptr) mark_live(decl->init);
+                    } else {
+                        decl->store_init = false;
+                        ++removed_stores;
+                    }
+                    break;
+                }
+                case StmtKind::Assignment: {
+                    auto* assign = static_cast<AssignmentStmt*>(stmt);
+                    if (kill(assign->symbol)) {
+                        mark_live(assign->value);
+                    } else {
+                        removed[i] = true;
+                        ++removed_stores;
+                    }
+                    break;
+                }
+                case StmtKind::Return: {
+                    const Expr* value = static_cast<const ReturnStmt*>(stmt)->value;
+                    if (value != nullptr) mark_live(value);
+                    break;
+                }
+                case StmtKind::If:
+                case StmtKind::While:
+                case StmtKind::Function:
+                case StmtKind::Block:  // control flow only compiles through the IR (lower.h)
+                case StmtKind::Error:
+                    break;
+            }
+        }
+
+        // Declarations of variables that are never read need no stack slot
+        for (size_t i = 0; i < program.statements.size(); ++i) {
+            if (program.statements[i]->kind != StmtKind::Declaration) continue;
+            auto* decl = static_cast<DeclarationStmt*>(program.statements[i]);
+            if (!ever_live[decl->symbol] && decl->needs_slot) {
+                decl->needs_slot = false;
+                if (verdicts[i] != Rejected) ++removed_slots;
+            }
+        }
+
+        size_t kept = 0;
+        for (size_t i = 0; i < program.statements.size(); ++i) {
+            if (!removed[i]) program.statements[kept++] = program.statements[i];
+        }
+        program.statements.resize(kept);
+    }
+};
+
+#endif // DEADSTORE_H
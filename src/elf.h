@@ -0,0 +1,275 @@
+#ifndef ELF_H
+#define ELF_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "encode.h"
+
+// ELF32 relocatable objects for MIPS O32, big- or little-endian: the machine code of encode.h in
+// .text, its labels in .symtab (the local ones first, as ELF requires) and the j/jal targets in
+// .rel.text as R_MIPS_26 relocations with the addend in the instruction, the way O32 does it.
+// read_elf_object() reads such an object back, e.g. for the simulator.
+
+namespace elf {
+
+constexpr uint16_t ET_REL = 1;
+constexpr uint16_t EM_MIPS = 8;
+constexpr uint32_t EF_MIPS_ABI_O32 = 0x00001000;
+constexpr uint32_t EF_MIPS_ARCH_32 = 0x50000000;
+constexpr uint32_t SHT_PROGBITS = 1, SHT_SYMTAB = 2, SHT_STRTAB = 3, SHT_NOBITS = 8, SHT_REL = 9;
+constexpr uint32_t SHF_ALLOC = 0x2, SHF_EXECINSTR = 0x4, SHF_INFO_LINK = 0x40;
+constexpr uint8_t STB_LOCAL = 0, STB_GLOBAL = 1;
+constexpr uint8_t STT_NOTYPE = 0, STT_SECTION = 3;
+constexpr uint32_t R_MIPS_26 = 4;
+constexpr size_t header_size = 52, section_header_size = 40, symbol_size = 16, relocation_size = 8;
+
+// Section indices of the objects written here
+enum Section : uint16_t { NULL_SECTION, TEXT, REL_TEXT, SYMTAB, STRTAB, SHSTRTAB, SECTION_COUNT };
+
+class Writer {
+private:
+    std::string& out;
+    bool big_endian;
+
+public:
+    Writer(std::string& out, bool big_endian) : out(out), big_endian(big_endian) {}
+
+    void u8(uint8_t value) { out.push_back((char)value); }
+
+    void u16(uint16_t value) {
+        u8((uint8_t)(big_endian ? value >> 8 : value));
+        u8((uint8_t)(big_endian ? value : value >> 8));
+    }
+
+    void u32(uint32_t value) {
+        for (int i = 0; i < 4; ++i) u8((uint8_t)(value >> (big_endian ? 24 - 8 * i : 8 * i)));
+    }
+
+    void align(size_t alignment) {
+        while (out.size() % alignment != 0) out.push_back('\0');
+    }
+};
+
+inline uint32_t read32(const unsigned char* p, bool big_endian) {
+    return big_endian ? (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3]
+                      : (uint32_t)p[3] << 24 | (uint32_t)p[2] << 16 | (uint32_t)p[1] << 8 | p[0];
+}
+
+inline uint16_t read16(const unsigned char* p, bool big_endian) {
+    return big_endian ? (uint16_t)(p[0] << 8 | p[1]) : (uint16_t)(p[1] << 8 | p[0]);
+}
+
+// Appends name and its terminating zero to a string table, returns its index there
+inline uint32_t add_string(std::string& table, std::string_view name) {
+    uint32_t index = (uint32_t)table.size();
+    table.append(name).push_back('\0');
+    return index;
+}
+
+} // namespace elf
+
+// The object file of code, in the byte order of a MIPS configured big- or little-endian
+inline std::string elf_object(const MachineCode& code, bool big_endian) {
+    using namespace elf;
+
+    // Symbols: null, the section, locals in code order, then globals; symbol_index maps code.symbols
+    std::vector<uint32_t> symbol_index(code.symbols.size());
+    std::vector<uint32_t> order;
+    for (int global = 0; global < 2; ++global) {
+        for (uint32_t s = 0; s < code.symbols.size(); ++s) {
+            if (code.symbols[s].global == (global == 1)) order.push_back(s);
+        }
+    }
+    uint32_t first_global = 2;
+    for (uint32_t i = 0; i < order.size(); ++i) {
+        symbol_index[order[i]] = 2 + i;
+        if (!code.symbols[order[i]].global) ++first_global;
+    }
+
+    std::string strtab(1, '\0');
+    std::string shstrtab(1, '\0');
+    uint32_t section_names[SECTION_COUNT] = {};
+    const char* names[SECTION_COUNT] = {"", ".text", ".rel.text", ".symtab", ".strtab", ".shstrtab"};
+    for (int section = TEXT; section < SECTION_COUNT; ++section) section_names[section] = add_string(shstrtab, names[section]);
+
+    std::string file;
+    Writer w(file, big_endian);
+    file.resize(header_size);  // filled in last, when the offsets are known
+
+    uint32_t offsets[SECTION_COUNT] = {}, sizes[SECTION_COUNT] = {};
+    offsets[TEXT] = (uint32_t)file.size();
+    for (uint32_t word : code.words) w.u32(word);
+    sizes[TEXT] = code.size();
+
+    offsets[REL_TEXT] = (uint32_t)file.size();
+    for (const CodeRelocation& relocation : code.relocations) {
+        uint32_t symbol = relocation.symbol == CodeRelocation::section_symbol ? 1 : symbol_index[relocation.symbol];
+        w.u32(relocation.offset);
+        w.u32(symbol << 8 | R_MIPS_26);
+    }
+    sizes[REL_TEXT] = (uint32_t)(file.size() - offsets[REL_TEXT]);
+
+    offsets[SYMTAB] = (uint32_t)file.size();
+    for (int i = 0; i < 4; ++i) w.u32(0);
+    w.u32(0);  // the section symbol
+    w.u32(0);
+    w.u32(0);
+    w.u8(STB_LOCAL << 4 | STT_SECTION);
+    w.u8(0);
+    w.u16(TEXT);
+    for (uint32_t s : order) {
+        const CodeSymbol& symbol = code.symbols[s];
+        w.u32(add_string(strtab, symbol.name));
+        w.u32(symbol.offset);
+        w.u32(0);
+        w.u8((uint8_t)((symbol.global ? STB_GLOBAL : STB_LOCAL) << 4 | STT_NOTYPE));
+        w.u8(0);
+        w.u16(symbol.defined ? TEXT : NULL_SECTION);
+    }
+    sizes[SYMTAB] = (uint32_t)(file.size() - offsets[SYMTAB]);
+
+    offsets[STRTAB] = (uint32_t)file.size();
+    file += strtab;
+    sizes[STRTAB] = (uint32_t)strtab.size();
+    offsets[SHSTRTAB] = (uint32_t)file.size();
+    file += shstrtab;
+    sizes[SHSTRTAB] = (uint32_t)shstrtab.size();
+    w.align(4);
+
+    uint32_t section_headers = (uint32_t)file.size();
+    const uint32_t types[SECTION_COUNT] = {0, SHT_PROGBITS, SHT_REL, SHT_SYMTAB, SHT_STRTAB, SHT_STRTAB};
+    const uint32_t flags[SECTION_COUNT] = {0, SHF_ALLOC | SHF_EXECINSTR, SHF_INFO_LINK, 0, 0, 0};
+    const uint32_t links[SECTION_COUNT] = {0, 0, SYMTAB, STRTAB, 0, 0};
+    const uint32_t infos[SECTION_COUNT] = {0, 0, TEXT, first_global, 0, 0};
+    const uint32_t alignments[SECTION_COUNT] = {0, 4, 4, 4, 1, 1};
+    const uint32_t entry_sizes[SECTION_COUNT] = {0, 0, relocation_size, symbol_size, 0, 0};
+    for (int section = NULL_SECTION; section < SECTION_COUNT; ++section) {
+        w.u32(section_names[section]);
+        w.u32(types[section]);
+        w.u32(flags[section]);
+        w.u32(0);  // address
+        w.u32(offsets[section]);
+        w.u32(sizes[section]);
+        w.u32(links[section]);
+        w.u32(infos[section]);
+        w.u32(alignments[section]);
+        w.u32(entry_sizes[section]);
+    }
+
+    std::string header;
+    Writer h(header, big_endian);
+    for (char c : {'\x7f', 'E', 'L', 'F'}) h.u8((uint8_t)c);
+    h.u8(1);                     // ELFCLASS32
+    h.u8(big_endian ? 2 : 1);    // ELFDATA2MSB / ELFDATA2LSB
+    h.u8(1);                     // EV_CURRENT
+    for (int i = 7; i < 16; ++i) h.u8(0);
+    h.u16(ET_REL);
+    h.u16(EM_MIPS);
+    h.u32(1);                    // version
+    h.u32(0);                    // entry
+    h.u32(0);                    // program headers
+    h.u32(section_headers);
+    h.u32(EF_MIPS_ARCH_32 | EF_MIPS_ABI_O32);
+    h.u16(header_size);
+    h.u16(0);
+    h.u16(0);
+    h.u16(section_header_size);
+    h.u16(SECTION_COUNT);
+    h.u16(SHSTRTAB);
+    file.replace(0, header_size, header);
+    return file;
+}
+
+// Reads the .text of a MIPS ELF32 relocatable object with its symbols and R_MIPS_26 relocations,
+// false with code.error set when data is not one
+inline bool read_elf_object(std::string_view data, MachineCode& code) {
+    using namespace elf;
+    auto fail = [&](const char* message) {
+        code.error = message;
+        return false;
+    };
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(data.data());
+    if (data.size() < header_size || data.substr(0, 4) != "\x7f" "ELF") return fail("not an ELF file");
+    if (p[4] != 1 || (p[5] != 1 && p[5] != 2)) return fail("not a 32-bit ELF file");
+    bool big = p[5] == 2;
+    if (read16(p + 16, big) != ET_REL || read16(p + 18, big) != EM_MIPS) return fail("not a MIPS relocatable object");
+
+    uint32_t section_headers = read32(p + 32, big);
+    uint16_t count = read16(p + 48, big);
+    uint16_t names_index = read16(p + 50, big);
+    if (read16(p + 46, big) != section_header_size || names_index >= count ||
+        section_headers > data.size() || (data.size() - section_headers) / section_header_size < count) {
+        return fail("bad section headers");
+    }
+    struct SectionHeader {
+        uint32_t name, type, offset, size, link, info;
+    };
+    std::vector<SectionHeader> sections(count);
+    for (uint16_t i = 0; i < count; ++i) {
+        const unsigned char* s = p + section_headers + i * section_header_size;
+        sections[i] = SectionHeader{read32(s, big), read32(s + 4, big), read32(s + 16, big), read32(s + 20, big),
+                                    read32(s + 24, big), read32(s + 28, big)};
+        if (sections[i].type != SHT_NOBITS && (sections[i].offset > data.size() || sections[i].size > data.size() - sections[i].offset)) {
+            return fail("section out of the file");
+        }
+    }
+    auto section_name = [&](uint32_t i) {
+        const SectionHeader& names = sections[names_index];
+        if (sections[i].name >= names.size) return std::string_view();
+        std::string_view table = data.substr(names.offset, names.size);
+        return table.substr(sections[i].name, table.find('\0', sections[i].name) - sections[i].name);
+    };
+
+    uint32_t text = 0, symtab = 0, rel = 0;
+    for (uint32_t i = 1; i < count; ++i) {
+        if (sections[i].type == SHT_PROGBITS && section_name(i) == ".text") text = i;
+    }
+    for (uint32_t i = 1; i < count; ++i) {
+        if (sections[i].type == SHT_SYMTAB) symtab = i;
+        if (sections[i].type == SHT_REL && sections[i].info == text) rel = i;
+    }
+    if (text == 0 || symtab == 0 || sections[symtab].link >= count) return fail("no .text or .symtab section");
+    if (sections[text].size % 4 != 0) return fail("partial instruction in .text");
+
+    code.words.clear();
+    code.symbols.clear();
+    code.relocations.clear();
+    for (uint32_t at = 0; at < sections[text].size; at += 4) code.words.push_back(read32(p + sections[text].offset + at, big));
+
+    // ELF symbol index -> index in code.symbols, section_symbol for the .text section symbol
+    const uint32_t unknown = CodeRelocation::section_symbol - 1;
+    const SectionHeader& strings = sections[sections[symtab].link];
+    std::string_view string_table = data.substr(strings.offset, strings.size);
+    std::vector<uint32_t> symbol_index(sections[symtab].size / symbol_size, unknown);
+    for (uint32_t i = 1; i < symbol_index.size(); ++i) {
+        const unsigned char* s = p + sections[symtab].offset + i * symbol_size;
+        uint32_t name = read32(s, big);
+        uint8_t info = s[12];
+        uint16_t section = read16(s + 14, big);
+        if ((info & 0xF) == STT_SECTION) {
+            if (section == text) symbol_index[i] = CodeRelocation::section_symbol;
+            continue;
+        }
+        if (name >= string_table.size() || (section != text && section != NULL_SECTION)) continue;
+        symbol_index[i] = (uint32_t)code.symbols.size();
+        code.symbols.push_back(CodeSymbol{std::string(string_table.substr(name, string_table.find('\0', name) - name)),
+                                          read32(s + 4, big), (info >> 4) == STB_GLOBAL, section == text});
+    }
+    if (rel != 0) {
+        for (uint32_t at = 0; at + relocation_size <= sections[rel].size; at += relocation_size) {
+            const unsigned char* r = p + sections[rel].offset + at;
+            uint32_t offset = read32(r, big), info = read32(r + 4, big);
+            if ((info & 0xFF) != R_MIPS_26) return fail("unsupported relocation type");
+            if ((info >> 8) >= symbol_index.size() || symbol_index[info >> 8] == unknown) {
+                return fail("relocation against an unknown symbol");
+            }
+            code.relocations.push_back(CodeRelocation{offset, symbol_index[info >> 8]});
+        }
+    }
+    return true;
+}
+
+#endif // ELF_H
@@ -0,0 +1,429 @@
+#ifndef ENCODE_H
+#define ENCODE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "instr.h"
+#include "mips.h"
+#include "strength.h"
+
+// MIPS32 machine code of an instruction list, the binary counterpart of print_instructions().
+// Pseudo instructions are expanded the way an assembler does it for the text: li into addiu, ori
+// or lui + ori, move into or, loads and stores with an offset beyond 16 bits into lui + addu + the
+// access. The text has no branch delay slots, so every branch and jump is followed by a nop.
+// Branches are resolved here, j/jal leave an R_MIPS_26 relocation for the object writer (elf.h).
+// decode_machine_code() turns the words back into the instructions they were encoded from.
+
+// A label of the code. Undefined symbols are the targets of j/jal the code does not define.
+struct CodeSymbol {
+    std::string name;
+    uint32_t offset = 0;  // byte offset in the code
+    bool global = false;  // named by a .globl directive
+    bool defined = true;
+};
+
+// j/jal at offset whose 26-bit field gets the address of symbols[symbol], section_symbol for a
+// local label: the field then already holds its offset
+struct CodeRelocation {
+    static constexpr uint32_t section_symbol = UINT32_MAX;
+    uint32_t offset;
+    uint32_t symbol;
+};
+
+struct MachineCode {
+    std::vector<uint32_t> words;
+    std::vector<CodeSymbol> symbols;  // in the order of the code
+    std::vector<CodeRelocation> relocations;
+    std::string error;  // why encoding or decoding failed
+
+    uint32_t size() const { return (uint32_t)words.size() * 4; }
+};
+
+namespace mips_encoding {
+
+// Primary opcodes and SPECIAL function codes used by the compiler
+enum : uint32_t {
+    SPECIAL = 0x00, REGIMM = 0x01, J = 0x02, JAL = 0x03, BEQ = 0x04, BNE = 0x05, BLEZ = 0x06, BGTZ = 0x07,
+    ADDIU = 0x09, SLTI = 0x0A, SLTIU = 0x0B, ORI = 0x0D, XORI = 0x0E, LUI = 0x0F, SPECIAL2 = 0x1C,
+    LB = 0x20, LH = 0x21, LW = 0x23, SB = 0x28, SH = 0x29, SW = 0x2B,
+};
+enum : uint32_t {
+    F_SLL = 0x00, F_SRL = 0x02, F_SRA = 0x03, F_JR = 0x08, F_SYSCALL = 0x0C, F_MFHI = 0x10, F_MFLO = 0x12,
+    F_MULT = 0x18, F_DIV = 0x1A, F_ADD = 0x20, F_ADDU = 0x21, F_SUB = 0x22, F_SUBU = 0x23, F_OR = 0x25,
+    F_XOR = 0x26, F_SLT = 0x2A, F_SLTU = 0x2B, F2_MUL = 0x02,
+};
+enum : uint32_t { RT_BLTZ = 0x00, RT_BGEZ = 0x01 };
+
+constexpr uint32_t nop = 0;  // sll $zero, $zero, 0
+
+inline uint32_t number(Reg reg) { return reg == Reg::none ? 0 : (uint32_t)reg; }
+
+inline uint32_t r_type(uint32_t funct, Reg rs, Reg rt, Reg rd, uint32_t shamt = 0) {
+    return number(rs) << 21 | number(rt) << 16 | number(rd) << 11 | (shamt & 31) << 6 | funct;
+}
+
+inline uint32_t i_type(uint32_t opcode, Reg rs, Reg rt, int32_t imm) {
+    return opcode << 26 | number(rs) << 21 | number(rt) << 16 | ((uint32_t)imm & 0xFFFF);
+}
+
+inline bool fits_unsigned16(int64_t value) { return value >= 0 && value <= 0xFFFF; }
+
+inline uint32_t load_store_opcode(Opcode op) {
+    switch (op) {
+        case Opcode::Lb: return LB;
+        case Opcode::Lh: return LH;
+        case Opcode::Lw: return LW;
+        case Opcode::Sb: return SB;
+        case Opcode::Sh: return SH;
+        default: return SW;
+    }
+}
+
+// Upper half for lui, such that adding the sign-extended lower half gives value back
+inline int32_t high_half(int32_t value) { return (int32_t)(((int64_t)value + 0x8000) >> 16); }
+inline int32_t low_half(int32_t value) { return (int32_t)(int16_t)(uint16_t)value; }
+
+// Words in is encoded into
+inline uint32_t encoded_words(const Instr& in) {
+    if (is_pseudo(in.op)) return 0;
+    if (in.op == Opcode::Li) {
+        return fits_immediate(in.imm) || fits_unsigned16(in.imm) || (in.imm & 0xFFFF) == 0 ? 1 : 2;
+    }
+    if (is_load(in.op) || is_store(in.op)) return fits_immediate(in.imm) ? 1 : 3;
+    if (is_branch(in.op)) return 2;  // and the delay slot
+    return 1;
+}
+
+} // namespace mips_encoding
+
+// Encodes code into out, false with out.error set when an operand cannot be encoded
+inline bool encode_instructions(const std::vector<Instr>& code, MachineCode& out) {
+    using namespace mips_encoding;
+    out.words.clear();
+    out.symbols.clear();
+    out.relocations.clear();
+
+    // Label offsets first, branches may go forward
+    std::unordered_map<std::string_view, uint32_t> labels;
+    std::vector<std::string_view> globals;
+    uint32_t offset = 0;
+    for (const Instr& in : code) {
+        if (in.op == Opcode::Label) {
+            if (!labels.emplace(in.note, (uint32_t)out.symbols.size()).second) {
+                out.error = "label '" + std::string(in.note) + "' defined twice";
+                return false;
+            }
+            out.symbols.push_back(CodeSymbol{std::string(in.note), offset});
+        } else if (in.op == Opcode::Directive && in.note.substr(0, 6) == ".globl") {
+            std::string_view name = in.note.substr(6);
+            while (!name.empty() && (name.front() == ' ' || name.front() == '\t')) name.remove_prefix(1);
+            globals.push_back(name);
+        }
+        offset += encoded_words(in) * 4;
+    }
+    for (std::string_view name : globals) {
+        auto it = labels.find(name);
+        if (it != labels.end()) out.symbols[it->second].global = true;
+    }
+
+    out.words.reserve(offset / 4);
+    for (const Instr& in : code) {
+        if (is_pseudo(in.op)) continue;
+        uint32_t at = out.size();
+        if (is_three_register(in.op)) {
+            static const uint32_t functs[] = {F_ADD, F_ADDU, F_SUB, F_SUBU, F2_MUL, F_SLT, F_SLTU, F_XOR};
+            uint32_t word = r_type(functs[(int)in.op - (int)Opcode::Add], in.rs, in.rt, in.rd);
+            out.words.push_back(in.op == Opcode::Mul ? SPECIAL2 << 26 | word : word);
+            continue;
+        }
+        switch (in.op) {
+            case Opcode::Addiu: case Opcode::Slti: case Opcode::Sltiu: case Opcode::Xori: {
+                bool fits = in.op == Opcode::Xori ? fits_unsigned16(in.imm) : fits_immediate(in.imm);
+                if (!fits) {
+                    out.error = std::string(opcode_name(in.op)) + " immediate " + std::to_string(in.imm) + " out of range";
+                    return false;
+                }
+                uint32_t opcode = in.op == Opcode::Addiu ? ADDIU : in.op == Opcode::Slti ? SLTI :
+                                  in.op == Opcode::Sltiu ? SLTIU : XORI;
+                out.words.push_back(i_type(opcode, in.rs, in.rd, in.imm));
+                break;
+            }
+            case Opcode::Sll: case Opcode::Sra: case Opcode::Srl: {
+                uint32_t funct = in.op == Opcode::Sll ? F_SLL : in.op == Opcode::Sra ? F_SRA : F_SRL;
+                out.words.push_back(r_type(funct, Reg::zero, in.rs, in.rd, (uint32_t)in.imm));
+                break;
+            }
+            case Opcode::Li:
+                if (fits_immediate(in.imm)) {
+                    out.words.push_back(i_type(ADDIU, Reg::zero, in.rd, in.imm));
+                } else if (fits_unsigned16(in.imm)) {
+                    out.words.push_back(i_type(ORI, Reg::zero, in.rd, in.imm));
+                } else {
+                    out.words.push_back(i_type(LUI, Reg::zero, in.rd, (int32_t)((uint32_t)in.imm >> 16)));
+                    if ((in.imm & 0xFFFF) != 0) out.words.push_back(i_type(ORI, in.rd, in.rd, in.imm));
+                }
+                break;
+            case Opcode::Move:
+                out.words.push_back(r_type(F_OR, in.rs, Reg::zero, in.rd));
+                break;
+            case Opcode::Mult: case Opcode::Div:
+                out.words.push_back(r_type(in.op == Opcode::Mult ? F_MULT : F_DIV, in.rs, in.rt, Reg::zero));
+                break;
+            case Opcode::Mflo: case Opcode::Mfhi:
+                out.words.push_back(r_type(in.op == Opcode::Mflo ? F_MFLO : F_MFHI, Reg::zero, Reg::zero, in.rd));
+                break;
+            case Opcode::Lb: case Opcode::Lh: case Opcode::Lw:
+            case Opcode::Sb: case Opcode::Sh: case Opcode::Sw: {
+                Reg value = is_load(in.op) ? in.rd : in.rt;
+                if (fits_immediate(in.imm)) {
+                    out.words.push_back(i_type(load_store_opcode(in.op), in.rs, value, in.imm));
+                    break;
+                }
+                // A load builds the address in its destination unless that is the base, a store in $at.
+                // The code generator keeps $at out of those, a base or stored value in it would be lost.
+                Reg temp = is_load(in.op) && value != in.rs && value != Reg::zero ? value : Reg::at;
+                if (temp == Reg::at && (in.rs == Reg::at || (is_store(in.op) && value == Reg::at))) {
+                    out.error = std::string(opcode_name(in.op)) + " through $at with offset " +
+                                std::to_string(in.imm) + " out of range";
+                    return false;
+                }
+                out.words.push_back(i_type(LUI, Reg::zero, temp, high_half(in.imm)));
+                out.words.push_back(r_type(F_ADDU, temp, in.rs, temp));
+                out.words.push_back(i_type(load_store_opcode(in.op), temp, value, low_half(in.imm)));
+                break;
+            }
+            case Opcode::Beq: case Opcode::Bne: case Opcode::Bltz: case Opcode::Bgez:
+            case Opcode::Bgtz: case Opcode::Blez: {
+                auto target = labels.find(in.note);
+                if (target == labels.end()) {
+                    out.error = "unknown label '" + std::string(in.note) + "'";
+                    return false;
+                }
+                int64_t distance = ((int64_t)out.symbols[target->second].offset - (at + 4)) / 4;
+                if (!fits_immediate(distance)) {
+                    out.error = "branch to '" + std::string(in.note) + "' out of range";
+                    return false;
+                }
+                uint32_t word;
+                switch (in.op) {
+                    case Opcode::Beq: word = i_type(BEQ, in.rs, in.rt, (int32_t)distance); break;
+                    case Opcode::Bne: word = i_type(BNE, in.rs, in.rt, (int32_t)distance); break;
+                    case Opcode::Bgtz: word = i_type(BGTZ, in.rs, Reg::zero, (int32_t)distance); break;
+                    case Opcode::Blez: word = i_type(BLEZ, in.rs, Reg::zero, (int32_t)distance); break;
+                    default:
+                        word = i_type(REGIMM, in.rs, (Reg)(in.op == Opcode::Bltz ? RT_BLTZ : RT_BGEZ), (int32_t)distance);
+                        break;
+                }
+                out.words.push_back(word);
+                out.words.push_back(nop);
+                break;
+            }
+            case Opcode::J: case Opcode::Jal: {
+                // Jumps to labels of the code are relocated against the section, the rest by name
+                auto target = labels.find(in.note);
+                uint32_t field = 0;
+                uint32_t symbol;
+                if (target != labels.end() && !out.symbols[target->second].global) {
+                    field = out.symbols[target->second].offset >> 2;
+                    symbol = CodeRelocation::section_symbol;
+                } else if (target != labels.end()) {
+                    symbol = target->second;
+                } else {
+                    symbol = (uint32_t)out.symbols.size();
+                    labels.emplace(in.note, symbol);
+                    out.symbols.push_back(CodeSymbol{std::string(in.note), 0, true, false});
+                }
+                out.relocations.push_back(CodeRelocation{at, symbol});
+                out.words.push_back((in.op == Opcode::J ? J : JAL) << 26 | field);
+                out.words.push_back(nop);
+                break;
+            }
+            case Opcode::Jr:
+                out.words.push_back(r_type(F_JR, in.rs, Reg::zero, Reg::zero));
+                out.words.push_back(nop);
+                break;
+            case Opcode::Syscall:
+                out.words.push_back(r_type(F_SYSCALL, Reg::zero, Reg::zero, Reg::zero));
+                break;
+            default:
+                break;
+        }
+    }
+    return true;
+}
+
+// Instructions the words of code were encoded from, with a Label for every defined symbol and
+// ".L<offset>" labels for branch targets without one. offsets[i] is the byte offset of
+// program[i]. The notes point into code.symbols, which is why targets are added there.
+inline bool decode_machine_code(MachineCode& code, std::vector<Instr>& program, std::vector<uint32_t>& offsets) {
+    using namespace mips_encoding;
+    const std::vector<uint32_t>& words = code.words;
+    uint32_t size = code.size();
+    std::unordered_map<uint32_t, const CodeRelocation*> relocations;
+    for (const CodeRelocation& relocation : code.relocations) relocations.emplace(relocation.offset, &relocation);
+
+    auto fail = [&](uint32_t at, const std::string& message) {
+        char hex[16];
+        std::snprintf(hex, sizeof(hex), "0x%x", at);
+        code.error = message + " at offset " + hex;
+        return false;
+    };
+    auto reg = [](uint32_t word, int shift) { return (Reg)(word >> shift & 31); };
+
+    // Branch and jump targets, to give each a label first
+    std::vector<uint32_t> targets(words.size(), 0);  // by word, byte offset + 1 of the target
+    for (uint32_t i = 0; i < words.size(); ++i) {
+        uint32_t word = words[i], opcode = word >> 26;
+        if (opcode == BEQ || opcode == BNE || opcode == BLEZ || opcode == BGTZ || opcode == REGIMM) {
+            targets[i] = i * 4 + 4 + (uint32_t)((int32_t)(int16_t)(word & 0xFFFF) * 4) + 1;
+        } else if (opcode == J || opcode == JAL) {
+            auto relocation = relocations.find(i * 4);
+            uint32_t target = (word & 0x03FFFFFF) << 2;
+            if (relocation != relocations.end() && relocation->second->symbol != CodeRelocation::section_symbol) {
+                const CodeSymbol& symbol = code.symbols[relocation->second->symbol];
+                if (!symbol.defined) return fail(i * 4, "undefined symbol '" + symbol.name + "'");
+                target += symbol.offset;
+            }
+            targets[i] = target + 1;
+        } else {
+            continue;
+        }
+        if (targets[i] - 1 > size || (targets[i] - 1) % 4 != 0) return fail(i * 4, "jump out of the code");
+    }
+    std::unordered_map<uint32_t, uint32_t> label_at;  // byte offset -> first symbol there
+    for (uint32_t s = 0; s < code.symbols.size(); ++s) {
+        if (code.symbols[s].defined) label_at.emplace(code.symbols[s].offset, s);
+    }
+    for (uint32_t target : targets) {
+        if (target != 0 && label_at.count(target - 1) == 0) {
+            char name[24];
+            std::snprintf(name, sizeof(name), ".L%x", target - 1);
+            label_at.emplace(target - 1, (uint32_t)code.symbols.size());
+            code.symbols.push_back(CodeSymbol{name, target - 1});
+        }
+    }
+    std::vector<std::vector<uint32_t>> labels(words.size() + 1);  // by word, the symbols defined there
+    for (uint32_t s = 0; s < code.symbols.size(); ++s) {
+        const CodeSymbol& symbol = code.symbols[s];
+        if (!symbol.defined) continue;
+        if (symbol.offset > size || symbol.offset % 4 != 0) return fail(symbol.offset, "misplaced symbol '" + symbol.name + "'");
+        labels[symbol.offset / 4].push_back(s);
+    }
+    auto target_name = [&](uint32_t i) { return std::string_view(code.symbols[label_at[targets[i] - 1]].name); };
+
+    program.clear();
+    offsets.clear();
+    for (uint32_t i = 0; i <= words.size(); ++i) {
+        for (uint32_t s : labels[i]) {
+            program.push_back(Instr{Opcode::Label, Reg::none, Reg::none, Reg::none, 0, code.symbols[s].name});
+            offsets.push_back(i * 4);
+        }
+        if (i == words.size()) break;
+        uint32_t word = words[i], opcode = word >> 26;
+        Reg rs = reg(word, 21), rt = reg(word, 16), rd = reg(word, 11);
+        int32_t imm = (int16_t)(word & 0xFFFF);
+        uint32_t at = i * 4;
+        Instr in{Opcode::Deleted};
+        uint32_t length = 1;
+        switch (opcode) {
+            case SPECIAL:
+                switch (word & 0x3F) {
+                    case F_ADD: in = Instr{Opcode::Add, rd, rs, rt}; break;
+                    case F_ADDU: in = Instr{Opcode::Addu, rd, rs, rt}; break;
+                    case F_SUB: in = Instr{Opcode::Sub, rd, rs, rt}; break;
+                    case F_SUBU: in = Instr{Opcode::Subu, rd, rs, rt}; break;
+                    case F_SLT: in = Instr{Opcode::Slt, rd, rs, rt}; break;
+                    case F_SLTU: in = Instr{Opcode::Sltu, rd, rs, rt}; break;
+                    case F_XOR: in = Instr{Opcode::Xor, rd, rs, rt}; break;
+                    case F_OR:
+                        if (rt == Reg::zero) in = Instr{Opcode::Move, rd, rs};
+                        break;
+                    case F_SLL: in = Instr{Opcode::Sll, rd, rt, Reg::none, (int32_t)(word >> 6 & 31)}; break;
+                    case F_SRL: in = Instr{Opcode::Srl, rd, rt, Reg::none, (int32_t)(word >> 6 & 31)}; break;
+                    case F_SRA: in = Instr{Opcode::Sra, rd, rt, Reg::none, (int32_t)(word >> 6 & 31)}; break;
+                    case F_MULT: in = Instr{Opcode::Mult, Reg::none, rs, rt}; break;
+                    case F_DIV: in = Instr{Opcode::Div, Reg::none, rs, rt}; break;
+                    case F_MFLO: in = Instr{Opcode::Mflo, rd}; break;
+                    case F_MFHI: in = Instr{Opcode::Mfhi, rd}; break;
+                    case F_JR: in = Instr{Opcode::Jr, Reg::none, rs}; break;
+                    case F_SYSCALL: in = Instr{Opcode::Syscall}; break;
+                }
+                break;
+            case SPECIAL2:
+                if ((word & 0x3F) == F2_MUL) in = Instr{Opcode::Mul, rd, rs, rt};
+                break;
+            case REGIMM:
+                if ((uint32_t)rt == RT_BLTZ || (uint32_t)rt == RT_BGEZ) {
+                    in = Instr{(uint32_t)rt == RT_BLTZ ? Opcode::Bltz : Opcode::Bgez, Reg::none, rs, Reg::none, 0, target_name(i)};
+                }
+                break;
+            case BEQ: case BNE:
+                in = Instr{opcode == BEQ ? Opcode::Beq : Opcode::Bne, Reg::none, rs, rt, 0, target_name(i)};
+                break;
+            case BLEZ: case BGTZ:
+                in = Instr{opcode == BLEZ ? Opcode::Blez : Opcode::Bgtz, Reg::none, rs, Reg::none, 0, target_name(i)};
+                break;
+            case J: case JAL:
+                in = Instr{opcode == J ? Opcode::J : Opcode::Jal, Reg::none, Reg::none, Reg::none, 0, target_name(i)};
+                break;
+            case ADDIU:
+                in = rs == Reg::zero ? Instr{Opcode::Li, rt, Reg::none, Reg::none, imm} : Instr{Opcode::Addiu, rt, rs, Reg::none, imm};
+                break;
+            case SLTI: in = Instr{Opcode::Slti, rt, rs, Reg::none, imm}; break;
+            case SLTIU: in = Instr{Opcode::Sltiu, rt, rs, Reg::none, imm}; break;
+            case XORI: in = Instr{Opcode::Xori, rt, rs, Reg::none, (int32_t)(word & 0xFFFF)}; break;
+            case ORI:
+                if (rs == Reg::zero) in = Instr{Opcode::Li, rt, Reg::none, Reg::none, (int32_t)(word & 0xFFFF)};
+                break;
+            case LUI: {
+                int32_t high = (int32_t)((word & 0xFFFF) << 16);
+                uint32_t next = i + 1 < words.size() && labels[i + 1].empty() ? words[i + 1] : nop;
+                uint32_t access = i + 2 < words.size() && labels[i + 2].empty() ? words[i + 2] : nop;
+                uint32_t access_opcode = access >> 26;
+                bool memory = access_opcode == LB || access_opcode == LH || access_opcode == LW ||
+                              access_opcode == SB || access_opcode == SH || access_opcode == SW;
+                if (next >> 26 == ORI && reg(next, 21) == rt && reg(next, 16) == rt) {
+                    in = Instr{Opcode::Li, rt, Reg::none, Reg::none, high | (int32_t)(next & 0xFFFF)};
+                    length = 2;
+                } else if (next >> 26 == SPECIAL && (next & 0x3F) == F_ADDU && reg(next, 21) == rt &&
+                           reg(next, 11) == rt && memory && reg(access, 21) == rt) {
+                    // lui + addu + access: one load or store with a large offset
+                    Opcode op = access_opcode == LB ? Opcode::Lb : access_opcode == LH ? Opcode::Lh :
+                                access_opcode == LW ? Opcode::Lw : access_opcode == SB ? Opcode::Sb :
+                                access_opcode == SH ? Opcode::Sh : Opcode::Sw;
+                    int32_t offset = (int32_t)((uint32_t)high + (uint32_t)(int16_t)(access & 0xFFFF));
+                    in = is_load(op) ? Instr{op, reg(access, 16), reg(next, 16), Reg::none, offset}
+                                     : Instr{op, Reg::none, reg(next, 16), reg(access, 16), offset};
+                    length = 3;
+                } else {
+                    in = Instr{Opcode::Li, rt, Reg::none, Reg::none, high};
+                }
+                break;
+            }
+            case LB: in = Instr{Opcode::Lb, rt, rs, Reg::none, imm}; break;
+            case LH: in = Instr{Opcode::Lh, rt, rs, Reg::none, imm}; break;
+            case LW: in = Instr{Opcode::Lw, rt, rs, Reg::none, imm}; break;
+            case SB: in = Instr{Opcode::Sb, Reg::none, rs, rt, imm}; break;
+            case SH: in = Instr{Opcode::Sh, Reg::none, rs, rt, imm}; break;
+            case SW: in = Instr{Opcode::Sw, Reg::none, rs, rt, imm}; break;
+        }
+        if (in.op == Opcode::Deleted) {
+            char hex[16];
+            std::snprintf(hex, sizeof(hex), "0x%08x", word);
+            return fail(at, std::string("unsupported instruction word ") + hex);
+        }
+        program.push_back(in);
+        offsets.push_back(at);
+        i += length - 1;
+        // The nop in the delay slot is the assembler's, the text has no delay slots
+        if (is_branch(in.op) && i + 1 < words.size() && words[i + 1] == nop && labels[i + 1].empty()) ++i;
+    }
+    return true;
+}
+
+#endif // ENCODE_H
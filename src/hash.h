@@ -0,0 +1,51 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+// 128-bit hash of a byte string, two independent 64-bit lanes over 8-byte words. Names cache
+// entries and fingerprints statements, so it has to spread well but needs no cryptographic strength.
+// Successive add() calls hash the concatenation with every part's length mixed in.
+struct Hash128 {
+    uint64_t low = 0x9E3779B97F4A7C15ull;
+    uint64_t high = 0xC2B2AE3D27D4EB4Full;
+
+    static uint64_t mix(uint64_t x) {
+        x ^= x >> 33;
+        x *= 0xff51afd7ed558ccdull;
+        x ^= x >> 33;
+        x *= 0xc4ceb9fe1a85ec53ull;
+        x ^= x >> 33;
+        return x;
+    }
+
+    void add(std::string_view bytes) {
+        const char* p = bytes.data();
+        size_t n = bytes.size();
+        for (; n >= 8; p += 8, n -= 8) {
+            uint64_t word;
+            std::memcpy(&word, p, 8);
+            low = mix(low ^ word) + 0x165667B19E3779F9ull;
+            high = mix(high + word * 0x27D4EB2F165667C5ull) ^ low;
+        }
+        uint64_t tail = 0;
+        std::memcpy(&tail, p, n);
+        low = mix(low ^ tail ^ (uint64_t)bytes.size() << 56);
+        high = mix(high + tail + bytes.size()) ^ low;
+    }
+
+    bool operator==(const Hash128& other) const { return low == other.low && high == other.high; }
+    bool operator!=(const Hash128& other) const { return !(*this == other); }
+
+    std::string hex() const {
+        char text[33];
+        std::snprintf(text, sizeof(text), "%016llx%016llx", (unsigned long long)high, (unsigned long long)low);
+        return text;
+    }
+};
+
+#endif // HASH_H
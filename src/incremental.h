@@ -0,0 +1,263 @@
+#ifndef INCREMENTAL_H
+#define INCREMENTAL_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "hash.h"
+#include "instr.h"
+#include "io.h"
+
+// Little-endian byte encoding of the records of the incremental state file
+class ByteWriter {
+public:
+    std::string bytes;
+
+    void u8(uint32_t value) { bytes.push_back((char)value); }
+
+    void u32(uint32_t value) {
+        char le[4] = {(char)value, (char)(value >> 8), (char)(value >> 16), (char)(value >> 24)};
+        bytes.append(le, 4);
+    }
+
+    void i32(int32_t value) { u32((uint32_t)value); }
+
+    void u64(uint64_t value) {
+        u32((uint32_t)value);
+        u32((uint32_t)(value >> 32));
+    }
+
+    void string(std::string_view text) {
+        u32((uint32_t)text.size());
+        bytes.append(text);
+    }
+};
+
+// Reads what ByteWriter wrote. Running past the end yields zeros and clears ok.
+class ByteReader {
+private:
+    std::string_view bytes;
+    size_t at = 0;
+
+public:
+    bool ok = true;
+
+    explicit ByteReader(std::string_view bytes) : bytes(bytes) {}
+
+    bool done() const { return at == bytes.size(); }
+
+    uint32_t u8() {
+        if (at >= bytes.size()) return ok = false;
+        return (uint8_t)bytes[at++];
+    }
+
+    uint32_t u32() {
+        std::string_view le = take(4);
+        if (le.empty()) return 0;
+        return (uint32_t)(uint8_t)le[0] | (uint32_t)(uint8_t)le[1] << 8 | (uint32_t)(uint8_t)le[2] << 16 |
+               (uint32_t)(uint8_t)le[3] << 24;
+    }
+
+    int32_t i32() { return (int32_t)u32(); }
+
+    uint64_t u64() {
+        uint64_t low = u32();
+        return low | (uint64_t)u32() << 32;
+    }
+
+    // The next size bytes, empty when fewer are left
+    std::string_view take(size_t size) {
+        if (bytes.size() - at < size) {
+            at = bytes.size();
+            ok = false;
+            return {};
+        }
+        std::string_view part = bytes.substr(at, size);
+        at += size;
+        return part;
+    }
+
+    std::string_view string() { return take(u32()); }
+};
+
+// Every instruction is opcode, rd, rs, rt, imm and the note's length (12 bytes), then the note
+inline void write_instructions(ByteWriter& out, const Instr* begin, const Instr* end) {
+    out.u32((uint32_t)(end - begin));
+    for (const Instr* in = begin; in != end; ++in) {
+        out.u8((uint32_t)in->op);
+        out.u8((uint32_t)in->rd);
+        out.u8((uint32_t)in->rs);
+        out.u8((uint32_t)in->rt);
+        out.i32(in->imm);
+        out.string(in->note);
+    }
+}
+
+// A register byte of a record: a register number or Reg::none
+inline bool valid_register(uint8_t reg) { return reg < 32 || reg == (uint8_t)Reg::none; }
+
+// Appends the instructions to code, false on a byte that is no opcode or register. Their notes
+// point into the bytes read, which have to outlive code.
+inline bool read_instructions(ByteReader& in, InstructionList& code) {
+    uint32_t count = in.u32();
+    for (uint32_t i = 0; i < count; ++i) {
+        std::string_view fixed = in.take(12);
+        if (fixed.empty()) return false;
+        const uint8_t* bytes = reinterpret_cast<const uint8_t*>(fixed.data());
+        if (bytes[0] > (uint8_t)Opcode::Deleted || !valid_register(bytes[1]) || !valid_register(bytes[2]) ||
+            !valid_register(bytes[3])) {
+            return false;
+        }
+        ByteReader field(fixed.substr(4));
+        Instr instr{(Opcode)bytes[0], (Reg)bytes[1], (Reg)bytes[2], (Reg)bytes[3], field.i32(), {}};
+        instr.note = in.take(field.u32());
+        if (!in.ok) return false;
+        code.emit(instr);
+    }
+    return in.ok;
+}
+
+// Code generation results of the previous build of a unit, for --incremental, one record per
+// segment (a run of statements). A segment is identified by two hashes: entry, a hash chain over
+// the state changes of all segments before it, and fingerprint, its statements. A segment whose code
+// depended on how soon values are needed again (register eviction) also carries a look-ahead hash
+// that has to match. Matching segments have their instruction block and state change (effect)
+// replayed instead of generated. The file is written after every successful build and holds only
+// that build, followed by a hash of everything before it.
+class IncrementalState {
+private:
+    struct Record {
+        Hash128 entry;
+        Hash128 fingerprint;
+        bool looked_ahead;
+        Hash128 lookahead;
+        std::string_view effect;
+        std::string_view stats;
+        std::string_view code;
+    };
+
+    MappedFile previous_file;
+    std::unordered_map<uint64_t, Record> previous;
+    ByteWriter next;
+
+    static constexpr std::string_view magic = "compilerlab1 incremental 2\n";
+
+    static uint64_t slot(const Hash128& entry, const Hash128& fingerprint) {
+        return Hash128::mix(entry.low ^ fingerprint.high) ^ entry.high ^ fingerprint.low;
+    }
+
+public:
+    // What replaying a segment takes, from the previous build or recorded in this one. Notes of
+    // the instructions in code point into the file, which stays mapped for the whole build.
+    struct Replay {
+        bool looked_ahead;
+        Hash128 lookahead;
+        std::string_view effect;  // part of the entry hash chain
+        std::string_view stats;   // counter changes, not part of the state
+        std::string_view code;
+    };
+
+    size_t reused = 0;
+    size_t generated = 0;
+
+    // Loads the previous build's records, none when the file is missing, damaged (checksum) or was
+    // written by another compiler or with other options (header)
+    void load(const std::string& path, std::string_view header) {
+        next.bytes.append(magic);
+        next.string(header);
+        if (!previous_file.open(path)) return;
+        std::string_view contents = previous_file.contents();
+        next.bytes.reserve(contents.size());
+        if (contents.size() < magic.size() + 16 || contents.substr(0, magic.size()) != magic) return;
+        std::string_view payload = contents.substr(0, contents.size() - 16);
+        ByteReader checksum(contents.substr(payload.size()));
+        Hash128 expected;
+        expected.low = checksum.u64();
+        expected.high = checksum.u64();
+        Hash128 actual;
+        actual.add(payload);
+        if (actual != expected) return;
+        ByteReader in(payload.substr(magic.size()));
+        if (in.string() != header || !in.ok) return;
+        while (!in.done()) {
+            Record record;
+            record.entry.low = in.u64();
+            record.entry.high = in.u64();
+            record.fingerprint.low = in.u64();
+            record.fingerprint.high = in.u64();
+            record.looked_ahead = in.u8() != 0;
+            record.lookahead.low = in.u64();
+            record.lookahead.high = in.u64();
+            record.effect = in.string();
+            record.stats = in.string();
+            record.code = in.string();
+            if (!in.ok) {
+                previous.clear();
+                return;
+            }
+            previous.emplace(slot(record.entry, record.fingerprint), record);
+        }
+    }
+
+    // Drops every record unless check accepts all of them: one that does not decode means the
+    // file is damaged after all, and the build is done in full
+    template <typename Check>
+    void validate(Check check) {
+        for (const auto& [key, record] : previous) {
+            if (!check(Replay{record.looked_ahead, record.lookahead, record.effect, record.stats, record.code})) {
+                previous.clear();
+                return;
+            }
+        }
+    }
+
+    bool find(const Hash128& entry, const Hash128& fingerprint, Replay& replay) const {
+        auto it = previous.find(slot(entry, fingerprint));
+        if (it == previous.end() || it->second.entry != entry || it->second.fingerprint != fingerprint) {
+            return false;
+        }
+        const Record& record = it->second;
+        replay = Replay{record.looked_ahead, record.lookahead, record.effect, record.stats, record.code};
+        return true;
+    }
+
+    // Records a segment of this build
+    void add(const Hash128& entry, const Hash128& fingerprint, const Replay& replay) {
+        next.u64(entry.low);
+        next.u64(entry.high);
+        next.u64(fingerprint.low);
+        next.u64(fingerprint.high);
+        next.u8(replay.looked_ahead);
+        next.u64(replay.lookahead.low);
+        next.u64(replay.lookahead.high);
+        next.string(replay.effect);
+        next.string(replay.stats);
+        next.string(replay.code);
+    }
+
+    // Replaces the file with this build's records (written aside and renamed, the old file
+    // stays mapped until then)
+    bool save(const std::string& path) {
+        Hash128 checksum;
+        checksum.add(next.bytes);
+        next.u64(checksum.low);
+        next.u64(checksum.high);
+        std::string temporary = path + ".tmp";
+        std::FILE* out = std::fopen(temporary.c_str(), "wb");
+        if (out == nullptr) return false;
+        bool ok = std::fwrite(next.bytes.data(), 1, next.bytes.size(), out) == next.bytes.size();
+        ok = std::fclose(out) == 0 && ok;
+        if (!ok || std::rename(temporary.c_str(), path.c_str()) != 0) {
+            std::remove(temporary.c_str());
+            return false;
+        }
+        return true;
+    }
+};
+
+#endif // INCREMENTAL_H
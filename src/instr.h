@@ -0,0 +1,265 @@
+#ifndef INSTR_H
+#define INSTR_H
+
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <string_view>
+#include <vector>
+
+#include "arena.h"
+#include "io.h"
+#include "mips.h"
+
+// In-memory MIPS code: the code generator appends structured instructions, the peephole pass
+// (peephole.h) rewrites them and print_instructions() formats the final text in one go.
+
+enum class Opcode : uint8_t {
+    // rd = rs op rt, slt/sltu give 1 when rs < rt (signed/unsigned)
+    Add, Addu, Sub, Subu, Mul, Slt, Sltu, Xor,
+    // rd = rs op imm
+    Addiu, Sll, Sra, Srl, Slti, Sltiu, Xori,
+    Li,       // rd = imm
+    Move,     // rd = rs
+    Mult,     // hi:lo = rs * rt
+    Div,      // lo = rs / rt, hi = rs % rt
+    Mflo,     // rd = lo
+    Mfhi,     // rd = hi
+    // rd = mem[rs + imm], bytes and halfwords sign-extended
+    Lb, Lh, Lw,
+    // mem[rs + imm] = rt, bytes and halfwords truncated
+    Sb, Sh, Sw,
+    // continue at the label in note when rs op rt, rs op 0 holds; j always
+    Beq, Bne, Bltz, Bgez, Bgtz, Blez, J,
+    Jal,      // $ra = the next instruction's address, continue at the label in note
+    Jr,       // continue at the address in rs
+    Syscall,
+    Comment,    // "# text" line
+    Label,      // "text:"
+    Directive,  // text verbatim, e.g. ".text"
+    Deleted,    // removed by the peephole pass, never printed
+};
+
+inline const char* opcode_name(Opcode op) {
+    switch (op) {
+        case Opcode::Add: return "add";
+        case Opcode::Addu: return "addu";
+        case Opcode::Sub: return "sub";
+        case Opcode::Subu: return "subu";
+        case Opcode::Mul: return "mul";
+        case Opcode::Slt: return "slt";
+        case Opcode::Sltu: return "sltu";
+        case Opcode::Xor: return "xor";
+        case Opcode::Addiu: return "addiu";
+        case Opcode::Sll: return "sll";
+        case Opcode::Sra: return "sra";
+        case Opcode::Srl: return "srl";
+        case Opcode::Slti: return "slti";
+        case Opcode::Sltiu: return "sltiu";
+        case Opcode::Xori: return "xori";
+        case Opcode::Li: return "li";
+        case Opcode::Move: return "move";
+        case Opcode::Mult: return "mult";
+        case Opcode::Div: return "div";
+        case Opcode::Mflo: return "mflo";
+        case Opcode::Mfhi: return "mfhi";
+        case Opcode::Lb: return "lb";
+        case Opcode::Lh: return "lh";
+        case Opcode::Lw: return "lw";
+        case Opcode::Sb: return "sb";
+        case Opcode::Sh: return "sh";
+        case Opcode::Sw: return "sw";
+        case Opcode::Beq: return "beq";
+        case Opcode::Bne: return "bne";
+        case Opcode::Bltz: return "bltz";
+        case Opcode::Bgez: return "bgez";
+        case Opcode::Bgtz: return "bgtz";
+        case Opcode::Blez: return "blez";
+        case Opcode::J: return "j";
+        case Opcode::Jal: return "jal";
+        case Opcode::Jr: return "jr";
+        case Opcode::Syscall: return "syscall";
+        default: return "";
+    }
+}
+
+inline bool is_three_register(Opcode op) { return op >= Opcode::Add && op <= Opcode::Xor; }
+inline bool is_register_immediate(Opcode op) { return op >= Opcode::Addiu && op <= Opcode::Xori; }
+inline bool is_load(Opcode op) { return op >= Opcode::Lb && op <= Opcode::Lw; }
+inline bool is_store(Opcode op) { return op >= Opcode::Sb && op <= Opcode::Sw; }
+inline bool is_branch(Opcode op) { return op >= Opcode::Beq && op <= Opcode::Jr; }
+inline bool is_pseudo(Opcode op) { return op >= Opcode::Comment; }
+
+struct Instr {
+    Opcode op;
+    Reg rd = Reg::none;
+    Reg rs = Reg::none;
+    Reg rt = Reg::none;
+    int32_t imm = 0;
+    std::string_view note = {};  // trailing comment, the label a branch goes to, or the text of Comment/Label/Directive
+
+    // Register written, Reg::none for stores, hi/lo producers, branches and pseudo instructions
+    Reg def() const {
+        switch (op) {
+            case Opcode::Jal:
+                return Reg::ra;
+            case Opcode::Sb: case Opcode::Sh: case Opcode::Sw:
+            case Opcode::Mult: case Opcode::Div: case Opcode::Syscall:
+                return Reg::none;
+            default:
+                return is_pseudo(op) || is_branch(op) ? Reg::none : rd;
+        }
+    }
+
+    // True when the instruction reads reg
+    bool reads(Reg reg) const {
+        if (reg == Reg::none) return false;
+        switch (op) {
+            case Opcode::Li: case Opcode::Mflo: case Opcode::Mfhi:
+                return false;
+            case Opcode::Syscall:
+                return reg == Reg::v0 || reg == Reg::a0;
+            default:
+                return !is_pseudo(op) && (rs == reg || rt == reg);
+        }
+    }
+};
+
+class InstructionList {
+private:
+    std::vector<Instr> code;
+    Arena text;  // comment and label text
+
+public:
+    InstructionList() : text(16 * 1024) {}
+
+    std::vector<Instr>& instructions() { return code; }
+    const std::vector<Instr>& instructions() const { return code; }
+
+    // Copies the concatenation of parts into the list's arena, for notes built on the fly
+    std::string_view note(std::initializer_list<std::string_view> parts) {
+        size_t size = 0;
+        for (std::string_view part : parts) size += part.size();
+        if (size == 0) return std::string_view();
+        char* p = static_cast<char*>(text.allocate(size, 1));
+        size_t at = 0;
+        for (std::string_view part : parts) {
+            std::memcpy(p + at, part.data(), part.size());
+            at += part.size();
+        }
+        return std::string_view(p, size);
+    }
+
+    void emit(const Instr& instr) { code.push_back(instr); }
+
+    void op3(Opcode op, Reg rd, Reg rs, Reg rt) { code.push_back(Instr{op, rd, rs, rt, 0, {}}); }
+    void op_imm(Opcode op, Reg rd, Reg rs, int32_t imm) { code.push_back(Instr{op, rd, rs, Reg::none, imm, {}}); }
+    void li(Reg rd, int32_t imm) { code.push_back(Instr{Opcode::Li, rd, Reg::none, Reg::none, imm, {}}); }
+    void move(Reg rd, Reg rs) { code.push_back(Instr{Opcode::Move, rd, rs, Reg::none, 0, {}}); }
+    void hilo(Opcode op, Reg rs, Reg rt) { code.push_back(Instr{op, Reg::none, rs, rt, 0, {}}); }
+    void from_hilo(Opcode op, Reg rd) { code.push_back(Instr{op, rd, Reg::none, Reg::none, 0, {}}); }
+    void syscall() { code.push_back(Instr{Opcode::Syscall}); }
+
+    // beq/bne compare rs with rt, the others rs with zero
+    void branch(Opcode op, Reg rs, Reg rt, std::string_view label) {
+        code.push_back(Instr{op, Reg::none, rs, rt, 0, label});
+    }
+
+    void jump(std::string_view label) { code.push_back(Instr{Opcode::J, Reg::none, Reg::none, Reg::none, 0, label}); }
+    void call(std::string_view label) { code.push_back(Instr{Opcode::Jal, Reg::none, Reg::none, Reg::none, 0, label}); }
+    void jr(Reg rs) { code.push_back(Instr{Opcode::Jr, Reg::none, rs, Reg::none, 0, {}}); }
+
+    void load(Opcode op, Reg rd, int32_t offset, Reg base, std::string_view note = {}) {
+        code.push_back(Instr{op, rd, base, Reg::none, offset, note});
+    }
+
+    void store(Opcode op, Reg rt, int32_t offset, Reg base, std::string_view note = {}) {
+        code.push_back(Instr{op, Reg::none, base, rt, offset, note});
+    }
+
+    void lw(Reg rd, int32_t offset, Reg base, std::string_view note = {}) { load(Opcode::Lw, rd, offset, base, note); }
+    void sw(Reg rt, int32_t offset, Reg base, std::string_view note = {}) { store(Opcode::Sw, rt, offset, base, note); }
+
+    void comment(std::string_view line) { code.push_back(Instr{Opcode::Comment, Reg::none, Reg::none, Reg::none, 0, line}); }
+    void label(std::string_view name) { code.push_back(Instr{Opcode::Label, Reg::none, Reg::none, Reg::none, 0, name}); }
+    void directive(std::string_view line) { code.push_back(Instr{Opcode::Directive, Reg::none, Reg::none, Reg::none, 0, line}); }
+};
+
+inline void print_instruction(const Instr& in, OutputBuffer& out) {
+    switch (in.op) {
+        case Opcode::Deleted:
+            return;
+        case Opcode::Comment:
+            out << "# " << in.note << '\n';
+            return;
+        case Opcode::Label:
+            out << in.note << ":\n";
+            return;
+        case Opcode::Directive:
+            out << in.note << '\n';
+            return;
+        default:
+            break;
+    }
+    out << opcode_name(in.op);
+    switch (in.op) {
+        case Opcode::Li:
+            out << ' ' << reg_name(in.rd) << ", " << in.imm;
+            break;
+        case Opcode::Move:
+            out << ' ' << reg_name(in.rd) << ", " << reg_name(in.rs);
+            break;
+        case Opcode::Mult:
+        case Opcode::Div:
+            out << ' ' << reg_name(in.rs) << ", " << reg_name(in.rt);
+            break;
+        case Opcode::Mflo:
+        case Opcode::Mfhi:
+            out << ' ' << reg_name(in.rd);
+            break;
+        case Opcode::Lb:
+        case Opcode::Lh:
+        case Opcode::Lw:
+            out << ' ' << reg_name(in.rd) << ", " << in.imm << '(' << reg_name(in.rs) << ')';
+            break;
+        case Opcode::Sb:
+        case Opcode::Sh:
+        case Opcode::Sw:
+            out << ' ' << reg_name(in.rt) << ", " << in.imm << '(' << reg_name(in.rs) << ')';
+            break;
+        case Opcode::Beq:
+        case Opcode::Bne:
+            out << ' ' << reg_name(in.rs) << ", " << reg_name(in.rt) << ", " << in.note << '\n';
+            return;
+        case Opcode::Bltz:
+        case Opcode::Bgez:
+        case Opcode::Bgtz:
+        case Opcode::Blez:
+            out << ' ' << reg_name(in.rs) << ", " << in.note << '\n';
+            return;
+        case Opcode::J:
+        case Opcode::Jal:
+            out << ' ' << in.note << '\n';
+            return;
+        case Opcode::Jr:
+            out << ' ' << reg_name(in.rs);
+            break;
+        case Opcode::Syscall:
+            break;
+        default:
+            if (is_three_register(in.op)) {
+                out << ' ' << reg_name(in.rd) << ", " << reg_name(in.rs) << ", " << reg_name(in.rt);
+            } else {
+                out << ' ' << reg_name(in.rd) << ", " << reg_name(in.rs) << ", " << in.imm;
+            }
+            break;
+    }
+    if (!in.note.empty()) out << "  # " << in.note;
+    out << '\n';
+}
+
+inline void print_instructions(const std::vector<Instr>& code, OutputBuffer& out) {
+    for (const Instr& in : code) print_instruction(in, out);
+}
+
+#endif // INSTR_H
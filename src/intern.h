@@ -0,0 +1,92 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+#include "arena.h"
+
+// Identifier interning. The lexer hands every identifier to intern() once, which numbers the
+// distinct names densely from 0 in order of first appearance, so the symbol table and the
+// per-variable state of the passes are plain vectors indexed by that id instead of hash maps
+// keyed by the text. The lookup itself is an open-addressing table (linear probing, kept at most
+// half full); a slot holds the name's hash next to its id, so probing only touches the text of
+// a name whose hash matches. The names are copied into the interner's own arena.
+class Interner {
+private:
+    struct Slot {
+        uint32_t hash;
+        uint32_t id;  // id + 1, 0 for an empty slot
+    };
+
+    std::vector<std::string_view> names;  // by id
+    std::vector<Slot> slots;              // size is a power of two
+    Arena text{16 * 1024};
+
+    // Identifiers are short, so whole 8-byte words are mixed in
+    static uint32_t hash(std::string_view name) {
+        const char* p = name.data();
+        size_t n = name.size();
+        uint64_t h = 0x9E3779B97F4A7C15ull ^ n;
+        for (; n >= 8; p += 8, n -= 8) {
+            uint64_t word;
+            std::memcpy(&word, p, 8);
+            h = (h ^ word) * 0xff51afd7ed558ccdull;
+            h ^= h >> 32;
+        }
+        uint64_t tail = 0;
+        for (size_t i = 0; i < n; ++i) tail |= (uint64_t)(unsigned char)p[i] << (8 * i);
+        h = (h ^ tail) * 0xc4ceb9fe1a85ec53ull;
+        return (uint32_t)(h >> 32) ^ (uint32_t)h;
+    }
+
+    // The slot holding name, or the empty slot where it belongs
+    size_t probe(std::string_view name, uint32_t h) const {
+        size_t mask = slots.size() - 1;
+        for (size_t i = h & mask;; i = (i + 1) & mask) {
+            const Slot& slot = slots[i];
+            if (slot.id == 0 || (slot.hash == h && names[slot.id - 1] == name)) return i;
+        }
+    }
+
+    void grow() {
+        std::vector<Slot> larger(slots.empty() ? 256 : slots.size() * 2, Slot{0, 0});
+        size_t mask = larger.size() - 1;
+        for (const Slot& slot : slots) {
+            if (slot.id == 0) continue;
+            size_t i = slot.hash & mask;
+            while (larger[i].id != 0) i = (i + 1) & mask;
+            larger[i] = slot;
+        }
+        slots.swap(larger);
+    }
+
+public:
+    static constexpr uint32_t none = UINT32_MAX;  // not an identifier, or never interned
+
+    uint32_t intern(std::string_view name) {
+        if (2 * (names.size() + 1) > slots.size()) grow();
+        uint32_t h = hash(name);
+        Slot& slot = slots[probe(name, h)];
+        if (slot.id == 0) {
+            names.push_back(text.copy(name));
+            slot = Slot{h, (uint32_t)names.size()};
+        }
+        return slot.id - 1;
+    }
+
+    uint32_t find(std::string_view name) const {
+        if (slots.empty()) return none;
+        uint32_t id = slots[probe(name, hash(name))].id;
+        return id == 0 ? none : id - 1;
+    }
+
+    std::string_view name(uint32_t id) const { return names[id]; }
+
+    // Number of distinct names, every id is below it
+    uint32_t size() const { return (uint32_t)names.size(); }
+};
+
+#endif // INTERN_H
@@ -0,0 +1,229 @@
+#ifndef IO_H
+#define IO_H
+
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include "spsc.h"
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Read-only view of a whole source file. Regular files are memory mapped so the lexer runs
+// directly over the mapped bytes; stdin ("-"), pipes and platforms without mmap are read into memory.
+class MappedFile {
+private:
+    const char* data;
+    size_t size;
+    bool mapped;
+    std::string buffer;  // fallback storage when the file could not be mapped
+
+    bool read_stream(std::FILE* file) {
+        char chunk[1 << 16];
+        size_t n;
+        while ((n = std::fread(chunk, 1, sizeof(chunk), file)) > 0) {
+            buffer.append(chunk, n);
+        }
+        data = buffer.data();
+        size = buffer.size();
+        return !std::ferror(file);
+    }
+
+public:
+    MappedFile() : data(nullptr), size(0), mapped(false) {}
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+#if !defined(_WIN32)
+        if (mapped) munmap(const_cast<char*>(data), size);
+#endif
+    }
+
+    bool open(const std::string& path) {
+        if (path == "-") {
+            return read_stream(stdin);
+        }
+#if !defined(_WIN32)
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+            void* p = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) {
+                madvise(p, (size_t)st.st_size, MADV_SEQUENTIAL);
+                data = static_cast<const char*>(p);
+                size = (size_t)st.st_size;
+                mapped = true;
+                ::close(fd);
+                return true;
+            }
+        }
+        ::close(fd);
+#endif
+        std::FILE* file = std::fopen(path.c_str(), "rb");
+        if (file == nullptr) return false;
+        bool ok = read_stream(file);
+        std::fclose(file);
+        return ok;
+    }
+
+    std::string_view contents() const { return std::string_view(data, size); }
+};
+
+// Output writer: instructions are formatted into a large preallocated buffer that is handed
+// to the OS in a few big writes instead of one stream operation per fragment.
+class OutputBuffer {
+private:
+    // Writer thread of --pipeline: full buffers are written there while formatting goes on in a spare
+    struct Chunk {
+        char* data = nullptr;  // nullptr stops the writer
+        size_t size = 0;
+    };
+    struct WriteBehind {
+        SpscQueue<Chunk, 4> full;   // to the writer
+        SpscQueue<Chunk, 4> empty;  // written, back from the writer
+        std::unique_ptr<char[]> spares[2];
+        std::thread thread;
+        bool failed = false;        // set by the writer, read after the join
+    };
+
+    std::FILE* file;
+    bool owns_file;
+    bool failed;
+    std::unique_ptr<char[]> buffer;
+    char* current;  // buffer being filled, one of the spares with a writer thread
+    size_t capacity;
+    size_t used;
+    std::unique_ptr<WriteBehind> behind;
+
+    void write_through(const char* p, size_t n) {
+        if (n > 0 && std::fwrite(p, 1, n, file) != n) failed = true;
+    }
+
+public:
+    static constexpr size_t default_capacity = 1 << 20;
+
+    explicit OutputBuffer(size_t capacity = default_capacity)
+        : file(nullptr), owns_file(false), failed(false), buffer(new char[capacity]), current(buffer.get()),
+          capacity(capacity), used(0) {}
+    OutputBuffer(const OutputBuffer&) = delete;
+    OutputBuffer& operator=(const OutputBuffer&) = delete;
+
+    ~OutputBuffer() { close(); }
+
+    bool open(const std::string& path) {
+        file = std::fopen(path.c_str(), "wb");
+        owns_file = true;
+        if (file != nullptr) std::setvbuf(file, nullptr, _IONBF, 0);  // we do our own buffering
+        return file != nullptr;
+    }
+
+    // Streaming mode: write to standard output so the compiler can sit in a pipe
+    void attach_stdout() {
+        file = stdout;
+        owns_file = false;
+    }
+
+    // Moves the writes to a thread of their own, after open() or attach_stdout()
+    void start_writer() {
+        if (file == nullptr || behind != nullptr) return;
+        behind = std::make_unique<WriteBehind>();
+        for (std::unique_ptr<char[]>& spare : behind->spares) {
+            spare.reset(new char[capacity]);
+            behind->empty.push(Chunk{spare.get(), 0});
+        }
+        WriteBehind* writer = behind.get();
+        behind->thread = std::thread([this, writer] {
+            for (;;) {
+                Chunk chunk = writer->full.pop();
+                if (chunk.data == nullptr) return;
+                if (std::fwrite(chunk.data, 1, chunk.size, file) != chunk.size) writer->failed = true;
+                if (!owns_file) std::fflush(file);
+                writer->empty.push(chunk);
+            }
+        });
+    }
+
+    void flush() {
+        if (behind != nullptr) {
+            if (used > 0) {
+                behind->full.push(Chunk{current, used});
+                current = behind->empty.pop().data;
+            }
+            used = 0;
+            return;
+        }
+        write_through(current, used);
+        used = 0;
+        if (!owns_file) std::fflush(file);
+    }
+
+    // Flushes and closes, false if any write failed
+    bool close() {
+        if (file == nullptr) return !failed;
+        flush();
+        if (behind != nullptr) {
+            behind->full.push(Chunk{});
+            behind->thread.join();
+            if (behind->failed) failed = true;
+            current = buffer.get();
+            behind.reset();
+        }
+        if (owns_file && std::fclose(file) != 0) failed = true;
+        file = nullptr;
+        return !failed;
+    }
+
+    OutputBuffer& operator<<(std::string_view text) {
+        if (used + text.size() > capacity) {
+            flush();
+            if (text.size() > capacity) {
+                if (behind == nullptr) {
+                    write_through(text.data(), text.size());
+                    return *this;
+                }
+                for (; text.size() > capacity; text.remove_prefix(capacity)) {
+                    std::memcpy(current, text.data(), capacity);
+                    used = capacity;
+                    flush();
+                }
+            }
+        }
+        std::memcpy(current + used, text.data(), text.size());
+        used += text.size();
+        return *this;
+    }
+
+    OutputBuffer& operator<<(const char* text) { return *this << std::string_view(text); }
+    OutputBuffer& operator<<(const std::string& text) { return *this << std::string_view(text); }
+
+    OutputBuffer& operator<<(char c) {
+        if (used == capacity) flush();
+        current[used++] = c;
+        return *this;
+    }
+
+    OutputBuffer& operator<<(long long value) {
+        char digits[24];
+        auto res = std::to_chars(digits, digits + sizeof(digits), value);
+        return *this << std::string_view(digits, res.ptr - digits);
+    }
+
+    OutputBuffer& operator<<(int value) { return *this << (long long)value; }
+    OutputBuffer& operator<<(long value) { return *this << (long long)value; }
+    OutputBuffer& operator<<(unsigned value) { return *this << (long long)value; }
+    OutputBuffer& operator<<(unsigned long value) { return *this << (long long)value; }
+};
+
+#endif // IO_H
@@ -0,0 +1,307 @@
+#ifndef IR_H
+#define IR_H
+
+#include <algorithm>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#include "arena.h"
+#include "types.h"
+
+// Three-address intermediate representation of the -O0/-O1/-O2 pipeline, between the parser and the
+// MIPS backend. A function is a list of instructions over virtual registers ("values"), every value
+// is defined by exactly one instruction. Lowering (lower.h) keeps the variables in memory, each read
+// is a Load and each write a Store of the variable's stack slot; the ssa pass (irpasses.h) renames
+// the variables into values, after which the code is in SSA form. Passes rewrite instructions in
+// place or rebuild the list.
+//
+// Control flow is explicit in the list: a Label starts a basic block, a Jump or Branch ends one,
+// anything else falls through to the next instruction. cfg.h builds the blocks and edges from it.
+// Straight-line code has none of these and needs no phi functions; with control flow the ssa pass
+// puts Phis at the top of the blocks where values from different predecessors meet. The blocks and
+// their order do not change after the ssa pass, the phi arguments depend on it.
+//
+// Every function of the program is an IrFunction of its own, main's has no name. A call passes its
+// arguments with one Arg each right in front of the Call; the callee reads them with Params, which
+// lowering puts at the very top of its code.
+
+enum class IrOp : uint8_t {
+    Const,   // dst = imm
+    Copy,    // dst = a
+    // dst = a op b with MIPS semantics: 32-bit wrap-around, Div truncates toward zero
+    Add, Sub, Mul, Div,
+    MulHi,   // dst = high word of the 64-bit product a * b
+    // dst = a shifted by imm
+    Shl, Sra, Srl,
+    Cmp,     // dst = 1 when a relation imm b holds, else 0
+    Narrow,  // dst = a narrowed to type (types.h)
+    Load,    // dst = variable symbol, already narrow to its type
+    Param,   // dst = argument imm of the function's caller
+    Phi,     // dst = the argument of the predecessor control came from, imm arguments from phi_args[target]
+    Store,   // variable symbol = a, narrowed to the variable's type
+    Arg,     // argument imm of the next Call = a
+    Call,    // dst = result of the function text, narrow to its return type; imm arguments
+    Return,  // $v0 = a; the program's result is the value of the last one executed
+    Label,   // target: starts a block
+    Jump,    // continue at label target
+    Branch,  // continue at label target when a relation imm b holds, else with the next instruction
+    Note,    // text as a comment of the output (diagnostics)
+    Nop,     // removed, dropped by the next rebuild
+};
+
+// Relations of Cmp and Branch, stored in imm. Signed comparisons.
+enum class Relation : uint8_t { Eq, Ne, Lt, Ge, Gt, Le };
+
+inline const char* relation_name(Relation relation) {
+    switch (relation) {
+        case Relation::Eq: return "eq";
+        case Relation::Ne: return "ne";
+        case Relation::Lt: return "lt";
+        case Relation::Ge: return "ge";
+        case Relation::Gt: return "gt";
+        case Relation::Le: return "le";
+    }
+    return "?";
+}
+
+// The relation holding exactly when relation does not
+inline Relation negate(Relation relation) {
+    switch (relation) {
+        case Relation::Eq: return Relation::Ne;
+        case Relation::Ne: return Relation::Eq;
+        case Relation::Lt: return Relation::Ge;
+        case Relation::Ge: return Relation::Lt;
+        case Relation::Gt: return Relation::Le;
+        case Relation::Le: return Relation::Gt;
+    }
+    return relation;
+}
+
+// The relation of b to a when a relation b holds
+inline Relation swap_operands(Relation relation) {
+    switch (relation) {
+        case Relation::Lt: return Relation::Gt;
+        case Relation::Gt: return Relation::Lt;
+        case Relation::Le: return Relation::Ge;
+        case Relation::Ge: return Relation::Le;
+        default: return relation;
+    }
+}
+
+inline bool holds(Relation relation, int32_t a, int32_t b) {
+    switch (relation) {
+        case Relation::Eq: return a == b;
+        case Relation::Ne: return a != b;
+        case Relation::Lt: return a < b;
+        case Relation::Ge: return a >= b;
+        case Relation::Gt: return a > b;
+        case Relation::Le: return a <= b;
+    }
+    return false;
+}
+
+inline const char* ir_op_name(IrOp op) {
+    switch (op) {
+        case IrOp::Const: return "const";
+        case IrOp::Copy: return "copy";
+        case IrOp::Add: return "add";
+        case IrOp::Sub: return "sub";
+        case IrOp::Mul: return "mul";
+        case IrOp::Div: return "div";
+        case IrOp::MulHi: return "mulhi";
+        case IrOp::Shl: return "shl";
+        case IrOp::Sra: return "sra";
+        case IrOp::Srl: return "srl";
+        case IrOp::Cmp: return "cmp";
+        case IrOp::Narrow: return "narrow";
+        case IrOp::Load: return "load";
+        case IrOp::Param: return "param";
+        case IrOp::Phi: return "phi";
+        case IrOp::Store: return "store";
+        case IrOp::Arg: return "arg";
+        case IrOp::Call: return "call";
+        case IrOp::Return: return "return";
+        case IrOp::Label: return "label";
+        case IrOp::Jump: return "jump";
+        case IrOp::Branch: return "branch";
+        case IrOp::Note: return "note";
+        case IrOp::Nop: return "nop";
+    }
+    return "?";
+}
+
+inline bool is_ir_binary(IrOp op) { return op >= IrOp::Add && op <= IrOp::MulHi; }
+inline bool is_ir_shift(IrOp op) { return op >= IrOp::Shl && op <= IrOp::Srl; }
+
+// Instructions without a side effect, removable once their value is unused
+inline bool is_ir_pure(IrOp op) { return op <= IrOp::Narrow; }
+
+constexpr uint32_t ir_none = UINT32_MAX;
+
+struct IrInstr {
+    IrOp op;
+    ValueType type = ValueType::Int;  // Narrow, Load, Store, Call and the variable's of a Phi
+    uint32_t dst = ir_none;
+    uint32_t a = ir_none;
+    uint32_t b = ir_none;
+    int32_t imm = 0;                  // Const value, shift amount, relation, phi argument count, argument index/count
+    uint32_t symbol = ir_none;        // Load and Store, the variable of a Phi
+    uint32_t target = ir_none;        // Label, Jump, Branch: label number; Phi: first argument in phi_args
+    uint32_t line = 0;                // Div: source position, for diagnostics
+    uint32_t column = 0;
+    std::string_view text = {};       // Note, the function a Call calls
+    bool wraps = false;               // Add, Sub: wraps around instead of trapping (addu/subu)
+};
+
+struct IrFunction {
+    std::string_view name;                  // empty for main
+    std::vector<IrInstr> code;
+    std::vector<uint32_t> defs;             // by value, index of the defining instruction
+    uint32_t values = 0;                    // every value is below it
+    std::vector<std::string_view> names;    // by symbol id, empty for names never declared
+    std::vector<ValueType> types;           // by symbol id, the type of the first declaration
+    std::vector<uint32_t> declared;         // symbols in declaration order
+    std::vector<uint32_t> phi_args;         // arguments of the Phis, in the order of their block's predecessors
+    uint32_t labels = 0;                    // every label number is below it
+    bool straight_line = true;              // no Label, Jump or Branch, updated by rebuild()
+    bool in_ssa = false;                    // variables renamed into values (ssa pass)
+    Arena text{4 * 1024};                   // note text made by the passes
+
+    explicit IrFunction(uint32_t symbols) : names(symbols), types(symbols, ValueType::Int) {}
+
+    uint32_t new_value() { return values++; }
+    uint32_t new_label() { return labels++; }
+
+    uint32_t* phi_begin(const IrInstr& phi) { return phi_args.data() + phi.target; }
+    const uint32_t* phi_begin(const IrInstr& phi) const { return phi_args.data() + phi.target; }
+    const uint32_t* phi_end(const IrInstr& phi) const { return phi_args.data() + phi.target + phi.imm; }
+
+    // Drops the Nops and indexes the definitions again, after a pass added or removed instructions
+    void rebuild() {
+        size_t kept = 0;
+        for (size_t i = 0; i < code.size(); ++i) {
+            if (code[i].op != IrOp::Nop) code[kept++] = code[i];
+        }
+        code.resize(kept);
+        defs.assign(values, ir_none);
+        straight_line = true;
+        for (uint32_t i = 0; i < code.size(); ++i) {
+            if (code[i].dst != ir_none) defs[code[i].dst] = i;
+            if (code[i].op == IrOp::Label || code[i].op == IrOp::Jump || code[i].op == IrOp::Branch) straight_line = false;
+        }
+    }
+
+    const IrInstr& def(uint32_t value) const { return code[defs[value]]; }
+
+    // Arguments of the call passing the most of them, -1 for a leaf function calling nothing
+    int call_arguments() const {
+        int most = -1;
+        for (const IrInstr& in : code) {
+            if (in.op == IrOp::Call) most = std::max(most, in.imm);
+        }
+        return most;
+    }
+
+    // The value a chain of copies starts from
+    uint32_t resolve(uint32_t value) const {
+        while (def(value).op == IrOp::Copy) value = def(value).a;
+        return value;
+    }
+
+    bool constant(uint32_t value, int32_t& out) const {
+        const IrInstr& in = def(resolve(value));
+        out = in.imm;
+        return in.op == IrOp::Const;
+    }
+
+    // Narrowest type holding every value the value can take
+    ValueType value_type(uint32_t value) const {
+        const IrInstr& in = def(resolve(value));
+        switch (in.op) {
+            case IrOp::Const:
+                if (narrow(in.imm, ValueType::Char) == in.imm) return ValueType::Char;
+                if (narrow(in.imm, ValueType::Short) == in.imm) return ValueType::Short;
+                return ValueType::Int;
+            case IrOp::Load:
+            case IrOp::Narrow:
+            case IrOp::Call:
+            case IrOp::Phi:
+                return in.type == ValueType::LongLong ? ValueType::Int : in.type;
+            case IrOp::Cmp:
+                return ValueType::Char;
+            default:
+                return ValueType::Int;
+        }
+    }
+};
+
+// Debug output (--print-ir), one instruction per line
+template <typename Out>
+void print_ir(Out& out, const IrFunction& function) {
+    for (const IrInstr& in : function.code) {
+        if (in.op == IrOp::Label) {
+            out << 'L' << in.target << ":\n";
+            continue;
+        }
+        out << "  ";
+        if (in.dst != ir_none) out << 'v' << in.dst << " = ";
+        out << ir_op_name(in.op);
+        if (in.wraps) out << 'u';
+        switch (in.op) {
+            case IrOp::Const:
+                out << ' ' << in.imm;
+                break;
+            case IrOp::Cmp:
+                out << ' ' << relation_name((Relation)in.imm) << " v" << in.a << ", v" << in.b;
+                break;
+            case IrOp::Phi: {
+                out << ' ' << function.names[in.symbol] << " [";
+                const char* separator = "v";
+                for (const uint32_t* arg = function.phi_begin(in); arg != function.phi_end(in); ++arg) {
+                    out << separator << *arg;
+                    separator = ", v";
+                }
+                out << ']';
+                break;
+            }
+            case IrOp::Jump:
+                out << " L" << in.target;
+                break;
+            case IrOp::Branch:
+                out << ' ' << relation_name((Relation)in.imm) << " v" << in.a << ", v" << in.b << ", L" << in.target;
+                break;
+            case IrOp::Narrow:
+                out << ' ' << type_name(in.type) << " v" << in.a;
+                break;
+            case IrOp::Load:
+                out << ' ' << function.names[in.symbol];
+                break;
+            case IrOp::Param:
+                out << ' ' << in.imm;
+                break;
+            case IrOp::Arg:
+                out << ' ' << in.imm << ", v" << in.a;
+                break;
+            case IrOp::Call:
+                out << ' ' << in.text;
+                break;
+            case IrOp::Store:
+                out << ' ' << function.names[in.symbol] << ", v" << in.a;
+                break;
+            case IrOp::Note:
+                out << ' ' << in.text;
+                break;
+            case IrOp::Nop:
+                break;
+            default:
+                if (in.a != ir_none) out << " v" << in.a;
+                if (in.b != ir_none) out << ", v" << in.b;
+                if (is_ir_shift(in.op)) out << ", " << in.imm;
+                break;
+        }
+        out << '\n';
+    }
+}
+
+#endif // IR_H
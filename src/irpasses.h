@@ -0,0 +1,1089 @@
+#ifndef IRPASSES_H
+#define IRPASSES_H
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "cfg.h"
+#include "constfold.h"
+#include "ir.h"
+#include "strength.h"
+#include "timing.h"
+#include "valnum.h"
+
+// Optimisation passes over the IR (ir.h) and the pass manager running them. Every pass returns the
+// number of instructions it changed, which --stats reports per pass. Passes only rewrite; what a
+// rewrite leaves unused (copies, operands of folded operations) is removed by dce. Straight-line
+// code takes the simple paths, with control flow the passes work on the blocks of cfg.h.
+
+inline void make_copy(IrInstr& in, uint32_t value) {
+    IrInstr copy{IrOp::Copy};
+    copy.dst = in.dst;
+    copy.a = value;
+    in = copy;
+}
+
+inline void make_constant(IrInstr& in, int32_t value) {
+    IrInstr constant{IrOp::Const};
+    constant.dst = in.dst;
+    constant.imm = value;
+    in = constant;
+}
+
+// ssa of straight-line code: one walk, the value last stored is the current one
+inline size_t ssa_straight_line(IrFunction& function) {
+    std::vector<uint32_t> current(function.types.size(), ir_none);  // by symbol id
+    std::vector<bool> stored(function.types.size(), false);
+    std::vector<uint32_t> written;                                  // symbols stored, in order
+    std::vector<IrInstr> code;
+    code.reserve(function.code.size());
+    size_t renamed = 0;
+    for (IrInstr in : function.code) {
+        if (in.op == IrOp::Load) {
+            uint32_t& value = current[in.symbol];
+            if (value == ir_none) {
+                value = in.dst;
+            } else {
+                make_copy(in, value);
+                ++renamed;
+            }
+        } else if (in.op == IrOp::Store) {
+            uint32_t value = in.a;
+            int32_t constant;
+            if (!fits_type(function.value_type(value), in.type)) {
+                bool known = function.constant(value, constant);
+                IrInstr narrowed{known ? IrOp::Const : IrOp::Narrow};
+                narrowed.type = in.type;
+                narrowed.dst = function.new_value();
+                narrowed.a = known ? ir_none : value;
+                narrowed.imm = known ? narrow(constant, in.type) : 0;
+                code.push_back(narrowed);
+                value = narrowed.dst;
+            }
+            if (!stored[in.symbol]) {
+                stored[in.symbol] = true;
+                written.push_back(in.symbol);
+            }
+            current[in.symbol] = value;
+            ++renamed;
+            continue;
+        }
+        code.push_back(in);
+    }
+    for (uint32_t symbol : written) {
+        IrInstr store{IrOp::Store};
+        store.type = function.types[symbol];
+        store.symbol = symbol;
+        store.a = current[symbol];
+        code.push_back(store);
+    }
+    function.code.swap(code);
+    function.rebuild();
+    function.in_ssa = true;
+    return renamed;
+}
+
+// Gives every block a Label, the entry one nothing jumps to. Afterwards no pass can merge two blocks
+// by emptying one, which would change the predecessor lists the Phis depend on.
+inline void label_every_block(IrFunction& function) {
+    std::vector<IrInstr> code;
+    code.reserve(function.code.size() + 16);
+    for (size_t i = 0; i < function.code.size(); ++i) {
+        const IrInstr& in = function.code[i];
+        bool starts = i == 0 || function.code[i - 1].op == IrOp::Jump || function.code[i - 1].op == IrOp::Branch;
+        if (starts && (i == 0 || in.op != IrOp::Label)) {
+            IrInstr label{IrOp::Label};
+            label.target = function.new_label();
+            code.push_back(label);
+        }
+        code.push_back(in);
+    }
+    function.code.swap(code);
+    function.rebuild();
+}
+
+// A Phi merging one value only, or itself, becomes a copy of it, until none is left
+inline size_t simplify_phis(IrFunction& function) {
+    size_t simplified = 0;
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (IrInstr& in : function.code) {
+            if (in.op != IrOp::Phi) continue;
+            uint32_t same = ir_none;
+            bool trivial = true;
+            for (const uint32_t* arg = function.phi_begin(in); arg != function.phi_end(in) && trivial; ++arg) {
+                uint32_t value = function.resolve(*arg);
+                if (value == in.dst || value == same) continue;
+                trivial = same == ir_none;
+                same = value;
+            }
+            if (trivial && same != ir_none) {
+                make_copy(in, same);
+                changed = true;
+                ++simplified;
+            }
+        }
+    }
+    return simplified;
+}
+
+// Moves the Phis a pass turned into copies or constants below the ones left, the code generator
+// takes a block's Phis up to its first other instruction
+inline void phis_first(IrFunction& function) {
+    std::vector<IrInstr>& code = function.code;
+    for (size_t begin = 0; begin < code.size();) {
+        while (begin < code.size() && code[begin].op == IrOp::Label) ++begin;
+        size_t end = begin;
+        for (size_t i = begin; i < code.size() && code[i].op != IrOp::Label; ++i) {
+            if (code[i].op == IrOp::Phi) end = i + 1;
+        }
+        std::stable_partition(code.begin() + begin, code.begin() + end, [](const IrInstr& in) { return in.op == IrOp::Phi; });
+        while (begin < code.size() && code[begin].op != IrOp::Label) ++begin;
+    }
+    function.rebuild();
+}
+
+// ssa: renames the variables into values (mem2reg). A Load becomes a copy of the value last stored,
+// a Store of a char or short value narrows it explicitly unless it is narrow already, then disappears.
+// Only a read before any store (of a variable whose initialiser was rejected) still loads the slot.
+// Straight-line code stores the final value of every variable at the end, dce removes those stores
+// as nothing reads them.
+//
+// With control flow the construction is Cytron et al.'s: a variable read in some block before the
+// block stores it gets a Phi in the iterated dominance frontier of its stores, then a walk over the
+// dominator tree renames, filling in the Phi arguments of every successor. A Phi merging one value
+// only, or itself, becomes a copy of it. Unreachable code goes first.
+inline size_t ssa_pass(IrFunction& function) {
+    if (function.straight_line) return ssa_straight_line(function);
+    remove_unreachable(function);
+    label_every_block(function);
+    ControlFlowGraph cfg(function);
+    uint32_t symbols = (uint32_t)function.types.size();
+    uint32_t block_count = (uint32_t)cfg.blocks.size();
+    uint32_t first_new = function.values;
+    std::vector<ValueType> fresh;  // type of every value made here, from first_new on
+    auto type_of = [&](uint32_t value) { return value < first_new ? function.value_type(value) : fresh[value - first_new]; };
+    auto new_value = [&](ValueType type) {
+        fresh.push_back(type);
+        return function.new_value();
+    };
+
+    // Variables read before a store in the same block, and the blocks storing each variable
+    std::vector<bool> crosses(symbols, false);
+    std::vector<uint32_t> stored_in(symbols, ir_none);
+    std::vector<std::pair<uint32_t, uint32_t>> stores;  // (symbol, block)
+    for (uint32_t b : cfg.order) {
+        for (uint32_t i = cfg.blocks[b].begin; i < cfg.blocks[b].end; ++i) {
+            const IrInstr& in = function.code[i];
+            if (in.op == IrOp::Load && stored_in[in.symbol] != b) crosses[in.symbol] = true;
+            if (in.op == IrOp::Store && stored_in[in.symbol] != b) {
+                stored_in[in.symbol] = b;
+                stores.push_back({in.symbol, b});
+            }
+        }
+    }
+
+    std::vector<std::vector<uint32_t>> frontier(block_count);
+    for (uint32_t b : cfg.order) {
+        const IrBlock& block = cfg.blocks[b];
+        if (block.predecessors.size() < 2) continue;
+        for (uint32_t p : block.predecessors) {
+            if (!cfg.reachable(p)) continue;
+            for (uint32_t runner = p; runner != block.idom; runner = cfg.blocks[runner].idom) {
+                if (frontier[runner].empty() || frontier[runner].back() != b) frontier[runner].push_back(b);
+            }
+        }
+    }
+
+    // Phi placement. Arguments start out as the Phi itself, which is what the ones of unreachable
+    // predecessors stay.
+    struct PlacedPhi {
+        uint32_t symbol;
+        uint32_t dst;
+        uint32_t args;  // first argument in phi_args
+    };
+    std::vector<std::vector<PlacedPhi>> phis(block_count);
+    std::vector<uint32_t> has_phi(block_count, ir_none);  // symbol whose Phi the block got last
+    std::vector<uint32_t> queued(block_count, ir_none);
+    std::vector<uint32_t> work;
+    std::sort(stores.begin(), stores.end());
+    for (size_t k = 0; k < stores.size();) {
+        uint32_t symbol = stores[k].first;
+        work.clear();
+        for (; k < stores.size() && stores[k].first == symbol; ++k) {
+            work.push_back(stores[k].second);
+            queued[stores[k].second] = symbol;
+        }
+        if (!crosses[symbol]) continue;
+        while (!work.empty()) {
+            uint32_t b = work.back();
+            work.pop_back();
+            for (uint32_t d : frontier[b]) {
+                if (has_phi[d] == symbol) continue;
+                has_phi[d] = symbol;
+                PlacedPhi phi{symbol, new_value(function.types[symbol]), (uint32_t)function.phi_args.size()};
+                function.phi_args.resize(phi.args + cfg.blocks[d].predecessors.size(), phi.dst);
+                phis[d].push_back(phi);
+                if (queued[d] != symbol) {
+                    queued[d] = symbol;
+                    work.push_back(d);
+                }
+            }
+        }
+    }
+
+    // Renaming. The passes read the code as it was, the renamed copy is put together at the end.
+    std::vector<IrInstr> code(function.code);
+    std::vector<uint32_t> current(symbols, ir_none);
+    std::vector<std::pair<uint32_t, uint32_t>> undo;  // (symbol, previous value)
+    std::vector<uint32_t> undefined(symbols, ir_none);
+    std::vector<IrInstr> entry_loads;                 // of variables a path reaches unstored
+    size_t renamed = 0;
+    auto set = [&](uint32_t symbol, uint32_t value) {
+        undo.push_back({symbol, current[symbol]});
+        current[symbol] = value;
+    };
+    auto value_of = [&](uint32_t symbol) {
+        if (current[symbol] != ir_none) return current[symbol];
+        if (undefined[symbol] == ir_none) {
+            IrInstr load{IrOp::Load};
+            load.type = function.types[symbol];
+            load.symbol = symbol;
+            load.dst = new_value(load.type);
+            entry_loads.push_back(load);
+            undefined[symbol] = load.dst;
+        }
+        return undefined[symbol];
+    };
+    auto rename = [&](uint32_t b) {
+        for (const PlacedPhi& phi : phis[b]) set(phi.symbol, phi.dst);
+        const IrBlock& block = cfg.blocks[b];
+        for (uint32_t i = block.begin; i < block.end; ++i) {
+            IrInstr& in = code[i];
+            if (in.op == IrOp::Load) {
+                if (current[in.symbol] == ir_none) {
+                    set(in.symbol, in.dst);
+                } else {
+                    make_copy(in, current[in.symbol]);
+                    ++renamed;
+                }
+            } else if (in.op == IrOp::Store) {
+                uint32_t value = in.a;
+                int32_t constant;
+                if (!fits_type(type_of(value), in.type)) {
+                    bool known = value < first_new && function.constant(value, constant);
+                    IrInstr narrowed{known ? IrOp::Const : IrOp::Narrow};
+                    narrowed.type = in.type;
+                    narrowed.dst = new_value(in.type);
+                    narrowed.a = known ? ir_none : value;
+                    narrowed.imm = known ? narrow(constant, in.type) : 0;
+                    value = narrowed.dst;
+                    set(in.symbol, value);
+                    in = narrowed;
+                } else {
+                    set(in.symbol, value);
+                    in.op = IrOp::Nop;
+                }
+                ++renamed;
+            }
+        }
+        for (uint32_t s : block.successors) {
+            uint32_t j = cfg.predecessor_index(s, b);
+            for (const PlacedPhi& phi : phis[s]) function.phi_args[phi.args + j] = value_of(phi.symbol);
+        }
+    };
+    struct Visit {
+        uint32_t block;
+        uint32_t child;  // next child in the dominator tree
+        size_t undo;     // undo entries before the block
+    };
+    std::vector<Visit> stack;
+    stack.push_back(Visit{0, cfg.child_begin[0], 0});
+    rename(0);
+    while (!stack.empty()) {
+        Visit& top = stack.back();
+        if (top.child < cfg.child_begin[top.block + 1]) {
+            uint32_t child = cfg.children[top.child++];
+            stack.push_back(Visit{child, cfg.child_begin[child], undo.size()});
+            rename(child);
+            continue;
+        }
+        for (size_t k = undo.size(); k-- > top.undo;) current[undo[k].first] = undo[k].second;
+        undo.resize(top.undo);
+        stack.pop_back();
+    }
+
+    // Every block starts with its Label, the Phis go right after it
+    std::vector<IrInstr> result;
+    result.reserve(code.size() + entry_loads.size() + 16);
+    for (uint32_t b = 0; b < block_count; ++b) {
+        const IrBlock& block = cfg.blocks[b];
+        result.push_back(code[block.begin]);
+        for (const PlacedPhi& placed : phis[b]) {
+            IrInstr phi{IrOp::Phi};
+            phi.type = function.types[placed.symbol];
+            phi.dst = placed.dst;
+            phi.symbol = placed.symbol;
+            phi.imm = (int32_t)block.predecessors.size();
+            phi.target = placed.args;
+            result.push_back(phi);
+            ++renamed;
+        }
+        if (b == 0) result.insert(result.end(), entry_loads.begin(), entry_loads.end());
+        for (uint32_t i = block.begin + 1; i < block.end; ++i) {
+            if (code[i].op != IrOp::Nop) result.push_back(code[i]);
+        }
+    }
+    function.code.swap(result);
+    function.rebuild();
+    function.in_ssa = true;
+    simplify_phis(function);
+    phis_first(function);
+    return renamed;
+}
+
+// Evaluates a binary operation or shift on constants, false for a division by zero
+inline bool fold_ir(const IrInstr& in, int32_t a, int32_t b, int32_t& out) {
+    switch (in.op) {
+        case IrOp::Add: return fold_binary(BinaryOp::Add, a, b, out);
+        case IrOp::Sub: return fold_binary(BinaryOp::Sub, a, b, out);
+        case IrOp::Mul: return fold_binary(BinaryOp::Mul, a, b, out);
+        case IrOp::Div: return fold_binary(BinaryOp::Div, a, b, out);
+        case IrOp::MulHi: out = (int32_t)((int64_t)a * b >> 32); return true;
+        case IrOp::Shl: out = (int32_t)((uint32_t)a << in.imm); return true;
+        case IrOp::Sra: out = a >> in.imm; return true;
+        case IrOp::Srl: out = (int32_t)((uint32_t)a >> in.imm); return true;
+        case IrOp::Cmp: out = holds((Relation)in.imm, a, b); return true;
+        default: return false;
+    }
+}
+
+// The branches on constants of SSA code as jumps or nothing. The Phis at the end of every edge
+// dropped, from the branch or from a block no longer reachable, lose that edge's argument; the
+// unreachable blocks go except for their notes, like remove_unreachable.
+inline size_t fold_ssa_branches(IrFunction& function) {
+    if (function.straight_line) return 0;
+    ControlFlowGraph cfg(function);
+    uint32_t block_count = (uint32_t)cfg.blocks.size();
+    std::vector<std::vector<uint32_t>> successors(block_count);
+    size_t folded = 0;
+    for (uint32_t b = 0; b < block_count; ++b) {
+        const IrBlock& block = cfg.blocks[b];
+        successors[b] = block.successors;
+        if (block.end == block.begin || !cfg.reachable(b)) continue;
+        IrInstr& in = function.code[block.end - 1];
+        if (in.op != IrOp::Branch) continue;
+        int32_t a = 0, c = 0;
+        if (function.resolve(in.a) != function.resolve(in.b) && !(function.constant(in.a, a) && function.constant(in.b, c))) {
+            continue;
+        }
+        uint32_t target = cfg.label_block[in.target];
+        bool taken = holds((Relation)in.imm, a, c);
+        if (target != b + 1) {
+            std::vector<uint32_t>& list = successors[b];
+            list.erase(std::remove(list.begin(), list.end(), taken ? b + 1 : target), list.end());
+        }
+        if (taken) {
+            IrInstr jump{IrOp::Jump};
+            jump.target = in.target;
+            in = jump;
+        } else {
+            in.op = IrOp::Nop;
+        }
+        ++folded;
+    }
+    if (folded == 0) return 0;
+
+    std::vector<bool> reached(block_count, false);
+    std::vector<uint32_t> stack{0};
+    reached[0] = true;
+    while (!stack.empty()) {
+        uint32_t b = stack.back();
+        stack.pop_back();
+        for (uint32_t s : successors[b]) {
+            if (!reached[s]) {
+                reached[s] = true;
+                stack.push_back(s);
+            }
+        }
+    }
+    for (uint32_t b = 0; b < block_count; ++b) {
+        const IrBlock& block = cfg.blocks[b];
+        if (!reached[b]) {
+            for (uint32_t i = block.begin; i < block.end; ++i) {
+                if (function.code[i].op != IrOp::Note) function.code[i].op = IrOp::Nop;
+            }
+            continue;
+        }
+        std::vector<bool> kept(block.predecessors.size());
+        for (size_t k = 0; k < kept.size(); ++k) {
+            uint32_t p = block.predecessors[k];
+            kept[k] = reached[p] && std::find(successors[p].begin(), successors[p].end(), b) != successors[p].end();
+        }
+        for (uint32_t i = block.begin; i < block.end; ++i) {
+            IrInstr& phi = function.code[i];
+            if (phi.op != IrOp::Phi) continue;
+            uint32_t* args = function.phi_begin(phi);
+            int32_t count = 0;
+            for (size_t k = 0; k < kept.size(); ++k) {
+                if (kept[k]) args[count++] = args[k];
+            }
+            phi.imm = count;
+        }
+    }
+    function.rebuild();
+    simplify_phis(function);
+    return folded;
+}
+
+// fold: constant folding and propagation with the algebraic identities of the syntax tree folder
+// (constfold.h), plus narrowing of values that are narrow already. Operands are looked up through
+// copies. Before ssa the variables are still in memory, the pass tracks which of them hold a known
+// value and turns their loads into constants; a Label forgets them all, control may come from
+// elsewhere. A constant division by zero then rejects its statement like the syntax tree folder
+// does: the statement's instructions, everything since the previous Store, Return, Note or control
+// flow, make way for the error (a declaration still declares its variable). A rejected condition
+// counts as false. In SSA form the statements are gone, the division stays in the code with a
+// warning in front of it. A branch on constants becomes a jump or goes, then the code no longer
+// reachable goes too. The pass runs again after copy-propagation, where the values of the
+// variables reach past the Labels: a Phi of one constant becomes that constant, and a folded branch
+// takes its arguments along with the edge it drops (fold_ssa_branches).
+inline size_t fold_pass(IrFunction& function) {
+    struct Variable {
+        uint32_t epoch = 0;  // known while it is the current epoch
+        int32_t value = 0;   // narrowed to the type
+    };
+    std::vector<Variable> variables(function.types.size());  // by symbol id, memory form only
+    uint32_t epoch = 1;                                      // advanced at every Label
+    std::vector<uint32_t> warnings;                          // instructions dividing by zero
+    std::vector<uint32_t> label_at(function.labels, 0);      // by label number, its instruction
+    for (uint32_t i = 0; i < function.code.size(); ++i) {
+        if (function.code[i].op == IrOp::Label) label_at[function.code[i].target] = i;
+    }
+    bool branches_folded = false;
+    size_t statement = 0;                                    // first instruction of the current statement
+    size_t folded = 0;
+    for (uint32_t i = 0; i < function.code.size(); ++i) {
+        IrInstr& in = function.code[i];
+        int32_t a = 0, b = 0, value = 0;
+        bool a_constant = in.a != ir_none && function.constant(in.a, a);
+        bool b_constant = in.b != ir_none && function.constant(in.b, b);
+        switch (in.op) {
+            case IrOp::Load:
+                if (variables[in.symbol].epoch == epoch) {
+                    make_constant(in, variables[in.symbol].value);
+                    ++folded;
+                }
+                continue;
+            case IrOp::Store:
+                variables[in.symbol] = Variable{a_constant ? epoch : 0, narrow(a, in.type)};
+                statement = i + 1;
+                continue;
+            case IrOp::Label:
+                ++epoch;
+                statement = i + 1;
+                continue;
+            case IrOp::Phi: {
+                // Every argument the same constant
+                int32_t first = 0, other = 0;
+                bool same = in.imm > 0 && function.constant(*function.phi_begin(in), first);
+                for (const uint32_t* arg = function.phi_begin(in); arg != function.phi_end(in) && same; ++arg) {
+                    same = function.resolve(*arg) == in.dst || (function.constant(*arg, other) && other == first);
+                }
+                if (same) {
+                    make_constant(in, first);
+                    ++folded;
+                }
+                continue;
+            }
+            case IrOp::Branch:
+                statement = i + 1;
+                if (function.in_ssa) continue;  // fold_ssa_branches
+                if ((a_constant && b_constant) || function.resolve(in.a) == function.resolve(in.b)) {
+                    if (holds((Relation)in.imm, a, b)) {
+                        IrInstr jump{IrOp::Jump};
+                        jump.target = in.target;
+                        in = jump;
+                    } else {
+                        in.op = IrOp::Nop;
+                    }
+                    branches_folded = true;
+                    ++folded;
+                }
+                continue;
+            case IrOp::Return:
+            case IrOp::Note:
+            case IrOp::Jump:
+                statement = i + 1;
+                continue;
+            case IrOp::Narrow:
+                if (a_constant) {
+                    make_constant(in, narrow(a, in.type));
+                } else if (fits_type(function.value_type(in.a), in.type)) {
+                    make_copy(in, in.a);
+                } else {
+                    continue;
+                }
+                ++folded;
+                continue;
+            default:
+                break;
+        }
+        if (!is_ir_binary(in.op) && !is_ir_shift(in.op) && in.op != IrOp::Cmp) continue;
+        if (in.op == IrOp::Div && b_constant && b == 0) {
+            if (in.line == 0) continue;  // reported before
+            if (function.in_ssa) {
+                warnings.push_back(i);
+                continue;
+            }
+            // The statement ends at the next Store, Return or Branch
+            uint32_t end = i;
+            while (function.code[end].op != IrOp::Store && function.code[end].op != IrOp::Return &&
+                   function.code[end].op != IrOp::Branch) {
+                ++end;
+            }
+            IrInstr error{IrOp::Note};
+            error.text = function.text.copy("Error: Division by zero at line " + std::to_string(in.line) +
+                                            ", column " + std::to_string(in.column));
+            for (size_t k = statement; k < end; ++k) function.code[k].op = IrOp::Nop;
+            if (function.code[end].op == IrOp::Branch) {
+                // False: an if skips to its else part (forward), a while does not loop (backward)
+                IrInstr& branch = function.code[end];
+                if (label_at[branch.target] > end) {
+                    IrInstr jump{IrOp::Jump};
+                    jump.target = branch.target;
+                    branch = jump;
+                } else {
+                    branch.op = IrOp::Nop;
+                }
+                function.code[i] = error;
+                branches_folded = true;
+            } else {
+                function.code[end] = error;
+            }
+            i = end;
+            statement = end + 1;
+            continue;
+        }
+        if (a_constant && (b_constant || is_ir_shift(in.op))) {
+            fold_ir(in, a, b, value);
+            make_constant(in, value);
+            ++folded;
+            continue;
+        }
+        uint32_t same = ir_none;
+        switch (in.op) {
+            case IrOp::Add:
+                if (a_constant && a == 0) same = in.b;
+                if (b_constant && b == 0) same = in.a;
+                break;
+            case IrOp::Sub:
+                if (b_constant && b == 0) same = in.a;
+                break;
+            case IrOp::Mul:
+                if (a_constant && a == 1) same = in.b;
+                if (b_constant && b == 1) same = in.a;
+                if ((a_constant && a == 0) || (b_constant && b == 0)) {
+                    make_constant(in, 0);
+                    ++folded;
+                    continue;
+                }
+                break;
+            case IrOp::Div:
+                if (b_constant && b == 1) same = in.a;
+                break;
+            case IrOp::Cmp:
+                // x relation x
+                if (function.resolve(in.a) == function.resolve(in.b)) {
+                    make_constant(in, holds((Relation)in.imm, 0, 0));
+                    ++folded;
+                    continue;
+                }
+                break;
+            default:
+                break;
+        }
+        if (same != ir_none) {
+            make_copy(in, same);
+            ++folded;
+        }
+    }
+    if (branches_folded) {
+        function.rebuild();
+        remove_unreachable(function);
+    }
+    if (!warnings.empty()) {
+        std::vector<IrInstr> code;
+        code.reserve(function.code.size() + warnings.size());
+        size_t next = 0;
+        for (uint32_t i = 0; i < function.code.size(); ++i) {
+            IrInstr& in = function.code[i];
+            if (next < warnings.size() && warnings[next] == i) {
+                IrInstr warning{IrOp::Note};
+                warning.text = function.text.copy("Warning: Division by zero at line " + std::to_string(in.line) +
+                                                  ", column " + std::to_string(in.column));
+                code.push_back(warning);
+                in.line = 0;  // reported
+                ++next;
+            }
+            code.push_back(in);
+        }
+        function.code.swap(code);
+    }
+    function.rebuild();
+    if (function.in_ssa) {
+        folded += fold_ssa_branches(function);
+        phis_first(function);
+    }
+    return folded;
+}
+
+// Exact key of a pure operation for cse, false when the operands do not fit its fields
+inline bool operation_key(const IrFunction& function, const IrInstr& in, uint64_t& key) {
+    constexpr uint32_t limit = 1u << 28;
+    uint64_t op = (uint64_t)in.op + 1;  // keys are never 0
+    if (in.op == IrOp::Const) {
+        key = op << 60 | (uint32_t)in.imm;
+        return true;
+    }
+    uint32_t a = function.resolve(in.a);
+    if (a >= limit) return false;
+    if (in.op == IrOp::Narrow) {
+        key = op << 60 | (uint64_t)in.type << 28 | a;
+        return true;
+    }
+    if (is_ir_shift(in.op)) {
+        key = op << 60 | (uint64_t)in.imm << 28 | a;
+        return true;
+    }
+    uint32_t b = function.resolve(in.b);
+    if (b >= limit) return false;
+    if (in.op == IrOp::Cmp) {
+        // a > b is b < a, a >= b is b <= a
+        Relation relation = (Relation)in.imm;
+        if (relation == Relation::Gt || relation == Relation::Ge) {
+            std::swap(a, b);
+            relation = swap_operands(relation);
+        }
+        if ((relation == Relation::Eq || relation == Relation::Ne) && b < a) std::swap(a, b);
+        key = op << 60 | (uint64_t)relation << 56 | (uint64_t)b << 28 | a;
+        return true;
+    }
+    if ((in.op == IrOp::Add || in.op == IrOp::Mul || in.op == IrOp::MulHi) && b < a) std::swap(a, b);
+    key = op << 60 | (uint64_t)in.wraps << 56 | (uint64_t)b << 28 | a;
+    return true;
+}
+
+// cse: a pure operation computing what an earlier one computed becomes a copy of its value.
+// Straight-line SSA code has no kills, so one table covers the whole function. With control flow
+// the blocks go in reverse postorder and an earlier value is only reused where its block dominates,
+// otherwise the later one takes its place in the table.
+inline size_t cse_pass(IrFunction& function) {
+    OperationTable table;
+    table.reserve(function.code.size());
+    size_t eliminated = 0;
+    auto visit = [&](IrInstr& in, auto&& available) {
+        if (!is_ir_pure(in.op) || in.op == IrOp::Copy) return;
+        uint64_t key;
+        if (!operation_key(function, in, key)) return;
+        bool inserted;
+        uint32_t value = table.find_or_insert(key, in.dst, inserted);
+        if (inserted) return;
+        if (available(value)) {
+            make_copy(in, value);
+            ++eliminated;
+        } else {
+            table.assign(key, in.dst);
+        }
+    };
+    if (function.straight_line) {
+        for (IrInstr& in : function.code) visit(in, [](uint32_t) { return true; });
+        return eliminated;
+    }
+    ControlFlowGraph cfg(function);
+    for (uint32_t b : cfg.order) {
+        auto dominating = [&](uint32_t value) { return cfg.dominates(cfg.block_of[function.defs[value]], b); };
+        for (uint32_t i = cfg.blocks[b].begin; i < cfg.blocks[b].end; ++i) visit(function.code[i], dominating);
+    }
+    return eliminated;
+}
+
+// copy-propagation: every operand, Phi arguments too, reads the value its chain of copies starts from
+inline size_t copy_propagation_pass(IrFunction& function) {
+    size_t replaced = 0;
+    for (IrInstr& in : function.code) {
+        if (in.op == IrOp::Phi) {
+            for (uint32_t* arg = function.phi_begin(in); arg != function.phi_begin(in) + in.imm; ++arg) {
+                if (function.def(*arg).op != IrOp::Copy) continue;
+                *arg = function.resolve(*arg);
+                ++replaced;
+            }
+            continue;
+        }
+        if (in.a != ir_none && function.def(in.a).op == IrOp::Copy) {
+            in.a = function.resolve(in.a);
+            ++replaced;
+        }
+        if (in.b != ir_none && function.def(in.b).op == IrOp::Copy) {
+            in.b = function.resolve(in.b);
+            ++replaced;
+        }
+    }
+    return replaced;
+}
+
+// strength-reduce: multiplications and divisions by a constant as shifts, adds and a
+// multiply-high (strength.h), the sequences the statement code generator emits. Their adds and
+// subtracts wrap around: a*3 as (a << 1) + a overflows where the mul it replaces does not.
+inline size_t strength_reduction_pass(IrFunction& function) {
+    std::vector<IrInstr> code;
+    code.reserve(function.code.size());
+    size_t reduced = 0;
+    auto emit = [&](IrOp op, uint32_t a, uint32_t b = ir_none, int32_t imm = 0) {
+        IrInstr in{op};
+        in.dst = function.new_value();
+        in.a = a;
+        in.b = b;
+        in.imm = imm;
+        in.wraps = op == IrOp::Add || op == IrOp::Sub;
+        code.push_back(in);
+        return in.dst;
+    };
+    auto negate = [&](uint32_t x) { return emit(IrOp::Sub, emit(IrOp::Const, ir_none, ir_none, 0), x); };
+
+    for (const IrInstr& in : function.code) {
+        int32_t a = 0, c = 0;
+        bool a_constant = (in.op == IrOp::Mul || in.op == IrOp::Div) && function.constant(in.a, a);
+        bool b_constant = (in.op == IrOp::Mul || in.op == IrOp::Div) && function.constant(in.b, c);
+        uint32_t x = in.a;
+        if (in.op == IrOp::Mul && a_constant && !b_constant) {
+            c = a;
+            x = in.b;
+        } else if (!b_constant || a_constant) {
+            code.push_back(in);
+            continue;
+        }
+
+        size_t start = code.size();
+        if (in.op == IrOp::Mul) {
+            ShiftPlan plan;
+            if (c == -1) {
+                negate(x);
+            } else if (plan_multiply(c, plan) && !(plan.low > 0 && plan.negate)) {
+                uint32_t d = emit(IrOp::Shl, x, ir_none, plan.high);
+                if (plan.low == 0) {
+                    d = emit(plan.subtract ? IrOp::Sub : IrOp::Add, d, x);
+                } else if (plan.low > 0) {
+                    d = emit(plan.subtract ? IrOp::Sub : IrOp::Add, d, emit(IrOp::Shl, x, ir_none, plan.low));
+                }
+                if (plan.negate) negate(d);
+            }
+        } else {
+            uint32_t m = c < 0 ? 0u - (uint32_t)c : (uint32_t)c;
+            if (c == -1) {
+                negate(x);
+            } else if (m < 2 || c == INT32_MIN) {
+                // nothing cheaper
+            } else if (is_power_of_two(m)) {
+                // Shifting alone rounds toward minus infinity, negative dividends get 2^k - 1 added first
+                int k = log2_exact(m);
+                uint32_t bias = k == 1 ? emit(IrOp::Srl, x, ir_none, 31)
+                                       : emit(IrOp::Srl, emit(IrOp::Sra, x, ir_none, 31), ir_none, 32 - k);
+                uint32_t d = emit(IrOp::Sra, emit(IrOp::Add, x, bias), ir_none, k);
+                if (c < 0) negate(d);
+            } else {
+                DivisionMagic magic = signed_division_magic(c);
+                uint32_t d = emit(IrOp::MulHi, x, emit(IrOp::Const, ir_none, ir_none, magic.magic));
+                if (c > 0 && magic.magic < 0) d = emit(IrOp::Add, d, x);
+                if (c < 0 && magic.magic > 0) d = emit(IrOp::Sub, d, x);
+                if (magic.shift > 0) d = emit(IrOp::Sra, d, ir_none, magic.shift);
+                // Round toward zero: add one when the quotient is negative
+                emit(IrOp::Add, d, emit(IrOp::Srl, d, ir_none, 31));
+            }
+        }
+        if (code.size() == start) {
+            code.push_back(in);
+        } else {
+            code.back().dst = in.dst;  // the last instruction computes the result
+            ++reduced;
+        }
+    }
+    function.code.swap(code);
+    function.rebuild();
+    return reduced;
+}
+
+// licm: loop-invariant code motion. A pure operation inside a loop whose operands all come from
+// outside it moves to the end of the loop's preheader, the one block entering the loop, which then
+// computes it once. Loops are the natural loops of the back edges (edges to a block dominating their
+// source), inner ones first so that what leaves an inner loop can leave the outer one as well.
+// Divisions stay where they are, in a loop that runs zero times they must not trap; loads only move
+// in SSA form, where nothing stores the variables any more. Constants move along with their users
+// but do not count, the code generator loads them where they are used anyway.
+inline size_t licm_pass(IrFunction& function) {
+    if (function.straight_line) return 0;
+    ControlFlowGraph cfg(function);
+    uint32_t block_count = (uint32_t)cfg.blocks.size();
+
+    std::vector<std::pair<uint32_t, uint32_t>> back_edges;  // (header, source)
+    for (uint32_t b : cfg.order) {
+        for (uint32_t s : cfg.blocks[b].successors) {
+            if (cfg.dominates(s, b)) back_edges.push_back({s, b});
+        }
+    }
+    std::sort(back_edges.begin(), back_edges.end());
+    std::vector<uint32_t> rank(block_count, 0);  // position in reverse postorder
+    for (uint32_t i = 0; i < cfg.order.size(); ++i) rank[cfg.order[i]] = i;
+
+    // The blocks of every loop, its header first: what reaches a back edge without passing the header
+    std::vector<std::vector<uint32_t>> loops;
+    std::vector<uint32_t> member(block_count, ir_none);  // loop the block was last found in
+    for (size_t k = 0; k < back_edges.size();) {
+        uint32_t header = back_edges[k].first;
+        uint32_t id = (uint32_t)loops.size();
+        std::vector<uint32_t> body{header};
+        std::vector<uint32_t> work;
+        member[header] = id;
+        for (; k < back_edges.size() && back_edges[k].first == header; ++k) work.push_back(back_edges[k].second);
+        while (!work.empty()) {
+            uint32_t b = work.back();
+            work.pop_back();
+            if (member[b] == id) continue;
+            member[b] = id;
+            body.push_back(b);
+            for (uint32_t p : cfg.blocks[b].predecessors) {
+                if (cfg.reachable(p)) work.push_back(p);
+            }
+        }
+        std::sort(body.begin() + 1, body.end(), [&](uint32_t a, uint32_t b) { return rank[a] < rank[b]; });
+        loops.push_back(std::move(body));
+    }
+    std::stable_sort(loops.begin(), loops.end(),
+                     [](const std::vector<uint32_t>& a, const std::vector<uint32_t>& b) { return a.size() < b.size(); });
+
+    std::vector<std::vector<IrInstr>> blocks(block_count);
+    std::vector<uint32_t> def_block(function.values, ir_none);
+    for (uint32_t b = 0; b < block_count; ++b) {
+        blocks[b].assign(function.code.begin() + cfg.blocks[b].begin, function.code.begin() + cfg.blocks[b].end);
+        for (const IrInstr& in : blocks[b]) {
+            if (in.dst != ir_none) def_block[in.dst] = b;
+        }
+    }
+
+    size_t moved = 0;
+    std::fill(member.begin(), member.end(), ir_none);
+    for (uint32_t id = 0; id < loops.size(); ++id) {
+        const std::vector<uint32_t>& body = loops[id];
+        for (uint32_t b : body) member[b] = id;
+        uint32_t preheader = ir_none;
+        bool single = true;
+        for (uint32_t p : cfg.blocks[body[0]].predecessors) {
+            if (member[p] == id || !cfg.reachable(p)) continue;
+            single = preheader == ir_none;
+            preheader = p;
+        }
+        if (!single || preheader == ir_none || cfg.blocks[preheader].successors.size() != 1) continue;
+
+        std::vector<IrInstr> hoisted;
+        auto outside = [&](uint32_t value) { return value == ir_none || member[def_block[value]] != id; };
+        for (uint32_t b : body) {
+            std::vector<IrInstr>& list = blocks[b];
+            size_t kept = 0;
+            for (const IrInstr& in : list) {
+                bool movable = (is_ir_pure(in.op) && in.op != IrOp::Div) || (in.op == IrOp::Load && function.in_ssa);
+                if (movable && outside(in.a) && outside(in.b)) {
+                    hoisted.push_back(in);
+                    def_block[in.dst] = preheader;
+                    if (in.op != IrOp::Const) ++moved;
+                } else {
+                    list[kept++] = in;
+                }
+            }
+            list.resize(kept);
+        }
+        std::vector<IrInstr>& target = blocks[preheader];
+        bool ends_in_branch = !target.empty() && (target.back().op == IrOp::Jump || target.back().op == IrOp::Branch);
+        target.insert(ends_in_branch ? target.end() - 1 : target.end(), hoisted.begin(), hoisted.end());
+    }
+
+    std::vector<IrInstr> code;
+    code.reserve(function.code.size());
+    for (const std::vector<IrInstr>& list : blocks) code.insert(code.end(), list.begin(), list.end());
+    function.code.swap(code);
+    function.rebuild();
+    return moved;
+}
+
+// dce of code with control flow: mark and sweep. Roots are notes, calls, the control flow itself, the
+// Returns whose value can reach the end of the code and the stores a load may read; marking follows
+// operands and Phi arguments, which also removes Phis only feeding each other around a loop.
+inline size_t dce_blocks(IrFunction& function) {
+    ControlFlowGraph cfg(function);
+    uint32_t block_count = (uint32_t)cfg.blocks.size();
+    uint32_t symbols = (uint32_t)function.types.size();
+    std::vector<IrInstr>& code = function.code;
+
+    // $v0 is read after a block when some path reaches the end without another Return
+    std::vector<bool> returns(block_count, false);
+    std::vector<bool> loaded(symbols, false);  // by symbol id, loaded anywhere
+    for (uint32_t b = 0; b < block_count; ++b) {
+        for (uint32_t i = cfg.blocks[b].begin; i < cfg.blocks[b].end; ++i) {
+            if (code[i].op == IrOp::Return) returns[b] = true;
+            if (code[i].op == IrOp::Load) loaded[code[i].symbol] = true;
+        }
+    }
+    std::vector<bool> result_in(block_count, false), result_out(block_count, false);
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (uint32_t b = block_count; b-- > 0;) {
+            bool out = cfg.blocks[b].exits;
+            for (uint32_t s : cfg.blocks[b].successors) out = out || result_in[s];
+            bool in = out && !returns[b];
+            if (out != result_out[b] || in != result_in[b]) {
+                result_out[b] = out;
+                result_in[b] = in;
+                changed = true;
+            }
+        }
+    }
+
+    std::vector<bool> keep(code.size(), false);
+    std::vector<uint32_t> work;
+    auto root = [&](uint32_t i) {
+        if (keep[i]) return;
+        keep[i] = true;
+        work.push_back(i);
+    };
+    std::vector<uint32_t> seen(symbols, ir_none);  // block that accessed the variable after the current store
+    std::vector<bool> read_later(symbols, false);
+    for (uint32_t b = 0; b < block_count; ++b) {
+        bool result = result_out[b];
+        bool flows = !cfg.blocks[b].successors.empty();
+        for (uint32_t i = cfg.blocks[b].end; i-- > cfg.blocks[b].begin;) {
+            const IrInstr& in = code[i];
+            switch (in.op) {
+                case IrOp::Note: case IrOp::Label: case IrOp::Jump: case IrOp::Branch:
+                case IrOp::Arg: case IrOp::Call:
+                    root(i);
+                    break;
+                case IrOp::Return:
+                    if (result) root(i);
+                    result = false;
+                    break;
+                case IrOp::Store:
+                    if (seen[in.symbol] == b ? read_later[in.symbol] : flows && loaded[in.symbol]) root(i);
+                    seen[in.symbol] = b;
+                    read_later[in.symbol] = false;
+                    break;
+                case IrOp::Load:
+                    seen[in.symbol] = b;
+                    read_later[in.symbol] = true;
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+    auto mark = [&](uint32_t value) {
+        if (value != ir_none) root(function.defs[value]);
+    };
+    while (!work.empty()) {
+        const IrInstr& in = code[work.back()];
+        work.pop_back();
+        mark(in.a);
+        mark(in.b);
+        if (in.op == IrOp::Phi) {
+            for (const uint32_t* arg = function.phi_begin(in); arg != function.phi_end(in); ++arg) mark(*arg);
+        }
+    }
+
+    size_t removed = 0;
+    for (uint32_t i = 0; i < code.size(); ++i) {
+        if (keep[i] || code[i].op == IrOp::Nop) continue;
+        code[i].op = IrOp::Nop;
+        ++removed;
+    }
+    function.rebuild();
+    return removed;
+}
+
+// dce: backward liveness over values and variables. Roots are the last Return (earlier ones are
+// overwritten in $v0), notes, calls and stores to a variable loaded later; everything else unused goes.
+// Code with control flow goes to dce_blocks.
+inline size_t dce_pass(IrFunction& function) {
+    if (!function.straight_line) return dce_blocks(function);
+    std::vector<bool> live(function.values, false);
+    std::vector<bool> loaded(function.types.size(), false);  // by symbol id, read before the next store
+    bool returned = false;
+    size_t removed = 0;
+    for (size_t i = function.code.size(); i-- > 0;) {
+        IrInstr& in = function.code[i];
+        bool keep;
+        switch (in.op) {
+            case IrOp::Return:
+                keep = !returned;
+                returned = true;
+                break;
+            case IrOp::Note:
+            case IrOp::Arg:
+            case IrOp::Call:
+                keep = true;
+                break;
+            case IrOp::Store:
+                keep = loaded[in.symbol];
+                loaded[in.symbol] = false;
+                break;
+            case IrOp::Nop:
+                continue;
+            default:
+                keep = live[in.dst];
+                if (keep && in.op == IrOp::Load) loaded[in.symbol] = true;
+                break;
+        }
+        if (!keep) {
+            in.op = IrOp::Nop;
+            ++removed;
+            continue;
+        }
+        if (in.a != ir_none) live[in.a] = true;
+        if (in.b != ir_none) live[in.b] = true;
+    }
+    function.rebuild();
+    return removed;
+}
+
+// Runs the selected passes in order, timing each of them as its own phase
+class PassManager {
+private:
+    struct Pass {
+        const char* name;
+        size_t (*run)(IrFunction&);
+        size_t changes;
+    };
+
+    std::vector<Pass> passes;
+
+public:
+    void add(const char* name, size_t (*run)(IrFunction&)) { passes.push_back(Pass{name, run, 0}); }
+
+    void run(IrFunction& function, PhaseTimer& timer) {
+        for (Pass& pass : passes) {
+            pass.changes += pass.run(function);
+            timer.lap(pass.name, function.code.size());
+        }
+    }
+
+    template <typename Out>
+    void report(Out& out) const {
+        out << "ir passes:";
+        for (size_t i = 0; i < passes.size(); ++i) {
+            out << (i == 0 ? " " : ", ") << passes[i].name << ' ' << passes[i].changes;
+        }
+        out << (passes.empty() ? " none\n" : "\n");
+    }
+};
+
+#endif // IRPASSES_H
@@ -0,0 +1,263 @@
+#ifndef LEXER_H
+#define LEXER_H
+
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+#include "intern.h"
+
+// Token kinds of the grammar in README.md
+enum class TokenKind : uint8_t {
+    End,         // end of input
+    Invalid,     // a byte the grammar does not know about
+    KwChar,      // char
+    KwShort,     // short
+    KwInt,       // int
+    KwLong,      // long
+    KwReturn,    // return
+    KwIf,        // if
+    KwElse,      // else
+    KwWhile,     // while
+    Identifier,
+    Number,      // decimal integer constant
+    Assign,      // =
+    Plus,        // +
+    Minus,       // -
+    Star,        // *
+    Slash,       // /
+    LParen,      // (
+    RParen,      // )
+    Semicolon,   // ;
+    Comma,       // ,
+    LBrace,      // {
+    RBrace,      // }
+    Less,        // <
+    LessEqual,   // <=
+    Greater,     // >
+    GreaterEqual,  // >=
+    Equal,       // ==
+    NotEqual,    // !=
+};
+
+// Compact token record (20 bytes). The text is never copied, it is a slice of the source buffer.
+struct Token {
+    uint32_t offset;   // byte offset of the first character in the source
+    uint32_t line;     // 1-based line number
+    uint32_t symbol;   // interned id of an identifier, Interner::none otherwise
+    uint32_t length;   // length in bytes, a number or name may be as long as the source
+    uint16_t column;   // 1-based column, saturates at 65535
+    TokenKind kind;
+
+    std::string_view text(std::string_view src) const {
+        return std::string_view(src.data() + offset, length);
+    }
+};
+static_assert(sizeof(Token) == 20, "tokens stay 20 bytes");
+
+inline const char* token_kind_name(TokenKind kind) {
+    switch (kind) {
+        case TokenKind::End:        return "end of input";
+        case TokenKind::Invalid:    return "invalid character";
+        case TokenKind::KwChar:     return "'char'";
+        case TokenKind::KwShort:    return "'short'";
+        case TokenKind::KwInt:      return "'int'";
+        case TokenKind::KwLong:     return "'long'";
+        case TokenKind::KwReturn:   return "'return'";
+        case TokenKind::KwIf:       return "'if'";
+        case TokenKind::KwElse:     return "'else'";
+        case TokenKind::KwWhile:    return "'while'";
+        case TokenKind::Identifier: return "identifier";
+        case TokenKind::Number:     return "constant";
+        case TokenKind::Assign:     return "'='";
+        case TokenKind::Plus:       return "'+'";
+        case TokenKind::Minus:      return "'-'";
+        case TokenKind::Star:       return "'*'";
+        case TokenKind::Slash:      return "'/'";
+        case TokenKind::LParen:     return "'('";
+        case TokenKind::RParen:     return "')'";
+        case TokenKind::Semicolon:  return "';'";
+        case TokenKind::Comma:      return "','";
+        case TokenKind::LBrace:     return "'{'";
+        case TokenKind::RBrace:     return "'}'";
+        case TokenKind::Less:       return "'<'";
+        case TokenKind::LessEqual:  return "'<='";
+        case TokenKind::Greater:    return "'>'";
+        case TokenKind::GreaterEqual: return "'>='";
+        case TokenKind::Equal:      return "'=='";
+        case TokenKind::NotEqual:   return "'!='";
+    }
+    return "?";
+}
+
+inline bool is_operator_token(TokenKind kind) {
+    return kind == TokenKind::Plus || kind == TokenKind::Minus ||
+           kind == TokenKind::Star || kind == TokenKind::Slash;
+}
+
+namespace lexer_detail {
+
+// Character classes driving the DFA, one table lookup per input byte
+enum CharClass : uint8_t { CC_OTHER, CC_SPACE, CC_NEWLINE, CC_DIGIT, CC_ALPHA, CC_PUNCT };
+
+struct CharTable {
+    CharClass cls[256];
+    TokenKind punct[256];  // token kind for single-character tokens (CC_PUNCT)
+};
+
+constexpr CharTable make_char_table() {
+    CharTable t{};
+    for (int c = 0; c < 256; ++c) {
+        t.cls[c] = CC_OTHER;
+        t.punct[c] = TokenKind::Invalid;
+    }
+    t.cls[(unsigned char)' '] = CC_SPACE;
+    t.cls[(unsigned char)'\t'] = CC_SPACE;
+    t.cls[(unsigned char)'\r'] = CC_SPACE;
+    t.cls[(unsigned char)'\v'] = CC_SPACE;
+    t.cls[(unsigned char)'\f'] = CC_SPACE;
+    t.cls[(unsigned char)'\n'] = CC_NEWLINE;
+    for (int c = '0'; c <= '9'; ++c) t.cls[c] = CC_DIGIT;
+    for (int c = 'a'; c <= 'z'; ++c) t.cls[c] = CC_ALPHA;
+    for (int c = 'A'; c <= 'Z'; ++c) t.cls[c] = CC_ALPHA;
+    t.cls[(unsigned char)'_'] = CC_ALPHA;
+
+    // '!' only exists as the start of "!=", alone it stays Invalid
+    const char puncts[] = "=+-*/();,{}<>!";
+    const TokenKind kinds[] = {
+        TokenKind::Assign, TokenKind::Plus, TokenKind::Minus, TokenKind::Star,
+        TokenKind::Slash, TokenKind::LParen, TokenKind::RParen, TokenKind::Semicolon, TokenKind::Comma,
+        TokenKind::LBrace, TokenKind::RBrace, TokenKind::Less, TokenKind::Greater, TokenKind::Invalid,
+    };
+    for (int i = 0; i < 14; ++i) {
+        t.cls[(unsigned char)puncts[i]] = CC_PUNCT;
+        t.punct[(unsigned char)puncts[i]] = kinds[i];
+    }
+    return t;
+}
+
+inline constexpr CharTable char_table = make_char_table();
+
+// Kind of the two-character operator starting with c when '=' follows it, Invalid when there is none
+constexpr TokenKind with_equals(unsigned char c) {
+    switch (c) {
+        case '<': return TokenKind::LessEqual;
+        case '>': return TokenKind::GreaterEqual;
+        case '=': return TokenKind::Equal;
+        case '!': return TokenKind::NotEqual;
+        default: return TokenKind::Invalid;
+    }
+}
+
+// Keywords are told apart by length first, so a plain identifier costs at most one compare
+inline TokenKind keyword_or_identifier(const char* p, size_t len) {
+    switch (len) {
+        case 2: if (p[0] == 'i' && p[1] == 'f') return TokenKind::KwIf; break;
+        case 3: if (std::memcmp(p, "int", 3) == 0) return TokenKind::KwInt; break;
+        case 4:
+            if (std::memcmp(p, "char", 4) == 0) return TokenKind::KwChar;
+            if (std::memcmp(p, "long", 4) == 0) return TokenKind::KwLong;
+            if (std::memcmp(p, "else", 4) == 0) return TokenKind::KwElse;
+            break;
+        case 5:
+            if (std::memcmp(p, "short", 5) == 0) return TokenKind::KwShort;
+            if (std::memcmp(p, "while", 5) == 0) return TokenKind::KwWhile;
+            break;
+        case 6: if (std::memcmp(p, "return", 6) == 0) return TokenKind::KwReturn; break;
+    }
+    return TokenKind::Identifier;
+}
+
+} // namespace lexer_detail
+
+// Hand-written single-pass DFA lexer. Every byte of the source is classified exactly once.
+class Lexer {
+private:
+    std::string_view src;
+    size_t pos;
+    size_t line_start;  // offset of the first byte of the current line
+    uint32_t line;
+    Interner* interner;  // identifiers are interned here when set
+
+    Token make(TokenKind kind, size_t start) const {
+        Token tok;
+        tok.offset = (uint32_t)start;
+        tok.line = line;
+        tok.symbol = Interner::none;
+        tok.length = (uint32_t)(pos - start);
+        size_t col = start - line_start + 1;
+        tok.column = (uint16_t)(col > 0xFFFF ? 0xFFFF : col);
+        tok.kind = kind;
+        return tok;
+    }
+
+public:
+    explicit Lexer(std::string_view source, uint32_t first_line = 1, Interner* interner = nullptr)
+        : src(source), pos(0), line_start(0), line(first_line), interner(interner) {}
+
+    // Lexes source[begin, end) only, offsets and columns stay those of the whole source.
+    // line_start is the offset of the line begin is on.
+    Lexer(std::string_view source, size_t begin, size_t end, uint32_t first_line, size_t line_start,
+          Interner* interner)
+        : src(source.substr(0, end)), pos(begin), line_start(line_start), line(first_line), interner(interner) {}
+
+    // Line of the next token, after the End token the line count of the input
+    uint32_t current_line() const { return line; }
+
+    Token next() {
+        using namespace lexer_detail;
+        const size_t n = src.size();
+        const char* s = src.data();
+
+        while (pos < n) {
+            size_t start = pos;
+            unsigned char c = (unsigned char)s[pos];
+            switch (char_table.cls[c]) {
+                case CC_SPACE:
+                    ++pos;
+                    break;
+                case CC_NEWLINE:
+                    ++pos;
+                    ++line;
+                    line_start = pos;
+                    break;
+                case CC_DIGIT:
+                    while (++pos < n && char_table.cls[(unsigned char)s[pos]] == CC_DIGIT) {}
+                    return make(TokenKind::Number, start);
+                case CC_ALPHA: {
+                    while (++pos < n && (char_table.cls[(unsigned char)s[pos]] == CC_ALPHA ||
+                                         char_table.cls[(unsigned char)s[pos]] == CC_DIGIT)) {}
+                    Token tok = make(keyword_or_identifier(s + start, pos - start), start);
+                    if (tok.kind == TokenKind::Identifier && interner != nullptr) {
+                        tok.symbol = interner->intern(std::string_view(s + start, pos - start));
+                    }
+                    return tok;
+                }
+                case CC_PUNCT:
+                    ++pos;
+                    if (pos < n && s[pos] == '=' && with_equals(c) != TokenKind::Invalid) {
+                        ++pos;
+                        return make(with_equals(c), start);
+                    }
+                    return make(char_table.punct[c], start);
+                default:
+                    ++pos;
+                    return make(TokenKind::Invalid, start);
+            }
+        }
+        return make(TokenKind::End, pos);
+    }
+
+    // Lex the whole source into tokens (cleared first), terminated by an End token
+    void tokenize(std::vector<Token>& tokens) {
+        tokens.clear();
+        for (;;) {
+            Token tok = next();
+            tokens.push_back(tok);
+            if (tok.kind == TokenKind::End) break;
+        }
+    }
+};
+
+#endif // LEXER_H
@@ -0,0 +1,443 @@
+#ifndef LOWER_H
+#define LOWER_H
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "ast.h"
+#include "ir.h"
+
+// Lowering of the syntax tree to the IR (ir.h). Variables stay in memory: every mention of a
+// variable is a Load, every assignment a Store, expressions become one instruction per operation,
+// operands left to right. The declaration checks are the statement code generator's, with the same
+// diagnostics at the same places: a rejected statement lowers to its Note and nothing else.
+//
+// if and while become labels and branches. A condition that is a comparison branches on it
+// directly, any other one is compared with zero; a condition rejected for an undeclared variable
+// counts as false. Loops test at the bottom, one branch per iteration:
+//
+//   if (c) T else E       branch !c, Lelse; T; jump Lend; Lelse: E; Lend:
+//   while (c) B           jump Ltest; Lbody: B; Ltest: branch c, Lbody
+//
+// Declarations are checked in source order whether or not they are executed. A variable declared
+// inside an if or while reads as 0 until its declaration runs, the function starts by storing 0 to it.
+//
+// Every function lowers on its own, run() the top-level statements into main and run(definition)
+// one function. A function starts by storing its Params into the parameters' variables; a return
+// narrows its value to the function's type and jumps to the end, where the code falling off the end
+// returns 0. Arguments lower left to right, then one Arg each and the Call. A call clobbers $v0, so
+// main in a program with functions keeps its result in a variable of its own (named "return", which
+// no variable can be) and only returns it at the end. Calls are checked like variables: a call of
+// an undefined function or with the wrong number of arguments rejects its statement.
+class IrLowering {
+private:
+    IrFunction& function;
+    std::ostream* trace;           // Infix/Postfix lines of --trace, nullptr when off
+    const std::vector<const FunctionStmt*>& functions;  // by symbol id, see function_definitions()
+    std::vector<bool> is_declared;  // by symbol id
+    uint32_t depth = 0;            // if and while statements around the current one
+    std::vector<uint32_t> nested;  // symbols declared inside one
+    std::vector<uint32_t> arguments;  // values of the calls being lowered, innermost last
+    const FunctionStmt* definition = nullptr;  // the function being lowered, nullptr for main
+    uint32_t result = ir_none;     // main's result variable in a program with functions
+    uint32_t exit = ir_none;       // label at the end of a function, once a return jumps there
+
+    void emit(const IrInstr& in) { function.code.push_back(in); }
+
+    void note(std::string_view text) {
+        IrInstr in{IrOp::Note};
+        in.text = function.text.copy(text);
+        emit(in);
+    }
+
+    uint32_t constant(int32_t value) {
+        IrInstr in{IrOp::Const};
+        in.dst = function.new_value();
+        in.imm = value;
+        emit(in);
+        return in.dst;
+    }
+
+    void store(uint32_t symbol, uint32_t value) {
+        IrInstr in{IrOp::Store};
+        in.type = function.types[symbol];
+        in.symbol = symbol;
+        in.a = value;
+        emit(in);
+    }
+
+    uint32_t load(uint32_t symbol) {
+        IrInstr in{IrOp::Load};
+        in.type = function.types[symbol];
+        in.symbol = symbol;
+        in.dst = function.new_value();
+        emit(in);
+        return in.dst;
+    }
+
+    void label(uint32_t number) {
+        IrInstr in{IrOp::Label};
+        in.target = number;
+        emit(in);
+    }
+
+    void jump(uint32_t label) {
+        IrInstr in{IrOp::Jump};
+        in.target = label;
+        emit(in);
+    }
+
+    static Relation relation_of(BinaryOp op) {
+        switch (op) {
+            case BinaryOp::Lt: return Relation::Lt;
+            case BinaryOp::Le: return Relation::Le;
+            case BinaryOp::Gt: return Relation::Gt;
+            case BinaryOp::Ge: return Relation::Ge;
+            case BinaryOp::Eq: return Relation::Eq;
+            default: return Relation::Ne;
+        }
+    }
+
+    // Continues at label when the condition's truth is when, falls through otherwise
+    void branch(const Expr* condition, bool when, uint32_t label) {
+        IrInstr in{IrOp::Branch};
+        Relation relation = Relation::Ne;
+        auto* bin = static_cast<const BinaryExpr*>(condition);
+        if (condition->kind == ExprKind::Binary && is_comparison(bin->op)) {
+            relation = relation_of(bin->op);
+            in.a = lower(bin->lhs);
+            in.b = lower(bin->rhs);
+        } else {
+            in.a = lower(condition);
+            in.b = constant(0);
+        }
+        in.imm = (int32_t)(when ? relation : negate(relation));
+        in.target = label;
+        emit(in);
+    }
+
+    // Reports the first undeclared variable of the expression
+    bool check_variables(const Expr* expr) {
+        switch (expr->kind) {
+            case ExprKind::Constant:
+                return true;
+            case ExprKind::Variable: {
+                auto* var = static_cast<const VariableExpr*>(expr);
+                if (!is_declared[var->symbol]) {
+                    not_declared(var->name);
+                    return false;
+                }
+                return true;
+            }
+            case ExprKind::Binary: {
+                auto* bin = static_cast<const BinaryExpr*>(expr);
+                return check_variables(bin->lhs) && check_variables(bin->rhs);
+            }
+            case ExprKind::Call: {
+                auto* call = static_cast<const CallExpr*>(expr);
+                const FunctionStmt* callee = functions[call->symbol];
+                if (callee == nullptr) {
+                    std::string text = "Error: Function '";
+                    text.append(call->name);
+                    text.append("' not defined.");
+                    note(text);
+                    return false;
+                }
+                if (callee->count != call->count) {
+                    std::string text = "Error: Function '";
+                    text.append(call->name);
+                    text.append("' takes " + std::to_string(callee->count) + " arguments, " +
+                                std::to_string(call->count) + " given.");
+                    note(text);
+                    return false;
+                }
+                for (uint32_t i = 0; i < call->count; ++i) {
+                    if (!check_variables(call->arguments[i])) return false;
+                }
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void not_declared(std::string_view name) {
+        std::string text = "Error: Variable '";
+        text.append(name);
+        text.append("' not declared.");
+        note(text);
+    }
+
+    uint32_t lower(const Expr* expr) {
+        switch (expr->kind) {
+            case ExprKind::Constant:
+                return constant(static_cast<const ConstantExpr*>(expr)->value);
+            case ExprKind::Variable:
+                return load(static_cast<const VariableExpr*>(expr)->symbol);
+            case ExprKind::Binary: {
+                auto* bin = static_cast<const BinaryExpr*>(expr);
+                IrInstr in{IrOp::Add};
+                switch (bin->op) {
+                    case BinaryOp::Add: in.op = IrOp::Add; break;
+                    case BinaryOp::Sub: in.op = IrOp::Sub; break;
+                    case BinaryOp::Mul: in.op = IrOp::Mul; break;
+                    case BinaryOp::Div: in.op = IrOp::Div; break;
+                    default:
+                        in.op = IrOp::Cmp;
+                        in.imm = (int32_t)relation_of(bin->op);
+                        break;
+                }
+                in.a = lower(bin->lhs);
+                in.b = lower(bin->rhs);
+                in.dst = function.new_value();
+                in.line = bin->line;
+                in.column = bin->column;
+                emit(in);
+                return in.dst;
+            }
+            case ExprKind::Call: {
+                auto* call = static_cast<const CallExpr*>(expr);
+                size_t outer = arguments.size();
+                for (uint32_t i = 0; i < call->count; ++i) arguments.push_back(lower(call->arguments[i]));
+                for (uint32_t i = 0; i < call->count; ++i) {
+                    IrInstr arg{IrOp::Arg};
+                    arg.a = arguments[outer + i];
+                    arg.imm = (int32_t)i;
+                    emit(arg);
+                }
+                arguments.resize(outer);
+                IrInstr in{IrOp::Call};
+                in.type = functions[call->symbol]->type;
+                in.dst = function.new_value();
+                in.imm = (int32_t)call->count;
+                in.text = call->name;
+                emit(in);
+                return in.dst;
+            }
+        }
+        return ir_none;
+    }
+
+    uint32_t narrowed(uint32_t value, ValueType type) {
+        if (type != ValueType::Char && type != ValueType::Short) return value;
+        IrInstr in{IrOp::Narrow};
+        in.type = type;
+        in.a = value;
+        in.dst = function.new_value();
+        emit(in);
+        return in.dst;
+    }
+
+    void declare(const DeclarationStmt* decl) {
+        is_declared[decl->symbol] = true;
+        function.names[decl->symbol] = decl->name;
+        function.types[decl->symbol] = decl->type;
+        function.declared.push_back(decl->symbol);
+        if (depth != 0) nested.push_back(decl->symbol);
+    }
+
+    void already_declared(std::string_view name) {
+        std::string text = "Error: Variable '";
+        text.append(name);
+        text.append("' already declared.");
+        note(text);
+    }
+
+    // Zero for the variables declared inside an if or while, at index top of the code
+    void initialise_nested(size_t top) {
+        if (nested.empty()) return;
+        std::vector<IrInstr> body(function.code.begin() + top, function.code.end());
+        function.code.resize(top);
+        for (uint32_t symbol : nested) store(symbol, constant(0));
+        function.code.insert(function.code.end(), body.begin(), body.end());
+    }
+
+    void lower(const Stmt* stmt) {
+        switch (stmt->kind) {
+            case StmtKind::Declaration: {
+                auto* decl = static_cast<const DeclarationStmt*>(stmt);
+                if (is_declared[decl->symbol]) {
+                    already_declared(decl->name);
+                    return;
+                }
+                declare(decl);
+                if (decl->init == nullptr) {
+                    store(decl->symbol, constant(0));  // declarations are zero initialised
+                } else if (check_variables(decl->init)) {
+                    store(decl->symbol, lower(decl->init));
+                }
+                break;
+            }
+            case StmtKind::Assignment: {
+                auto* assign = static_cast<const AssignmentStmt*>(stmt);
+                if (!is_declared[assign->symbol]) {
+                    not_declared(assign->name);
+                    return;
+                }
+                if (trace != nullptr && assign->value->kind != ExprKind::Constant) {
+                    *trace << "Infix: ";
+                    print_infix(*trace, assign->value);
+                    *trace << '\n';
+                    *trace << "Postfix: ";
+                    print_postfix(*trace, assign->value);
+                    *trace << '\n';
+                }
+                if (check_variables(assign->value)) store(assign->symbol, lower(assign->value));
+                break;
+            }
+            case StmtKind::Return: {
+                const Expr* value = static_cast<const ReturnStmt*>(stmt)->value;
+                if (value != nullptr && !check_variables(value)) return;
+                uint32_t returned = value != nullptr ? lower(value) : constant(0);
+                if (result != ir_none) {
+                    store(result, returned);
+                    break;
+                }
+                IrInstr in{IrOp::Return};
+                in.a = definition != nullptr ? narrowed(returned, definition->type) : returned;
+                emit(in);
+                if (definition != nullptr) {
+                    if (exit == ir_none) exit = function.new_label();
+                    jump(exit);
+                }
+                break;
+            }
+            case StmtKind::Error: {
+                std::string text = "Error: ";
+                text.append(static_cast<const ErrorStmt*>(stmt)->message);
+                note(text);
+                break;
+            }
+            case StmtKind::If: {
+                auto* branch_stmt = static_cast<const IfStmt*>(stmt);
+                uint32_t otherwise = function.new_label();
+                if (check_variables(branch_stmt->condition)) {
+                    branch(branch_stmt->condition, false, otherwise);
+                } else {
+                    jump(otherwise);
+                }
+                ++depth;
+                lower(branch_stmt->then_branch);
+                if (branch_stmt->else_branch != nullptr) {
+                    uint32_t end = function.new_label();
+                    jump(end);
+                    label(otherwise);
+                    lower(branch_stmt->else_branch);
+                    label(end);
+                } else {
+                    label(otherwise);
+                }
+                --depth;
+                break;
+            }
+            case StmtKind::While: {
+                auto* loop = static_cast<const WhileStmt*>(stmt);
+                bool valid = check_variables(loop->condition);
+                uint32_t body = function.new_label();
+                uint32_t test = function.new_label();
+                jump(test);
+                label(body);
+                ++depth;
+                lower(loop->body);
+                --depth;
+                label(test);
+                if (valid) branch(loop->condition, true, body);
+                break;
+            }
+            case StmtKind::Block: {
+                auto* block = static_cast<const BlockStmt*>(stmt);
+                for (uint32_t i = 0; i < block->count; ++i) lower(block->statements[i]);
+                break;
+            }
+            case StmtKind::Function: {
+                // Lowered on their own, main only reports the definitions that do not count
+                auto* defined = static_cast<const FunctionStmt*>(stmt);
+                std::string text = "Error: Function '";
+                text.append(defined->name);
+                if (defined->name == "main") {
+                    text.append("' cannot be defined, the top-level statements are main.");
+                    note(text);
+                } else if (functions[defined->symbol] != defined) {
+                    text.append("' already defined.");
+                    note(text);
+                }
+                break;
+            }
+        }
+    }
+
+public:
+    IrLowering(IrFunction& function, std::ostream* trace, const std::vector<const FunctionStmt*>& functions)
+        : function(function), trace(trace), functions(functions) {}
+
+    // main: the top-level statements
+    void run(const Program& program) {
+        is_declared.assign(program.symbols, false);
+        function.code.reserve(program.statements.size() * 4);
+        bool calls = false;
+        for (const FunctionStmt* defined : functions) calls |= defined != nullptr;
+        if (calls) {
+            result = program.symbols;
+            function.names.resize(result + 1);
+            function.types.resize(result + 1, ValueType::Int);
+            function.names[result] = "return";
+            function.declared.push_back(result);
+            store(result, constant(0));
+        }
+        for (const Stmt* stmt : program.statements) lower(stmt);
+        initialise_nested(calls ? 2 : 0);
+        if (calls) {
+            IrInstr in{IrOp::Return};
+            in.a = load(result);
+            emit(in);
+        }
+        function.rebuild();
+    }
+
+    // One function, its body and nothing else
+    void run(const Program& program, const FunctionStmt& defined) {
+        definition = &defined;
+        function.name = defined.name;
+        is_declared.assign(program.symbols, false);
+        for (uint32_t k = 0; k < defined.count; ++k) {
+            const DeclarationStmt* parameter = defined.parameters[k];
+            if (is_declared[parameter->symbol]) {
+                already_declared(parameter->name);
+                continue;
+            }
+            declare(parameter);
+            IrInstr in{IrOp::Param};
+            in.dst = function.new_value();
+            in.imm = (int32_t)k;
+            emit(in);
+            store(parameter->symbol, in.dst);
+        }
+        size_t top = function.code.size();
+        for (uint32_t i = 0; i < defined.body->count; ++i) lower(defined.body->statements[i]);
+        if (!function.code.empty() && function.code.back().op == IrOp::Jump && function.code.back().target == exit) {
+            function.code.pop_back();  // the last statement returns, it is at the end already
+        }
+        if (function.code.empty() || function.code.back().op != IrOp::Return) {
+            IrInstr in{IrOp::Return};
+            in.a = constant(0);
+            emit(in);
+        }
+        if (exit != ir_none) label(exit);
+        initialise_nested(top);
+        function.rebuild();
+    }
+};
+
+// The function each name calls, by symbol id: its first definition, nullptr for names no function
+// has. main is no function, the top-level statements are.
+inline std::vector<const FunctionStmt*> function_definitions(const Program& program) {
+    std::vector<const FunctionStmt*> functions(program.symbols, nullptr);
+    for (const Stmt* stmt : program.statements) {
+        if (stmt->kind != StmtKind::Function) continue;
+        auto* defined = static_cast<const FunctionStmt*>(stmt);
+        if (defined->name != "main" && functions[defined->symbol] == nullptr) functions[defined->symbol] = defined;
+    }
+    return functions;
+}
+
+#endif // LOWER_H
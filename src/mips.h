@@ -0,0 +1,30 @@
+#ifndef MIPS_H
+#define MIPS_H
+
+#include <cstdint>
+
+// MIPS32 general purpose registers, numbered as in the hardware encoding
+enum class Reg : uint8_t {
+    zero, at, v0, v1, a0, a1, a2, a3,
+    t0, t1, t2, t3, t4, t5, t6, t7,
+    s0, s1, s2, s3, s4, s5, s6, s7,
+    t8, t9, k0, k1, gp, sp, fp, ra,
+    none = 0xFF
+};
+
+inline const char* reg_name(Reg reg) {
+    static const char* const names[32] = {
+        "$zero", "$at", "$v0", "$v1", "$a0", "$a1", "$a2", "$a3",
+        "$t0", "$t1", "$t2", "$t3", "$t4", "$t5", "$t6", "$t7",
+        "$s0", "$s1", "$s2", "$s3", "$s4", "$s5", "$s6", "$s7",
+        "$t8", "$t9", "$k0", "$k1", "$gp", "$sp", "$fp", "$ra",
+    };
+    return (uint8_t)reg < 32 ? names[(uint8_t)reg] : "$?";
+}
+
+// Callee-saved registers must be preserved for whoever called us
+inline bool is_callee_saved(Reg reg) {
+    return reg >= Reg::s0 && reg <= Reg::s7;
+}
+
+#endif // MIPS_H
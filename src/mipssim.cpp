@@ -0,0 +1,87 @@
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "elf.h"
+#include "encode.h"
+#include "io.h"
+#include "simulator.h"
+
+// Runs an output.s (or the ELF object compilerlab1 -c writes) and reports what it printed together with instruction, memory access and
+// estimated cycle counts, e.g. to compare the code of two optimisation settings.
+int main(int argc, char* argv[]) {
+    const char* usage = " <output.s|output.o|-> [--quiet] [--max-instructions <n>]";
+    std::string input_filename;
+    bool quiet = false;  // only the printed result
+    uint64_t limit = 0;  // instructions before giving up, 0 for the simulator's default
+
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--quiet") == 0 || std::strcmp(argv[i], "-q") == 0) {
+            quiet = true;
+        } else if (std::strcmp(argv[i], "--max-instructions") == 0 && i + 1 < argc) {
+            limit = std::strtoull(argv[++i], nullptr, 10);
+        } else if (argv[i][0] == '-' && argv[i][1] != '\0') {
+            std::cerr << "Error: Invalid optional argument '" << argv[i] << "'." << std::endl;
+            std::cerr << "Usage: " << argv[0] << usage << std::endl;
+            return 1;
+        } else if (input_filename.empty()) {
+            input_filename = argv[i];
+        } else {
+            std::cerr << "Usage: " << argv[0] << usage << std::endl;
+            return 1;
+        }
+    }
+    if (input_filename.empty()) {
+        std::cerr << "Usage: " << argv[0] << usage << std::endl;
+        return 1;
+    }
+
+    MappedFile input_file;
+    if (!input_file.open(input_filename)) {
+        std::cerr << "Error: Could not open file.\n";
+        return 1;
+    }
+
+    // An object is decoded back into the instructions it was encoded from, errors point at byte offsets
+    Assembler assembler;
+    MachineCode machine_code;
+    std::vector<uint32_t> offsets;
+    bool object = input_file.contents().substr(0, 4) == "\x7f" "ELF";
+    if (object) {
+        if (!read_elf_object(input_file.contents(), machine_code) ||
+            !decode_machine_code(machine_code, assembler.program, offsets)) {
+            std::cerr << input_filename << ": Error: " << machine_code.error << "\n";
+            return 1;
+        }
+    } else if (!assembler.run(input_file.contents())) {
+        std::cerr << input_filename << ":" << assembler.error.line << ": Error: " << assembler.error.message << "\n";
+        return 1;
+    }
+
+    Simulator simulator;
+    if (limit != 0) simulator.instruction_limit = limit;
+    if (!simulator.run(assembler.program)) {
+        if (object) {
+            std::cerr << input_filename << ":0x" << std::hex << offsets[simulator.error_index] << std::dec;
+        } else {
+            std::cerr << input_filename << ":" << assembler.lines[simulator.error_index];
+        }
+        std::cerr << ": Runtime error: " << simulator.error << "\n";
+        return 1;
+    }
+
+    // Code compiled without --debug has no print/exit epilogue, its result is left in $v0
+    std::string result = simulator.exited ? simulator.output : std::to_string(simulator.reg(Reg::v0));
+    if (quiet) {
+        std::cout << result << "\n";
+        return 0;
+    }
+    const SimulationStats& stats = simulator.stats;
+    std::cout << (simulator.exited ? "output: " : "result ($v0): ") << result << "\n";
+    std::cout << "instructions: " << stats.instructions << "\n";
+    std::cout << "loads: " << stats.loads << "\n";
+    std::cout << "stores: " << stats.stores << "\n";
+    std::cout << "cycles: " << stats.cycles << " (" << stats.stalls << " stall cycles)\n";
+    return 0;
+}
@@ -0,0 +1,583 @@
+#ifndef PARSER_H
+#define PARSER_H
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "arena.h"
+#include "ast.h"
+#include "intern.h"
+#include "lexer.h"
+#include "spsc.h"
+#include "timing.h"
+#include "workpool.h"
+
+// Recursive-descent parser building the AST straight from the token stream.
+//
+//   program    := { function | statement }
+//   function   := type IDENT '(' [ type IDENT { ',' type IDENT } ] ')' '{' { statement } '}'
+//   statement  := type IDENT [ '=' expr ] ';'
+//               | IDENT '=' expr ';'
+//               | 'return' [ expr ] ';'
+//               | 'if' '(' expr ')' statement [ 'else' statement ]
+//               | 'while' '(' expr ')' statement
+//               | '{' { statement } '}'
+//   expr       := relation { ('==' | '!=') relation }
+//   relation   := sum { ('<' | '<=' | '>' | '>=') sum }
+//   sum        := term { ('+' | '-') term }
+//   term       := factor { ('*' | '/') factor }
+//   factor     := NUMBER | IDENT | IDENT '(' [ expr { ',' expr } ] ')' | '(' expr ')'
+//   type       := 'char' | 'short' | 'int' | 'long' [ 'long' ]
+//
+// A lone 'long' is 32 bits wide as in the MIPS O32 ABI, so it declares an int. An 'else' belongs to
+// the nearest 'if'. Functions are only defined at the top level, inside a statement the '(' after
+// the name is a syntax error.
+//
+// A syntax error turns the statement into an ErrorStmt and parsing resumes after the next ';', or
+// in front of the next '}' so the enclosing block still ends there. Statements and expressions
+// nest at most max_nesting levels deep, counting every operator of a chain like a + a + a as one:
+// the parser and the passes after it walk the tree recursively.
+class Parser {
+public:
+    static constexpr uint32_t max_nesting = 1000;
+
+private:
+    const Token* tok;      // current token, the array is terminated by an End token
+    std::string_view src;
+    Arena& arena;
+    bool copy_text;        // copy names into the arena when the source buffer dies before the AST
+    bool control_flow = false;  // parsed an if, while, block or comparison
+    std::vector<Stmt*> block;   // statements of the blocks being parsed, innermost last
+    std::vector<Expr*> arguments;  // of the calls being parsed, innermost last
+    uint32_t open_blocks = 0;
+    uint32_t nesting = 0;       // statements being parsed, 1 at the top level
+    uint32_t open_parens = 0;   // parenthesised expressions and calls being parsed
+    uint32_t height = 0;        // levels of the expression parsed last, 1 for an operand
+
+    std::string_view text(const Token& t) const {
+        std::string_view s = t.text(src);
+        return copy_text ? arena.copy(s) : s;
+    }
+
+    [[noreturn]] void fail(const Token& at, const std::string& what) const {
+        std::string found = at.kind == TokenKind::End ? std::string(token_kind_name(at.kind))
+                                                      : "'" + std::string(at.text(src)) + "'";
+        throw std::runtime_error("Syntax error at line " + std::to_string(at.line) + ", column " +
+                                 std::to_string(at.column) + ": expected " + what + " but found " + found);
+    }
+
+    std::string too_deep_message(const Token& at) const {
+        return "Syntax error at line " + std::to_string(at.line) + ", column " + std::to_string(at.column) +
+               ": nesting deeper than " + std::to_string(max_nesting) + " levels";
+    }
+
+    [[noreturn]] void too_deep(const Token& at) const { throw std::runtime_error(too_deep_message(at)); }
+
+    // Skips a statement nesting too deep as a whole, up to the ';' or '}' ending it and any 'else'
+    // after that, so the error is reported once
+    Stmt* skip_statement() {
+        const Token& first = *tok;
+        uint32_t depth = 0;
+        while (tok->kind != TokenKind::End && !(tok->kind == TokenKind::RBrace && depth == 0)) {
+            TokenKind kind = (tok++)->kind;
+            if (kind == TokenKind::LBrace) ++depth;
+            if (kind == TokenKind::RBrace) --depth;
+            bool ends = depth == 0 && (kind == TokenKind::Semicolon || kind == TokenKind::RBrace);
+            if (ends && tok->kind != TokenKind::KwElse) break;
+        }
+        return arena.make<ErrorStmt>(arena.copy(too_deep_message(first)), first.line);
+    }
+
+    // An operator joining the expression parsed before the right operand, height now holds the right one's
+    void join(const Token& op, uint32_t lhs_height) {
+        height = std::max(height, lhs_height) + 1;
+        if (height > max_nesting) too_deep(op);
+    }
+
+    const Token& expect(TokenKind kind) {
+        if (tok->kind != kind) fail(*tok, token_kind_name(kind));
+        return *tok++;
+    }
+
+    int32_t parse_number(const Token& t) const {
+        int64_t value = 0;
+        for (char c : t.text(src)) {
+            value = value * 10 + (c - '0');
+            if (value > INT32_MAX) {
+                throw std::runtime_error("Constant '" + std::string(t.text(src)) + "' at line " +
+                                         std::to_string(t.line) + " is out of range");
+            }
+        }
+        return (int32_t)value;
+    }
+
+    Expr* parse_factor() {
+        const Token& t = *tok;
+        switch (t.kind) {
+            case TokenKind::Number:
+                ++tok;
+                height = 1;
+                return arena.make<ConstantExpr>(parse_number(t), t.line, t.column);
+            case TokenKind::Identifier:
+                ++tok;
+                if (tok->kind == TokenKind::LParen) return parse_call(t);
+                height = 1;
+                return arena.make<VariableExpr>(text(t), t.symbol, t.line, t.column);
+            case TokenKind::LParen: {
+                ++tok;
+                if (++open_parens > max_nesting) too_deep(t);
+                Expr* inner = parse_expr();
+                expect(TokenKind::RParen);
+                --open_parens;
+                return inner;
+            }
+            default:
+                fail(t, "an operand");
+        }
+    }
+
+    Expr* parse_call(const Token& name) {
+        ++tok;
+        control_flow = true;
+        if (++open_parens > max_nesting) too_deep(name);
+        size_t outer = arguments.size();
+        uint32_t highest = 0;
+        if (tok->kind != TokenKind::RParen) {
+            arguments.push_back(parse_expr());
+            highest = height;
+            while (tok->kind == TokenKind::Comma) {
+                ++tok;
+                arguments.push_back(parse_expr());
+                highest = std::max(highest, height);
+            }
+        }
+        expect(TokenKind::RParen);
+        --open_parens;
+        height = highest + 1;
+        if (height > max_nesting) too_deep(name);
+        uint32_t count = (uint32_t)(arguments.size() - outer);
+        auto** list = static_cast<Expr**>(arena.allocate(sizeof(Expr*) * (count + 1), alignof(Expr*)));
+        std::copy(arguments.begin() + outer, arguments.end(), list);
+        arguments.resize(outer);
+        return arena.make<CallExpr>(text(name), name.symbol, list, count, name.line, name.column);
+    }
+
+    Expr* parse_term() {
+        Expr* lhs = parse_factor();
+        while (tok->kind == TokenKind::Star || tok->kind == TokenKind::Slash) {
+            const Token& op = *tok++;
+            uint32_t lhs_height = height;
+            Expr* rhs = parse_factor();
+            join(op, lhs_height);
+            lhs = arena.make<BinaryExpr>(op.kind == TokenKind::Star ? BinaryOp::Mul : BinaryOp::Div,
+                                         lhs, rhs, op.line, op.column);
+        }
+        return lhs;
+    }
+
+    Expr* parse_sum() {
+        Expr* lhs = parse_term();
+        while (tok->kind == TokenKind::Plus || tok->kind == TokenKind::Minus) {
+            const Token& op = *tok++;
+            uint32_t lhs_height = height;
+            Expr* rhs = parse_term();
+            join(op, lhs_height);
+            lhs = arena.make<BinaryExpr>(op.kind == TokenKind::Plus ? BinaryOp::Add : BinaryOp::Sub,
+                                         lhs, rhs, op.line, op.column);
+        }
+        return lhs;
+    }
+
+    Expr* parse_relation() {
+        Expr* lhs = parse_sum();
+        for (;;) {
+            BinaryOp op;
+            switch (tok->kind) {
+                case TokenKind::Less: op = BinaryOp::Lt; break;
+                case TokenKind::LessEqual: op = BinaryOp::Le; break;
+                case TokenKind::Greater: op = BinaryOp::Gt; break;
+                case TokenKind::GreaterEqual: op = BinaryOp::Ge; break;
+                default: return lhs;
+            }
+            const Token& at = *tok++;
+            uint32_t lhs_height = height;
+            Expr* rhs = parse_sum();
+            join(at, lhs_height);
+            lhs = arena.make<BinaryExpr>(op, lhs, rhs, at.line, at.column);
+            control_flow = true;
+        }
+    }
+
+    Expr* parse_expr() {
+        Expr* lhs = parse_relation();
+        while (tok->kind == TokenKind::Equal || tok->kind == TokenKind::NotEqual) {
+            const Token& op = *tok++;
+            uint32_t lhs_height = height;
+            Expr* rhs = parse_relation();
+            join(op, lhs_height);
+            lhs = arena.make<BinaryExpr>(op.kind == TokenKind::Equal ? BinaryOp::Eq : BinaryOp::Ne,
+                                         lhs, rhs, op.line, op.column);
+            control_flow = true;
+        }
+        return lhs;
+    }
+
+    Expr* parse_condition() {
+        expect(TokenKind::LParen);
+        Expr* condition = parse_expr();
+        expect(TokenKind::RParen);
+        return condition;
+    }
+
+    // After the name: the parameter list and the body
+    Stmt* parse_function(ValueType type, const Token& name, uint32_t line) {
+        ++tok;
+        control_flow = true;
+        std::vector<DeclarationStmt*> parameters;
+        if (tok->kind != TokenKind::RParen) {
+            for (;;) {
+                const Token& at = *tok;
+                if (at.kind != TokenKind::KwChar && at.kind != TokenKind::KwShort && at.kind != TokenKind::KwInt &&
+                    at.kind != TokenKind::KwLong) {
+                    fail(at, "a parameter type");
+                }
+                ValueType parameter_type = parse_type();
+                const Token& ident = expect(TokenKind::Identifier);
+                parameters.push_back(arena.make<DeclarationStmt>(text(ident), ident.symbol, parameter_type, nullptr, at.line));
+                if (tok->kind != TokenKind::Comma) break;
+                ++tok;
+            }
+        }
+        expect(TokenKind::RParen);
+        if (tok->kind != TokenKind::LBrace) fail(*tok, token_kind_name(TokenKind::LBrace));
+        Stmt* body = parse_statement();
+        auto** list = static_cast<DeclarationStmt**>(
+            arena.allocate(sizeof(DeclarationStmt*) * (parameters.size() + 1), alignof(DeclarationStmt*)));
+        std::copy(parameters.begin(), parameters.end(), list);
+        // A body whose closing brace is missing comes back as an ErrorStmt, the function is empty then
+        auto* block = body->kind == StmtKind::Block ? static_cast<BlockStmt*>(body)
+                                                    : arena.make<BlockStmt>(nullptr, 0, body->line);
+        return arena.make<FunctionStmt>(text(name), name.symbol, type, list, (uint32_t)parameters.size(), block, line);
+    }
+
+    ValueType parse_type() {
+        switch ((tok++)->kind) {
+            case TokenKind::KwChar: return ValueType::Char;
+            case TokenKind::KwShort: return ValueType::Short;
+            case TokenKind::KwLong:
+                if (tok->kind != TokenKind::KwLong) return ValueType::Int;
+                ++tok;
+                return ValueType::LongLong;
+            default: return ValueType::Int;
+        }
+    }
+
+    Stmt* parse_statement_or_throw() {
+        const Token& first = *tok;
+        if (nesting > max_nesting) return skip_statement();
+        switch (first.kind) {
+            case TokenKind::KwChar:
+            case TokenKind::KwShort:
+            case TokenKind::KwInt:
+            case TokenKind::KwLong: {
+                ValueType type = parse_type();
+                const Token& ident = expect(TokenKind::Identifier);
+                if (tok->kind == TokenKind::LParen && nesting == 1) return parse_function(type, ident, first.line);
+                Expr* init = nullptr;
+                if (tok->kind == TokenKind::Assign) {
+                    ++tok;
+                    init = parse_expr();
+                }
+                expect(TokenKind::Semicolon);
+                return arena.make<DeclarationStmt>(text(ident), ident.symbol, type, init, first.line);
+            }
+            case TokenKind::KwReturn: {
+                ++tok;
+                Expr* value = tok->kind == TokenKind::Semicolon ? nullptr : parse_expr();
+                expect(TokenKind::Semicolon);
+                return arena.make<ReturnStmt>(value, first.line);
+            }
+            case TokenKind::Identifier: {
+                ++tok;
+                expect(TokenKind::Assign);
+                Expr* value = parse_expr();
+                expect(TokenKind::Semicolon);
+                return arena.make<AssignmentStmt>(text(first), first.symbol, value, first.line);
+            }
+            case TokenKind::KwIf: {
+                ++tok;
+                control_flow = true;
+                Expr* condition = parse_condition();
+                Stmt* then_branch = parse_statement();
+                Stmt* else_branch = nullptr;
+                if (tok->kind == TokenKind::KwElse) {
+                    ++tok;
+                    else_branch = parse_statement();
+                }
+                return arena.make<IfStmt>(condition, then_branch, else_branch, first.line);
+            }
+            case TokenKind::KwWhile: {
+                ++tok;
+                control_flow = true;
+                Expr* condition = parse_condition();
+                return arena.make<WhileStmt>(condition, parse_statement(), first.line);
+            }
+            case TokenKind::LBrace: {
+                ++tok;
+                control_flow = true;
+                size_t outer = block.size();
+                ++open_blocks;
+                while (tok->kind != TokenKind::RBrace && tok->kind != TokenKind::End) {
+                    Stmt* stmt = parse_statement();
+                    block.push_back(stmt);
+                }
+                --open_blocks;
+                expect(TokenKind::RBrace);
+                uint32_t count = (uint32_t)(block.size() - outer);
+                auto** statements = static_cast<Stmt**>(arena.allocate(sizeof(Stmt*) * (count + 1), alignof(Stmt*)));
+                std::copy(block.begin() + outer, block.end(), statements);
+                block.resize(outer);
+                return arena.make<BlockStmt>(statements, count, first.line);
+            }
+            default:
+                fail(first, "a statement");
+        }
+    }
+
+public:
+    Parser(const Token* tokens, std::string_view source, Arena& arena, bool copy_text = false)
+        : tok(tokens), src(source), arena(arena), copy_text(copy_text) {}
+
+    bool at_end() const { return tok->kind == TokenKind::End; }
+
+    // Parses the next statement, a syntax error is returned as an ErrorStmt
+    Stmt* parse_statement() {
+        const Token* first = tok;
+        size_t statements = block.size();
+        size_t operands = arguments.size();
+        uint32_t depth = open_blocks;
+        uint32_t parens = open_parens;
+        uint32_t outer = nesting++;
+        try {
+            Stmt* stmt = parse_statement_or_throw();
+            nesting = outer;
+            return stmt;
+        } catch (const std::runtime_error& e) {
+            // Resynchronise after the next ';' or in front of the next '}'. Outside of any block
+            // a '}' closes nothing and is skipped.
+            block.resize(statements);
+            arguments.resize(operands);
+            open_blocks = depth;
+            open_parens = parens;
+            nesting = outer;
+            while (tok->kind != TokenKind::End && tok->kind != TokenKind::Semicolon && tok->kind != TokenKind::RBrace) ++tok;
+            if (tok->kind == TokenKind::Semicolon || (tok == first && tok->kind == TokenKind::RBrace && open_blocks == 0)) ++tok;
+            return arena.make<ErrorStmt>(arena.copy(e.what()), first->line);
+        }
+    }
+
+    void parse_program(Program& program) {
+        while (!at_end()) {
+            program.statements.push_back(parse_statement());
+        }
+        program.control_flow |= control_flow;
+    }
+};
+
+// Lexing and parsing of --pipeline: a lexer thread cuts the token stream into batches, the calling
+// thread parses each batch as soon as it arrives. A batch ends after a ';' outside of any braces
+// that no 'else' follows (with an End token appended). No statement reaches past such a ';', a syntax
+// error resumes there too, so the batches parse exactly like the whole stream. Parsed batches go back to the lexer: the tokens take
+// a few batches of memory whatever the size of the input. Returns the number of tokens.
+inline size_t parse_pipelined(std::string_view source, Interner& interner, Arena& arena, Program& program) {
+    struct TokenBatch {
+        std::vector<Token> tokens;
+        bool last = false;  // ends with the End token of the input
+    };
+    constexpr size_t batch_tokens = 16 * 1024;
+    constexpr size_t batches = 4;
+    SpscQueue<TokenBatch, batches> lexed;
+    SpscQueue<TokenBatch, batches> parsed;  // empty batches for the lexer
+    for (size_t i = 0; i < batches; ++i) {
+        TokenBatch batch;
+        batch.tokens.reserve(batch_tokens + 64);
+        parsed.push(std::move(batch));
+    }
+
+    HeapAccount* account = heap_account;
+    std::thread lexer_thread([&] {
+        HeapCharge charge(account);
+        Lexer lexer(source, 1, &interner);
+        uint32_t depth = 0;  // '{' not closed yet, a '}' closing nothing is skipped as the parser does
+        Token next;
+        bool held = false;   // next is lexed already
+        for (;;) {
+            TokenBatch batch = parsed.pop();
+            batch.tokens.clear();
+            for (;;) {
+                Token tok = held ? next : lexer.next();
+                held = false;
+                batch.tokens.push_back(tok);
+                if (tok.kind == TokenKind::End) {
+                    batch.last = true;
+                    break;
+                }
+                if (tok.kind == TokenKind::LBrace) ++depth;
+                if (tok.kind == TokenKind::RBrace && depth > 0) --depth;
+                if (tok.kind == TokenKind::Semicolon && depth == 0 && batch.tokens.size() >= batch_tokens) {
+                    next = lexer.next();
+                    held = true;
+                    if (next.kind == TokenKind::KwElse) continue;
+                    tok.kind = TokenKind::End;
+                    batch.tokens.push_back(tok);
+                    break;
+                }
+            }
+            bool last = batch.last;
+            lexed.push(std::move(batch));
+            if (last) return;
+        }
+    });
+
+    size_t tokens = 0;
+    bool done = false;
+    try {
+        while (!done) {
+            TokenBatch batch = lexed.pop();
+            Parser(batch.tokens.data(), source, arena).parse_program(program);
+            done = batch.last;
+            tokens += batch.tokens.size() - (done ? 0 : 1);  // without the End appended to the batch
+            parsed.push(std::move(batch));
+        }
+    } catch (...) {
+        // The lexer runs to the end of the input before the thread can be joined
+        while (!done) {
+            TokenBatch batch = lexed.pop();
+            done = batch.last;
+            parsed.push(std::move(batch));
+        }
+        lexer_thread.join();
+        throw;
+    }
+    lexer_thread.join();
+    return tokens;
+}
+
+// Lexing and parsing of --parse-threads: the source is split into one chunk per thread after a ';'
+// chosen as for the batches above, so every chunk parses exactly like the whole stream would. The chunks are
+// lexed in parallel, each into an interner of its own; a sequential merge then interns the chunks'
+// names in chunk order, which numbers them in order of first appearance as a single lexer would, and
+// counts the lines in front of every chunk. The parallel parse renumbers each chunk's tokens, then
+// builds its statements, which are appended in order. Returns the number of tokens.
+inline size_t parse_parallel(std::string_view source, unsigned threads, Interner& interner, Arena& arena,
+                             Program& program) {
+    constexpr size_t min_chunk = 64 * 1024;  // bytes, smaller inputs are not worth a thread
+    struct Chunk {
+        size_t begin = 0;
+        size_t end = 0;
+        size_t line_start = 0;         // offset of the line begin is on
+        uint32_t lines = 0;            // newlines in the chunk
+        Interner names;                // chunk-local ids of the tokens
+        std::vector<uint32_t> symbols; // by local id, the merged id
+        std::vector<Token> tokens;
+        Arena arena;
+        Program program;
+    };
+
+    // True when the next token after offset at is an 'else'
+    auto else_follows = [source](size_t at) {
+        using namespace lexer_detail;
+        while (at < source.size() && (char_table.cls[(unsigned char)source[at]] == CC_SPACE ||
+                                      char_table.cls[(unsigned char)source[at]] == CC_NEWLINE)) {
+            ++at;
+        }
+        if (source.compare(at, 4, "else") != 0) return false;
+        return at + 4 == source.size() || (char_table.cls[(unsigned char)source[at + 4]] != CC_ALPHA &&
+                                           char_table.cls[(unsigned char)source[at + 4]] != CC_DIGIT);
+    };
+
+    if (threads == 0) threads = 1;
+    std::vector<std::unique_ptr<Chunk>> chunks;
+    size_t begin = 0;
+    size_t scan = 0;     // braces are counted up to here, every byte of them is a token
+    uint32_t depth = 0;
+    for (unsigned t = 1; t <= threads && begin < source.size(); ++t) {
+        size_t end = source.size();
+        if (t < threads) {
+            size_t target = source.size() / threads * t;
+            if (target < begin + min_chunk) target = begin + min_chunk;
+            for (; scan < source.size(); ++scan) {
+                char c = source[scan];
+                if (c == '{') {
+                    ++depth;
+                } else if (c == '}') {
+                    if (depth > 0) --depth;
+                } else if (c == ';' && depth == 0 && scan >= target && !else_follows(scan + 1)) {
+                    end = ++scan;
+                    break;
+                }
+            }
+        }
+        auto chunk = std::make_unique<Chunk>();
+        chunk->begin = begin;
+        chunk->end = end;
+        size_t newline = begin == 0 ? std::string_view::npos : source.rfind('\n', begin - 1);
+        chunk->line_start = newline == std::string_view::npos ? 0 : newline + 1;
+        chunks.push_back(std::move(chunk));
+        begin = end;
+    }
+    if (chunks.empty()) chunks.push_back(std::make_unique<Chunk>());  // empty input: just the End token
+
+    HeapAccount* account = heap_account;
+    WorkStealingPool pool;
+    pool.run(chunks.size(), threads, [&](size_t i) {
+        HeapCharge charge(account);
+        Chunk& chunk = *chunks[i];
+        Lexer lexer(source, chunk.begin, chunk.end, 0, chunk.line_start, &chunk.names);
+        chunk.tokens.reserve((chunk.end - chunk.begin) / 4 + 1);
+        for (;;) {
+            Token tok = lexer.next();
+            chunk.tokens.push_back(tok);
+            if (tok.kind == TokenKind::End) break;
+        }
+        chunk.lines = lexer.current_line();
+    });
+
+    std::vector<uint32_t> first_line(chunks.size());
+    uint32_t line = 1;
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        Chunk& chunk = *chunks[i];
+        chunk.symbols.resize(chunk.names.size());
+        for (uint32_t id = 0; id < chunk.names.size(); ++id) chunk.symbols[id] = interner.intern(chunk.names.name(id));
+        first_line[i] = line;
+        line += chunk.lines;
+    }
+
+    pool.run(chunks.size(), threads, [&](size_t i) {
+        HeapCharge charge(account);
+        Chunk& chunk = *chunks[i];
+        for (Token& tok : chunk.tokens) {
+            tok.line += first_line[i];
+            if (tok.symbol != Interner::none) tok.symbol = chunk.symbols[tok.symbol];
+        }
+        Parser(chunk.tokens.data(), source, chunk.arena).parse_program(chunk.program);
+    });
+
+    size_t tokens = 1;  // the End token of the input
+    for (std::unique_ptr<Chunk>& chunk : chunks) {
+        tokens += chunk->tokens.size() - 1;
+        program.statements.insert(program.statements.end(), chunk->program.statements.begin(),
+                                  chunk->program.statements.end());
+        program.control_flow |= chunk->program.control_flow;
+        arena.adopt(chunk->arena);
+    }
+    return tokens;
+}
+
+#endif // PARSER_H
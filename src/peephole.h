@@ -0,0 +1,229 @@
+#ifndef PEEPHOLE_H
+#define PEEPHOLE_H
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#include "instr.h"
+
+// Peephole optimizer over the instruction list. Every rule looks at an instruction and the next
+// real one (comments are skipped, labels end the window) and counts its hits so the statistics
+// show which rules pay off. Rules can be switched off one by one.
+enum class PeepholeRule : uint8_t {
+    SelfMove,       // move r, r / addiu r, r, 0 / shift by 0 onto itself: dropped
+    StoreLoad,      // sw a, x ; lw b, x          -> sw a, x ; move b, a
+    LoadStore,      // lw a, x ; sw a, x          -> lw a, x
+    StoreStore,     // sw a, x ; sw b, x          -> sw b, x
+    ZeroConstant,   // li r, 0 ; op .. r ..       -> op .. $zero ..   (r dead afterwards)
+    ImmediateOperand,  // li r, c ; addu d, s, r  -> addiu d, s, c   (r dead afterwards)
+    CopyForward,    // move t, s ; op .. t ..     -> op .. s ..       (t dead afterwards)
+    MoveCoalesce,   // op t, .. ; move d, t       -> op d, ..         (t dead afterwards)
+    Count
+};
+
+inline const char* peephole_rule_name(PeepholeRule rule) {
+    switch (rule) {
+        case PeepholeRule::SelfMove: return "self-move";
+        case PeepholeRule::StoreLoad: return "store-load";
+        case PeepholeRule::LoadStore: return "load-store";
+        case PeepholeRule::StoreStore: return "store-store";
+        case PeepholeRule::ZeroConstant: return "zero-constant";
+        case PeepholeRule::ImmediateOperand: return "immediate-operand";
+        case PeepholeRule::CopyForward: return "copy-forward";
+        case PeepholeRule::MoveCoalesce: return "move-coalesce";
+        default: return "?";
+    }
+}
+
+constexpr int peephole_rule_count = (int)PeepholeRule::Count;
+
+class PeepholeOptimizer {
+private:
+    static constexpr size_t liveness_window = 64;  // instructions scanned before assuming "live"
+
+    std::vector<Instr>* code = nullptr;
+    uint32_t enabled_mask;
+    Reg live_out;  // register still read after the last instruction (the return value)
+
+    bool enabled(PeepholeRule rule) const { return enabled_mask >> (int)rule & 1; }
+
+    // Next real instruction after i, or code.size() when a label or the end comes first
+    size_t next(size_t i) const {
+        const std::vector<Instr>& c = *code;
+        for (++i; i < c.size(); ++i) {
+            if (c[i].op == Opcode::Label) return c.size();
+            if (c[i].op != Opcode::Comment && c[i].op != Opcode::Deleted) return i;
+        }
+        return c.size();
+    }
+
+    // True when reg's value after instruction i is never read. Conservative: anything unclear
+    // (labels, branches, the scan window running out, special registers) counts as live.
+    bool dead_after(size_t i, Reg reg) const {
+        if (reg == Reg::zero || reg == Reg::fp || reg == Reg::sp || reg == Reg::ra || reg == Reg::none) return false;
+        const std::vector<Instr>& c = *code;
+        if (is_branch(c[i].op)) return false;
+        size_t scanned = 0;
+        for (size_t j = i + 1; j < c.size(); ++j) {
+            const Instr& in = c[j];
+            if (in.op == Opcode::Label) return false;
+            if (in.op == Opcode::Comment || in.op == Opcode::Directive || in.op == Opcode::Deleted) continue;
+            if (in.reads(reg) || is_branch(in.op)) return false;
+            if (in.def() == reg) return true;
+            if (++scanned == liveness_window) return false;
+        }
+        return reg != live_out;
+    }
+
+    static bool same_slot(const Instr& a, const Instr& b) {
+        return a.rs == b.rs && a.imm == b.imm;
+    }
+
+    void hit(PeepholeRule rule) { ++hits[(int)rule]; }
+
+    void remove(size_t i) {
+        (*code)[i].op = Opcode::Deleted;
+        ++removed;
+    }
+
+    // True when reg is one of in's register operands (a syscall reads its registers implicitly)
+    static bool reads_operand(const Instr& in, Reg reg) {
+        return in.op != Opcode::Syscall && in.reads(reg);
+    }
+
+    // Replaces every read of from in in by to
+    static void substitute(Instr& in, Reg from, Reg to) {
+        if (in.rs == from) in.rs = to;
+        if (in.rt == from) in.rt = to;
+    }
+
+    bool apply(size_t i) {
+        std::vector<Instr>& c = *code;
+        Instr& in = c[i];
+        if (enabled(PeepholeRule::SelfMove) && in.def() == in.rs && in.def() != Reg::none &&
+            (in.op == Opcode::Move ||
+             ((in.op == Opcode::Addiu || in.op == Opcode::Sll || in.op == Opcode::Sra || in.op == Opcode::Srl) && in.imm == 0) ||
+             ((in.op == Opcode::Addu || in.op == Opcode::Add) && in.rt == Reg::zero))) {
+            hit(PeepholeRule::SelfMove);
+            remove(i);
+            return true;
+        }
+
+        size_t j = next(i);
+        if (j == c.size()) return false;
+        Instr& after = c[j];
+
+        if (in.op == Opcode::Sw) {
+            if (enabled(PeepholeRule::StoreLoad) && after.op == Opcode::Lw && same_slot(in, after) && in.rs != after.rd) {
+                hit(PeepholeRule::StoreLoad);
+                if (after.rd == in.rt) {
+                    remove(j);
+                } else {
+                    after = Instr{Opcode::Move, after.rd, in.rt, Reg::none, 0, after.note};
+                }
+                return true;
+            }
+            if (enabled(PeepholeRule::StoreStore) && after.op == Opcode::Sw && same_slot(in, after)) {
+                hit(PeepholeRule::StoreStore);
+                remove(i);
+                return true;
+            }
+        }
+
+        if (enabled(PeepholeRule::LoadStore) && in.op == Opcode::Lw && after.op == Opcode::Sw &&
+            same_slot(in, after) && after.rt == in.rd && in.rs != in.rd) {
+            hit(PeepholeRule::LoadStore);
+            remove(j);
+            return true;
+        }
+
+        if (in.op == Opcode::Li) {
+            Reg r = in.rd;
+            if (enabled(PeepholeRule::ZeroConstant) && in.imm == 0 && reads_operand(after, r) &&
+                (after.def() == r || dead_after(j, r))) {
+                hit(PeepholeRule::ZeroConstant);
+                substitute(after, r, Reg::zero);
+                remove(i);
+                return true;
+            }
+            if (enabled(PeepholeRule::ImmediateOperand) && fits_imm16(in.imm) && after.rs != after.rt &&
+                (after.op == Opcode::Addu || after.op == Opcode::Add ||
+                 ((after.op == Opcode::Subu || after.op == Opcode::Sub) && after.rt == r && in.imm != INT16_MIN)) &&
+                after.reads(r) && (after.def() == r || dead_after(j, r))) {
+                int32_t imm = after.op == Opcode::Subu || after.op == Opcode::Sub ? -in.imm : in.imm;
+                Reg other = after.rs == r ? after.rt : after.rs;
+                hit(PeepholeRule::ImmediateOperand);
+                after = Instr{Opcode::Addiu, after.rd, other, Reg::none, imm, after.note};
+                remove(i);
+                return true;
+            }
+        }
+
+        if (enabled(PeepholeRule::CopyForward) && in.op == Opcode::Move && in.rd != in.rs && reads_operand(after, in.rd) &&
+            (after.def() == in.rd || dead_after(j, in.rd))) {
+            hit(PeepholeRule::CopyForward);
+            substitute(after, in.rd, in.rs);
+            remove(i);
+            return true;
+        }
+
+        if (enabled(PeepholeRule::MoveCoalesce) && after.op == Opcode::Move && in.def() != Reg::none &&
+            after.rs == in.def() && after.rd != after.rs && dead_after(j, after.rs)) {
+            hit(PeepholeRule::MoveCoalesce);
+            in.rd = after.rd;
+            if (after.note.empty()) {
+                remove(j);
+            } else {
+                after = Instr{Opcode::Comment, Reg::none, Reg::none, Reg::none, 0, after.note};
+            }
+            return true;
+        }
+        return false;
+    }
+
+    static bool fits_imm16(int32_t value) { return value >= INT16_MIN && value <= INT16_MAX; }
+
+public:
+    uint64_t hits[peephole_rule_count] = {};
+    uint64_t removed = 0;  // instructions deleted
+
+    explicit PeepholeOptimizer(uint32_t enabled_mask = ~0u, Reg live_out = Reg::v0)
+        : enabled_mask(enabled_mask), live_out(live_out) {}
+
+    // Bit mask of the rules named in a comma separated list, -1 when a name is unknown
+    static int64_t parse_rules(std::string_view list) {
+        int64_t mask = 0;
+        while (!list.empty()) {
+            size_t comma = list.find(',');
+            std::string_view name = list.substr(0, comma);
+            list = comma == std::string_view::npos ? std::string_view() : list.substr(comma + 1);
+            int rule = 0;
+            while (rule < peephole_rule_count && name != peephole_rule_name((PeepholeRule)rule)) ++rule;
+            if (rule == peephole_rule_count) return -1;
+            mask |= int64_t(1) << rule;
+        }
+        return mask;
+    }
+
+    // Applies the rules until nothing changes (a rewrite often enables another), then compacts the list
+    void run(std::vector<Instr>& instructions) {
+        code = &instructions;
+        for (int pass = 0; pass < 4; ++pass) {
+            bool changed = false;
+            for (size_t i = 0; i < instructions.size(); ++i) {
+                if (instructions[i].op == Opcode::Deleted || is_pseudo(instructions[i].op)) continue;
+                changed |= apply(i);
+            }
+            if (!changed) break;
+        }
+        size_t kept = 0;
+        for (const Instr& in : instructions) {
+            if (in.op != Opcode::Deleted) instructions[kept++] = in;
+        }
+        instructions.resize(kept);
+        code = nullptr;
+    }
+};
+
+#endif // PEEPHOLE_H
@@ -0,0 +1,91 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <cstdint>
+#include <vector>
+
+#include "instr.h"
+
+// Timing of a simple in-order 5-stage pipeline with full forwarding: one instruction issues per
+// cycle, a consumer waits until its operands are ready, a taken branch costs a cycle, plus the
+// cycles to fill the pipeline. The simulator (simulator.h) counts its cycles with it and the
+// scheduler (scheduler.h) orders code for it.
+
+constexpr uint64_t pipeline_fill = 4;
+
+// Cycles after issue until the result of op can be used, for mult/div until hi/lo can be read.
+// A load's value comes one cycle after the next instruction.
+inline uint64_t result_latency(Opcode op) {
+    switch (op) {
+        case Opcode::Lb: case Opcode::Lh: case Opcode::Lw:
+            return 2;
+        case Opcode::Mul:
+            return 4;
+        case Opcode::Mult:
+            return 5;
+        case Opcode::Div:
+            return 35;
+        default:
+            return 1;
+    }
+}
+
+// Issue slots taken by in: li of a constant beyond 16 bits is lui + ori
+inline uint64_t issue_slots(const Instr& in) {
+    if (is_pseudo(in.op)) return 0;
+    return in.op == Opcode::Li && (in.imm < INT16_MIN || in.imm > 0xFFFF) ? 2 : 1;
+}
+
+inline bool reads_hilo(Opcode op) { return op == Opcode::Mflo || op == Opcode::Mfhi; }
+inline bool writes_hilo(Opcode op) { return op == Opcode::Mult || op == Opcode::Div; }
+
+class PipelineModel {
+private:
+    uint64_t ready[32] = {};  // cycle from which each register's new value can be used
+    uint64_t hilo_ready = 0;
+
+public:
+    uint64_t cycle = 0;   // issue cycle of the last instruction
+    uint64_t stalls = 0;  // cycles spent waiting for operands
+
+    // Issues in after its operands are ready, returns the stall cycles
+    uint64_t issue(const Instr& in) {
+        if (is_pseudo(in.op)) return 0;
+        uint64_t at = cycle + 1;
+        for (Reg reg : {in.rs, in.rt}) {
+            if (reg != Reg::none && in.reads(reg) && ready[(int)reg] > at) at = ready[(int)reg];
+        }
+        if (in.op == Opcode::Syscall) {
+            for (Reg reg : {Reg::v0, Reg::a0}) {
+                if (ready[(int)reg] > at) at = ready[(int)reg];
+            }
+        }
+        if (reads_hilo(in.op) && hilo_ready > at) at = hilo_ready;
+        uint64_t stall = at - cycle - 1;
+        stalls += stall;
+        cycle = at + issue_slots(in) - 1;
+
+        Reg def = in.def();
+        if (def != Reg::none && def != Reg::zero) ready[(int)def] = cycle + result_latency(in.op);
+        if (writes_hilo(in.op)) hilo_ready = cycle + result_latency(in.op);
+        return stall;
+    }
+
+    // A taken branch or jump: the instruction fetched after it is thrown away, one lost cycle
+    void redirect() {
+        ++cycle;
+        ++stalls;
+    }
+
+    // Total cycles of the instructions issued so far
+    uint64_t cycles() const { return cycle == 0 ? 0 : cycle + pipeline_fill; }
+};
+
+// Stall cycles of running code straight through, from a pipeline with every value ready
+inline uint64_t estimate_stalls(const std::vector<Instr>& code) {
+    PipelineModel model;
+    for (const Instr& in : code) model.issue(in);
+    return model.stalls;
+}
+
+#endif // PIPELINE_H
@@ -0,0 +1,214 @@
+#ifndef REGALLOC_H
+#define REGALLOC_H
+
+#include <algorithm>
+#include <cstdint>
+
+#include "ast.h"
+#include "mips.h"
+
+// Sethi–Ullman labelling: stores in every node the number of registers needed to evaluate
+// its subtree without spilling. Evaluating the needier operand first keeps pressure minimal.
+inline int label_register_need(Expr* expr) {
+    if (expr->kind != ExprKind::Binary) {
+        expr->reg_need = 1;
+        return 1;
+    }
+    auto* bin = static_cast<BinaryExpr*>(expr);
+    int l = label_register_need(bin->lhs);
+    int r = label_register_need(bin->rhs);
+    int need = l == r ? l + 1 : std::max(l, r);
+    expr->reg_need = (uint16_t)std::min(need, 0xFFFF);
+    return need;
+}
+
+// Labels every expression of the program
+inline void label_register_need(Program& program) {
+    for (Stmt* stmt : program.statements) {
+        switch (stmt->kind) {
+            case StmtKind::Declaration: {
+                Expr* init = static_cast<DeclarationStmt*>(stmt)->init;
+                if (init != nullptr) label_register_need(init);
+                break;
+            }
+            case StmtKind::Assignment:
+                label_register_need(static_cast<AssignmentStmt*>(stmt)->value);
+                break;
+            case StmtKind::Return: {
+                Expr* value = static_cast<ReturnStmt*>(stmt)->value;
+                if (value != nullptr) label_register_need(value);
+                break;
+            }
+            case StmtKind::If:
+            case StmtKind::While:
+            case StmtKind::Function:
+            case StmtKind::Block:  // control flow only compiles through the IR (lower.h)
+            case StmtKind::Error:
+                break;
+        }
+    }
+}
+
+// Pool of registers handed out for expression evaluation: $t0..$t9 first, then $s0..$s7.
+// A register is either free, a temporary owned by the expression being generated, or the cached
+// home of a variable (register caching) or of a value computed earlier (value numbering). Cached registers can be pinned while an expression
+// reads them; unpinned ones may be evicted when the pool runs dry.
+// The pool itself never fails silently, callers check available_count() and spill when it runs low.
+class RegisterAllocator {
+private:
+    static constexpr Reg pool[] = {
+        Reg::t0, Reg::t1, Reg::t2, Reg::t3, Reg::t4, Reg::t5, Reg::t6, Reg::t7, Reg::t8, Reg::t9,
+        Reg::s0, Reg::s1, Reg::s2, Reg::s3, Reg::s4, Reg::s5, Reg::s6, Reg::s7,
+    };
+    static constexpr int pool_size = sizeof(pool) / sizeof(pool[0]);
+
+    uint32_t free_mask;    // bit i set when pool[i] is free
+    uint32_t used_mask;    // bit i set once pool[i] has been handed out
+    uint32_t cached_mask;  // bit i set when pool[i] holds a variable
+    int owner[pool_size];  // what pool[i] caches: a variable (negative stack offset) or a value number
+    uint16_t pins[pool_size];
+
+    static int pool_index(Reg reg) {
+        for (int i = 0; i < pool_size; ++i) {
+            if (pool[i] == reg) return i;
+        }
+        return -1;
+    }
+
+    uint32_t evictable_mask() const {
+        uint32_t mask = 0;
+        for (uint32_t m = cached_mask; m != 0; m &= m - 1) {
+            int i = __builtin_ctz(m);
+            if (pins[i] == 0) mask |= 1u << i;
+        }
+        return mask;
+    }
+
+public:
+    RegisterAllocator() : free_mask((1u << pool_size) - 1), used_mask(0), cached_mask(0), owner(), pins() {}
+
+    static int size() { return pool_size; }
+
+    // Register i of the pool, in the order alloc() hands them out
+    static Reg pool_register(int i) { return pool[i]; }
+
+    int free_count() const { return __builtin_popcount(free_mask); }
+
+    // Free registers plus cached ones that could be evicted right now
+    int available_count() const { return free_count() + __builtin_popcount(evictable_mask()); }
+
+    bool is_free(Reg reg) const {
+        int i = pool_index(reg);
+        return i >= 0 && (free_mask >> i & 1);
+    }
+
+    // Lowest free register in pool order, Reg::none when everything is taken
+    Reg alloc() {
+        if (free_mask == 0) return Reg::none;
+        int i = __builtin_ctz(free_mask);
+        free_mask &= ~(1u << i);
+        used_mask |= 1u << i;
+        return pool[i];
+    }
+
+    // Takes a free register out of the pool for good, alloc() never hands it out again
+    void reserve(Reg reg) {
+        int i = pool_index(reg);
+        free_mask &= ~(1u << i);
+        used_mask |= 1u << i;
+    }
+
+    void release(Reg reg) {
+        int i = pool_index(reg);
+        if (i < 0) return;
+        free_mask |= 1u << i;
+        cached_mask &= ~(1u << i);
+        pins[i] = 0;
+    }
+
+    // Makes an allocated register the home of a variable
+    void bind(Reg reg, int var) {
+        int i = pool_index(reg);
+        cached_mask |= 1u << i;
+        owner[i] = var;
+    }
+
+    // Turns a cached register back into a plain temporary
+    void unbind(Reg reg) {
+        int i = pool_index(reg);
+        if (i < 0) return;
+        cached_mask &= ~(1u << i);
+        pins[i] = 0;
+    }
+
+    void pin(Reg reg) {
+        int i = pool_index(reg);
+        if (i >= 0) ++pins[i];
+    }
+
+    void unpin(Reg reg) {
+        int i = pool_index(reg);
+        if (i >= 0 && pins[i] > 0) --pins[i];
+    }
+
+    int pin_count(Reg reg) const {
+        int i = pool_index(reg);
+        return i >= 0 ? pins[i] : 0;
+    }
+
+    // Unpinned cached register whose variable is needed furthest in the future (Belady),
+    // next_use(var) returns the distance to the next use. Reg::none when nothing can be evicted.
+    template <typename NextUse>
+    Reg pick_victim(NextUse&& next_use) const {
+        Reg victim = Reg::none;
+        uint64_t best = 0;
+        for (uint32_t m = evictable_mask(); m != 0; m &= m - 1) {
+            int i = __builtin_ctz(m);
+            uint64_t distance = next_use(owner[i]);
+            if (victim == Reg::none || distance > best) {
+                victim = pool[i];
+                best = distance;
+            }
+        }
+        return victim;
+    }
+
+    // Every register currently caching a variable, as (register, variable) pairs
+    template <typename Visit>
+    void for_each_cached(Visit&& visit) const {
+        for (uint32_t m = cached_mask; m != 0; m &= m - 1) {
+            int i = __builtin_ctz(m);
+            visit(pool[i], owner[i]);
+        }
+    }
+
+    // Number of distinct registers handed out so far
+    int used_count() const { return __builtin_popcount(used_mask); }
+
+    // The complete pool state, so incremental recompilation can put it back without generating
+    // the code that led to it. owner is only meaningful for cached registers.
+    struct Snapshot {
+        uint32_t free_mask;
+        uint32_t used_mask;
+        uint32_t cached_mask;
+        int owner[pool_size];
+        uint16_t pins[pool_size];
+    };
+
+    Snapshot snapshot() const {
+        Snapshot state{free_mask, used_mask, cached_mask, {}, {}};
+        std::copy(owner, owner + pool_size, state.owner);
+        std::copy(pins, pins + pool_size, state.pins);
+        return state;
+    }
+
+    void restore(const Snapshot& state) {
+        free_mask = state.free_mask;
+        used_mask = state.used_mask;
+        cached_mask = state.cached_mask;
+        std::copy(state.owner, state.owner + pool_size, owner);
+        std::copy(state.pins, state.pins + pool_size, pins);
+    }
+};
+
+#endif // REGALLOC_H
@@ -0,0 +1,237 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <cstdint>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+
+#include "instr.h"
+#include "pipeline.h"
+#include "strength.h"
+
+// List scheduler over the instruction list. Within a basic block (labels, branches, directives,
+// syscalls and changes of $fp/$sp end one) instructions are reordered so that independent work fills the gap
+// between a load, mul, mult or div and the instruction consuming its result. Dependences are the
+// register ones (read after write, write after read, write after write, hi/lo counting as one more
+// register, and an access past 16-bit offsets writing $at, which the assembler expands it through)
+// and the memory ones between accesses of the same stack word. Comments move together
+// with the instruction after them. A block keeps its order unless the new one stalls less in the
+// pipeline model (pipeline.h).
+class InstructionScheduler {
+private:
+    static constexpr int hilo = 32;  // hi/lo in the register dependence tables
+
+    struct Node {
+        size_t first;          // first comment in front of the instruction, or the instruction
+        size_t index;          // the instruction
+        uint32_t predecessors = 0;
+        uint64_t earliest = 0; // cycle from which its operands are ready
+        uint64_t height = 0;   // latency-weighted length of the longest dependence chain it starts
+    };
+
+    struct Edge {
+        uint32_t from;
+        uint32_t to;
+        uint32_t latency;
+    };
+
+    // Accesses of one stack word since the block started
+    struct WordAccess {
+        uint32_t store = UINT32_MAX;  // last store
+        std::vector<uint32_t> loads;  // loads since it
+    };
+
+    std::vector<Instr>* code = nullptr;
+    std::vector<Node> nodes;               // of the current block
+    std::vector<Edge> edges;
+    std::vector<uint32_t> successor_begin;  // edges sorted by from, CSR offsets
+    std::vector<Edge> successors;
+    uint32_t last_def[33];                 // node that last wrote each register
+    std::vector<uint32_t> readers[33];     // readers of each register since its last write
+    std::unordered_map<int64_t, WordAccess> words;
+    std::vector<Instr> scheduled;
+
+    static bool is_barrier(const Instr& in) {
+        switch (in.op) {
+            case Opcode::Label: case Opcode::Directive: case Opcode::Syscall:
+                return true;
+            default:
+                break;
+        }
+        if (is_branch(in.op)) return true;
+        Reg def = in.def();
+        if (def == Reg::fp || def == Reg::sp) return true;
+        // Only accesses relative to the frame are told apart, anything else keeps its place
+        return (is_load(in.op) || is_store(in.op)) && in.rs != Reg::fp && in.rs != Reg::sp;
+    }
+
+    void depend(uint32_t from, uint32_t to, uint64_t latency) {
+        if (from != UINT32_MAX) edges.push_back(Edge{from, to, (uint32_t)latency});
+    }
+
+    void read(int reg, uint32_t node) {
+        if (last_def[reg] != UINT32_MAX) {
+            const Instr& def = code_at(last_def[reg]);
+            depend(last_def[reg], node, result_latency(def.op));
+        }
+        readers[reg].push_back(node);
+    }
+
+    void write(int reg, uint32_t node) {
+        depend(last_def[reg], node, 1);
+        for (uint32_t reader : readers[reg]) {
+            if (reader != node) depend(reader, node, 1);
+        }
+        readers[reg].clear();
+        last_def[reg] = node;
+    }
+
+    const Instr& code_at(uint32_t node) const { return (*code)[nodes[node].index]; }
+
+    void add_dependences(uint32_t node) {
+        const Instr& in = code_at(node);
+        for (Reg reg : {in.rs, in.rt}) {
+            if (reg != Reg::none && reg != Reg::zero && in.reads(reg)) read((int)reg, node);
+        }
+        if (reads_hilo(in.op)) read(hilo, node);
+        Reg def = in.def();
+        if (def != Reg::none && def != Reg::zero) write((int)def, node);
+        if (writes_hilo(in.op)) write(hilo, node);
+
+        if (is_load(in.op) || is_store(in.op)) {
+            if (!fits_immediate(in.imm)) write((int)Reg::at, node);
+            // Accesses are naturally aligned, only ones within the same word can overlap
+            int64_t key = (int64_t)in.rs << 32 | (uint32_t)(in.imm & ~3);
+            WordAccess& word = words[key];
+            depend(word.store, node, 1);
+            if (is_load(in.op)) {
+                word.loads.push_back(node);
+            } else {
+                for (uint32_t load : word.loads) depend(load, node, 1);
+                word.loads.clear();
+                word.store = node;
+            }
+        }
+    }
+
+    // Schedules the block's nodes into scheduled, comments in front of their instruction
+    void schedule_block() {
+        std::vector<Instr>& c = *code;
+        uint32_t count = (uint32_t)nodes.size();
+        for (uint32_t& def : last_def) def = UINT32_MAX;
+        for (std::vector<uint32_t>& list : readers) list.clear();
+        words.clear();
+        edges.clear();
+        for (uint32_t node = 0; node < count; ++node) add_dependences(node);
+
+        successor_begin.assign(count + 1, 0);
+        for (const Edge& edge : edges) {
+            ++successor_begin[edge.from + 1];
+            ++nodes[edge.to].predecessors;
+        }
+        for (uint32_t node = 0; node < count; ++node) successor_begin[node + 1] += successor_begin[node];
+        successors.resize(edges.size());
+        std::vector<uint32_t> fill(successor_begin.begin(), successor_begin.end() - 1);
+        for (const Edge& edge : edges) successors[fill[edge.from]++] = edge;
+
+        // Edges point forward, so one backward sweep gives every height
+        for (uint32_t node = count; node-- > 0;) {
+            uint64_t height = 0;
+            for (uint32_t e = successor_begin[node]; e < successor_begin[node + 1]; ++e) {
+                uint64_t path = successors[e].latency + nodes[successors[e].to].height;
+                if (path > height) height = path;
+            }
+            nodes[node].height = height;
+        }
+
+        // Nodes whose predecessors are all scheduled wait in waiting until their operands are
+        // ready; of the ready ones the longest chain goes first, then the original order
+        auto later = [this](uint32_t a, uint32_t b) {
+            return nodes[a].earliest != nodes[b].earliest ? nodes[a].earliest > nodes[b].earliest : a > b;
+        };
+        auto lower = [this](uint32_t a, uint32_t b) {
+            return nodes[a].height != nodes[b].height ? nodes[a].height < nodes[b].height : a > b;
+        };
+        std::priority_queue<uint32_t, std::vector<uint32_t>, decltype(later)> waiting(later);
+        std::priority_queue<uint32_t, std::vector<uint32_t>, decltype(lower)> available(lower);
+        for (uint32_t node = 0; node < count; ++node) {
+            if (nodes[node].predecessors == 0) waiting.push(node);
+        }
+
+        std::vector<uint32_t> order;
+        order.reserve(count);
+        uint64_t cycle = 0;
+        while (order.size() < count) {
+            while (!waiting.empty() && nodes[waiting.top()].earliest <= cycle + 1) {
+                available.push(waiting.top());
+                waiting.pop();
+            }
+            if (available.empty()) {
+                available.push(waiting.top());
+                waiting.pop();
+            }
+            uint32_t node = available.top();
+            available.pop();
+            order.push_back(node);
+            uint64_t at = nodes[node].earliest > cycle + 1 ? nodes[node].earliest : cycle + 1;
+            cycle = at + issue_slots(code_at(node)) - 1;
+            for (uint32_t e = successor_begin[node]; e < successor_begin[node + 1]; ++e) {
+                Node& next = nodes[successors[e].to];
+                if (cycle + successors[e].latency > next.earliest) next.earliest = cycle + successors[e].latency;
+                if (--next.predecessors == 0) waiting.push(successors[e].to);
+            }
+        }
+
+        // The new order only pays off when it waits less
+        PipelineModel before, after;
+        for (uint32_t node = 0; node < count; ++node) before.issue(code_at(node));
+        for (uint32_t node : order) after.issue(code_at(node));
+        bool reorder = after.stalls < before.stalls;
+        for (uint32_t i = 0; i < count; ++i) {
+            uint32_t node = reorder ? order[i] : i;
+            if (node != i) ++moved;
+            for (size_t j = nodes[node].first; j <= nodes[node].index; ++j) {
+                if (c[j].op != Opcode::Deleted) scheduled.push_back(c[j]);
+            }
+        }
+        nodes.clear();
+    }
+
+public:
+    uint64_t moved = 0;          // instructions placed elsewhere
+    uint64_t stalls_before = 0;  // estimated stall cycles of the code as generated
+    uint64_t stalls_after = 0;   // and as scheduled
+
+    void run(std::vector<Instr>& instructions) {
+        code = &instructions;
+        std::vector<Instr>& c = instructions;
+        stalls_before = estimate_stalls(c);
+        scheduled.clear();
+        scheduled.reserve(c.size());
+
+        size_t pending = 0;  // first instruction not in a node or the output yet
+        for (size_t i = 0; i < c.size(); ++i) {
+            const Instr& in = c[i];
+            if (in.op == Opcode::Comment || in.op == Opcode::Deleted) continue;
+            if (is_barrier(in)) {
+                schedule_block();
+                for (; pending <= i; ++pending) {
+                    if (c[pending].op != Opcode::Deleted) scheduled.push_back(c[pending]);
+                }
+                continue;
+            }
+            nodes.push_back(Node{pending, i});
+            pending = i + 1;
+        }
+        schedule_block();
+        for (; pending < c.size(); ++pending) {
+            if (c[pending].op != Opcode::Deleted) scheduled.push_back(c[pending]);
+        }
+
+        c.swap(scheduled);
+        stalls_after = estimate_stalls(c);
+    }
+};
+
+#endif // SCHEDULER_H
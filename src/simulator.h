@@ -0,0 +1,457 @@
+#ifndef SIMULATOR_H
+#define SIMULATOR_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "instr.h"
+#include "mips.h"
+#include "pipeline.h"
+
+// MIPS32 interpreter for the subset the compiler emits, so generated code can be checked for
+// correctness and speed without SPIM/MARS. Branches take effect at once, without a delay slot. Assembler reads the text of an output.s back into
+// instructions (the mnemonics print_instructions() writes), Simulator runs them.
+
+inline Reg reg_from_name(std::string_view name) {
+    if (name.size() < 2 || name[0] != '$') return Reg::none;
+    name.remove_prefix(1);
+    if (name[0] >= '0' && name[0] <= '9') {
+        int n = 0;
+        for (char c : name) {
+            if (c < '0' || c > '9') return Reg::none;
+            n = n * 10 + (c - '0');
+            if (n > 31) return Reg::none;
+        }
+        return (Reg)n;
+    }
+    if (name == "s8") return Reg::fp;
+    for (int r = 0; r < 32; ++r) {
+        if (name == reg_name((Reg)r) + 1) return (Reg)r;
+    }
+    return Reg::none;
+}
+
+// Decimal or 0x hexadecimal, optionally negative, must fit in 32 bits (signed or unsigned)
+inline bool parse_immediate(std::string_view text, int32_t& value) {
+    bool negative = !text.empty() && text[0] == '-';
+    if (negative || (!text.empty() && text[0] == '+')) text.remove_prefix(1);
+    int base = 10;
+    if (text.size() > 2 && text[0] == '0' && (text[1] == 'x' || text[1] == 'X')) {
+        base = 16;
+        text.remove_prefix(2);
+    }
+    if (text.empty()) return false;
+    uint64_t magnitude = 0;
+    for (char c : text) {
+        int digit;
+        if (c >= '0' && c <= '9') digit = c - '0';
+        else if (base == 16 && c >= 'a' && c <= 'f') digit = c - 'a' + 10;
+        else if (base == 16 && c >= 'A' && c <= 'F') digit = c - 'A' + 10;
+        else return false;
+        magnitude = magnitude * base + digit;
+        if (magnitude > 0xFFFFFFFFull) return false;
+    }
+    if (negative && magnitude > 0x80000000ull) return false;
+    value = (int32_t)(uint32_t)(negative ? 0 - magnitude : magnitude);
+    return true;
+}
+
+struct AssemblyError {
+    size_t line = 0;
+    std::string message;
+};
+
+// Parses assembly text into program. Labels become Label entries, directives and comments are
+// dropped; lines[i] is the source line of program[i] for error messages.
+class Assembler {
+private:
+    static void split_operands(std::string_view text, std::vector<std::string_view>& out) {
+        out.clear();
+        size_t i = 0;
+        while (i < text.size()) {
+            while (i < text.size() && (text[i] == ' ' || text[i] == '\t' || text[i] == ',')) ++i;
+            size_t start = i;
+            while (i < text.size() && text[i] != ' ' && text[i] != '\t' && text[i] != ',') ++i;
+            if (i > start) out.push_back(text.substr(start, i - start));
+        }
+    }
+
+    static std::string_view trim(std::string_view text) {
+        while (!text.empty() && (text.front() == ' ' || text.front() == '\t')) text.remove_prefix(1);
+        while (!text.empty() && (text.back() == ' ' || text.back() == '\t' || text.back() == '\r')) text.remove_suffix(1);
+        return text;
+    }
+
+    static Opcode opcode_from_name(std::string_view name) {
+        for (int op = 0; op < (int)Opcode::Comment; ++op) {
+            if (name == opcode_name((Opcode)op)) return (Opcode)op;
+        }
+        return Opcode::Deleted;
+    }
+
+    bool fail(std::string message) {
+        error.line = line;
+        error.message = std::move(message);
+        return false;
+    }
+
+    bool reg_operand(std::string_view text, Reg& reg) {
+        reg = reg_from_name(text);
+        return reg != Reg::none || fail("bad register '" + std::string(text) + "'");
+    }
+
+    bool imm_operand(std::string_view text, int32_t& value) {
+        return parse_immediate(text, value) || fail("bad immediate '" + std::string(text) + "'");
+    }
+
+    // "offset($base)"
+    bool address_operand(std::string_view text, int32_t& offset, Reg& base) {
+        size_t open = text.find('(');
+        if (open == std::string_view::npos || text.back() != ')') return fail("bad address '" + std::string(text) + "'");
+        offset = 0;
+        if (open > 0 && !imm_operand(text.substr(0, open), offset)) return false;
+        return reg_operand(text.substr(open + 1, text.size() - open - 2), base);
+    }
+
+    bool instruction(std::string_view text) {
+        size_t space = text.find_first_of(" \t");
+        std::string_view mnemonic = text.substr(0, space);
+        split_operands(space == std::string_view::npos ? std::string_view() : text.substr(space), operands);
+        Instr in{opcode_from_name(mnemonic)};
+        if (in.op == Opcode::Deleted) return fail("unsupported instruction '" + std::string(mnemonic) + "'");
+
+        size_t expected;
+        bool ok;
+        const std::vector<std::string_view>& o = operands;
+        if (is_three_register(in.op)) {
+            expected = 3;
+            ok = o.size() == 3 && reg_operand(o[0], in.rd) && reg_operand(o[1], in.rs) && reg_operand(o[2], in.rt);
+        } else if (is_register_immediate(in.op)) {
+            expected = 3;
+            ok = o.size() == 3 && reg_operand(o[0], in.rd) && reg_operand(o[1], in.rs) && imm_operand(o[2], in.imm);
+        } else {
+            switch (in.op) {
+                case Opcode::Li:
+                    expected = 2;
+                    ok = o.size() == 2 && reg_operand(o[0], in.rd) && imm_operand(o[1], in.imm);
+                    break;
+                case Opcode::Move:
+                    expected = 2;
+                    ok = o.size() == 2 && reg_operand(o[0], in.rd) && reg_operand(o[1], in.rs);
+                    break;
+                case Opcode::Mult:
+                case Opcode::Div:
+                    expected = 2;
+                    ok = o.size() == 2 && reg_operand(o[0], in.rs) && reg_operand(o[1], in.rt);
+                    break;
+                case Opcode::Mflo:
+                case Opcode::Mfhi:
+                    expected = 1;
+                    ok = o.size() == 1 && reg_operand(o[0], in.rd);
+                    break;
+                case Opcode::Lb:
+                case Opcode::Lh:
+                case Opcode::Lw:
+                    expected = 2;
+                    ok = o.size() == 2 && reg_operand(o[0], in.rd) && address_operand(o[1], in.imm, in.rs);
+                    break;
+                case Opcode::Sb:
+                case Opcode::Sh:
+                case Opcode::Sw:
+                    expected = 2;
+                    ok = o.size() == 2 && reg_operand(o[0], in.rt) && address_operand(o[1], in.imm, in.rs);
+                    break;
+                case Opcode::Beq:
+                case Opcode::Bne:
+                    expected = 3;
+                    ok = o.size() == 3 && reg_operand(o[0], in.rs) && reg_operand(o[1], in.rt);
+                    if (ok) in.note = o[2];
+                    break;
+                case Opcode::Bltz:
+                case Opcode::Bgez:
+                case Opcode::Bgtz:
+                case Opcode::Blez:
+                    expected = 2;
+                    ok = o.size() == 2 && reg_operand(o[0], in.rs);
+                    if (ok) in.note = o[1];
+                    break;
+                case Opcode::J:
+                case Opcode::Jal:
+                    expected = 1;
+                    ok = o.size() == 1;
+                    if (ok) in.note = o[0];
+                    break;
+                case Opcode::Jr:
+                    expected = 1;
+                    ok = o.size() == 1 && reg_operand(o[0], in.rs);
+                    break;
+                default:  // syscall
+                    expected = 0;
+                    ok = o.empty();
+                    break;
+            }
+        }
+        if (!ok) {
+            if (error.message.empty()) {
+                return fail(std::string(mnemonic) + " expects " + std::to_string(expected) + " operands");
+            }
+            return false;
+        }
+        program.push_back(in);
+        lines.push_back(line);
+        return true;
+    }
+
+    std::vector<std::string_view> operands;
+
+public:
+    std::vector<Instr> program;
+    std::vector<size_t> lines;  // source line of every entry of program
+    AssemblyError error;
+    size_t line = 0;
+
+    bool run(std::string_view text) {
+        while (!text.empty()) {
+            ++line;
+            size_t end = text.find('\n');
+            std::string_view current = text.substr(0, end);
+            text = end == std::string_view::npos ? std::string_view() : text.substr(end + 1);
+
+            size_t hash = current.find('#');
+            if (hash != std::string_view::npos) current = current.substr(0, hash);
+            current = trim(current);
+            if (current.empty()) continue;
+            size_t colon = current.find(':');
+            if (current[0] == '.' && colon == std::string_view::npos) continue;  // directives carry no code here
+
+            if (colon != std::string_view::npos) {
+                program.push_back(Instr{Opcode::Label, Reg::none, Reg::none, Reg::none, 0, trim(current.substr(0, colon))});
+                lines.push_back(line);
+                current = trim(current.substr(colon + 1));
+                if (current.empty()) continue;
+            }
+            if (!instruction(current)) return false;
+        }
+        return true;
+    }
+};
+
+// Counters of one run. Cycles follow the pipeline model of pipeline.h.
+struct SimulationStats {
+    uint64_t instructions = 0;  // machine instructions, li of a 32-bit constant counts as lui + ori
+    uint64_t loads = 0;
+    uint64_t stores = 0;
+    uint64_t stalls = 0;
+    uint64_t cycles = 0;
+};
+
+class Simulator {
+private:
+    static constexpr uint32_t stack_top = 0x7FFFF000;  // $sp at entry
+    static constexpr uint32_t stack_size = 1u << 20;   // bytes below $sp
+    static constexpr uint32_t stack_base = stack_top - stack_size;
+    static constexpr uint32_t stack_end = stack_top + 4096;  // a little room above $sp
+
+    int32_t regs[32] = {};
+    int32_t hi = 0, lo = 0;
+    std::vector<int32_t> stack;  // words from stack_base to stack_end
+    PipelineModel pipeline;
+    std::unordered_map<std::string_view, size_t> labels;  // index of every label of the program
+
+    bool fail(size_t index, std::string message) {
+        error_index = index;
+        error = std::move(message);
+        return false;
+    }
+
+    // Word holding an access of size bytes, which has to be naturally aligned. Memory is
+    // little-endian: the byte at address sits at bit 8 * (address & 3) of the word.
+    int32_t* word(uint32_t address, uint32_t size = 4) {
+        if ((address & (size - 1)) != 0 || address < stack_base || address >= stack_end) return nullptr;
+        return &stack[(address - stack_base) / 4];
+    }
+
+    int32_t get(Reg reg) const { return regs[(int)reg]; }
+
+    void set(Reg reg, int32_t value) {
+        if (reg != Reg::zero) regs[(int)reg] = value;
+    }
+
+public:
+    SimulationStats stats;
+    std::string output;   // everything the program printed
+    bool exited = false;  // reached syscall 10 (otherwise it ran off the end)
+    uint64_t instruction_limit = 100000000;  // a program running longer is taken to loop forever
+    std::string error;
+    size_t error_index = 0;
+
+    Simulator() : stack((stack_end - stack_base) / 4, 0) {
+        regs[(int)Reg::sp] = (int32_t)stack_top;
+        regs[(int)Reg::fp] = (int32_t)stack_top;
+    }
+
+    int32_t reg(Reg r) const { return regs[(int)r]; }
+
+    // Runs program from the label main (or the first instruction), false on a runtime error
+    bool run(const std::vector<Instr>& program) {
+        for (size_t i = 0; i < program.size(); ++i) {
+            if (program[i].op == Opcode::Label) labels.emplace(program[i].note, i);
+        }
+        for (size_t i = 0; i < program.size(); ++i) {
+            if (is_branch(program[i].op) && program[i].op != Opcode::Jr && labels.count(program[i].note) == 0) {
+                return fail(i, "unknown label '" + std::string(program[i].note) + "'");
+            }
+        }
+        auto entry = labels.find("main");
+        size_t pc = entry == labels.end() ? 0 : entry->second;
+        for (; pc < program.size() && !exited; ++pc) {
+            const Instr& in = program[pc];
+            if (is_pseudo(in.op)) continue;
+            if (stats.instructions >= instruction_limit) return fail(pc, "instruction limit exceeded");
+            pipeline.issue(in);
+            ++stats.instructions;
+            int32_t s = in.rs == Reg::none ? 0 : get(in.rs);
+            int32_t t = in.rt == Reg::none ? 0 : get(in.rt);
+            switch (in.op) {
+                case Opcode::Add: case Opcode::Addu:
+                    set(in.rd, (int32_t)((uint32_t)s + (uint32_t)t));
+                    break;
+                case Opcode::Sub: case Opcode::Subu:
+                    set(in.rd, (int32_t)((uint32_t)s - (uint32_t)t));
+                    break;
+                case Opcode::Mul:
+                    set(in.rd, (int32_t)((uint32_t)s * (uint32_t)t));
+                    break;
+                case Opcode::Slt:
+                    set(in.rd, s < t);
+                    break;
+                case Opcode::Sltu:
+                    set(in.rd, (uint32_t)s < (uint32_t)t);
+                    break;
+                case Opcode::Xor:
+                    set(in.rd, s ^ t);
+                    break;
+                case Opcode::Addiu:
+                    set(in.rd, (int32_t)((uint32_t)s + (uint32_t)in.imm));
+                    break;
+                case Opcode::Slti:
+                    set(in.rd, s < in.imm);
+                    break;
+                case Opcode::Sltiu:  // the immediate is sign-extended, then compared unsigned
+                    set(in.rd, (uint32_t)s < (uint32_t)in.imm);
+                    break;
+                case Opcode::Xori:
+                    set(in.rd, s ^ (int32_t)((uint32_t)in.imm & 0xFFFF));
+                    break;
+                case Opcode::Sll:
+                    set(in.rd, (int32_t)((uint32_t)s << (in.imm & 31)));
+                    break;
+                case Opcode::Sra:
+                    set(in.rd, s >> (in.imm & 31));
+                    break;
+                case Opcode::Srl:
+                    set(in.rd, (int32_t)((uint32_t)s >> (in.imm & 31)));
+                    break;
+                case Opcode::Li:
+                    if (issue_slots(in) == 2) ++stats.instructions;  // lui + ori
+                    set(in.rd, in.imm);
+                    break;
+                case Opcode::Move:
+                    set(in.rd, s);
+                    break;
+                case Opcode::Mult: {
+                    int64_t product = (int64_t)s * t;
+                    lo = (int32_t)product;
+                    hi = (int32_t)(product >> 32);
+                    break;
+                }
+                case Opcode::Div:
+                    if (t == 0) return fail(pc, "division by zero");
+                    if (s == INT32_MIN && t == -1) {
+                        lo = INT32_MIN;
+                        hi = 0;
+                    } else {
+                        lo = s / t;
+                        hi = s % t;
+                    }
+                    break;
+                case Opcode::Mflo:
+                    set(in.rd, lo);
+                    break;
+                case Opcode::Mfhi:
+                    set(in.rd, hi);
+                    break;
+                case Opcode::Lb: case Opcode::Lh: case Opcode::Lw: {
+                    uint32_t address = (uint32_t)s + (uint32_t)in.imm;
+                    uint32_t size = in.op == Opcode::Lb ? 1 : in.op == Opcode::Lh ? 2 : 4;
+                    int32_t* p = word(address, size);
+                    if (p == nullptr) return fail(pc, "bad load address");
+                    ++stats.loads;
+                    // Shift the bytes to the top, the arithmetic shift back sign-extends them
+                    int32_t value = (int32_t)((uint32_t)*p << (32 - 8 * size - 8 * (address & 3)));
+                    set(in.rd, size == 4 ? *p : value >> (32 - 8 * size));
+                    break;
+                }
+                case Opcode::Sb: case Opcode::Sh: case Opcode::Sw: {
+                    uint32_t address = (uint32_t)s + (uint32_t)in.imm;
+                    uint32_t size = in.op == Opcode::Sb ? 1 : in.op == Opcode::Sh ? 2 : 4;
+                    int32_t* p = word(address, size);
+                    if (p == nullptr) return fail(pc, "bad store address");
+                    ++stats.stores;
+                    if (size == 4) {
+                        *p = t;
+                    } else {
+                        int shift = 8 * (address & 3);
+                        uint32_t mask = ((1u << 8 * size) - 1) << shift;
+                        *p = (int32_t)(((uint32_t)*p & ~mask) | ((uint32_t)t << shift & mask));
+                    }
+                    break;
+                }
+                case Opcode::Beq: case Opcode::Bne: case Opcode::Bltz: case Opcode::Bgez:
+                case Opcode::Bgtz: case Opcode::Blez: case Opcode::J: {
+                    bool taken = in.op == Opcode::Beq ? s == t : in.op == Opcode::Bne ? s != t :
+                                 in.op == Opcode::Bltz ? s < 0 : in.op == Opcode::Bgez ? s >= 0 :
+                                 in.op == Opcode::Bgtz ? s > 0 : in.op == Opcode::Blez ? s <= 0 : true;
+                    if (taken) {
+                        pipeline.redirect();
+                        pc = labels.find(in.note)->second;  // the label, the loop steps past it
+                    }
+                    break;
+                }
+                // Code addresses are instruction indices: $ra holds the index jr continues at
+                case Opcode::Jal:
+                    pipeline.redirect();
+                    set(Reg::ra, (int32_t)(pc + 1));
+                    pc = labels.find(in.note)->second;
+                    break;
+                case Opcode::Jr:
+                    if (s < 0 || (size_t)s > program.size()) return fail(pc, "bad jump address");
+                    pipeline.redirect();
+                    pc = (size_t)s - 1;
+                    break;
+                case Opcode::Syscall:
+                    switch (get(Reg::v0)) {
+                        case 1:
+                            output += std::to_string(get(Reg::a0));
+                            break;
+                        case 10:
+                            exited = true;
+                            break;
+                        default:
+                            return fail(pc, "unsupported syscall " + std::to_string(get(Reg::v0)));
+                    }
+                    break;
+                default:
+                    break;
+            }
+        }
+        stats.stalls = pipeline.stalls;
+        stats.cycles = pipeline.cycles();
+        return true;
+    }
+};
+
+#endif // SIMULATOR_H
@@ -0,0 +1,50 @@
+#ifndef SPSC_H
+#define SPSC_H
+
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <utility>
+
+// Bounded queue between exactly one producer thread and one consumer thread, the link between two
+// stages of the --pipeline mode. Lock-free: the producer only advances tail, the consumer only
+// head, each reads the other's index to see whether there is room or data. A stage finding the
+// queue full or empty yields, the stages on both ends run at the same rate anyway.
+template <typename T, size_t Capacity>
+class SpscQueue {
+    static_assert(Capacity != 0 && (Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+
+private:
+    T slots[Capacity];
+    alignas(64) std::atomic<size_t> head{0};  // next slot to pop
+    alignas(64) std::atomic<size_t> tail{0};  // next slot to push
+
+public:
+    bool try_push(T& value) {
+        size_t at = tail.load(std::memory_order_relaxed);
+        if (at - head.load(std::memory_order_acquire) == Capacity) return false;
+        slots[at & (Capacity - 1)] = std::move(value);
+        tail.store(at + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool try_pop(T& value) {
+        size_t at = head.load(std::memory_order_relaxed);
+        if (at == tail.load(std::memory_order_acquire)) return false;
+        value = std::move(slots[at & (Capacity - 1)]);
+        head.store(at + 1, std::memory_order_release);
+        return true;
+    }
+
+    void push(T value) {
+        while (!try_push(value)) std::this_thread::yield();
+    }
+
+    T pop() {
+        T value;
+        while (!try_pop(value)) std::this_thread::yield();
+        return value;
+    }
+};
+
+#endif // SPSC_H
@@ -0,0 +1,92 @@
+#ifndef STRENGTH_H
+#define STRENGTH_H
+
+#include <cstdint>
+
+// Strength reduction helpers: cheaper instruction sequences for operations with a constant operand.
+// The code generator (emit_reduced in compilerlab1.cpp) emits them; everything here is pure arithmetic.
+
+inline bool fits_immediate(int64_t value) {
+    return value >= INT16_MIN && value <= INT16_MAX;
+}
+
+inline bool is_power_of_two(uint32_t value) {
+    return value != 0 && (value & (value - 1)) == 0;
+}
+
+inline int log2_exact(uint32_t value) {
+    return __builtin_ctz(value);
+}
+
+// x * c as at most two shifts and an add/sub: |c| = 2^high (+|-) 2^low, negated when c < 0.
+// low < 0 means a single shift.
+struct ShiftPlan {
+    int high;
+    int low;
+    bool subtract;
+    bool negate;
+};
+
+inline bool plan_multiply(int32_t c, ShiftPlan& plan) {
+    uint32_t m = c < 0 ? 0u - (uint32_t)c : (uint32_t)c;
+    plan.negate = c < 0;
+    if (m < 2) return false;  // 0 and 1 are folded away before code generation
+    if (is_power_of_two(m)) {
+        plan = ShiftPlan{log2_exact(m), -1, false, c < 0};
+        return true;
+    }
+    // 2^a + 2^b: exactly two bits set
+    uint32_t rest = m & (m - 1);
+    if (is_power_of_two(rest)) {
+        plan = ShiftPlan{log2_exact(rest), log2_exact(m), false, c < 0};
+        return true;
+    }
+    // 2^a - 2^b: one contiguous run of ones, e.g. 7 = 8 - 1
+    uint32_t low_bit = m & (0u - m);
+    uint32_t top = m + low_bit;
+    if (top != 0 && is_power_of_two(top)) {
+        plan = ShiftPlan{log2_exact(top), log2_exact(low_bit), true, c < 0};
+        return true;
+    }
+    return false;
+}
+
+// Signed division by a constant d (|d| >= 2, not a power of two) as a multiply-high:
+// q = hi(x * magic), corrected by +-x, shifted right by shift, plus one when negative
+// (Hacker's Delight, chapter 10).
+struct DivisionMagic {
+    int32_t magic;
+    int shift;
+};
+
+inline DivisionMagic signed_division_magic(int32_t d) {
+    const uint32_t two31 = 0x80000000u;
+    uint32_t ad = d < 0 ? 0u - (uint32_t)d : (uint32_t)d;
+    uint32_t t = two31 + ((uint32_t)d >> 31);
+    uint32_t anc = t - 1 - t % ad;  // absolute value of nc
+    int p = 31;
+    uint32_t q1 = two31 / anc, r1 = two31 - q1 * anc;
+    uint32_t q2 = two31 / ad, r2 = two31 - q2 * ad;
+    uint32_t delta;
+    do {
+        ++p;
+        q1 *= 2;
+        r1 *= 2;
+        if (r1 >= anc) {
+            ++q1;
+            r1 -= anc;
+        }
+        q2 *= 2;
+        r2 *= 2;
+        if (r2 >= ad) {
+            ++q2;
+            r2 -= ad;
+        }
+        delta = ad - r2;
+    } while (q1 < delta || (q1 == delta && r1 == 0));
+    int32_t magic = (int32_t)(q2 + 1);
+    if (d < 0) magic = (int32_t)(0u - (uint32_t)magic);
+    return DivisionMagic{magic, p - 32};
+}
+
+#endif // STRENGTH_H
@@ -0,0 +1,110 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ostream>
+#include <vector>
+
+// Heap allocations, counted by the global operator new of the compiler driver (compilerlab1.cpp)
+// into the account of the allocating thread. Programs that do not replace it simply report zero.
+struct HeapAccount {
+    std::atomic<uint64_t> allocations{0};
+    std::atomic<uint64_t> bytes{0};
+};
+
+inline thread_local HeapAccount thread_heap;
+inline thread_local HeapAccount* heap_account = &thread_heap;
+
+// Charges the allocations of the current thread to another account while it lives: the helper
+// threads of --pipeline and --parse-threads work for the thread that started them
+class HeapCharge {
+private:
+    HeapAccount* previous;
+
+public:
+    explicit HeapCharge(HeapAccount* account) : previous(heap_account) { heap_account = account; }
+    HeapCharge(const HeapCharge&) = delete;
+    HeapCharge& operator=(const HeapCharge&) = delete;
+    ~HeapCharge() { heap_account = previous; }
+};
+
+// Wall time per compiler phase for --time-passes. lap() charges the time and heap allocations
+// since the previous lap to the named phase, together with the number of work items the phase
+// handled (tokens, statements, instructions). The allocations are those of the account of the
+// thread that made the timer, helper threads included. The report starts every line with
+// "name seconds", which the benchmark tool (bench.cpp) parses.
+class PhaseTimer {
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Phase {
+        const char* name;
+        double seconds;
+        uint64_t items;
+        uint64_t allocations;
+        uint64_t bytes;
+    };
+
+    std::vector<Phase> phases;
+    HeapAccount* account;
+    Clock::time_point last;
+    uint64_t last_allocations;
+    uint64_t last_bytes;
+
+public:
+    PhaseTimer()
+        : account(heap_account), last(Clock::now()), last_allocations(account->allocations.load()),
+          last_bytes(account->bytes.load()) {}
+
+    void lap(const char* name, uint64_t items = 1) {
+        Clock::time_point now = Clock::now();
+        double seconds = std::chrono::duration<double>(now - last).count();
+        uint64_t heap_allocations = account->allocations.load();
+        uint64_t heap_bytes = account->bytes.load();
+        uint64_t allocations = heap_allocations - last_allocations;
+        uint64_t bytes = heap_bytes - last_bytes;
+        last = now;
+        last_allocations = heap_allocations;
+        last_bytes = heap_bytes;
+        for (Phase& phase : phases) {
+            if (std::strcmp(phase.name, name) == 0) {
+                phase.seconds += seconds;
+                phase.items += items;
+                phase.allocations += allocations;
+                phase.bytes += bytes;
+                return;
+            }
+        }
+        phases.push_back(Phase{name, seconds, items, allocations, bytes});
+    }
+
+    double total() const {
+        double sum = 0;
+        for (const Phase& phase : phases) sum += phase.seconds;
+        return sum;
+    }
+
+    void report(std::ostream& out) const {
+        double sum = total();
+        uint64_t allocations = 0, bytes = 0;
+        char line[128];
+        out << "phase              seconds       %      items     allocs        bytes\n";
+        for (const Phase& phase : phases) {
+            std::snprintf(line, sizeof(line), "%-16s %10.6f %6.1f %10llu %10llu %12llu\n", phase.name, phase.seconds,
+                          sum > 0 ? 100.0 * phase.seconds / sum : 0.0, (unsigned long long)phase.items,
+                          (unsigned long long)phase.allocations, (unsigned long long)phase.bytes);
+            out << line;
+            allocations += phase.allocations;
+            bytes += phase.bytes;
+        }
+        std::snprintf(line, sizeof(line), "%-16s %10.6f %6.1f %10s %10llu %12llu\n", "total", sum, 100.0, "",
+                      (unsigned long long)allocations, (unsigned long long)bytes);
+        out << line;
+    }
+};
+
+#endif // TIMING_H
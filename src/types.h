@@ -0,0 +1,47 @@
+#ifndef TYPES_H
+#define TYPES_H
+
+#include <cstdint>
+
+// Value types of declared variables. Arithmetic is done in 32-bit registers whatever the types;
+// a variable keeps the value narrowed to its own type: char and short are sign-extended from
+// their low 8 and 16 bits, long long holds the sign extension of the 32-bit result in its high word.
+enum class ValueType : uint8_t { Char, Short, Int, LongLong };
+
+// Bytes taken in the stack frame, which is also the natural alignment
+inline int type_size(ValueType type) {
+    switch (type) {
+        case ValueType::Char: return 1;
+        case ValueType::Short: return 2;
+        case ValueType::Int: return 4;
+        case ValueType::LongLong: return 8;
+    }
+    return 4;
+}
+
+inline const char* type_name(ValueType type) {
+    switch (type) {
+        case ValueType::Char: return "char";
+        case ValueType::Short: return "short";
+        case ValueType::Int: return "int";
+        case ValueType::LongLong: return "long long";
+    }
+    return "?";
+}
+
+// True when every value of from is a value of to, so assigning it needs no narrowing.
+// Registers hold 32 bits, so int and long long take any value.
+inline bool fits_type(ValueType from, ValueType to) {
+    return type_size(to) >= 4 || type_size(from) <= type_size(to);
+}
+
+// The value a variable of the type holds after being assigned value
+inline int32_t narrow(int32_t value, ValueType type) {
+    switch (type) {
+        case ValueType::Char: return (int8_t)(uint8_t)value;
+        case ValueType::Short: return (int16_t)(uint16_t)value;
+        default: return value;
+    }
+}
+
+#endif // TYPES_H
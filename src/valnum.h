@@ -0,0 +1,183 @@
+#ifndef VALNUM_H
+#define VALNUM_H
+
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "ast.h"
+
+// Open-addressing table from operation keys to value numbers, key 0 marks an empty slot.
+// The numbering pass does one lookup per operation of the program, node-based maps were the bottleneck.
+class OperationTable {
+private:
+    struct Slot {
+        uint64_t key;
+        uint32_t value;
+    };
+    std::vector<Slot> slots;
+    size_t count = 0;
+
+    static size_t hash(uint64_t key) {
+        key ^= key >> 33;
+        key *= 0xff51afd7ed558ccdull;
+        key ^= key >> 33;
+        return (size_t)key;
+    }
+
+    void grow() {
+        std::vector<Slot> old(slots.empty() ? 1024 : slots.size() * 2, Slot{0, 0});
+        old.swap(slots);
+        for (const Slot& slot : old) {
+            if (slot.key != 0) insert_new(slot.key, slot.value);
+        }
+    }
+
+    Slot& insert_new(uint64_t key, uint32_t value) {
+        size_t mask = slots.size() - 1;
+        size_t i = hash(key) & mask;
+        while (slots[i].key != 0) i = (i + 1) & mask;
+        slots[i] = Slot{key, value};
+        return slots[i];
+    }
+
+public:
+    void reserve(size_t n) {
+        size_t size = 1024;
+        while (size < n * 2) size *= 2;
+        if (count == 0 && size > slots.size()) slots.assign(size, Slot{0, 0});
+    }
+
+    // Value number stored under key, or value inserted for it first
+    uint32_t find_or_insert(uint64_t key, uint32_t value, bool& inserted) {
+        if ((count + 1) * 2 > slots.size()) grow();
+        size_t mask = slots.size() - 1;
+        for (size_t i = hash(key) & mask;; i = (i + 1) & mask) {
+            if (slots[i].key == key) {
+                inserted = false;
+                return slots[i].value;
+            }
+            if (slots[i].key == 0) {
+                slots[i] = Slot{key, value};
+                ++count;
+                inserted = true;
+                return value;
+            }
+        }
+    }
+
+    // Replaces the value stored under a key that is in the table
+    void assign(uint64_t key, uint32_t value) {
+        size_t mask = slots.size() - 1;
+        size_t i = hash(key) & mask;
+        while (slots[i].key != key) i = (i + 1) & mask;
+        slots[i].value = value;
+    }
+};
+
+// Local value numbering over the straight-line program. Every expression node gets a number such
+// that two nodes with the same number are guaranteed to compute the same value: constants are
+// numbered by value, a variable read by the variable's current version (every assignment starts a
+// new one) and an operation by its operator and operand numbers, + and * ignoring operand order.
+// The code generator keeps operations whose number comes up again in a register and reuses them.
+class ValueNumbering {
+private:
+    uint32_t next_number;
+    std::unordered_map<int32_t, uint32_t> constants;
+    std::vector<uint32_t> versions;                           // current number by symbol id, 0 before the first
+    OperationTable operations;                                // keyed by operator and operand numbers
+    std::vector<std::pair<uint32_t, uint32_t>> computed;      // (number, statement) of every operation
+
+    uint32_t version_of(uint32_t symbol) {
+        if (versions[symbol] == 0) versions[symbol] = next_number++;
+        return versions[symbol];
+    }
+
+    uint32_t number(Expr* expr, uint32_t index) {
+        switch (expr->kind) {
+            case ExprKind::Constant: {
+                auto [it, inserted] = constants.try_emplace(static_cast<ConstantExpr*>(expr)->value, next_number);
+                if (inserted) ++next_number;
+                return expr->value_number = it->second;
+            }
+            case ExprKind::Variable:
+                return expr->value_number = version_of(static_cast<VariableExpr*>(expr)->symbol);
+            case ExprKind::Binary: {
+                auto* bin = static_cast<BinaryExpr*>(expr);
+                uint32_t l = number(bin->lhs, index);
+                uint32_t r = number(bin->rhs, index);
+                if ((bin->op == BinaryOp::Add || bin->op == BinaryOp::Mul) && l > r) std::swap(l, r);
+                uint64_t key = (uint64_t)bin->op << 62 | (uint64_t)l << 31 | r;  // numbers stay below 2^31
+                bool inserted;
+                uint32_t value_number = operations.find_or_insert(key, next_number, inserted);
+                if (inserted) ++next_number;
+                expr->value_number = value_number;
+                if (occurrences.size() <= value_number) occurrences.resize(value_number + 1);
+                ++occurrences[value_number];
+                computed.push_back({value_number, index});
+                return value_number;
+            }
+            case ExprKind::Call:  // calls only compile through the IR (lower.h)
+                break;
+        }
+        return 0;
+    }
+
+    // Every assignment, even one the code generator will reject, makes old values of the variable stale
+    void assign(uint32_t symbol) {
+        versions[symbol] = next_number++;
+    }
+
+public:
+    std::vector<uint32_t> occurrences;                               // operations per value number
+    std::unordered_map<uint32_t, std::vector<uint32_t>> positions;  // statements needing a reused value
+
+    ValueNumbering() : next_number(1) {}
+
+    // True when more than one operation computes the value
+    bool reused(uint32_t value_number) const {
+        return value_number < occurrences.size() && occurrences[value_number] > 1;
+    }
+
+    void run(Program& program) {
+        operations.reserve(program.statements.size() * 2);
+        versions.assign(program.symbols, 0);
+        for (uint32_t i = 0; i < program.statements.size(); ++i) {
+            Stmt* stmt = program.statements[i];
+            switch (stmt->kind) {
+                case StmtKind::Declaration: {
+                    auto* decl = static_cast<DeclarationStmt*>(stmt);
+                    if (decl->init != nullptr) number(decl->init, i);
+                    assign(decl->symbol);
+                    break;
+                }
+                case StmtKind::Assignment: {
+                    auto* assign_stmt = static_cast<AssignmentStmt*>(stmt);
+                    number(assign_stmt->value, i);
+                    assign(assign_stmt->symbol);
+                    break;
+                }
+                case StmtKind::Return: {
+                    Expr* value = static_cast<ReturnStmt*>(stmt)->value;
+                    if (value != nullptr) number(value, i);
+                    break;
+                }
+                case StmtKind::If:
+                case StmtKind::While:
+                case StmtKind::Function:
+                case StmtKind::Block:  // control flow only compiles through the IR (lower.h)
+                case StmtKind::Error:
+                    break;
+            }
+        }
+        for (const auto& [value_number, index] : computed) {
+            if (!reused(value_number)) continue;
+            std::vector<uint32_t>& at = positions[value_number];
+            if (at.empty() || at.back() != index) at.push_back(index);
+        }
+        computed.clear();
+    }
+};
+
+#endif // VALNUM_H
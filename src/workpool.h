@@ -0,0 +1,94 @@
+#ifndef WORKPOOL_H
+#define WORKPOOL_H
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Runs job(i) for every i in [0, count) on a fixed number of threads. Each worker owns a range of
+// the indices and takes work from its front; a worker whose range runs dry steals the back half
+// of the largest remaining range. Compilation units differ a lot in size, so a static split
+// would leave threads idle behind one big file. No work is added while running, so a worker
+// that finds nothing to steal is done.
+class WorkStealingPool {
+private:
+    struct Queue {
+        std::mutex lock;
+        size_t begin = 0;
+        size_t end = 0;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;
+
+    bool pop(Queue& queue, size_t& index) {
+        std::lock_guard<std::mutex> guard(queue.lock);
+        if (queue.begin == queue.end) return false;
+        index = queue.begin++;
+        return true;
+    }
+
+    // Moves the back half of the fullest other queue into own, false when all are empty
+    bool steal(size_t thief) {
+        for (;;) {
+            size_t victim = thief;
+            size_t most = 0;
+            for (size_t q = 0; q < queues.size(); ++q) {
+                if (q == thief) continue;
+                std::lock_guard<std::mutex> guard(queues[q]->lock);
+                size_t left = queues[q]->end - queues[q]->begin;
+                if (left > most) {
+                    most = left;
+                    victim = q;
+                }
+            }
+            if (victim == thief) return false;
+
+            size_t begin, end;
+            {
+                std::lock_guard<std::mutex> guard(queues[victim]->lock);
+                Queue& from = *queues[victim];
+                size_t left = from.end - from.begin;
+                if (left == 0) continue;  // emptied meanwhile, look again
+                end = from.end;
+                from.end -= (left + 1) / 2;
+                begin = from.end;
+            }
+            std::lock_guard<std::mutex> guard(queues[thief]->lock);
+            queues[thief]->begin = begin;
+            queues[thief]->end = end;
+            return true;
+        }
+    }
+
+    template <typename Job>
+    void work(size_t id, Job& job) {
+        size_t index;
+        for (;;) {
+            while (pop(*queues[id], index)) job(index);
+            if (!steal(id)) return;
+        }
+    }
+
+public:
+    template <typename Job>
+    void run(size_t count, unsigned threads, Job job) {
+        if (threads == 0) threads = 1;
+        if (threads > count) threads = count == 0 ? 1 : (unsigned)count;
+        queues.clear();
+        for (unsigned t = 0; t < threads; ++t) {
+            queues.push_back(std::make_unique<Queue>());
+            queues.back()->begin = count * t / threads;
+            queues.back()->end = count * (t + 1) / threads;
+        }
+        std::vector<std::thread> workers;
+        for (unsigned t = 1; t < threads; ++t) {
+            workers.emplace_back([this, t, &job] { work(t, job); });
+        }
+        work(0, job);  // the calling thread is worker 0
+        for (std::thread& worker : workers) worker.join();
+    }
+};
+
+#endif // WORKPOOL_H